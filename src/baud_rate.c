@@ -0,0 +1,328 @@
+/*
+   baud_rate.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: ELM327 serial baud rate negotiation.
+
+                The interpreter starts at 9600 baud, which limits a CAN
+                vehicle to a few samples per second. ATBRD hh switches the
+                interpreter to 4000000 / hh baud:
+
+                1. Host sends "ATBRD 23\r", the interpreter replies "OK"
+                   at the old rate, or '?' if it cannot switch.
+                2. Host and interpreter switch to the new rate and the
+                   interpreter sends its ID string, "ELM327 v1.5".
+                3. Host replies with a carriage return within the ATBRT
+                   time, the interpreter keeps the new rate and sends the
+                   prompt. Otherwise it goes back to the old rate.
+
+                Faster rates are tried in turn until one fails. Each rate
+                is checked with ATI before it is kept. The best rate for
+                each adapter is saved in ADAPTER_BAUD_FILE and tried first
+                the next time the server starts.
+
+                ATZ returns the interpreter to its default rate, use ATWS
+                to reset the interpreter after the rate has been changed.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "obd_monitor.h"
+#include "rs232.h"
+#include "elm_parser.h"
+#include "baud_rate.h"
+
+/* Rates the ELM327 can reach with ATBRD that are also standard host rates. */
+const int elm_baud_rates[] = { 38400, 57600, 115200, 230400, 500000, 0 };
+
+ADAPTER_LOCAL int link_baud_rate = ELM_DEFAULT_BAUD_RATE;
+
+/* ADAPTER_BAUD_FILE is shared by the adapter threads. */
+pthread_mutex_t baud_file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int get_link_baud_rate()
+{
+   return(link_baud_rate);
+}
+
+int get_baud_divisor(int baud_rate)
+{
+   return((4000000 + (baud_rate / 2)) / baud_rate);
+}
+
+/*
+   Function: read_elm_text()
+
+   Purpose : Reads from the interpreter until a string arrives. Control
+           : codes are stored as '!', the '>' prompt ends the read.
+   Input   : Serial port number, reply buffer, string to wait for, ">" for
+           : the prompt, and timeout in milliseconds.
+   Output  : Returns 1 if the string arrived, 0 on the prompt without the
+           : string or -1 on timeout.
+*/
+int read_elm_text(int serial_port, char *reply, char *text, int timeout_ms)
+{
+   ELM_Parser parser;
+   struct pollfd pfd;
+   unsigned char in_buf[MAX_SERIAL_BUF_LEN];
+   long long deadline, remaining;
+   int n, result = -1;
+
+   init_elm_parser(&parser, NULL);
+   pfd.fd = RS232_GetFileDescriptor(serial_port);
+   pfd.events = POLLIN;
+   deadline = get_monotonic_ms() + timeout_ms;
+
+   while ((remaining = deadline - get_monotonic_ms()) > 0)
+   {
+      pfd.revents = 0;
+      if (poll(&pfd, 1, (int)remaining) < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         break;
+      }
+
+      while ((n = RS232_PollComport(serial_port, in_buf, MAX_SERIAL_BUF_LEN)) > 0)
+      {
+         feed_elm_parser(&parser, in_buf, n);
+      }
+
+      if (strstr(parser.reply, text) != NULL)
+      {
+         result = 1;
+         break;
+      }
+      if (parser.reply_status & ELM_REPLY_PROMPT)
+      {
+         result = (strcmp(text, ">") == 0);
+         break;
+      }
+   }
+
+   memcpy(reply, parser.reply, parser.reply_len + 1);
+
+   return(result);
+}
+
+int elm_exchange(int serial_port, char *query, char *reply)
+{
+   RS232_flushRX(serial_port);
+   RS232_SendBuf(serial_port, (unsigned char *)query, strlen(query));
+
+   return(read_elm_text(serial_port, reply, ">", ELM_AT_TIMEOUT_MS));
+}
+
+/*
+   Function: try_baud_rate()
+
+   Purpose : Switches the interpreter and the serial port to a new rate
+           : with ATBRD and checks the link with ATI.
+   Input   : Serial port number and the new baud rate.
+   Output  : Returns 1 if the new rate is in use, 0 if the link is still
+           : at the old rate.
+*/
+int try_baud_rate(int serial_port, int new_baud_rate)
+{
+   char query[16];
+   char reply[MAX_BUFFER_LEN];
+   char *id_string;
+
+   sprintf(query, "ATBRD %.2X\r", get_baud_divisor(new_baud_rate));
+   RS232_flushRX(serial_port);
+   RS232_SendBuf(serial_port, (unsigned char *)query, strlen(query));
+
+   if (read_elm_text(serial_port, reply, "OK", ELM_AT_TIMEOUT_MS) != 1)
+   {
+      printf("try_baud_rate(): %i baud not supported: %s\n", new_baud_rate, reply);
+      read_elm_text(serial_port, reply, ">", ELM_AT_TIMEOUT_MS);
+      return(0);
+   }
+
+   if (RS232_SetBaudrate(serial_port, new_baud_rate) != 0)
+   {
+      /* The interpreter goes back to the old rate when no carriage return arrives. */
+      read_elm_text(serial_port, reply, ">", ELM_BAUD_SWITCH_TIMEOUT_MS + ELM_AT_TIMEOUT_MS);
+      return(0);
+   }
+
+   /* Wait for the whole ID string, it ends with a carriage return. */
+   if ((read_elm_text(serial_port, reply, "ELM", ELM_BAUD_SWITCH_TIMEOUT_MS) == 1) &&
+       ((id_string = strstr(reply, "ELM")) != NULL) &&
+       ((strchr(id_string, '!') != NULL) || (read_elm_text(serial_port, reply, "!", ELM_BAUD_SWITCH_TIMEOUT_MS) == 1)))
+   {
+      RS232_SendBuf(serial_port, (unsigned char *)"\r", 1);
+
+      if ((read_elm_text(serial_port, reply, ">", ELM_AT_TIMEOUT_MS) == 1) &&
+          (elm_exchange(serial_port, "ATI\r", reply) == 1) && (strstr(reply, "ELM") != NULL))
+      {
+         printf("try_baud_rate(): Link at %i baud.\n", new_baud_rate);
+         link_baud_rate = new_baud_rate;
+         return(1);
+      }
+   }
+
+   printf("try_baud_rate(): No reply at %i baud, back to %i baud.\n", new_baud_rate, link_baud_rate);
+   RS232_SetBaudrate(serial_port, link_baud_rate);
+   read_elm_text(serial_port, reply, ">", ELM_BAUD_SWITCH_TIMEOUT_MS + ELM_AT_TIMEOUT_MS);
+   RS232_flushRX(serial_port);
+
+   return(0);
+}
+
+/*
+   Function: load_adapter_baud_rate()
+
+   Purpose : Gets the saved baud rate of an adapter, one "id=rate" line
+           : per adapter in ADAPTER_BAUD_FILE.
+   Input   : Adapter ID, serial port name and ATI string.
+   Output  : Returns the saved rate or 0 if there is none.
+*/
+int load_adapter_baud_rate(char *adapter_id)
+{
+   FILE *baud_file;
+   char line[MAX_ADAPTER_ID_LEN + 32];
+   char *sep;
+   int baud_rate = 0;
+
+   pthread_mutex_lock(&baud_file_lock);
+   baud_file = fopen(ADAPTER_BAUD_FILE, "r");
+   if (baud_file == NULL)
+   {
+      pthread_mutex_unlock(&baud_file_lock);
+      return(0);
+   }
+
+   while (fgets(line, sizeof(line), baud_file) != NULL)
+   {
+      sep = strrchr(line, '=');
+      if (sep == NULL)
+         continue;
+      *sep = 0;
+      if (strcmp(line, adapter_id) == 0)
+      {
+         baud_rate = atoi(sep + 1);
+         break;
+      }
+   }
+
+   fclose(baud_file);
+   pthread_mutex_unlock(&baud_file_lock);
+
+   return(baud_rate);
+}
+
+int save_adapter_baud_rate(char *adapter_id, int baud_rate)
+{
+   FILE *baud_file;
+   char adapter_list[MAX_SAVED_ADAPTERS][MAX_ADAPTER_ID_LEN];
+   int rate_list[MAX_SAVED_ADAPTERS];
+   char line[MAX_ADAPTER_ID_LEN + 32];
+   char *sep;
+   int ii, count = 0;
+
+   pthread_mutex_lock(&baud_file_lock);
+   baud_file = fopen(ADAPTER_BAUD_FILE, "r");
+   if (baud_file != NULL)
+   {
+      while ((count < MAX_SAVED_ADAPTERS - 1) && (fgets(line, sizeof(line), baud_file) != NULL))
+      {
+         sep = strrchr(line, '=');
+         if (sep == NULL)
+            continue;
+         *sep = 0;
+         if (strcmp(line, adapter_id) == 0)
+            continue;
+         strncpy(adapter_list[count], line, MAX_ADAPTER_ID_LEN - 1);
+         adapter_list[count][MAX_ADAPTER_ID_LEN - 1] = 0;
+         rate_list[count++] = atoi(sep + 1);
+      }
+      fclose(baud_file);
+   }
+
+   strncpy(adapter_list[count], adapter_id, MAX_ADAPTER_ID_LEN - 1);
+   adapter_list[count][MAX_ADAPTER_ID_LEN - 1] = 0;
+   rate_list[count++] = baud_rate;
+
+   baud_file = fopen(ADAPTER_BAUD_FILE, "w");
+   if (baud_file == NULL)
+   {
+      printf("save_adapter_baud_rate() <ERROR>: Could not open %s\n", ADAPTER_BAUD_FILE);
+      pthread_mutex_unlock(&baud_file_lock);
+      return(-1);
+   }
+
+   for (ii = 0; ii < count; ii++)
+   {
+      fprintf(baud_file, "%s=%i\n", adapter_list[ii], rate_list[ii]);
+   }
+
+   fclose(baud_file);
+   pthread_mutex_unlock(&baud_file_lock);
+
+   return(count);
+}
+
+/*
+   Function: negotiate_baud_rate()
+
+   Purpose : Moves the link to the fastest rate the adapter accepts. The
+           : saved rate for the adapter is tried first, then each faster
+           : rate in turn until one fails.
+   Input   : Serial port number and serial port name.
+   Output  : Returns the baud rate in use.
+*/
+int negotiate_baud_rate(int serial_port, char *interface_name)
+{
+   char reply[MAX_BUFFER_LEN];
+   char adapter_id[MAX_ADAPTER_ID_LEN];
+   char *id_string;
+   int saved_rate, ii;
+
+   /* The adapter is known by its port and ID string, the echo is still on. */
+   if (elm_exchange(serial_port, "ATI\r", reply) != 1)
+   {
+      return(link_baud_rate);
+   }
+
+   id_string = strstr(reply, "ELM");
+   if (id_string == NULL)
+      id_string = reply;
+   id_string[strcspn(id_string, "!>")] = 0;
+   snprintf(adapter_id, MAX_ADAPTER_ID_LEN, "%.32s %.64s", interface_name, id_string);
+
+   saved_rate = load_adapter_baud_rate(adapter_id);
+   if ((saved_rate > link_baud_rate) && (try_baud_rate(serial_port, saved_rate) == 1))
+   {
+      return(link_baud_rate);
+   }
+
+   for (ii = 0; elm_baud_rates[ii] != 0; ii++)
+   {
+      if (elm_baud_rates[ii] <= link_baud_rate)
+         continue;
+      if (try_baud_rate(serial_port, elm_baud_rates[ii]) == 0)
+         break;
+   }
+
+   if (link_baud_rate != saved_rate)
+   {
+      save_adapter_baud_rate(adapter_id, link_baud_rate);
+   }
+
+   printf("negotiate_baud_rate(): %s at %i baud.\n", adapter_id, link_baud_rate);
+
+   return(link_baud_rate);
+}
+
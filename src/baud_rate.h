@@ -0,0 +1,32 @@
+/*
+   baud_rate.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: ELM327 serial baud rate negotiation with ATBRD.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_BAUD_RATE_INCLUDED
+#define OBD_BAUD_RATE_INCLUDED
+
+#define ELM_DEFAULT_BAUD_RATE 9600
+#define ELM_BAUD_SWITCH_TIMEOUT_MS 250   /* ATBRT default is 75 ms, allow for the ID string. */
+#define MAX_ADAPTER_ID_LEN 128
+#define MAX_SAVED_ADAPTERS 16
+#define ADAPTER_BAUD_FILE "obd_adapter_baud.txt"
+
+/* baud_rate.c */
+int get_link_baud_rate();
+int get_baud_divisor(int baud_rate);
+int load_adapter_baud_rate(char *adapter_id);
+int save_adapter_baud_rate(char *adapter_id, int baud_rate);
+int try_baud_rate(int serial_port, int new_baud_rate);
+int negotiate_baud_rate(int serial_port, char *interface_name);
+
+#endif
+
@@ -0,0 +1,235 @@
+/*
+   binary_clients.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Clients that get ECU replies in the binary wire format or
+                as decoded text.
+
+                FORMAT BIN
+                FORMAT UNITS
+                FORMAT TEXT
+
+                After "FORMAT BIN\r" the Mode 01 replies for the client are
+                scaled and held until the end of the event loop pass, then
+                sent as one datagram (see wire_protocol.c). A multi-PID
+                reply or several polled PIDs cost the client one datagram
+                instead of one per PID. Everything else is sent as text.
+
+                After "FORMAT UNITS\r" replies the server can decode are
+                sent as text in engineering units, "01 0C 1726.00 rpm",
+                see obd_decoder.c.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "obd_monitor.h"
+#include "binary_clients.h"
+#include "obd_decoder.h"
+#include "udp_batch.h"
+
+ADAPTER_LOCAL Binary_Client binary_client_list[MAX_BINARY_CLIENTS];
+ADAPTER_LOCAL int binary_client_count;
+
+void init_binary_clients()
+{
+   memset(binary_client_list, 0, sizeof(binary_client_list));
+   binary_client_count = 0;
+
+   return;
+}
+
+Binary_Client *find_binary_client(Client_Address *client)
+{
+   int ii;
+
+   if (binary_client_count == 0)
+   {
+      return(NULL);
+   }
+
+   for (ii = 0; ii < MAX_BINARY_CLIENTS; ii++)
+   {
+      if ((binary_client_list[ii].in_use == 1) && same_client(&binary_client_list[ii].client, client))
+      {
+         return(&binary_client_list[ii]);
+      }
+   }
+
+   return(NULL);
+}
+
+int send_wire_samples(Binary_Client *bc)
+{
+   unsigned char out_buf[MAX_WIRE_DATAGRAM_LEN];
+   int len;
+
+   len = encode_wire_datagram(out_buf, MAX_WIRE_DATAGRAM_LEN, bc->sequence, bc->samples, bc->sample_count);
+   bc->sample_count = 0;
+   if (len == 0)
+   {
+      return(0);
+   }
+
+   bc->sequence++;
+
+   return(send_client_msg(&bc->client, out_buf, len));
+}
+
+/*
+   Function: parse_format_request()
+
+   Purpose : Parses a FORMAT message from a client.
+   Input   : Client request.
+   Output  : Returns 1, or -1 on a bad message or a full client list.
+*/
+int parse_format_request(ECU_Request *client_req)
+{
+   Binary_Client *bc;
+   int ii, format;
+
+   bc = find_binary_client(&client_req->from_client);
+
+   if (strncmp(client_req->ecu_query, "FORMAT TEXT", 11) == 0)
+   {
+      if (bc != NULL)
+      {
+         bc->in_use = 0;
+         binary_client_count--;
+      }
+      return(1);
+   }
+
+   if (strncmp(client_req->ecu_query, "FORMAT BIN", 10) == 0)
+      format = CLIENT_FORMAT_BINARY;
+   else if (strncmp(client_req->ecu_query, "FORMAT UNITS", 12) == 0)
+      format = CLIENT_FORMAT_UNITS;
+   else
+      return(-1);
+
+   if (bc != NULL)
+   {
+      bc->format = format;
+      bc->sample_count = 0;
+      return(1);
+   }
+
+   for (ii = 0; ii < MAX_BINARY_CLIENTS; ii++)
+   {
+      if (binary_client_list[ii].in_use == 0)
+      {
+         memset(&binary_client_list[ii], 0, sizeof(Binary_Client));
+         binary_client_list[ii].in_use = 1;
+         binary_client_list[ii].client = client_req->from_client;
+         binary_client_list[ii].format = format;
+         binary_client_count++;
+         return(1);
+      }
+   }
+
+   printf("parse_format_request() <ERROR>: Binary client list is full.\n");
+
+   return(-1);
+}
+
+/*
+   Function: send_client_data()
+
+   Purpose : Sends an ECU reply to one client, as text, as decoded text or
+           : as a sample in the next binary datagram for the client. Replies to requests
+           : with an ID are always text with the ID in front, the binary
+           : samples have no room for it.
+   Input   : Client address, request ID or 0, ECU reply and reply length.
+   Output  : Returns the reply length if sent or held, otherwise the
+           : send_client_msg() result.
+*/
+int send_client_data(Client_Address *client, unsigned int request_id, char *ecu_reply, int reply_len)
+{
+   char id_reply[MAX_UDP_MSG_LEN];
+   char units_reply[MAX_UNITS_REPLY_LEN];
+   Binary_Client *bc;
+   int len;
+
+   if (request_id != 0)
+   {
+      len = snprintf(id_reply, MAX_UDP_MSG_LEN, "ID %X %.*s", request_id, reply_len, ecu_reply);
+      if (len >= MAX_UDP_MSG_LEN)
+         len = MAX_UDP_MSG_LEN - 1;
+      return(send_client_msg(client, id_reply, len));
+   }
+
+   bc = find_binary_client(client);
+   if ((bc != NULL) && (bc->format == CLIENT_FORMAT_UNITS))
+   {
+      len = get_units_reply(ecu_reply, units_reply, MAX_UNITS_REPLY_LEN);
+      if (len > 0)
+         return(send_client_msg(client, units_reply, len));
+   }
+   else if ((bc != NULL) && (get_wire_sample(ecu_reply, get_monotonic_ms(), &bc->samples[bc->sample_count]) == 1))
+   {
+      bc->sample_count++;
+      if (bc->sample_count >= MAX_WIRE_SAMPLES)
+         send_wire_samples(bc);
+      return(reply_len);
+   }
+
+   return(send_client_msg(client, ecu_reply, reply_len));
+}
+
+/*
+   Function: flush_binary_clients()
+
+   Purpose : Sends the samples held for each binary client, called at the
+           : end of each event loop pass.
+   Input   : None.
+   Output  : Returns the number of datagrams sent.
+*/
+int flush_binary_clients()
+{
+   int ii, count = 0;
+
+   if (binary_client_count == 0)
+   {
+      return(0);
+   }
+
+   for (ii = 0; ii < MAX_BINARY_CLIENTS; ii++)
+   {
+      if ((binary_client_list[ii].in_use == 1) && (binary_client_list[ii].sample_count > 0))
+      {
+         if (send_wire_samples(&binary_client_list[ii]) > 0)
+            count++;
+      }
+   }
+
+   return(count);
+}
+
+int remove_binary_client(Client_Address *client)
+{
+   Binary_Client *bc;
+
+   bc = find_binary_client(client);
+   if (bc == NULL)
+   {
+      return(0);
+   }
+
+   bc->in_use = 0;
+   binary_client_count--;
+
+   return(1);
+}
+
+int get_binary_client_count()
+{
+   return(binary_client_count);
+}
+
@@ -0,0 +1,45 @@
+/*
+   binary_clients.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Clients that get ECU replies in the binary wire format or
+                as decoded text. Used by the server event loop.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_BINARY_CLIENTS_INCLUDED
+#define OBD_BINARY_CLIENTS_INCLUDED
+
+#include "request_queue.h"
+#include "wire_protocol.h"
+
+#define MAX_BINARY_CLIENTS 32
+#define CLIENT_FORMAT_BINARY 1   /* FORMAT BIN, see wire_protocol.c. */
+#define CLIENT_FORMAT_UNITS 2    /* FORMAT UNITS, see obd_decoder.c. */
+
+struct _Binary_Client {
+   int in_use;
+   Client_Address client;
+   int format;
+   unsigned int sequence;
+   int sample_count;
+   Wire_Sample samples[MAX_WIRE_SAMPLES];
+};
+
+typedef struct _Binary_Client Binary_Client;
+
+/* binary_clients.c */
+void init_binary_clients();
+int parse_format_request(ECU_Request *client_req);
+int send_client_data(Client_Address *client, unsigned int request_id, char *ecu_reply, int reply_len);
+int flush_binary_clients();
+int remove_binary_client(Client_Address *client);
+int get_binary_client_count();
+
+#endif
+
@@ -17,6 +17,8 @@
       Name: "String"
       Description: "String"
       Formula: "String"
+      Data_Bytes: "String"
+      Units: "String"
       Minumum_Value: "String"
       Maximum_Value: "String"
    
@@ -28,6 +30,10 @@
    
    }
 
+   ID_Number is the mode and PID in hex, "22115C", the formula is of the
+   data bytes A, B, C and D, see custom_pid.c. Data_Bytes is 1 if it is
+   not set. See resources/custom_pids.txt.
+
    DTC Data Format:
    
    Manufacturer_DTC_List {
@@ -51,11 +57,13 @@
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "obd_monitor.h"
 #include "protocols.h"
 #include "pid_hash_map.h"
 #include "dtc_hash_map.h"
+#include "config.h"
 
 FILE *config_file;
 
@@ -89,6 +97,86 @@ int get_custom_pid(int pid_num)
    return(0);
 }
 
+/* Sets the PID field of one line of a PID_Entry. */
+static void set_pid_entry_value(PID_Parameters *pid, char *key, char *value)
+{
+   if (strcmp(key, "ID_Number") == 0)
+      strncpy(pid->pid_code, value, sizeof(pid->pid_code) - 1);
+   else if (strcmp(key, "Name") == 0)
+      strncpy(pid->pid_gauge_label, value, sizeof(pid->pid_gauge_label) - 1);
+   else if (strcmp(key, "Description") == 0)
+      strncpy(pid->pid_description, value, sizeof(pid->pid_description) - 1);
+   else if (strcmp(key, "Formula") == 0)
+      strncpy(pid->pid_formula, value, sizeof(pid->pid_formula) - 1);
+   else if (strcmp(key, "Units") == 0)
+      strncpy(pid->pid_units, value, sizeof(pid->pid_units) - 1);
+   else if (strcmp(key, "Data_Bytes") == 0)
+      pid->pid_data_bytes = atoi(value);
+
+   /* Minumum_Value and Maximum_Value are gauge settings. */
+
+   return;
+}
+
+/*
+   Function: read_custom_pid_file()
+
+   Purpose : Reads the PID_Entry records of a manufacturer PID file.
+   Input   : File name, PID list and the size of the list.
+   Output  : Returns the number of PIDs read, -1 if the file does not
+           : open. Entries without an ID_Number or a Formula are skipped.
+*/
+int read_custom_pid_file(char *pid_file_name, PID_Parameters *pid_list, int max_pids)
+{
+   FILE *pid_file;
+   PID_Parameters *pid = NULL;
+   char line[512];
+   char key[64];
+   char value[256];
+   int pid_count = 0;
+
+   pid_file = fopen(pid_file_name, "r");
+   if (pid_file == NULL)
+   {
+      return(-1);
+   }
+
+   while (fgets(line, sizeof(line), pid_file) != NULL)
+   {
+      if (strstr(line, "PID_Entry") != NULL)
+      {
+         if (pid_count >= max_pids)
+         {
+            printf("read_custom_pid_file() <ERROR>: More than %i PIDs in %s.\n", max_pids, pid_file_name);
+            break;
+         }
+         pid = &pid_list[pid_count];
+         memset(pid, 0, sizeof(PID_Parameters));
+         pid->pid_data_bytes = 1;
+      }
+      else if (pid == NULL)
+      {
+         continue; /* Manufacturer_PID_List or a blank line. */
+      }
+      else if (sscanf(line, " %63[A-Za-z_]: \"%255[^\"]\"", key, value) == 2)
+      {
+         set_pid_entry_value(pid, key, value);
+      }
+      else if (strchr(line, '}') != NULL)
+      {
+         if ((pid->pid_code[0] != 0) && (pid->pid_formula[0] != 0))
+            pid_count++;
+         else
+            printf("read_custom_pid_file() <ERROR>: PID_Entry without an ID_Number or a Formula in %s.\n", pid_file_name);
+         pid = NULL;
+      }
+   }
+
+   fclose(pid_file);
+
+   return(pid_count);
+}
+
 
 int get_config_item()
 {
@@ -28,6 +28,7 @@ typedef struct _ConfigOptions ConfigOptions;
 int load_configuration_file(char *config_file);
 int load_custom_pid_list();
 int get_custom_pid(int pid_num);
+int read_custom_pid_file(char *pid_file_name, PID_Parameters *pid_list, int max_pids);
 
 
 #endif
@@ -0,0 +1,269 @@
+/*
+   custom_pid.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Manufacturer PIDs defined by a formula of the data bytes.
+
+                Mode 01 PIDs are scaled from the PID table (pid_table.c),
+                manufacturer PIDs outside SAE J1979 have a formula string
+                instead, as in the scan tool apps:
+
+                [PID]    [Data Bytes] [Formula]        [Units] [Description]
+                 22115C   1            (A*.65)-17.5     psi     Oil Pressure (GM)
+
+                A, B, C and D are the data bytes. Each formula is compiled
+                with te_compile() when the PID is added, with the byte
+                variables bound to the PID record, then lowered to flat
+                bytecode with te_compile_program(). A sample only sets the
+                variables and runs the bytecode, which gives the same
+                result as te_eval() without walking the tree. Formulas
+                are never parsed again.
+
+                The PIDs are read from custom_pids.txt in the server
+                directory, in the config.c PID_Entry format, see
+                resources/custom_pids.txt. The GM oil pressure PID is
+                built in and is used unless the file defines 22115C.
+
+                The records are per adapter thread, the bound variables
+                are written for every sample.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "obd_monitor.h"
+#include "tinyexpr.h"
+#include "pid_table.h"
+#include "custom_pid.h"
+#include "config.h"
+
+struct _Custom_PID_Entry {
+   char *pid_code;
+   unsigned int data_bytes;
+   char *formula;
+   char *units;
+   char *description;
+};
+
+/* Built-in manufacturer PIDs. The oil pressure formula in
+   resources/oil-pressure.txt is (A*.065)-17.5, that is below zero for
+   every byte, so the scale is .65. */
+static const struct _Custom_PID_Entry builtin_pids[] = {
+   { "22115C", 1, "(A*.65)-17.5", "psi", "Oil Pressure (GM)" },
+   { NULL, 0, NULL, NULL, NULL }
+};
+
+ADAPTER_LOCAL PID_Parameters custom_pids[MAX_CUSTOM_PIDS];
+ADAPTER_LOCAL int custom_pid_count;
+
+/* Loaded PID with the code, "22115C" or "22115c", or NULL. */
+static PID_Parameters *find_custom_pid_code(char *pid_code)
+{
+   unsigned char code_bytes[4];
+   int code_len;
+
+   code_len = get_hex_bytes(pid_code, code_bytes, 4);
+   if ((code_len < 2) || (code_len > 3))
+   {
+      return(NULL);
+   }
+
+   return(find_custom_pid(code_bytes[0], (code_len == 3) ? ((code_bytes[1] << 8) | code_bytes[2]) : code_bytes[1]));
+}
+
+/*
+   Function: load_custom_pids()
+
+   Purpose : Adds the manufacturer PIDs and compiles their formulas, called
+           : by each adapter thread before it decodes replies. The PID
+           : file is optional, the built-in PIDs fill in the codes it
+           : does not define.
+   Input   : Nothing.
+   Output  : Returns the number of PIDs loaded.
+*/
+int load_custom_pids()
+{
+   int ii;
+
+   free_custom_pids();
+
+   load_custom_pid_file(DEFAULT_CUSTOM_PID_FILE);
+
+   for (ii = 0; builtin_pids[ii].pid_code != NULL; ii++)
+   {
+      if (find_custom_pid_code(builtin_pids[ii].pid_code) != NULL)
+         continue;
+
+      add_custom_pid(builtin_pids[ii].pid_code, builtin_pids[ii].data_bytes, builtin_pids[ii].formula,
+                     builtin_pids[ii].units, builtin_pids[ii].description);
+   }
+
+   return(custom_pid_count);
+}
+
+/*
+   Function: load_custom_pid_file()
+
+   Purpose : Adds the PIDs of a PID file, see read_custom_pid_file().
+   Input   : File name.
+   Output  : Returns the number of PIDs added, -1 if the file does not
+           : open.
+*/
+int load_custom_pid_file(char *pid_file_name)
+{
+   PID_Parameters *pid_list;
+   int ii, pid_count, added = 0;
+
+   pid_list = (PID_Parameters *) xmalloc(sizeof(PID_Parameters) * MAX_CUSTOM_PIDS);
+
+   pid_count = read_custom_pid_file(pid_file_name, pid_list, MAX_CUSTOM_PIDS);
+   for (ii = 0; ii < pid_count; ii++)
+   {
+      added += add_custom_pid(pid_list[ii].pid_code, pid_list[ii].pid_data_bytes, pid_list[ii].pid_formula,
+                              pid_list[ii].pid_units, pid_list[ii].pid_description);
+   }
+
+   free(pid_list);
+
+   return((pid_count < 0) ? -1 : added);
+}
+
+void free_custom_pids()
+{
+   int ii;
+
+   for (ii = 0; ii < custom_pid_count; ii++)
+   {
+      te_free_program(custom_pids[ii].pid_program);
+      te_free(custom_pids[ii].pid_expr);
+   }
+   memset(custom_pids, 0, sizeof(custom_pids));
+   custom_pid_count = 0;
+
+   return;
+}
+
+/*
+   Function: add_custom_pid()
+
+   Purpose : Adds a PID and compiles its formula.
+   Input   : PID code, mode then PID in hex, "22115C", number of data
+           : bytes, formula of A, B, C and D, units and description.
+   Output  : Returns 1, 0 if the code or the formula is not valid or the
+           : table is full.
+*/
+int add_custom_pid(char *pid_code, unsigned int data_bytes, char *formula, char *units, char *description)
+{
+   PID_Parameters *pid;
+   te_variable vars[MAX_CUSTOM_PID_VARS];
+   char var_names[MAX_CUSTOM_PID_VARS][2];
+   char expression[256];
+   unsigned char code_bytes[4];
+   int ii, code_len, error;
+
+   if (custom_pid_count >= MAX_CUSTOM_PIDS)
+   {
+      printf("add_custom_pid() <ERROR>: No room for PID %s.\n", pid_code);
+      return(0);
+   }
+
+   code_len = get_hex_bytes(pid_code, code_bytes, 4);
+   if ((code_len < 2) || (code_len > 3) || (strlen(pid_code) != code_len * 2) || (data_bytes > MAX_CUSTOM_PID_VARS))
+   {
+      printf("add_custom_pid() <ERROR>: Invalid PID %s.\n", pid_code);
+      return(0);
+   }
+
+   pid = &custom_pids[custom_pid_count];
+   memset(pid, 0, sizeof(PID_Parameters));
+   strncpy(pid->pid_code, pid_code, sizeof(pid->pid_code) - 1);
+   strncpy(pid->pid_formula, formula, sizeof(pid->pid_formula) - 1);
+   strncpy(pid->pid_units, units, sizeof(pid->pid_units) - 1);
+   strncpy(pid->pid_description, description, sizeof(pid->pid_description) - 1);
+   pid->pid_mode = code_bytes[0];
+   pid->pid_num = (code_len == 3) ? ((code_bytes[1] << 8) | code_bytes[2]) : code_bytes[1];
+   pid->pid_data_bytes = data_bytes;
+
+   /* tinyexpr names are lower case, the formulas use A, B, C and D. */
+   for (ii = 0; (formula[ii] != 0) && (ii < sizeof(expression) - 1); ii++)
+      expression[ii] = tolower((unsigned char)formula[ii]);
+   expression[ii] = 0;
+
+   for (ii = 0; ii < MAX_CUSTOM_PID_VARS; ii++)
+   {
+      var_names[ii][0] = 'a' + ii;
+      var_names[ii][1] = 0;
+      vars[ii].name = var_names[ii];
+      vars[ii].address = &pid->pid_vars[ii];
+      vars[ii].type = TE_VARIABLE;
+      vars[ii].context = NULL;
+   }
+
+   /* The names are only used while compiling. */
+   pid->pid_expr = te_compile(expression, vars, MAX_CUSTOM_PID_VARS, &error);
+   if (pid->pid_expr == NULL)
+   {
+      printf("add_custom_pid() <ERROR>: PID %s formula %s, error at character %i.\n", pid_code, formula, error);
+      return(0);
+   }
+
+   /* NULL if the formula is too deep, te_eval() is used then. */
+   pid->pid_program = te_compile_program(pid->pid_expr);
+
+   custom_pid_count++;
+
+   return(1);
+}
+
+PID_Parameters *find_custom_pid(unsigned int pid_mode, unsigned int pid_num)
+{
+   int ii;
+
+   for (ii = 0; ii < custom_pid_count; ii++)
+   {
+      if ((custom_pids[ii].pid_mode == pid_mode) && (custom_pids[ii].pid_num == pid_num))
+         return(&custom_pids[ii]);
+   }
+
+   return(NULL);
+}
+
+/*
+   Function: get_custom_pid_value()
+
+   Purpose : Evaluates the compiled formula of a PID for one sample.
+   Input   : PID, data bytes after the PID and the number of bytes.
+   Output  : Returns 1 and sets the value, 0 if there are too few bytes.
+*/
+int get_custom_pid_value(PID_Parameters *pid, unsigned char *data, int data_len, double *value)
+{
+   int ii;
+
+   if (data_len < (int)pid->pid_data_bytes)
+   {
+      return(0);
+   }
+
+   for (ii = 0; ii < MAX_CUSTOM_PID_VARS; ii++)
+      pid->pid_vars[ii] = (ii < pid->pid_data_bytes) ? data[ii] : 0.0;
+
+   if (pid->pid_program != NULL)
+      *value = te_eval_program(pid->pid_program);
+   else
+      *value = te_eval(pid->pid_expr);
+
+   return(1);
+}
+
+int get_custom_pid_count()
+{
+   return(custom_pid_count);
+}
@@ -0,0 +1,35 @@
+/*
+   custom_pid.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Manufacturer PIDs with formulas, such as the GM Mode 22
+                oil pressure, compiled once with tinyexpr. Used by the
+                server decoder.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_CUSTOM_PID_INCLUDED
+#define OBD_CUSTOM_PID_INCLUDED
+
+#include "protocols.h"
+
+#define MAX_CUSTOM_PIDS 32
+#define MAX_CUSTOM_PID_VARS 4    /* Data bytes A, B, C and D. */
+#define DEFAULT_CUSTOM_PID_FILE "./custom_pids.txt"
+
+/* custom_pid.c */
+int load_custom_pids();
+int load_custom_pid_file(char *pid_file_name);
+void free_custom_pids();
+int add_custom_pid(char *pid_code, unsigned int data_bytes, char *formula, char *units, char *description);
+PID_Parameters *find_custom_pid(unsigned int pid_mode, unsigned int pid_num);
+int get_custom_pid_value(PID_Parameters *pid, unsigned char *data, int data_len, double *value);
+int get_custom_pid_count();
+
+#endif
+
@@ -10,6 +10,11 @@
  
    Usage: ./ecu_sim [udp port]
 
+   The simulator also takes the server POLL and UNPOLL messages, so the
+   GUI gauges work without a server: "POLL 250 01 0C 0D\r" sends the RPM
+   and speed replies every 250 milliseconds until the client sends
+   UNPOLL or stops renewing the POLL for POLL_LEASE_MS.
+
    Selected ECU Mode 01 Parameters: 
    
    [PID] [Data Bytes] [Min Value] [Max Value] [Formula]           [Description]
@@ -47,12 +52,29 @@
 #include <netdb.h>
 #include <stdio.h>
 #include <time.h>
+#include <poll.h>
 
 #include "obd_monitor.h"
 #include "protocols.h"
 #include "rs232.h"
+#include "elm_parser.h"
+#include "udp_batch.h"
 
 #define BUFFER_LEN 512
+#define MAX_SIM_POLLS 32
+
+struct _Sim_Poll {
+   int in_use;
+   unsigned int pid_mode;
+   unsigned int pid_num;
+   int interval_ms;
+   long long last_poll_ms;
+   long long lease_expiry_ms;
+   socklen_t addr_len;
+   struct sockaddr_storage addr;
+};
+
+typedef struct _Sim_Poll Sim_Poll;
 
 ECU_Parameters simulator_ecu;
 OBD_Interface simulator_obd;
@@ -62,9 +84,14 @@ unsigned int tick_count;
 int sock, length, n, serial_port;
 socklen_t from_len;
 struct sockaddr_in server;
-struct sockaddr_in from_client;
-char in_buf[MAX_BUFFER_LEN];
+struct sockaddr_storage from_client;
+char *in_buf;                      /* Request being parsed, a slot of recv_batch. */
+UDP_Batch recv_batch;
+char recv_bufs[MAX_UDP_BATCH][MAX_SERIAL_BUF_LEN];
+struct sockaddr_storage recv_addrs[MAX_UDP_BATCH];
 unsigned char ecu_msg[MAX_BUFFER_LEN];
+ELM_Parser elm_request;            /* Request from the serial port. */
+Sim_Poll sim_polls[MAX_SIM_POLLS]; /* PIDs polled by the clients. */
    
 const char *OBD_Protocol_List[] = {
 "OBD 0 - Automatic OBD-II Protocol Search",
@@ -159,7 +186,7 @@ int send_engine_rpm()
    /* TODO: log simulator msg. */
    printf("send_engine_rpm(): Simulator RPM Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -179,7 +206,7 @@ int send_coolant_temperature()
    /* TODO: log simulator msg. */
    printf("send_coolant_temperature(): Simulator ECT Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -197,7 +224,7 @@ void send_manifold_pressure()
    
    sprintf(reply_buf, "41 0B %.2x\n", map_A);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    printf("send_manifold_pressure(): Simulator MAP Msg: %i bytes %s", n, reply_buf);
       
@@ -219,7 +246,7 @@ int send_intake_air_temperature()
    /* TODO: log simulator msg. */
    printf("send_intake_air_temperature(): Simulator IAT Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -238,7 +265,7 @@ int send_vehicle_speed()
    sprintf(reply_buf, "41 0D %.2x\n", vs_A);
    printf("send_vehicle_speed(): Simulator VS Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -265,7 +292,7 @@ int send_throttle_position()
    /* TODO: log simulator msg. */
    printf("send_throttle_position(): Simulator Throttle Position Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -285,7 +312,7 @@ int send_oil_temperature()
    /* TODO: log simulator msg. */
    printf("send_oil_temperature(): Simulator OT Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n); 
 }
@@ -315,7 +342,7 @@ int send_mode_1_supported_pid_list_1_32()
    
    printf("send_mode_1_supported_pid_list_1_32(): Supported PID Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -337,7 +364,7 @@ int send_mode_9_supported_pid_list_1_32()
    /* TODO: log simulator msg. */
    printf("send_mode_9_supported_pid_list_1_32(): Supported PID Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -363,7 +390,7 @@ int send_fuel_tank_level()
    /* TODO: log simulator msg. */
    printf("send_fuel_tank_level(): Simulator Fuel Tank Level Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -385,7 +412,7 @@ int send_fuel_flow_rate()
    /* TODO: log simulator msg. */
    printf("send_fuel_flow_rate(): Simulator Fuel Flow Rate Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -404,7 +431,7 @@ int send_fuel_pressure()
    /* TODO: log simulator msg. */
    printf("send_fuel_pressure(): Simulator Fuel Pressure Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -423,7 +450,7 @@ int send_accelerator_position()
    /* TODO: log simulator msg. */
    printf("send_accelerator_position(): Simulator Accelerator Position Msg: %s", reply_buf);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    return(n);
 }
@@ -438,7 +465,7 @@ void send_battery_voltage()
    memset(reply_buf, 0, 256);
    sprintf(reply_buf, "ATRV %.2f\n", simulator_ecu.ecu_battery_voltage);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
 
    printf("send_battery_voltage(): Simulator ATRV Msg: %i bytes %s", n, reply_buf);
       
@@ -455,7 +482,7 @@ void send_interface_information()
 
    sprintf(reply_buf, "ATI ELM327\n");
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    printf("send_interface_information(): Simulator ATI Msg: %i bytes %s", n, reply_buf);
    
@@ -503,7 +530,7 @@ void send_obd_protocol_name(char *obd_msg)
       printf("send_obd_protocol_name(): %s", obd_msg);
    }
 
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    printf("send_obd_protocol_name() : %i bytes %s", n, reply_buf);
    
    return;
@@ -518,7 +545,7 @@ void send_vin_msg()
 
    sprintf(reply_buf, "%s\n", ecu_vin[0]); /* TODO: switch between CAN and non-CAN formats. */
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    printf("send_vin_msg(): VIN Msg: %i bytes %s", n, reply_buf);
    
@@ -534,7 +561,7 @@ void send_ecu_name()
 
    sprintf(reply_buf, "%s\n", ecu_name[0]);
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    printf("send_ecu_name(): ECU Name: %i bytes %s", n, reply_buf);
    
@@ -552,7 +579,7 @@ void send_mil_status()
    
    sprintf(reply_buf, "41 01 %.2x 01 02 03\n", mil_status); /* Msg = (41 01 81 XX XX XX) if MIL on and 1 DTC. */
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    printf("send_mil_status(): MIL Msg: %i bytes %s", n, reply_buf);
    
@@ -606,7 +633,7 @@ void reply_mode_03_msg(char *obd_msg)
    /* TODO: send multiple DTCs. */
    strcpy(reply_buf, "43 01 33 00 00 00 00\n"); /* DTC = P0133. */
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    printf("---------------------------------------------------------\n");
    printf("reply_mode_03_msg(): DTC Msg: %i bytes %s", n, reply_buf);
    printf("---------------------------------------------------------\n");
@@ -645,13 +672,175 @@ void send_no_data()
 
    sprintf(reply_buf, "NO DATA");
    
-   n = sendto(sock, reply_buf, strlen(reply_buf), 0, (struct sockaddr *)&from_client, from_len);
+   n = queue_udp_msg(sock, &from_client, from_len, reply_buf, strlen(reply_buf));
    
    printf("send_no_data(): %i bytes %s", n, reply_buf);
       
    return;
 }
 
+Sim_Poll *find_sim_poll(unsigned int pid_mode, unsigned int pid_num)
+{
+   int ii;
+
+   for (ii = 0; ii < MAX_SIM_POLLS; ii++)
+   {
+      if ((sim_polls[ii].in_use == 1) && (sim_polls[ii].pid_mode == pid_mode) && (sim_polls[ii].pid_num == pid_num) &&
+          (sim_polls[ii].addr_len == from_len) && (memcmp(&sim_polls[ii].addr, &from_client, from_len) == 0))
+      {
+         return(&sim_polls[ii]);
+      }
+   }
+
+   return(NULL);
+}
+
+/*
+   Function: parse_poll_message()
+
+   Purpose : Adds, renews or removes the polled PIDs of the client that
+           : sent the message, as the server polling scheduler does.
+   Input   : None, the message is in in_buf.
+   Output  : Returns the number of PIDs updated or -1 on a bad message.
+*/
+int parse_poll_message()
+{
+   char temp_buf[MAX_SERIAL_BUF_LEN];
+   char *token;
+   char *end_ptr;
+   unsigned int pid_mode, pid_num;
+   int ii, interval_ms = 0;
+   int add_pid, count = 0;
+   Sim_Poll *sp;
+
+   strncpy(temp_buf, in_buf, MAX_SERIAL_BUF_LEN - 1);
+   temp_buf[MAX_SERIAL_BUF_LEN - 1] = 0;
+
+   token = strtok(temp_buf, " \r\n");
+   if (token == NULL)
+      return(-1);
+
+   if (strcmp(token, "POLL") == 0)
+   {
+      add_pid = 1;
+      token = strtok(NULL, " \r\n");
+      if (token == NULL)
+         return(-1);
+      interval_ms = strtol(token, &end_ptr, 10);
+      if (*end_ptr != 0)
+         return(-1);
+   }
+   else if (strcmp(token, "UNPOLL") == 0)
+   {
+      add_pid = 0;
+   }
+   else
+   {
+      return(-1);
+   }
+
+   token = strtok(NULL, " \r\n");
+   if (token == NULL)
+      return(-1);
+   pid_mode = strtoul(token, &end_ptr, 16);
+   if ((*end_ptr != 0) || (pid_mode > 0xFF))
+      return(-1);
+
+   while ((token = strtok(NULL, " \r\n")) != NULL)
+   {
+      pid_num = strtoul(token, &end_ptr, 16);
+      if ((*end_ptr != 0) || (pid_num > 0xFF))
+         return(-1);
+
+      sp = find_sim_poll(pid_mode, pid_num);
+      if (add_pid == 0)
+      {
+         if (sp != NULL)
+         {
+            sp->in_use = 0;
+            count++;
+         }
+         continue;
+      }
+
+      for (ii = 0; (sp == NULL) && (ii < MAX_SIM_POLLS); ii++)
+      {
+         if (sim_polls[ii].in_use == 0)
+         {
+            sp = &sim_polls[ii];
+            memset(sp, 0, sizeof(Sim_Poll));
+            sp->in_use = 1;
+            sp->pid_mode = pid_mode;
+            sp->pid_num = pid_num;
+            sp->addr = from_client;
+            sp->addr_len = from_len;
+         }
+      }
+
+      if (sp == NULL)
+      {
+         printf("parse_poll_message() <ERROR>: No room for PID %.2X %.2X\n", pid_mode, pid_num);
+         continue;
+      }
+
+      sp->interval_ms = (interval_ms < 1) ? 1 : interval_ms;
+      sp->lease_expiry_ms = get_monotonic_ms() + POLL_LEASE_MS;
+      count++;
+   }
+
+   return(count);
+}
+
+/*
+   Function: send_polled_pids()
+
+   Purpose : Sends the replies of the polled PIDs that are due, and drops
+           : the PIDs of clients that stopped renewing their POLL.
+   Input   : Current monotonic time.
+   Output  : Returns the time in milliseconds until the next PID is due,
+           : -1 if no PIDs are polled.
+*/
+int send_polled_pids(long long now_ms)
+{
+   char query[MAX_ECU_QUERY_LEN];
+   long long due, min_due = -1;
+   int ii;
+
+   for (ii = 0; ii < MAX_SIM_POLLS; ii++)
+   {
+      if (sim_polls[ii].in_use == 0)
+         continue;
+
+      if (sim_polls[ii].lease_expiry_ms <= now_ms)
+      {
+         sim_polls[ii].in_use = 0;
+         continue;
+      }
+
+      if (sim_polls[ii].last_poll_ms + sim_polls[ii].interval_ms <= now_ms)
+      {
+         from_client = sim_polls[ii].addr;
+         from_len = sim_polls[ii].addr_len;
+         snprintf(query, MAX_ECU_QUERY_LEN, "%.2X %.2X\r", sim_polls[ii].pid_mode, sim_polls[ii].pid_num);
+         if (sim_polls[ii].pid_mode == 0x01)
+            reply_mode_01_msg(query);
+         else if (sim_polls[ii].pid_mode == 0x09)
+            reply_mode_09_msg(query);
+         sim_polls[ii].last_poll_ms = now_ms;
+
+         /* The gauges move while the client only polls. */
+         tick_count = (tick_count + 1) % 100;
+         set_simulator_ecu_parameters();
+      }
+
+      due = sim_polls[ii].last_poll_ms + sim_polls[ii].interval_ms - now_ms;
+      if ((min_due < 0) || (due < min_due))
+         min_due = due;
+   }
+
+   return((int)min_due);
+}
+
 int parse_gui_message()
 {
    int n;
@@ -663,7 +852,12 @@ int parse_gui_message()
    if (msg_len > 0) /* All messages must terminate with a \r. */
    {
       /* Parse the message. */
-      if (in_buf[0] == 'A') /* ELM327 interface messages all start with 'AT'. */
+      if ((strncmp(in_buf, "POLL", 4) == 0) || (strncmp(in_buf, "UNPOLL", 6) == 0)) /* Server polling messages. */
+      {
+         if (parse_poll_message() < 0)
+            n = -1;
+      }
+      else if (in_buf[0] == 'A') /* ELM327 interface messages all start with 'AT'. */
       {
          if (strncmp(in_buf, "ATRV", 4) == 0)
          {
@@ -766,28 +960,41 @@ int send_ecu_query(int serial_port, char *ecu_query)
     return(out_msg_len);
 }
 
+/*
+   Function: recv_ecu_reply()
+
+   Purpose : Reads a request from the serial port. The request is framed
+           : at its carriage return by the ELM327 parser, a request split
+           : over several reads is kept until the rest arrives.
+   Input   : Serial port number and request buffer.
+   Output  : Returns the request length, 0 if no whole request arrived.
+*/
 int recv_ecu_reply(int serial_port, unsigned char *ecu_query)
 {
+    unsigned char rx_buf[MAX_SERIAL_BUF_LEN];
     int in_msg_len = 0;
+    ELM_Line *line;
 
-    while((in_msg_len = RS232_PollComport(serial_port, ecu_query, MAX_BUFFER_LEN)) > 0)
+    while ((elm_request.line_count == 0) && ((in_msg_len = RS232_PollComport(serial_port, rx_buf, MAX_SERIAL_BUF_LEN)) > 0))
     {
-          int idx;
+          feed_elm_parser(&elm_request, rx_buf, in_msg_len);
 
-          ecu_query[in_msg_len] = 0;   /* always put a "null" at the end of a string! */
+          usleep(100000);  /* sleep for 100 milliSeconds */
+    }
 
-          for(idx = 0; idx < in_msg_len; idx++)
-          {
-             if(ecu_query[idx] < 32)  /* replace unreadable control-codes by dots */
-             {
-                ecu_query[idx] = '.';
-             }
-          }
+    if (elm_request.line_count == 0)
+    {
+       return(0);
+    }
 
-          printf("recv_ecu_reply(): RXD %i bytes: %s", in_msg_len, ecu_query);
+    /* The interpreter takes one request at a time. */
+    line = &elm_request.lines[0];
+    in_msg_len = line->text_len;
+    memcpy(ecu_query, elm_request.reply + line->text_idx, in_msg_len);
+    ecu_query[in_msg_len] = 0;
+    init_elm_parser(&elm_request, NULL);
 
-          usleep(100000);  /* sleep for 100 milliSeconds */
-    }
+    printf("recv_ecu_reply(): RXD %i bytes: %s\n", in_msg_len, ecu_query);
 
     return(in_msg_len);
 }
@@ -795,6 +1002,8 @@ int recv_ecu_reply(int serial_port, unsigned char *ecu_query)
 int main(int argc, char *argv[])
 {
    char udp_port[16];
+   struct pollfd pfd;
+   int ii, count, timeout_ms;
    
    memset(udp_port, 0, 16);
    
@@ -817,6 +1026,7 @@ int main(int argc, char *argv[])
    /* TODO: make this configurable for RS232 unit tests.
    serial_port = init_serial_comms("ttyUSB0");
    */
+   init_elm_parser(&elm_request, NULL);
    
    sock = socket(AF_INET, SOCK_DGRAM, 0);
 
@@ -835,38 +1045,59 @@ int main(int argc, char *argv[])
 
    from_len = sizeof(struct sockaddr_in);
    
-   memset(in_buf, 0, MAX_BUFFER_LEN);
+   /* Requests are received in batches, each buffer is null terminated
+      at the message length so nothing needs clearing. */
+   for (ii = 0; ii < MAX_UDP_BATCH; ii++)
+   {
+      set_batch_buffer(&recv_batch, ii, recv_bufs[ii], MAX_SERIAL_BUF_LEN, &recv_addrs[ii]);
+   }
+   init_udp_sends();
+   memset(sim_polls, 0, sizeof(sim_polls));
+   timeout_ms = -1;
+   pfd.fd = sock;
+   pfd.events = POLLIN;
    
    while (1) 
    {
-       n = recvfrom(sock, in_buf, MAX_BUFFER_LEN, 0, (struct sockaddr *)&from_client, &from_len);
+       /* Wait for requests or until the next polled PID is due. */
+       count = 0;
+       if (poll(&pfd, 1, timeout_ms) > 0)
+          count = recv_udp_batch(sock, &recv_batch, 0);
 
-       if (n < 0) fatal_error("recvfrom");
+       if (count < 0) fatal_error("recvmmsg");
 
-       printf("main(): RXD ECU Query: %s", in_buf);
+       for (ii = 0; ii < count; ii++)
+       {
+          in_buf = recv_bufs[ii];
+          from_client = recv_addrs[ii];
+          from_len = recv_batch.addr_len[ii];
 
-       n = parse_gui_message();
+          printf("main(): RXD ECU Query: %s", in_buf);
 
-       if (n  < 0) 
-          printf("main() <ERROR>:Message parsing failed.\n");
+          n = parse_gui_message();
 
-       set_simulator_ecu_parameters();
-       
-       tick_count += 1;
-       if (tick_count == 100)
-       {
-          tick_count = 0;
+          if (n  < 0) 
+             printf("main() <ERROR>:Message parsing failed.\n");
+
+          set_simulator_ecu_parameters();
+          
+          tick_count += 1;
+          if (tick_count == 100)
+          {
+             tick_count = 0;
+          }
+          
+          /* Now send the query to the ECU interface and get a response. 
+          n = send_ecu_query(serial_port, in_buf);
+          n = recv_ecu_reply(serial_port, ecu_msg);
+          */
+          /* TODO: log ECU query and reply. */
        }
-       
-       /* Now send the query to the ECU interface and get a response. 
-       n = send_ecu_query(serial_port, in_buf);
-       n = recv_ecu_reply(serial_port, ecu_msg);
-       */
-       /* TODO: log ECU query and reply. */
 
+       timeout_ms = send_polled_pids(get_monotonic_ms());
 
-       /* TODO: Clear the buffers!!! */
-       memset(in_buf, 0, MAX_BUFFER_LEN);
+       /* Replies to the whole batch in one sendmmsg(). */
+       flush_udp_msgs();
    }
 
    return 0;
@@ -0,0 +1,271 @@
+/*
+   elm_parser.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Incremental ELM327 reply parser.
+
+                The serial port returns a reply in chunks of any size, a
+                line or a token such as "SEARCHING..." can be split over
+                two reads. The parser keeps its state between calls, so
+                bytes are fed as they arrive:
+
+                "01 0C\r41 0C 1A F8\r\r>"
+
+                echo    "01 0C"         ELM_LINE_ECHO
+                line    "41 0C 1A F8"   ELM_LINE_DATA, bytes 41 0C 1A F8
+                prompt  '>'             ELM_REPLY_PROMPT
+
+                Each line is classified when its carriage return arrives
+                and the bytes of a data line are decoded into the data
+                buffer by decode_hex_tokens(), see hex_decode.c. Lines are
+                offsets into the reply text and the data buffer, nothing
+                is copied or allocated.
+
+                The reply text is kept with control codes as '!' line
+                delimiters, "01 0C!41 0C 1A F8!!", for the decoders and
+                the log. Bytes after the prompt are ignored.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "obd_monitor.h"
+#include "hex_decode.h"
+#include "elm_parser.h"
+
+/* Replies that end the exchange without ECU data. */
+static const char *elm_failed_msgs[] = {
+   "?",
+   "UNABLE TO CONNECT",
+   "BUFFER FULL",
+   "BUS BUSY",
+   "STOPPED",
+   "LV RESET",
+   "ACT ALERT",
+   NULL
+};
+
+/*
+   Function: init_elm_parser()
+
+   Purpose : Resets the parser for the reply to a new request.
+   Input   : Parser and the request, NULL if the echo is not known. The
+           : first line of the reply is the echo if it starts with the
+           : request, the interpreter can add the response count to it.
+*/
+void init_elm_parser(ELM_Parser *parser, char *ecu_query)
+{
+   parser->reply_status = 0;
+   parser->line_count = 0;
+   parser->reply_len = 0;
+   parser->reply[0] = 0;
+   parser->data_len = 0;
+   parser->line_len = 0;
+
+   parser->echo_len = 0;
+   if (ecu_query != NULL)
+   {
+      parser->echo_len = strcspn(ecu_query, "\r\n");
+      if (parser->echo_len > ELM_MAX_ECHO_LEN)
+         parser->echo_len = ELM_MAX_ECHO_LEN;
+      memcpy(parser->echo, ecu_query, parser->echo_len);
+   }
+
+   return;
+}
+
+static int is_search_line(char *line, int len)
+{
+   return(((len >= 9) && (strncmp(line, "SEARCHING", 9) == 0)) || ((len >= 8) && (strncmp(line, "BUS INIT", 8) == 0)));
+}
+
+static int get_line_type(ELM_Parser *parser, char *line, int len)
+{
+   int ii;
+
+   if ((parser->line_count == 0) && (parser->echo_len > 0) && (len >= parser->echo_len) &&
+       (strncmp(line, parser->echo, parser->echo_len) == 0))
+   {
+      return(ELM_LINE_ECHO);
+   }
+
+   if ((parser->line_hex == 1) && (strspn(line, " ") < (size_t)len))
+   {
+      return(ELM_LINE_DATA);
+   }
+
+   if (strstr(line, "ERROR") != NULL)
+   {
+      return(ELM_LINE_ERROR);
+   }
+
+   if (is_search_line(line, len))
+   {
+      return(ELM_LINE_SEARCHING);
+   }
+
+   if (strncmp(line, "NO DATA", 7) == 0)
+   {
+      return(ELM_LINE_NO_DATA);
+   }
+
+   for (ii = 0; elm_failed_msgs[ii] != NULL; ii++)
+   {
+      if (strncmp(line, elm_failed_msgs[ii], strlen(elm_failed_msgs[ii])) == 0)
+         return(ELM_LINE_FAILED);
+   }
+
+   return(ELM_LINE_TEXT);
+}
+
+static void end_elm_line(ELM_Parser *parser)
+{
+   ELM_Line *line;
+   int line_type, text_len;
+
+   if (parser->line_len == 0)
+   {
+      return; /* Blank line, or the line feed after a carriage return. */
+   }
+
+   parser->reply[parser->reply_len] = 0;
+   text_len = parser->reply_len - parser->line_start;
+   line_type = get_line_type(parser, parser->reply + parser->line_start, text_len);
+   if (line_type == ELM_LINE_DATA)
+   {
+      parser->data_len += decode_hex_tokens(parser->reply + parser->line_start, text_len, parser->data + parser->data_len,
+                                            ELM_MAX_DATA_BYTES - parser->data_len, NULL);
+      if (parser->data_len == ELM_MAX_DATA_BYTES)
+         parser->reply_status |= ELM_REPLY_OVERFLOW;
+   }
+
+   if (parser->line_count < ELM_MAX_LINES)
+   {
+      line = &parser->lines[parser->line_count++];
+      line->line_type = line_type;
+      line->text_idx = parser->line_start;
+      line->text_len = text_len;
+      line->data_idx = parser->line_data_idx;
+      line->data_len = parser->data_len - parser->line_data_idx;
+   }
+   else
+   {
+      parser->reply_status |= ELM_REPLY_OVERFLOW;
+   }
+
+   parser->reply_status |= line_type;
+   parser->line_len = 0;
+
+   return;
+}
+
+static void append_reply_char(ELM_Parser *parser, unsigned char c)
+{
+   if (parser->reply_len < MAX_BUFFER_LEN - 1)
+      parser->reply[parser->reply_len++] = c;
+   else
+      parser->reply_status |= ELM_REPLY_OVERFLOW; /* Keep reading until the prompt. */
+
+   return;
+}
+
+/*
+   Function: feed_elm_parser()
+
+   Purpose : Adds bytes read from the interpreter to the reply. Lines are
+           : classified at their carriage return, a search in progress is
+           : reported as soon as "SEARCHING" or "BUS INIT" has arrived.
+   Input   : Parser, raw bytes and byte count, any size.
+   Output  : Returns the ELM_LINE_ and ELM_REPLY_ bits set by these bytes,
+           : ELM_REPLY_PROMPT when the reply is complete.
+*/
+int feed_elm_parser(ELM_Parser *parser, unsigned char *in_buf, int in_len)
+{
+   int old_status = parser->reply_status;
+   unsigned char c;
+   int ii;
+
+   for (ii = 0; (ii < in_len) && ((parser->reply_status & ELM_REPLY_PROMPT) == 0); ii++)
+   {
+      c = in_buf[ii];
+
+      if (c == '>')
+      {
+         /* ELM327 is ready to receive another request. */
+         end_elm_line(parser);
+         parser->reply_status |= ELM_REPLY_PROMPT;
+      }
+      else if (c < 32)
+      {
+         end_elm_line(parser);
+         append_reply_char(parser, '!');
+      }
+      else
+      {
+         if (parser->line_len == 0)
+         {
+            parser->line_start = parser->reply_len;
+            parser->line_hex = 1;
+            parser->line_data_idx = parser->data_len;
+         }
+
+         append_reply_char(parser, c);
+         parser->line_len++;
+         if ((parser->line_hex == 1) && (c != ' ') && (c != ':') && (hex_nibble(c) < 0))
+            parser->line_hex = 0;
+
+         if (((parser->line_len == 8) || (parser->line_len == 9)) &&
+             is_search_line(parser->reply + parser->line_start, parser->reply_len - parser->line_start))
+         {
+            parser->reply_status |= ELM_LINE_SEARCHING;
+         }
+      }
+   }
+
+   parser->reply[parser->reply_len] = 0;
+
+   return(parser->reply_status & ~old_status);
+}
+
+/*
+   Function: get_elm_response()
+
+   Purpose : Finds the first line of the response, after the echo and the
+           : protocol search messages.
+   Input   : Parser.
+   Output  : Returns the line or NULL if there is none.
+*/
+ELM_Line *get_elm_response(ELM_Parser *parser)
+{
+   int ii;
+
+   for (ii = 0; ii < parser->line_count; ii++)
+   {
+      if ((parser->lines[ii].line_type & (ELM_LINE_ECHO | ELM_LINE_SEARCHING)) == 0)
+         return(&parser->lines[ii]);
+   }
+
+   return(NULL);
+}
+
+char *get_elm_line_type(int line_type)
+{
+   switch (line_type)
+   {
+      case ELM_LINE_ECHO: return("ECHO");
+      case ELM_LINE_DATA: return("DATA");
+      case ELM_LINE_TEXT: return("TEXT");
+      case ELM_LINE_SEARCHING: return("SEARCHING");
+      case ELM_LINE_NO_DATA: return("NO DATA");
+      case ELM_LINE_ERROR: return("ERROR");
+      case ELM_LINE_FAILED: return("FAILED");
+   }
+
+   return("UNKNOWN");
+}
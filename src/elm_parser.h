@@ -0,0 +1,79 @@
+/*
+   elm_parser.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Incremental ELM327 reply parser. Used by the server serial
+                thread, the startup exchanges, the baud rate negotiation
+                and the ECU simulator.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_ELM_PARSER_INCLUDED
+#define OBD_ELM_PARSER_INCLUDED
+
+#define ELM_MAX_LINES 32
+#define ELM_MAX_DATA_BYTES 256
+#define ELM_MAX_ECHO_LEN 64
+
+/* Line types, one bit each so a reply status holds every type seen. */
+#define ELM_LINE_ECHO 0x01       /* The request, sent back with echo on. */
+#define ELM_LINE_DATA 0x02       /* Hex digits only, "41 0C 1A F8", "410C1AF8" or "0: 41 0C". */
+#define ELM_LINE_TEXT 0x04       /* AT replies, "OK", "12.5V", "ELM327 v1.5". */
+#define ELM_LINE_SEARCHING 0x08  /* "SEARCHING..." or "BUS INIT: ...", protocol search in progress. */
+#define ELM_LINE_NO_DATA 0x10    /* "NO DATA", no ECU replied. */
+#define ELM_LINE_ERROR 0x20      /* "CAN ERROR", "<DATA ERROR", "BUS INIT: ...ERROR". */
+#define ELM_LINE_FAILED 0x40     /* "?", "UNABLE TO CONNECT", "BUFFER FULL", "BUS BUSY", "STOPPED". */
+
+/* Reply status, with the line types. */
+#define ELM_REPLY_PROMPT 0x100   /* The '>' prompt arrived, the reply is complete. */
+#define ELM_REPLY_OVERFLOW 0x200 /* Reply text, lines or data bytes were cut off. */
+
+/* A line of the reply, the text and bytes stay in the parser buffers. */
+struct _ELM_Line {
+   int line_type;
+   int text_idx;
+   int text_len;
+   int data_idx;
+   int data_len;
+};
+
+typedef struct _ELM_Line ELM_Line;
+
+struct _ELM_Parser {
+   int reply_status;
+   int line_count;
+   ELM_Line lines[ELM_MAX_LINES];
+
+   /* Reply text, control codes are stored as '!' line delimiters. */
+   int reply_len;
+   char reply[MAX_BUFFER_LEN];
+
+   /* Bytes of the data lines. */
+   int data_len;
+   unsigned char data[ELM_MAX_DATA_BYTES];
+
+   /* State of the line being read. */
+   int line_start;
+   int line_len;
+   int line_hex;
+   int line_data_idx;
+
+   int echo_len;
+   char echo[ELM_MAX_ECHO_LEN];
+};
+
+typedef struct _ELM_Parser ELM_Parser;
+
+/* elm_parser.c */
+void init_elm_parser(ELM_Parser *parser, char *ecu_query);
+int feed_elm_parser(ELM_Parser *parser, unsigned char *in_buf, int in_len);
+ELM_Line *get_elm_response(ELM_Parser *parser);
+char *get_elm_line_type(int line_type);
+
+#endif
+
@@ -0,0 +1,381 @@
+/*
+   hex_decode.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: ASCII hex to byte decoding of ELM327 replies.
+
+                Replies come with spaces, "41 0C 1A F8", or packed with
+                spaces off (ATS0), "410C1AF8". In monitor mode (ATMA) an
+                adapter sends thousands of such lines a second, so blocks
+                of characters are decoded with SIMD instructions:
+
+                SSE2   16 packed characters to 8 bytes, or 15 spaced
+                       characters, "41 0C 1A F8 0D ", to 5 bytes.
+                AVX2   32 packed characters to 16 bytes, or 30 spaced
+                       characters to 10 bytes.
+
+                Each block is converted to nibbles and checked against the
+                packed or the spaced layout in a few instructions. A block
+                that matches neither, and the tail of the line, are decoded
+                a digit pair at a time, so every level returns the same
+                bytes. AVX2 is used if the CPU has it, other CPUs use the
+                scalar decoder.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hex_decode.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__) && defined(__GNUC__)
+#define HEX_DECODE_SIMD
+#include <immintrin.h>
+#endif
+
+static int hex_decode_level = -1;   /* Set on first use. */
+
+int hex_nibble(unsigned char c)
+{
+   if ((unsigned char)(c - '0') < 10)
+      return(c - '0');
+
+   c |= 0x20; /* Lower case. */
+   if ((unsigned char)(c - 'a') < 6)
+      return(c - 'a' + 10);
+
+   return(-1);
+}
+
+#ifdef HEX_DECODE_SIMD
+
+/* Hex digit positions of the spaced layout "XX XX XX XX XX " in 15
+   characters, and the space positions. */
+#define SPACED_HEX_MASK 0x36DB
+#define SPACED_SPACE_MASK 0x4924
+#define SPACED_BLOCK_MASK 0x7FFF
+
+/* Converts 16 characters to nibble values, with masks of the hex digits
+   and the spaces. */
+static __m128i get_nibbles_sse2(__m128i chars, int *hex_mask, int *space_mask)
+{
+   const __m128i zero = _mm_setzero_si128();
+   __m128i digit, alpha, is_digit, is_alpha;
+
+   digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+   alpha = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+   is_digit = _mm_cmpeq_epi8(_mm_subs_epu8(digit, _mm_set1_epi8(9)), zero);
+   is_alpha = _mm_cmpeq_epi8(_mm_subs_epu8(alpha, _mm_set1_epi8(5)), zero);
+
+   *hex_mask = _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha));
+   *space_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')));
+
+   return(_mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10)))));
+}
+
+/* Decodes a block of 16 characters, returns the bytes and sets the
+   characters used, 0 bytes if the block is not all hex digit pairs. */
+static int decode_block_sse2(unsigned char *pch, unsigned char *out_bytes, int *used)
+{
+   unsigned char pairs[16];
+   __m128i nibbles, bytes;
+   int hex_mask, space_mask;
+
+   nibbles = get_nibbles_sse2(_mm_loadu_si128((__m128i *)pch), &hex_mask, &space_mask);
+
+   /* Byte i is nibble i and nibble i + 1, the pairs start at even
+      positions when packed and every third position when spaced. */
+   bytes = _mm_or_si128(_mm_slli_epi16(nibbles, 4), _mm_srli_si128(nibbles, 1));
+
+   if (hex_mask == 0xFFFF)
+   {
+      bytes = _mm_and_si128(bytes, _mm_set1_epi16(0x00FF));
+      _mm_storel_epi64((__m128i *)out_bytes, _mm_packus_epi16(bytes, bytes));
+      *used = 16;
+      return(8);
+   }
+
+   if (((hex_mask & SPACED_BLOCK_MASK) == SPACED_HEX_MASK) && ((space_mask & SPACED_SPACE_MASK) == SPACED_SPACE_MASK))
+   {
+      _mm_storeu_si128((__m128i *)pairs, bytes);
+      out_bytes[0] = pairs[0];
+      out_bytes[1] = pairs[3];
+      out_bytes[2] = pairs[6];
+      out_bytes[3] = pairs[9];
+      out_bytes[4] = pairs[12];
+      *used = 15;
+      return(5);
+   }
+
+   return(0);
+}
+
+__attribute__((target("avx2")))
+static __m256i get_nibbles_avx2(__m256i chars, int *hex_mask, int *space_mask)
+{
+   const __m256i zero = _mm256_setzero_si256();
+   __m256i digit, alpha, is_digit, is_alpha;
+
+   digit = _mm256_sub_epi8(chars, _mm256_set1_epi8('0'));
+   alpha = _mm256_sub_epi8(_mm256_or_si256(chars, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+   is_digit = _mm256_cmpeq_epi8(_mm256_subs_epu8(digit, _mm256_set1_epi8(9)), zero);
+   is_alpha = _mm256_cmpeq_epi8(_mm256_subs_epu8(alpha, _mm256_set1_epi8(5)), zero);
+
+   *hex_mask = _mm256_movemask_epi8(_mm256_or_si256(is_digit, is_alpha));
+   *space_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8(' ')));
+
+   return(_mm256_or_si256(_mm256_and_si256(is_digit, digit), _mm256_and_si256(is_alpha, _mm256_add_epi8(alpha, _mm256_set1_epi8(10)))));
+}
+
+/* Decodes a block of 32 characters, the caller has checked there are 32
+   characters and 16 free bytes. A spaced block is loaded as two lanes of
+   15 characters so both lanes have the same layout. */
+__attribute__((target("avx2")))
+static int decode_block_avx2(unsigned char *pch, unsigned char *out_bytes, int *used)
+{
+   __m256i nibbles, bytes, spaced_pairs;
+   int hex_mask, space_mask;
+
+   nibbles = get_nibbles_avx2(_mm256_loadu_si256((__m256i *)pch), &hex_mask, &space_mask);
+   if (hex_mask == -1)
+   {
+      /* The shifts stay in each 128 bit lane, only the last odd byte of
+         a lane is wrong and it is not a pair. */
+      bytes = _mm256_or_si256(_mm256_slli_epi16(nibbles, 4), _mm256_srli_si256(nibbles, 1));
+      bytes = _mm256_and_si256(bytes, _mm256_set1_epi16(0x00FF));
+      bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(bytes, bytes), 0xD8);
+      _mm_storeu_si128((__m128i *)out_bytes, _mm256_castsi256_si128(bytes));
+      *used = 32;
+      return(16);
+   }
+
+   if (((hex_mask & SPACED_BLOCK_MASK) != SPACED_HEX_MASK) || ((space_mask & SPACED_SPACE_MASK) != SPACED_SPACE_MASK))
+   {
+      return(0);
+   }
+
+   nibbles = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *)pch)), _mm_loadu_si128((__m128i *)(pch + 15)), 1);
+   nibbles = get_nibbles_avx2(nibbles, &hex_mask, &space_mask);
+   bytes = _mm256_or_si256(_mm256_slli_epi16(nibbles, 4), _mm256_srli_si256(nibbles, 1));
+   spaced_pairs = _mm256_setr_epi8(0, 3, 6, 9, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                   0, 3, 6, 9, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+   bytes = _mm256_shuffle_epi8(bytes, spaced_pairs);
+   _mm_storel_epi64((__m128i *)out_bytes, _mm256_castsi256_si128(bytes));
+   if ((((hex_mask >> 16) & SPACED_BLOCK_MASK) != SPACED_HEX_MASK) || (((space_mask >> 16) & SPACED_SPACE_MASK) != SPACED_SPACE_MASK))
+   {
+      /* Only the first 15 characters are spaced pairs. Staying in AVX2
+         code here avoids a switch to SSE2 with the upper lanes in use. */
+      *used = 15;
+      return(5);
+   }
+
+   _mm_storel_epi64((__m128i *)(out_bytes + 5), _mm256_extracti128_si256(bytes, 1));
+   *used = 30;
+
+   return(10);
+}
+
+#endif
+
+int get_hex_decode_level()
+{
+   if (hex_decode_level < 0)
+   {
+#ifdef HEX_DECODE_SIMD
+      __builtin_cpu_init();
+      hex_decode_level = __builtin_cpu_supports("avx2") ? HEX_DECODE_AVX2 : HEX_DECODE_SSE2;
+#else
+      hex_decode_level = HEX_DECODE_SCALAR;
+#endif
+   }
+
+   return(hex_decode_level);
+}
+
+/*
+   Function: set_hex_decode_level()
+
+   Purpose : Selects the decoder, to compare the levels. Levels the CPU
+           : does not support fall back to the best supported one.
+   Input   : Decoder level.
+   Output  : Returns the level in use.
+*/
+int set_hex_decode_level(int level)
+{
+   hex_decode_level = -1;
+   if (level < get_hex_decode_level())
+      hex_decode_level = level;
+
+   return(hex_decode_level);
+}
+
+char *get_hex_decode_name(int level)
+{
+   switch (level)
+   {
+      case HEX_DECODE_SSE2: return("SSE2");
+      case HEX_DECODE_AVX2: return("AVX2");
+   }
+
+   return("scalar");
+}
+
+/*
+   Function: decode_hex_bytes()
+
+   Purpose : Converts hex digit pairs to bytes, with or without spaces,
+           : "41 0C 1A F8" or "410C1AF8". Stops at anything that is not
+           : a hex digit pair.
+   Input   : Hex message, message length, byte buffer and buffer length.
+   Output  : Returns the number of bytes, used set to the characters
+           : decoded if it is not NULL.
+*/
+int decode_hex_bytes(char *hex_msg, int msg_len, unsigned char *out_bytes, int max_bytes, int *used)
+{
+   unsigned char *pch = (unsigned char *)hex_msg;
+   unsigned char *end = pch + msg_len;
+   int hi, lo, nbytes = 0;
+#ifdef HEX_DECODE_SIMD
+   int level = get_hex_decode_level();
+   int block_bytes, block_used;
+   unsigned char *next_block = pch;
+#endif
+
+   while (nbytes < max_bytes)
+   {
+      while ((pch < end) && (*pch == ' '))
+         pch++;
+
+#ifdef HEX_DECODE_SIMD
+      if ((level == HEX_DECODE_AVX2) && (pch >= next_block) && (end - pch >= 32) && (max_bytes - nbytes >= 16))
+      {
+         if ((block_bytes = decode_block_avx2(pch, out_bytes + nbytes, &block_used)) > 0)
+         {
+            nbytes += block_bytes;
+            pch += block_used;
+            continue;
+         }
+         next_block = pch + 16; /* The decode is likely to stop in this block. */
+      }
+      else if ((level >= HEX_DECODE_SSE2) && (pch >= next_block) && (end - pch >= 16) && (max_bytes - nbytes >= 8))
+      {
+         if ((block_bytes = decode_block_sse2(pch, out_bytes + nbytes, &block_used)) > 0)
+         {
+            nbytes += block_bytes;
+            pch += block_used;
+            continue;
+         }
+         next_block = pch + 16;
+      }
+#endif
+
+      if (end - pch < 2)
+         break;
+
+      hi = hex_nibble(pch[0]);
+      if (hi < 0)
+         break;
+      lo = hex_nibble(pch[1]);
+      if (lo < 0)
+         break;
+
+      out_bytes[nbytes++] = (unsigned char)((hi << 4) | lo);
+      pch += 2;
+   }
+
+   if (used != NULL)
+      *used = pch - (unsigned char *)hex_msg;
+
+   return(nbytes);
+}
+
+static int is_hex_delimiter(unsigned char c)
+{
+   return((c == ' ') || (c == '!') || (c == '\r') || (c == '\n'));
+}
+
+/*
+   Function: decode_hex_tokens()
+
+   Purpose : Converts the hex tokens of an ECU reply to bytes. Lines are
+           : delimited with '!' (server) or '\r'. ISO-TP frame numbers,
+           : "0:", and tokens with an odd number of digits, such as CAN
+           : headers "7E8", are left out. Other tokens, "NO DATA", are
+           : skipped.
+   Input   : ECU reply, reply length, byte buffer and buffer length.
+   Output  : Returns the number of bytes, byte_count set to the ISO-TP
+           : byte count in front of the data or -1, if it is not NULL.
+*/
+int decode_hex_tokens(char *hex_msg, int msg_len, unsigned char *out_bytes, int max_bytes, int *byte_count)
+{
+   unsigned char *msg = (unsigned char *)hex_msg;
+   int pos = 0, nbytes = 0;
+   int used, token_start, token_end, token_bytes;
+
+   if (byte_count != NULL)
+      *byte_count = -1;
+
+   while (pos < msg_len)
+   {
+      nbytes += decode_hex_bytes(hex_msg + pos, msg_len - pos, out_bytes + nbytes, max_bytes - nbytes, &used);
+      pos += used;
+      if ((pos >= msg_len) || (nbytes >= max_bytes))
+         break;
+
+      /* Stopped in a token that is not all digit pairs, its bytes are
+         only kept if it ends here. */
+      for (token_start = pos; (token_start > 0) && (hex_nibble(msg[token_start - 1]) >= 0); token_start--)
+         ;
+      token_bytes = (pos - token_start) / 2;
+
+      if (is_hex_delimiter(msg[pos]))
+      {
+         pos++;
+         continue;
+      }
+
+      if (msg[pos] == ':')
+      {
+         /* ISO-TP frame number. */
+         nbytes -= token_bytes;
+         pos++;
+         continue;
+      }
+
+      if (hex_nibble(msg[pos]) >= 0)
+      {
+         token_end = pos + 1;
+         if ((token_end < msg_len) && (msg[token_end] == ':'))
+         {
+            nbytes -= token_bytes;
+            pos = token_end + 1;
+            continue;
+         }
+
+         if ((token_end >= msg_len) || is_hex_delimiter(msg[token_end]))
+         {
+            /* Odd number of digits, the byte count is three digits in
+               front of the data. */
+            nbytes -= token_bytes;
+            if ((byte_count != NULL) && (*byte_count < 0) && (nbytes == 0) && (token_end - token_start == 3))
+               *byte_count = (hex_nibble(msg[token_start]) << 8) | (hex_nibble(msg[token_start + 1]) << 4) | hex_nibble(msg[token_start + 2]);
+            pos = token_end;
+            continue;
+         }
+      }
+
+      /* Not a hex token, "ATRV" or "12.5V", or text in front of a colon. */
+      nbytes -= token_bytes;
+      while ((pos < msg_len) && !is_hex_delimiter(msg[pos]) && (msg[pos] != ':'))
+         pos++;
+      if ((pos < msg_len) && (msg[pos] == ':'))
+         pos++;
+   }
+
+   return(nbytes);
+}
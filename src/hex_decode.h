@@ -0,0 +1,33 @@
+/*
+   hex_decode.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: ASCII hex to byte decoding of ELM327 replies, SSE2 and AVX2
+                with a scalar fallback. Used by the reply parser, the PID
+                table and the utilities.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_HEX_DECODE_INCLUDED
+#define OBD_HEX_DECODE_INCLUDED
+
+/* Decoder levels, the best one the CPU supports is used by default. */
+#define HEX_DECODE_SCALAR 0
+#define HEX_DECODE_SSE2 1        /* 16 characters at a time, any x86-64 CPU. */
+#define HEX_DECODE_AVX2 2        /* 32 characters at a time. */
+
+/* hex_decode.c */
+int hex_nibble(unsigned char c);
+int decode_hex_bytes(char *hex_msg, int msg_len, unsigned char *out_bytes, int max_bytes, int *used);
+int decode_hex_tokens(char *hex_msg, int msg_len, unsigned char *out_bytes, int max_bytes, int *byte_count);
+int get_hex_decode_level();
+int set_hex_decode_level(int level);
+char *get_hex_decode_name(int level);
+
+#endif
+
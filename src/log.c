@@ -8,6 +8,28 @@
    Date   : 24/12/2017
   
    Purpose: Logging, reporting and debug functions.
+
+            Log entries are written by a background thread. Each thread
+            that logs gets its own lock-free ring of fixed size records
+            (spsc_ring.c) the first time it calls print_log_entry(), which
+            only copies the text and a timestamp into the next slot. The
+            log thread takes the records from all the rings in the order
+            they were logged, formats them into one buffer and writes the
+            buffer with a single fwrite(). While entries keep coming it
+            writes every LOG_FLUSH_INTERVAL_US, when the rings are empty it
+            sleeps on a condition variable until an entry is queued, so an
+            idle process does not wake it.
+
+            The server serial and network loops never wait on the log
+            file, they only take the lock to wake the log thread when it
+            is asleep. If a ring is full the entry is dropped and counted,
+            and the count is written to the log. Entries longer than
+            MAX_LOG_RECORD_LEN are cut and end with "... <TRUNCATED n>",
+            n being the length of the entry.
+
+            Entries go straight to the file, as before, until the log file
+            is open and after it is closed, and for threads beyond
+            MAX_LOG_RINGS.
    
 */
 
@@ -19,9 +41,52 @@
 #include <string.h>
 #include <time.h>
 
+#include <pthread.h>
+#include <stdatomic.h>
+
 #include "obd_monitor.h"
+#include "spsc_ring.h"
+
+#define MAX_LOG_RINGS 16               /* Threads with their own ring. */
+#define LOG_RING_SLOTS 128             /* Power of two. */
+#define MAX_LOG_TAG_LEN 32
+#define MAX_LOG_RECORD_LEN 480
+#define LOG_WRITE_BUF_LEN 65536
+#define LOG_FLUSH_INTERVAL_US 20000
+#define LOG_TRUNCATED_MARK_LEN 32      /* "... <TRUNCATED n>" at the end of a long entry. */
+
+struct _Log_Record {
+   unsigned int seq;                   /* Order across the rings. */
+   time_t log_time;
+   char tag[MAX_LOG_TAG_LEN];
+   char text[MAX_LOG_RECORD_LEN];
+};
+
+typedef struct _Log_Record Log_Record;
+
+struct _Log_Ring {
+   SPSC_Ring ring;
+   Log_Record slots[LOG_RING_SLOTS];
+   atomic_uint dropped;
+};
+
+typedef struct _Log_Ring Log_Ring;
 
 FILE *log_file = NULL;
+ADAPTER_LOCAL char log_tag[MAX_LOG_TAG_LEN]; /* Adapter name in front of each entry of the thread. */
+
+Log_Ring log_rings[MAX_LOG_RINGS];
+atomic_int log_ring_count;
+atomic_uint log_seq;
+atomic_int log_thread_running;
+atomic_int log_thread_stopping;        /* 1 while stop_log_thread() waits for the log thread to exit. */
+atomic_int log_thread_waiting;         /* 1 while the log thread sleeps on log_wake_cond. */
+pthread_mutex_t log_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t log_wake_cond = PTHREAD_COND_INITIALIZER;
+pthread_t log_thread_id;
+char log_write_buf[LOG_WRITE_BUF_LEN]; /* Log thread, or stop_log_thread() after the join. */
+ADAPTER_LOCAL Log_Ring *thread_log_ring;
+ADAPTER_LOCAL int thread_log_ring_claimed;
 
 /*
    Function: open_log_file()
@@ -52,6 +117,10 @@ int open_log_file(char *startup_path, char *log_file_name)
       printf("open_log_file() <ERROR>: could not open logfile: %s\n", log_file_name); 
       ret_val = -1;
    }
+   else
+   {
+      start_log_thread();
+   }
 
 
    return(ret_val);
@@ -69,36 +138,75 @@ void close_log_file()
    print_log_entry("------------------------");
    print_log_entry(">>> Closing log session.");
    print_log_entry("------------------------");
-   
-   fclose(log_file);
+
+   stop_log_thread(); /* Writes the entries still in the rings. */
+
+   if (log_file != NULL)
+      fclose(log_file);
+   log_file = NULL;
    
    return;
 }
 
 
+void set_log_tag(char *tag)
+{
+   snprintf(log_tag, sizeof(log_tag), "%s", tag);
+
+   return;
+}
+
 /*
-   Function: print_log_entry()
- 
-   Purpose : Creates a log entry and prints to the log file and stdin.
-           : 
-   Input   : Log string and log file.
-   Output  : Timestamped log entry.
+   Function: format_log_entry()
+
+   Purpose : Formats a timestamped log entry, "Sat Oct 16 10:00:00 2026
+           : ttyUSB0 text\n". The time string is only formatted again when
+           : the second changes.
+   Input   : Entry time, tag, text, output buffer and length.
+   Output  : Returns the entry length.
 */
-int print_log_entry(char *estr)
+int format_log_entry(time_t log_time, char *tag, char *estr, char *out_buf, int out_len)
 {
-   time_t curtime;
+   static __thread time_t last_time = -1;
+   static __thread char time_str[32];
    struct tm *loctime;
+   int len;
+
+   if (log_time != last_time)
+   {
+#ifdef _WIN32
+      loctime = localtime (&log_time); /* Thread local in the Windows C runtime. */
+      strncpy(time_str, asctime(loctime), 31);
+#else
+      struct tm loctime_buf;
+      loctime = localtime_r (&log_time, &loctime_buf);
+      asctime_r(loctime, time_str);
+#endif
+      time_str[strcspn(time_str, "\n")] = 0;
+      last_time = log_time;
+   }
+
+   if (tag[0] != 0)
+      len = snprintf(out_buf, out_len, "%s %s %s\n", time_str, tag, estr);
+   else
+      len = snprintf(out_buf, out_len, "%s %s\n", time_str, estr);
+
+   if (len >= out_len)
+   {
+      len = out_len - 1;
+      out_buf[len - 1] = '\n';
+   }
+
+   return(len);
+}
+
+/* Synchronous entry, before the log thread starts, after it stops or for threads without a ring. */
+int write_log_entry(char *estr)
+{
    int slen = strlen(estr);
    char *log_entry = xcalloc(slen + 256);
-     
-   /* Get the current time. */
-   curtime = time (NULL);
-   loctime = localtime (&curtime);
-   char *time_str = asctime(loctime);   
-   strncpy(log_entry, time_str, strlen(time_str) - 1);
-   strcat(log_entry, " ");
-   strncat(log_entry, estr, slen);
-   strcat(log_entry, "\n");
+
+   format_log_entry(time(NULL), log_tag, estr, log_entry, slen + 256);
 
    if (log_file != NULL)
    {
@@ -110,9 +218,275 @@ int print_log_entry(char *estr)
    }
 
    xfree(log_entry, slen + 256);
-  
+
    return(0);
 }
 
+Log_Ring *get_thread_log_ring()
+{
+   int ii;
+
+   if (thread_log_ring_claimed == 0)
+   {
+      thread_log_ring_claimed = 1;
+      ii = atomic_fetch_add(&log_ring_count, 1);
+      if (ii < MAX_LOG_RINGS)
+         thread_log_ring = &log_rings[ii];
+      else
+         printf("get_thread_log_ring() <WARNING>: No log ring left, this thread logs synchronously.\n");
+   }
+
+   return(thread_log_ring);
+}
+
+/*
+   Function: print_log_entry()
+ 
+   Purpose : Queues a log entry for the log thread, or writes it to the log
+           : file or stdout if the log thread is not running.
+   Input   : Log string.
+   Output  : Returns 0, -1 if the entry was dropped because the ring of
+           : the thread is full.
+*/
+int print_log_entry(char *estr)
+{
+   Log_Ring *lr;
+   Log_Record *rec;
+   int len;
+
+   if ((atomic_load(&log_thread_running) == 0) || ((lr = get_thread_log_ring()) == NULL))
+   {
+      return(write_log_entry(estr));
+   }
+
+   rec = (Log_Record *)get_ring_write_slot(&lr->ring);
+   if (rec == NULL)
+   {
+      atomic_fetch_add_explicit(&lr->dropped, 1, memory_order_relaxed);
+      return(-1);
+   }
+
+   rec->seq = atomic_fetch_add_explicit(&log_seq, 1, memory_order_relaxed);
+   rec->log_time = time(NULL);
+   memcpy(rec->tag, log_tag, MAX_LOG_TAG_LEN);
+   len = strlen(estr);
+   if (len < MAX_LOG_RECORD_LEN)
+   {
+      memcpy(rec->text, estr, len + 1);
+   }
+   else
+   {
+      memcpy(rec->text, estr, MAX_LOG_RECORD_LEN - LOG_TRUNCATED_MARK_LEN);
+      snprintf(rec->text + MAX_LOG_RECORD_LEN - LOG_TRUNCATED_MARK_LEN, LOG_TRUNCATED_MARK_LEN, "... <TRUNCATED %i>", len);
+   }
+   commit_ring_write(&lr->ring);
+
+   /* Pairs with the fence in wait_log_records(), either the log thread
+      sees this record or this thread sees that it is waiting. */
+   atomic_thread_fence(memory_order_seq_cst);
+   if (atomic_load_explicit(&log_thread_waiting, memory_order_relaxed) == 1)
+   {
+      pthread_mutex_lock(&log_wake_lock);
+      pthread_cond_signal(&log_wake_cond);
+      pthread_mutex_unlock(&log_wake_lock);
+   }
+
+   return(0);
+}
+
+/*
+   Function: write_log_records()
+
+   Purpose : Takes the records from all the rings, oldest first, and writes
+           : them to the log file in large blocks. Log thread only.
+   Input   : None.
+   Output  : Returns the number of records written.
+*/
+int write_log_records()
+{
+   char drop_msg[64];
+   Log_Record *rec, *oldest;
+   Log_Ring *oldest_ring = NULL;
+   unsigned int dropped;
+   int ii, ring_count, buf_len = 0, count = 0;
+
+   ring_count = atomic_load(&log_ring_count);
+   if (ring_count > MAX_LOG_RINGS)
+      ring_count = MAX_LOG_RINGS;
 
+   while (1)
+   {
+      oldest = NULL;
+      for (ii = 0; ii < ring_count; ii++)
+      {
+         rec = (Log_Record *)get_ring_read_slot(&log_rings[ii].ring);
+         if ((rec != NULL) && ((oldest == NULL) || ((int)(rec->seq - oldest->seq) < 0)))
+         {
+            oldest = rec;
+            oldest_ring = &log_rings[ii];
+         }
+      }
+
+      if (oldest == NULL)
+         break;
+
+      if (buf_len + MAX_LOG_RECORD_LEN + 128 > LOG_WRITE_BUF_LEN)
+      {
+         fwrite(log_write_buf, 1, buf_len, log_file);
+         buf_len = 0;
+      }
+      buf_len += format_log_entry(oldest->log_time, oldest->tag, oldest->text, log_write_buf + buf_len, LOG_WRITE_BUF_LEN - buf_len);
+      commit_ring_read(&oldest_ring->ring);
+      count++;
+   }
+
+   for (ii = 0; ii < ring_count; ii++)
+   {
+      dropped = atomic_exchange(&log_rings[ii].dropped, 0);
+      if ((dropped > 0) && (buf_len + 256 > LOG_WRITE_BUF_LEN))
+      {
+         fwrite(log_write_buf, 1, buf_len, log_file);
+         buf_len = 0;
+      }
+      if (dropped > 0)
+      {
+         snprintf(drop_msg, 64, "print_log_entry() <ERROR>: %u entries dropped.", dropped);
+         buf_len += format_log_entry(time(NULL), "", drop_msg, log_write_buf + buf_len, LOG_WRITE_BUF_LEN - buf_len);
+      }
+   }
+
+   if (buf_len > 0)
+   {
+      fwrite(log_write_buf, 1, buf_len, log_file);
+      fflush(log_file);
+   }
+
+   return(count);
+}
+
+int has_log_records()
+{
+   int ii, ring_count;
+
+   ring_count = atomic_load(&log_ring_count);
+   if (ring_count > MAX_LOG_RINGS)
+      ring_count = MAX_LOG_RINGS;
+
+   for (ii = 0; ii < ring_count; ii++)
+   {
+      if (get_ring_read_slot(&log_rings[ii].ring) != NULL)
+         return(1);
+   }
+
+   return(0);
+}
+
+/*
+   Function: wait_log_records()
+
+   Purpose : Sleeps until an entry is queued or the log thread is stopped.
+           : Log thread only.
+   Input   : None.
+   Output  : None.
+*/
+void wait_log_records()
+{
+   pthread_mutex_lock(&log_wake_lock);
+   atomic_store_explicit(&log_thread_waiting, 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_seq_cst);
+   while ((atomic_load(&log_thread_stopping) == 0) && (has_log_records() == 0))
+   {
+      pthread_cond_wait(&log_wake_cond, &log_wake_lock);
+   }
+   atomic_store_explicit(&log_thread_waiting, 0, memory_order_relaxed);
+   pthread_mutex_unlock(&log_wake_lock);
+
+   return;
+}
+
+void *log_thread_main(void *arg)
+{
+   while (atomic_load(&log_thread_stopping) == 0)
+   {
+      /* Busy, collect entries for the next write. Idle, sleep until one comes. */
+      if (write_log_records() > 0)
+         usleep(LOG_FLUSH_INTERVAL_US);
+      else
+         wait_log_records();
+   }
+
+   write_log_records();
+
+   return(NULL);
+}
+
+/*
+   Function: start_log_thread()
+
+   Purpose : Sets up the log rings and starts the log thread, called when
+           : the log file is opened. Entries are written synchronously if
+           : the thread cannot be started.
+   Input   : None.
+   Output  : Returns 0 or -1 on error.
+*/
+int start_log_thread()
+{
+   static int exit_handler = 0;
+   int ii;
+
+   if (atomic_load(&log_thread_running) == 1)
+   {
+      return(0);
+   }
+
+   for (ii = 0; ii < MAX_LOG_RINGS; ii++)
+   {
+      init_spsc_ring(&log_rings[ii].ring, log_rings[ii].slots, sizeof(Log_Record), LOG_RING_SLOTS);
+      atomic_init(&log_rings[ii].dropped, 0);
+   }
+
+   atomic_store(&log_thread_running, 1);
+   if (pthread_create(&log_thread_id, NULL, log_thread_main, NULL) != 0)
+   {
+      printf("start_log_thread() <ERROR>: Could not create the log thread.\n");
+      atomic_store(&log_thread_running, 0);
+      return(-1);
+   }
+
+   /* fatal_error() exits without closing the log. */
+   if (exit_handler == 0)
+   {
+      atexit(stop_log_thread);
+      exit_handler = 1;
+   }
+
+   return(0);
+}
+
+/*
+   Function: stop_log_thread()
+
+   Purpose : Stops the log thread and writes the entries still in the
+           : rings. Other threads keep queueing entries until the log
+           : thread has exited, then write them synchronously.
+   Input   : None.
+   Output  : None.
+*/
+void stop_log_thread()
+{
+   if ((atomic_load(&log_thread_running) == 1) && (atomic_exchange(&log_thread_stopping, 1) == 0))
+   {
+      pthread_mutex_lock(&log_wake_lock);
+      pthread_cond_signal(&log_wake_cond);
+      pthread_mutex_unlock(&log_wake_lock);
+      pthread_join(log_thread_id, NULL);
+
+      /* Entries queued while the log thread was writing its last pass. */
+      atomic_store(&log_thread_running, 0);
+      write_log_records();
+      atomic_store(&log_thread_stopping, 0);
+   }
+
+   return;
+}
 
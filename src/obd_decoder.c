@@ -0,0 +1,489 @@
+/*
+   obd_decoder.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Decodes ECU replies to typed samples in engineering units.
+
+                The server decodes each ECU reply once, as it arrives, with
+                the same Mode 01 formulas the GUI and the binary format use
+                (pid_table.c). Clients that send "FORMAT UNITS\r" get the
+                decoded samples as text instead of ELM327 hex, one sample
+                per line:
+
+                41 0C 1A F8            ->  01 0C 1726.00 rpm
+                41 01 82 07 E5 00      ->  01 01 2.00 DTCs MIL On
+                43 01 33 00 00 00 00   ->  03 P0133
+                49 02 01 31 47 31 ...  ->  09 02 1G1JC5444R7252367
+                62 11 5C 5B            ->  22 115C 41.65 psi
+                ATRV 12.5V             ->  ATRV 12.50 V
+
+                Manufacturer PIDs, such as the Mode 22 oil pressure, are
+                scaled with their formulas, see custom_pid.c. The latest
+                sample of each PID is kept for headless consumers in the
+                server, get_decoded_sample(). Nothing here depends on GTK
+                or the GUI ECU parameters.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "obd_monitor.h"
+#include "pid_table.h"
+#include "custom_pid.h"
+#include "obd_decoder.h"
+
+#define MAX_LATEST_SAMPLES 128
+
+const char *DTC_System_Letters = "PCBU";
+
+/* Latest sample of each mode and PID, sample_type 0 is a free slot. */
+ADAPTER_LOCAL OBD_Sample latest_samples[MAX_LATEST_SAMPLES];
+ADAPTER_LOCAL int decoded_count;
+
+/* Last reply decoded, the fan-out to several clients decodes it once. */
+ADAPTER_LOCAL char last_reply[MAX_UNITS_REPLY_LEN];
+ADAPTER_LOCAL OBD_Sample last_samples[MAX_DECODED_SAMPLES];
+ADAPTER_LOCAL int last_sample_count;
+
+void init_obd_decoder()
+{
+   memset(latest_samples, 0, sizeof(latest_samples));
+   memset(last_reply, 0, sizeof(last_reply));
+   decoded_count = 0;
+   last_sample_count = 0;
+
+   load_custom_pids();
+
+   return;
+}
+
+int get_decoded_count()
+{
+   return(decoded_count);
+}
+
+/*
+   Function: decode_dtc()
+
+   Purpose : Converts the two bytes of a diagnostic trouble code to text,
+           : 01 33 is P0133. The top two bits are the system, P, C, B or U.
+   Input   : DTC bytes and a code buffer of at least 6 characters.
+   Output  : Returns 1, 0 if the bytes are padding (00 00).
+*/
+int decode_dtc(unsigned char *dtc_bytes, char *dtc_code)
+{
+   if ((dtc_bytes[0] == 0) && (dtc_bytes[1] == 0))
+   {
+      return(0);
+   }
+
+   sprintf(dtc_code, "%c%X%X%.2X", DTC_System_Letters[dtc_bytes[0] >> 6], (dtc_bytes[0] >> 4) & 3, dtc_bytes[0] & 0x0F, dtc_bytes[1]);
+
+   return(1);
+}
+
+OBD_Sample *new_sample(OBD_Sample *samples, int *count, int max_samples, unsigned int pid_mode, unsigned int pid_num, int sample_type, long long timestamp_ms)
+{
+   OBD_Sample *sample;
+
+   if (*count >= max_samples)
+   {
+      return(NULL);
+   }
+
+   sample = &samples[(*count)++];
+   memset(sample, 0, sizeof(OBD_Sample));
+   sample->pid_mode = pid_mode;
+   sample->pid_num = pid_num;
+   sample->sample_type = sample_type;
+   sample->timestamp_ms = timestamp_ms;
+   sample->units = "";
+
+   return(sample);
+}
+
+void decode_mode_01_bytes(unsigned char *reply_bytes, int nbytes, long long timestamp_ms, OBD_Sample *samples, int *count, int max_samples)
+{
+   OBD_Sample *sample;
+   double value;
+   int idx, pid_len;
+
+   /* One or more PIDs after the mode byte, "41 0C 1A F8 0D 32". */
+   idx = 1;
+   while (idx < nbytes)
+   {
+      pid_len = get_mode_01_pid_length(reply_bytes[idx]);
+      if ((pid_len == 0) || ((idx + 1 + pid_len) > nbytes))
+      {
+         break;
+      }
+
+      if (reply_bytes[idx] == 0x01)
+      {
+         sample = new_sample(samples, count, max_samples, 0x01, 0x01, OBD_SAMPLE_VALUE, timestamp_ms);
+         if (sample != NULL)
+         {
+            sample->value = reply_bytes[idx + 1] & 0x7F;
+            sample->units = "DTCs";
+            strcpy(sample->text, (reply_bytes[idx + 1] & 0x80) ? "MIL On" : "MIL Off");
+         }
+      }
+      else if (get_mode_01_pid_value(reply_bytes[idx], &reply_bytes[idx + 1], &value) == 1)
+      {
+         sample = new_sample(samples, count, max_samples, 0x01, reply_bytes[idx], OBD_SAMPLE_VALUE, timestamp_ms);
+         if (sample != NULL)
+         {
+            sample->value = value;
+            sample->units = get_mode_01_pid_units(reply_bytes[idx]);
+         }
+      }
+
+      idx += 1 + pid_len;
+   }
+
+   return;
+}
+
+void decode_mode_03_bytes(unsigned char *reply_bytes, int nbytes, long long timestamp_ms, OBD_Sample *samples, int *count, int max_samples)
+{
+   OBD_Sample *sample;
+   char dtc_code[8];
+   int idx, ii, dtc_num = 0;
+
+   for (ii = 0; ii < *count; ii++)
+   {
+      if (samples[ii].pid_mode == 0x03)
+         dtc_num++; /* Codes from the lines before this one. */
+   }
+
+   /* Non-CAN lines have three codes, "43 01 33 00 00 00 00". CAN replies
+      have the number of codes first, "43 01 01 33", so an odd count of
+      data bytes has the count in front. */
+   idx = ((nbytes - 1) % 2 == 1) ? 2 : 1;
+
+   for (; idx + 1 < nbytes; idx += 2)
+   {
+      if (decode_dtc(&reply_bytes[idx], dtc_code) == 0)
+         continue;
+
+      /* Codes have no PID, so they are numbered to keep them apart. */
+      sample = new_sample(samples, count, max_samples, 0x03, dtc_num++, OBD_SAMPLE_TEXT, timestamp_ms);
+      if (sample != NULL)
+      {
+         strcpy(sample->text, dtc_code);
+      }
+   }
+
+   return;
+}
+
+void decode_mode_09_bytes(unsigned char *reply_bytes, int nbytes, long long timestamp_ms, OBD_Sample *samples, int *count, int max_samples)
+{
+   OBD_Sample *sample = NULL;
+   int ii, len;
+
+   if ((nbytes < 4) || ((reply_bytes[1] != 0x02) && (reply_bytes[1] != 0x0A)))
+   {
+      return; /* Only the VIN and the ECU name are text. */
+   }
+
+   /* Non-CAN VINs arrive as several lines, "49 02 01 00 00 00 31",
+      "49 02 02 47 31 4A 43"..., so the text is added to the same sample. */
+   for (ii = 0; ii < *count; ii++)
+   {
+      if ((samples[ii].pid_mode == 0x09) && (samples[ii].pid_num == reply_bytes[1]))
+         sample = &samples[ii];
+   }
+   if (sample == NULL)
+   {
+      sample = new_sample(samples, count, max_samples, 0x09, reply_bytes[1], OBD_SAMPLE_TEXT, timestamp_ms);
+      if (sample == NULL)
+         return;
+   }
+
+   /* Mode, PID and the line or item count, then the characters padded with 00. */
+   len = strlen(sample->text);
+   for (ii = 3; (ii < nbytes) && (len < OBD_SAMPLE_TEXT_LEN - 1); ii++)
+   {
+      if ((reply_bytes[ii] > 0x20) && (reply_bytes[ii] < 0x7F))
+         sample->text[len++] = reply_bytes[ii];
+   }
+   sample->text[len] = 0;
+
+   return;
+}
+
+void decode_custom_pid_bytes(unsigned char *reply_bytes, int nbytes, long long timestamp_ms, OBD_Sample *samples, int *count, int max_samples)
+{
+   PID_Parameters *pid;
+   OBD_Sample *sample;
+   unsigned int pid_mode, pid_num;
+   int idx;
+   double value;
+
+   /* Mode 22 PIDs are two bytes, "62 11 5C 8A", the other manufacturer
+      modes one byte. */
+   pid_mode = reply_bytes[0] - 0x40;
+   if (pid_mode == 0x22)
+   {
+      if (nbytes < 3)
+         return;
+      pid_num = (reply_bytes[1] << 8) | reply_bytes[2];
+      idx = 3;
+   }
+   else
+   {
+      pid_num = reply_bytes[1];
+      idx = 2;
+   }
+
+   pid = find_custom_pid(pid_mode, pid_num);
+   if ((pid == NULL) || (get_custom_pid_value(pid, &reply_bytes[idx], nbytes - idx, &value) == 0))
+   {
+      return; /* No formula, the reply is only sent as text. */
+   }
+
+   sample = new_sample(samples, count, max_samples, pid_mode, pid_num, OBD_SAMPLE_VALUE, timestamp_ms);
+   if (sample != NULL)
+   {
+      sample->value = value;
+      sample->units = pid->pid_units;
+   }
+
+   return;
+}
+
+int decode_voltage_reply(char *at_reply, long long timestamp_ms, OBD_Sample *samples, int max_samples)
+{
+   OBD_Sample *sample;
+   char *end_ptr;
+   double value;
+   int count = 0;
+
+   /* "ATRV 12.5V", the AT command is put in front of the reply by the server. */
+   value = strtod(at_reply + 4, &end_ptr);
+   if ((end_ptr == at_reply + 4) || (*end_ptr != 'V'))
+   {
+      return(0);
+   }
+
+   sample = new_sample(samples, &count, max_samples, OBD_MODE_INTERFACE, OBD_PID_VOLTAGE, OBD_SAMPLE_VALUE, timestamp_ms);
+   if (sample != NULL)
+   {
+      sample->value = value;
+      sample->units = "V";
+   }
+
+   return(count);
+}
+
+/*
+   Function: decode_ecu_reply()
+
+   Purpose : Decodes an ECU reply, one or more lines delimited with '!', to
+           : samples. Multi-PID Mode 01 replies give one sample per PID.
+   Input   : ECU reply, time the reply arrived, sample buffer and length.
+   Output  : Returns the number of samples, 0 if nothing in the reply has
+           : a decoder.
+*/
+int decode_ecu_reply(char *ecu_reply, long long timestamp_ms, OBD_Sample *samples, int max_samples)
+{
+   char temp_buf[MAX_UNITS_REPLY_LEN];
+   unsigned char reply_bytes[MAX_REPLY_BYTES];
+   char *line, *next_line;
+   int nbytes, count = 0;
+
+   if (strncmp(ecu_reply, "ATRV", 4) == 0)
+   {
+      return(decode_voltage_reply(ecu_reply, timestamp_ms, samples, max_samples));
+   }
+
+   /* Long replies in several CAN frames are decoded as one line. */
+   if (join_reply_frames(ecu_reply, temp_buf, MAX_UNITS_REPLY_LEN) == 0)
+   {
+      strncpy(temp_buf, ecu_reply, MAX_UNITS_REPLY_LEN - 1);
+      temp_buf[MAX_UNITS_REPLY_LEN - 1] = 0;
+   }
+
+   for (line = temp_buf; line != NULL; line = next_line)
+   {
+      next_line = strchr(line, '!');
+      if (next_line != NULL)
+         *next_line++ = 0;
+
+      nbytes = get_reply_bytes(line, reply_bytes, MAX_REPLY_BYTES);
+      if (nbytes < 2)
+         continue;
+
+      switch(reply_bytes[0])
+      {
+         case 0x41: decode_mode_01_bytes(reply_bytes, nbytes, timestamp_ms, samples, &count, max_samples); break;
+         case 0x43: decode_mode_03_bytes(reply_bytes, nbytes, timestamp_ms, samples, &count, max_samples); break;
+         case 0x49: decode_mode_09_bytes(reply_bytes, nbytes, timestamp_ms, samples, &count, max_samples); break;
+         default : decode_custom_pid_bytes(reply_bytes, nbytes, timestamp_ms, samples, &count, max_samples); break;
+      }
+   }
+
+   return(count);
+}
+
+/*
+   Function: format_obd_sample()
+
+   Purpose : Writes a sample as text, "01 0C 1726.00 rpm".
+   Input   : Sample, output buffer and buffer length.
+   Output  : Returns the text length.
+*/
+int format_obd_sample(OBD_Sample *sample, char *out_buf, int out_len)
+{
+   int len;
+
+   if (sample->pid_mode == OBD_MODE_INTERFACE)
+      len = snprintf(out_buf, out_len, "ATRV %.2f %s", sample->value, sample->units);
+   else if (sample->sample_type == OBD_SAMPLE_VALUE)
+      len = snprintf(out_buf, out_len, "%.2X %.2X %.2f %s%s%s", sample->pid_mode, sample->pid_num, sample->value, sample->units,
+                     (sample->text[0] != 0) ? " " : "", sample->text);
+   else if (sample->pid_mode == 0x03)
+      len = snprintf(out_buf, out_len, "03 %s", sample->text);
+   else
+      len = snprintf(out_buf, out_len, "%.2X %.2X %s", sample->pid_mode, sample->pid_num, sample->text);
+
+   if (len >= out_len)
+      len = out_len - 1;
+
+   return(len);
+}
+
+int decode_last_reply(char *ecu_reply, long long timestamp_ms)
+{
+   if ((last_reply[0] != 0) && (strncmp(last_reply, ecu_reply, MAX_UNITS_REPLY_LEN - 1) == 0))
+   {
+      return(last_sample_count);
+   }
+
+   strncpy(last_reply, ecu_reply, MAX_UNITS_REPLY_LEN - 1);
+   last_reply[MAX_UNITS_REPLY_LEN - 1] = 0;
+   last_sample_count = decode_ecu_reply(ecu_reply, timestamp_ms, last_samples, MAX_DECODED_SAMPLES);
+
+   return(last_sample_count);
+}
+
+/*
+   Function: decode_ecu_data()
+
+   Purpose : Decode stage of the server, called once for each ECU reply.
+           : Keeps the latest sample of each PID.
+   Input   : ECU reply and the time it arrived.
+   Output  : Returns the number of samples decoded.
+*/
+int decode_ecu_data(char *ecu_reply, long long timestamp_ms)
+{
+   OBD_Sample *sample;
+   int ii, jj, free_slot;
+
+   last_reply[0] = 0; /* A repeated reply is a new sample. */
+   decode_last_reply(ecu_reply, timestamp_ms);
+
+   for (ii = 0; ii < last_sample_count; ii++)
+   {
+      sample = &last_samples[ii];
+      free_slot = -1;
+      for (jj = 0; jj < MAX_LATEST_SAMPLES; jj++)
+      {
+         if (latest_samples[jj].sample_type == 0)
+         {
+            if (free_slot < 0)
+               free_slot = jj;
+         }
+         else if ((latest_samples[jj].pid_mode == sample->pid_mode) && (latest_samples[jj].pid_num == sample->pid_num))
+         {
+            break;
+         }
+      }
+
+      if (jj < MAX_LATEST_SAMPLES)
+         latest_samples[jj] = *sample;
+      else if (free_slot >= 0)
+         latest_samples[free_slot] = *sample;
+   }
+
+   decoded_count += last_sample_count;
+
+   return(last_sample_count);
+}
+
+/*
+   Function: get_last_decoded_samples()
+
+   Purpose : Gets the samples of the last reply from decode_ecu_data().
+   Input   : Number of samples.
+   Output  : Returns the samples, valid until the next reply is decoded.
+*/
+OBD_Sample *get_last_decoded_samples(int *sample_count)
+{
+   *sample_count = last_sample_count;
+
+   return(last_samples);
+}
+
+/*
+   Function: get_decoded_sample()
+
+   Purpose : Gets the latest sample of a PID. DTCs are mode 03 with the
+           : code number as the PID, the battery voltage is mode and PID 00.
+   Input   : Mode, PID and the sample.
+   Output  : Returns 1, 0 if the PID has not been decoded.
+*/
+int get_decoded_sample(unsigned int pid_mode, unsigned int pid_num, OBD_Sample *sample)
+{
+   int ii;
+
+   for (ii = 0; ii < MAX_LATEST_SAMPLES; ii++)
+   {
+      if ((latest_samples[ii].sample_type != 0) && (latest_samples[ii].pid_mode == pid_mode) && (latest_samples[ii].pid_num == pid_num))
+      {
+         *sample = latest_samples[ii];
+         return(1);
+      }
+   }
+
+   return(0);
+}
+
+/*
+   Function: get_units_reply()
+
+   Purpose : Gets the text of a reply for FORMAT UNITS clients, one decoded
+           : sample per line.
+   Input   : ECU reply, output buffer and buffer length.
+   Output  : Returns the text length, 0 if the reply has no samples and is
+           : sent as it is.
+*/
+int get_units_reply(char *ecu_reply, char *out_buf, int out_len)
+{
+   int ii, len = 0;
+
+   if (decode_last_reply(ecu_reply, 0) == 0)
+   {
+      return(0);
+   }
+
+   out_buf[0] = 0;
+   for (ii = 0; (ii < last_sample_count) && (len + 2 < out_len); ii++)
+   {
+      if (ii > 0)
+         out_buf[len++] = '\n';
+      len += format_obd_sample(&last_samples[ii], out_buf + len, out_len - len);
+   }
+
+   return(len);
+}
+
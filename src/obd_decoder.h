@@ -0,0 +1,50 @@
+/*
+   obd_decoder.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Decodes ECU replies to typed samples in engineering units.
+                Used by the server, no GTK dependencies.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_DECODER_INCLUDED
+#define OBD_DECODER_INCLUDED
+
+#define OBD_SAMPLE_VALUE 1      /* Scaled number with units, Mode 01 PIDs and ATRV. */
+#define OBD_SAMPLE_TEXT 2       /* DTC code, VIN or ECU name. */
+#define OBD_SAMPLE_TEXT_LEN 32
+#define OBD_MODE_INTERFACE 0x00 /* Sample from the interpreter, not an ECU. */
+#define OBD_PID_VOLTAGE 0x00    /* ATRV battery voltage. */
+#define MAX_DECODED_SAMPLES 16
+#define MAX_UNITS_REPLY_LEN 512
+
+struct _OBD_Sample {
+   unsigned int pid_mode;
+   unsigned int pid_num;
+   int sample_type;
+   long long timestamp_ms;
+   double value;
+   const char *units;
+   char text[OBD_SAMPLE_TEXT_LEN];
+};
+
+typedef struct _OBD_Sample OBD_Sample;
+
+/* obd_decoder.c */
+void init_obd_decoder();
+int decode_dtc(unsigned char *dtc_bytes, char *dtc_code);
+int decode_ecu_reply(char *ecu_reply, long long timestamp_ms, OBD_Sample *samples, int max_samples);
+int format_obd_sample(OBD_Sample *sample, char *out_buf, int out_len);
+int decode_ecu_data(char *ecu_reply, long long timestamp_ms);
+int get_decoded_sample(unsigned int pid_mode, unsigned int pid_num, OBD_Sample *sample);
+int get_units_reply(char *ecu_reply, char *out_buf, int out_len);
+int get_decoded_count();
+OBD_Sample *get_last_decoded_samples(int *sample_count);
+
+#endif
+
@@ -36,8 +36,20 @@
 #define MAX_COPY_LEN 4088
 #define MAX_SERIAL_BUF_LEN 256
 #define OBD_WAIT_TIMEOUT 100000
+#define ELM_AT_TIMEOUT_MS 500         /* Interpreter AT commands. */
+#define ELM_OBD_TIMEOUT_MS 1000       /* ECU requests, ELM327 default ATST is ~200ms. */
+#define ELM_RESET_TIMEOUT_MS 3000     /* ATZ and ATWS reset commands. */
+#define ELM_SEARCH_TIMEOUT_MS 10000   /* Automatic protocol search, reply contains SEARCHING... */
+#define ELM_WATCHDOG_LIMIT 3          /* Consecutive timeouts before the interpreter is reset. */
 #define NUM_PI 3.1415926535897932384626433832795028841971693993751
 #define LOG_FILE "./obd-mon-data.log"
+#define MAX_PENDING_REQUESTS 64       /* Client requests waiting for a reply, see send_ecu_request(). */
+#define MAX_OBD_ADAPTERS 8            /* Serial ports driven by one server process. */
+#define POLL_LEASE_MS 10000           /* Datagram POLL and SUB registrations lapse unless renewed. */
+#define POLL_REFRESH_MS 3000          /* Clients renew their registrations, see register_gauge_pids(). */
+
+/* Server state with one copy for each adapter thread, see obd_monitor_server.c. */
+#define ADAPTER_LOCAL __thread
 
 /* TODO: PID Message Codes. */
 
@@ -61,6 +73,14 @@ struct _DialPoint {
 
 typedef struct _DialPoint DialPoint;
 
+struct _Pending_Request {
+   unsigned int request_id;      /* 0 = free slot. */
+   long long sent_ms;
+   char ecu_query[MAX_ECU_QUERY_LEN];
+};
+
+typedef struct _Pending_Request Pending_Request;
+
 /* Function Prototypes. */
 
 /* obd_monitor_gui.c */
@@ -80,8 +100,11 @@ int xfree(char *buf, int len);
 char* xitoa(int value, char* result, int len, int base);
 int xstrcpy(char *out_buf, char *in_buf, int start, int end);
 int xhextoascii(char *out_buf, char *in_buf);
+int xhexspace(char *out_buf, char *in_buf, int out_len);
 int print_help();
 int get_time_string(char *tstr, int slen);
+long long get_monotonic_ms();
+long long get_monotonic_us();
 /* int get_ip_address(char *interface, char *ip_addr); */
 int validate_ipv4_address(char *ipv4_addr);
 int validate_ipv6_address(char *ipv6_addr);
@@ -94,15 +117,30 @@ int replacechar(char *str, char orig, char rep);
 
 /* log.c */
 int open_log_file(char *startup_path, char *log_file_name);
+void set_log_tag(char *tag);
 int print_log_entry(char *estr);
 void close_log_file();
+int start_log_thread();
+void stop_log_thread();
 
 /* sockets.c */
 int init_client_socket(char *server, char *port);
+int init_unix_client_socket(char *path);
+int init_stream_client_socket(char *server, char *port);
+int connect_obd_server(char *address);
+int send_server_msg(char *msg, int msg_len);
+int recv_server_frame(char *msg, int max_len);
 int init_server_socket(char *port);
 int send_ecu_msg(char *query);
 int recv_ecu_msg(char *msg);
 int init_obd_comms(char *obd_msg);
+int send_poll_request(int interval_ms, char *pid_list);
+int send_subscribe_request(int subscribe, char *pid_list);
+int send_format_request(int binary);
+unsigned int send_ecu_request(char *query);
+int recv_ecu_reply_msg(char *msg, unsigned int *request_id, long long *latency_ms);
+int get_pending_request_count();
+int expire_pending_requests(int timeout_ms);
 int server_connect();
 int get_ecu_connected();
 void set_ecu_connected(int cstatus);
@@ -19,6 +19,7 @@
 
 #include "obd_monitor.h"
 #include "protocols.h"
+#include "wire_protocol.h"
 #include "gui_dialogs.h"
 #include "gui_gauges.h"
 #include "gui_gauges_aux.h"
@@ -142,18 +143,10 @@ void print_msg(GtkWidget *widget, gpointer window)
 
 gint send_obd_message_60sec_callback (gpointer data)
 {
+   /* Gauge PIDs are polled by the server, see register_gauge_pids(). */
    send_ecu_msg("ATRV\r");  /* Battery Voltage */
    send_ecu_msg("01 01\r"); /* Get MIL status and DTC count. */
    send_ecu_msg("03\r");    /* Get DTC codes. */
-   send_ecu_msg("01 05\r"); /* Coolant Temperature */
-   send_ecu_msg("01 2F\r"); /* Fuel Tank Level */
-   send_ecu_msg("01 0F\r"); /* Intake Air Temperature */
-   send_ecu_msg("01 5C\r"); /* Oil Temperature */
-   send_ecu_msg("01 0A\r"); /* Fuel Pressure */
-   send_ecu_msg("01 0B\r"); /* MAP Pressure */
-   send_ecu_msg("01 5E\r"); /* Fuel Flow Rate */
-   send_ecu_msg("01 0C\r"); /* Engine RPM */
-   send_ecu_msg("01 0D\r"); /* Vehicle Speed */
    
    return(TRUE);
 }
@@ -178,12 +171,22 @@ gint send_obd_message_10sec_callback (gpointer data)
    return(TRUE);
 }
 
-gint send_obd_message_1sec_callback (gpointer data)
+void register_gauge_pids()
 {
+   /* The server schedules these requests and sends the replies. A POLL
+      lapses after POLL_LEASE_MS, sending it again renews it and registers
+      the PIDs again after a server restart. */
+   send_poll_request(250, "01 0C 0D");                  /* Engine RPM, Vehicle Speed */
+   send_poll_request(1000, "01 11 5A 0B");              /* Throttle, Accelerator, MAP Pressure */
+   send_poll_request(10000, "01 05 2F 0F 5C 0A 5E");    /* Temperatures, Fuel Level, Pressure and Flow Rate */
+
+   return;
+}
+
+gint refresh_gauge_pids_callback (gpointer data)
+{
+   register_gauge_pids();
 
-   send_ecu_msg("01 0C\r"); /* Engine RPM */
-   send_ecu_msg("01 0D\r"); /* Vehicle Speed */
-   
    return(TRUE);
 }
 
@@ -191,15 +194,20 @@ gint recv_obd_message_callback (gpointer data)
 {
    char msg_buf[256];
    char log_buf[512];
+   unsigned int request_id;
+   long long latency_ms;
    int n, msg_num;
    
    memset(msg_buf, 0, 256);
    memset(log_buf, 0, 512);
 
-   n = recv_ecu_msg(msg_buf);
-   if (n > 0)
+   /* Read every pending message, the server sends polled PIDs unrequested. */
+   while ((n = recv_ecu_reply_msg(msg_buf, &request_id, &latency_ms)) > 0)
    {
-      msg_num = parse_obd_msg(msg_buf);
+      if (is_wire_datagram((unsigned char *)msg_buf, n))
+         msg_num = parse_wire_msg((unsigned char *)msg_buf, n); /* Scaled samples, see send_format_request(). */
+      else
+         msg_num = parse_obd_msg(msg_buf);
       if (msg_num < 0)
       {
          /* TODO: Log an error message. */
@@ -251,8 +259,10 @@ void ecu_connect_callback(GtkWidget *widget, gpointer window)
       /* send_ecu_msg("01 5C\r"); /* Oil Temperature */ 
       send_ecu_msg("03\r");      
       
+      register_gauge_pids();
+      
+      g_timeout_add (POLL_REFRESH_MS, refresh_gauge_pids_callback, (gpointer)window);
       g_timeout_add (60000, send_obd_message_60sec_callback, (gpointer)window);
-      g_timeout_add (1000, send_obd_message_1sec_callback, (gpointer)window);
       g_timeout_add (200, recv_obd_message_callback, (gpointer)window);  
  
    }
@@ -822,9 +832,11 @@ int main(int argc, char *argv[])
          send_ecu_msg("01 5C\r"); /* Oil Temperature */
          send_ecu_msg("03\r");
          
+         register_gauge_pids();
+         
+         g_timeout_add (POLL_REFRESH_MS, refresh_gauge_pids_callback, (gpointer)window);
          g_timeout_add (60000, send_obd_message_60sec_callback, (gpointer)window);
          /* g_timeout_add (10000, send_obd_message_10sec_callback, (gpointer)window); */
-         g_timeout_add (1000, send_obd_message_1sec_callback, (gpointer)window);
          g_timeout_add (100, recv_obd_message_callback, (gpointer)window);
          set_status_msg("Connected to ECU.\0");
   
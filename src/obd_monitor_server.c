@@ -17,6 +17,11 @@
                 information and fault codes from the engine control unit using 
                 the OBD-II protocol.
 
+                Up to MAX_OBD_ADAPTERS serial adapters, one per vehicle,
+                are driven by one server. Each adapter has its own UDP
+                port, network thread and serial thread, clients choose the
+                vehicle with the port.
+
    Date: 30/11/2017
    
 */
@@ -28,6 +33,9 @@
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #ifdef _WINSOCK
 
@@ -38,6 +46,8 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <sys/epoll.h>
+#include <poll.h>
 
 #endif
 
@@ -47,9 +57,59 @@
 #include "obd_monitor.h"
 
 #include "rs232.h"
+#include "request_queue.h"
+#include "pid_scheduler.h"
+#include "subscriptions.h"
+#include "response_cache.h"
+#include "pid_table.h"
+#include "response_count.h"
+#include "baud_rate.h"
+#include "binary_clients.h"
+#include "obd_decoder.h"
+#include "udp_batch.h"
+#include "elm_parser.h"
+#include "serial_thread.h"
+#include "telemetry.h"
+#include "transport.h"
+#include "server_stats.h"
 
 
 #define DEFAULT_UDP_PORT 8989
+#define MAX_EPOLL_EVENTS 8
+#define ECU_TIMEOUT_MSG "ERROR: TIMEOUT"
+#define ECU_NO_DATA_MSG "NO DATA"
+#define MAX_INTERFACE_NAME_LEN 32
+
+/* One serial adapter and vehicle, each has a network and a serial thread. */
+struct _OBD_Adapter {
+   char interface_name[MAX_INTERFACE_NAME_LEN];
+   int serial_port;
+   int udp_port;
+   int cache_ttl;
+   pthread_t thread_id;
+};
+
+typedef struct _OBD_Adapter OBD_Adapter;
+
+OBD_Adapter adapter_list[MAX_OBD_ADAPTERS];
+
+/* The request currently being handled by the ELM327 interpreter. */
+ADAPTER_LOCAL ECU_Request active_request;
+ADAPTER_LOCAL int serial_busy;
+ADAPTER_LOCAL unsigned int serial_exchange_id;           /* Exchange in flight in the serial thread. */
+ADAPTER_LOCAL long long serial_start_time;
+ADAPTER_LOCAL long long serial_deadline;
+ADAPTER_LOCAL int watchdog_count;
+
+/* Compact session: echo, linefeeds, spaces and headers off. */
+const char *elm_session_commands[] = { "ATE0\r", "ATL0\r", "ATS0\r", "ATH0\r", NULL };
+
+/* Mode 01 requests sent together in one multi-PID request, CAN only. */
+ADAPTER_LOCAL ECU_Request batch_requests[MAX_BATCH_PIDS];
+ADAPTER_LOCAL int batch_count;
+ADAPTER_LOCAL int multi_pid_enabled;
+ADAPTER_LOCAL UDP_Batch recv_batch;                      /* Client datagrams, one recvmmsg() per pass. */
+ADAPTER_LOCAL ECU_Request recv_requests[MAX_UDP_BATCH];
 
 
 void fatal_error(const char *error_msg)
@@ -62,22 +122,22 @@ void fatal_error(const char *error_msg)
 int init_serial_comms(char *interface_name)
 {
   int cport_nr=0;        /* /dev/ttyS0 (COM1 on windows) */
-  int bdrate=9600;       /* 9600 baud */
+  int bdrate=ELM_DEFAULT_BAUD_RATE; /* 9600 baud, faster rates are negotiated with ATBRD. */
   char mode[]={'8','N','1',0};
   
   cport_nr = RS232_GetPortnr(interface_name);
   if (cport_nr == -1)
   {
-     printf("init_serial_comms() ERROR: Cannot get com port number.\n");
-     exit(-1);
+     printf("init_serial_comms() ERROR: Cannot get com port number: %s\n", interface_name);
+     return(-1);
   }
 
   printf("init_serial_comms() Serial port number: %i\n",cport_nr);
 
   if(RS232_OpenComport(cport_nr, bdrate, mode))
   {
-    printf("innit_serial_comms() ERROR: Cannot open comport!\n");
-    exit(-1);
+    printf("innit_serial_comms() ERROR: Cannot open comport: %s\n", interface_name);
+    return(-1);
   }
   
   return(cport_nr);
@@ -85,6 +145,7 @@ int init_serial_comms(char *interface_name)
 
 int send_ecu_query(int serial_port, char *ecu_query)
 {
+    char out_query[MAX_SERIAL_BUF_LEN];
     int out_msg_len = 0;
 /*  struct timespec reqtime;
     reqtime.tv_sec = 0;
@@ -98,9 +159,12 @@ int send_ecu_query(int serial_port, char *ecu_query)
       return(0);
     }
 
-    RS232_SendBuf(serial_port, (unsigned char *)ecu_query, out_msg_len);
+    /* Mode 01 requests get the expected response count, "01 0C 1\r". */
+    out_msg_len = add_response_count(ecu_query, out_query, MAX_SERIAL_BUF_LEN);
+
+    RS232_SendBuf(serial_port, (unsigned char *)out_query, out_msg_len);
 
-    printf("send_ecu_query() TXD %i bytes: %s\n", out_msg_len, ecu_query);
+    printf("send_ecu_query() TXD %i bytes: %s\n", out_msg_len, out_query);
 
     /* nanosleep(100000);   sleep for 1 millisecond */
     RS232_flushTX(serial_port);
@@ -108,144 +172,341 @@ int send_ecu_query(int serial_port, char *ecu_query)
     return(out_msg_len);
 }
 
-int recv_ecu_reply(int serial_port, char *ecu_reply)
+/*
+   Function: queue_ecu_query()
+
+   Purpose : Passes a request to the serial thread, once the event loop is
+           : running the serial port is only used by that thread.
+   Input   : Request message.
+   Output  : Returns the length of the request sent, 0 on error.
+*/
+int queue_ecu_query(char *ecu_query)
 {
-   int in_msg_len;
-   unsigned char in_buf[MAX_SERIAL_BUF_LEN];
-   int interpreter_ready_status = 0;
-   int msg_idx = 0;
+   char out_query[MAX_SERIAL_BUF_LEN];
+   int out_msg_len;
+
+   out_msg_len = strlen(ecu_query);
+   if ((out_msg_len < 1) || (out_msg_len >= MAX_SERIAL_BUF_LEN))
+   {
+      printf("queue_ecu_query() ERROR: Bad message length!\n");
+      return(0);
+   }
+
+   /* Mode 01 requests get the expected response count, "01 0C 1\r". */
+   out_msg_len = add_response_count(ecu_query, out_query, MAX_SERIAL_BUF_LEN);
 
-   while (interpreter_ready_status == 0) /* TODO: need a timeout in case lose comms with interpreter. */
+   serial_exchange_id = queue_serial_request(out_query, out_msg_len);
+   if (serial_exchange_id == 0)
    {
-      int buf_idx;
+      return(0);
+   }
+
+   printf("queue_ecu_query() TXD %i bytes: %s\n", out_msg_len, out_query);
+   note_serial_request(out_msg_len);
+
+   return(out_msg_len);
+}
+
+/*
+   Function: get_request_timeout()
+
+   Purpose : Gets the reply deadline for a request. Resets take longer than
+           : other AT commands and ECU requests are bounded by the ELM327
+           : protocol timeout.
+   Input   : Request message.
+   Output  : Timeout in milliseconds.
+*/
+int get_request_timeout(char *ecu_query)
+{
+   if ((strncmp(ecu_query, "ATZ", 3) == 0) || (strncmp(ecu_query, "ATWS", 4) == 0))
+   {
+      return(ELM_RESET_TIMEOUT_MS);
+   }
+   else if ((ecu_query[0] == 'A') || (ecu_query[0] == 'a'))
+   {
+      return(ELM_AT_TIMEOUT_MS);
+   }
+
+   return(ELM_OBD_TIMEOUT_MS);
+}
+
+/*
+   Function: recv_ecu_reply()
 
-      memset(in_buf, 0, MAX_SERIAL_BUF_LEN);
+   Purpose : Waits with poll() for the interpreter reply until the '>' prompt
+           : arrives or the deadline expires. The deadline is only extended
+           : once, if the interpreter reports an automatic protocol search.
+   Input   : Serial port number, reply parser and timeout in milliseconds.
+   Output  : Returns the reply length or -1 on timeout or serial error.
+*/
+int recv_ecu_reply(int serial_port, ELM_Parser *parser, int timeout_ms)
+{
+   struct pollfd pfd;
+   int in_msg_len, result;
+   unsigned char in_buf[MAX_SERIAL_BUF_LEN];
+   int events = 0;
+   long long start_time, deadline, remaining;
+
+   pfd.fd = RS232_GetFileDescriptor(serial_port);
+   pfd.events = POLLIN;
+   start_time = get_monotonic_ms();
+   deadline = start_time + timeout_ms;
 
-      if ((in_msg_len = RS232_PollComport(serial_port, in_buf, MAX_SERIAL_BUF_LEN)) > 0)
+   while ((events & ELM_REPLY_PROMPT) == 0)
+   {
+      remaining = deadline - get_monotonic_ms();
+      if (remaining <= 0)
       {
-         /* printf("recv_ecu_reply(): RXD00 buf %i bytes: %s\n", in_msg_len, in_buf); */
- 
-         if (in_buf[0] == '>')
-         {
-            /* TODO: something wrong here!!! */
-            /* ELM327 is ready to receive another request, so exit. */
-            /* See ELM327 datasheet for vague details of protocol.  */
-            interpreter_ready_status = 1;
-            printf("recv_ecu_reply(): RXD01 > Interpreter Ready.\n");
-         }
-         else
+         printf("recv_ecu_reply() <ERROR>: Timeout after %i ms, partial reply: %s\n", timeout_ms, parser->reply);
+         return(-1);
+      }
+
+      pfd.revents = 0;
+      result = poll(&pfd, 1, (int)remaining);
+      if (result < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         perror("recv_ecu_reply() <ERROR>: poll");
+         return(-1);
+      }
+      if ((result == 0) || ((pfd.revents & POLLIN) == 0))
+      {
+         if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
          {
-         
-            for (buf_idx = 0; buf_idx < in_msg_len; buf_idx++)
-            {
-               if (in_buf[buf_idx] < 32)   /* Ignore unreadable control-codes except 0x0D message delimiter. */
-               {
-                  /* if (in_buf[buf_idx] == '\r')  End of message ASCII value 0x0D == \r not ASCII value 0x0A == \n */
-                  
-                     ecu_reply[msg_idx] = '!'; /* Delimiter between request and response. */
-                     msg_idx++;
-                  
-               }
-               else
-               {
-
-                  if (in_buf[buf_idx] == '>')
-                  {
-                     /* ELM327 is ready to receive another request, so exit. */
-                     /* See ELM327 datasheet for vague details of protocol.  */
-                     interpreter_ready_status = 1;
-                     /* DEBUG: view raw messages. */
-                     printf("recv_ecu_reply(): RXD02 > Interpreter Ready.\n");
-                  }
-                  else
-                  {
-                     ecu_reply[msg_idx] = in_buf[buf_idx]; /* Add character to the reply message buffer. */
-                     msg_idx++;
-                  }
-               }
-            }  
+            printf("recv_ecu_reply() <ERROR>: Serial port closed.\n");
+            return(-1);
          }
+         continue;
+      }
+
+      while ((in_msg_len = RS232_PollComport(serial_port, in_buf, MAX_SERIAL_BUF_LEN)) > 0)
+      {
+         events |= feed_elm_parser(parser, in_buf, in_msg_len);
+         if (events & ELM_REPLY_PROMPT)
+            break;
+      }
+
+      if (events & ELM_LINE_SEARCHING)
+      {
+         events &= ~ELM_LINE_SEARCHING;
+         deadline = start_time + ELM_SEARCH_TIMEOUT_MS;
       }
    }
 
+   printf("recv_ecu_reply(): RXD02 > Interpreter Ready.\n");
+
    RS232_flushRX(serial_port); 
 
-   /* printf("recv_ecu_reply(): RXD buf %i bytes: %s\n", in_msg_len, in_buf); */
-   printf("recv_ecu_reply(): RXD msg %i bytes: %s\n", msg_idx, ecu_reply);
+   printf("recv_ecu_reply(): RXD msg %i bytes: %s\n", parser->reply_len, parser->reply);
+
+   return(parser->reply_len);
+}
+
+/*
+   Function: ecu_exchange()
+
+   Purpose : Sends a request to the interpreter and waits for the reply
+           : with the deadline for that request.
+   Input   : Serial port number, request and reply parser.
+   Output  : Returns the reply length or -1 on error.
+*/
+int ecu_exchange(int serial_port, char *ecu_query, ELM_Parser *parser)
+{
+   init_elm_parser(parser, ecu_query);
+
+   if (send_ecu_query(serial_port, ecu_query) <= 0)
+   {
+      return(-1);
+   }
+
+   return(recv_ecu_reply(serial_port, parser, get_request_timeout(ecu_query)));
+}
+
+
+/*
+   Function: set_multi_pid_mode()
+
+   Purpose : Enables multi-PID Mode 01 requests if the interpreter is using
+           : a CAN protocol, ATSP 6 to 9. The ATDPN reply is the protocol
+           : number, with an 'A' prefix if it was found by automatic search.
+   Input   : ATDPN reply.
+   Output  : Returns 1 if multi-PID requests are enabled.
+*/
+int set_multi_pid_mode(ELM_Parser *dpn_reply)
+{
+   ELM_Line *response;
+   char *protocol;
+   int len;
+
+   multi_pid_enabled = 0;
+
+   response = get_elm_response(dpn_reply);
+   if (response != NULL)
+   {
+      protocol = dpn_reply->reply + response->text_idx;
+      len = response->text_len;
+      if (protocol[0] == 'A')
+      {
+         protocol++;
+         len--;
+      }
+      if ((len == 1) && (protocol[0] >= '6') && (protocol[0] <= '9'))
+         multi_pid_enabled = 1;
+   }
+
+   printf("set_multi_pid_mode(): Multi-PID requests %s.\n", multi_pid_enabled ? "enabled" : "disabled");
+
+   return(multi_pid_enabled);
+}
+
+/*
+   Function: discover_ecu_responses()
+
+   Purpose : Reads the supported Mode 01 PIDs of each ECU with headers on,
+           : so requests can be sent with the expected response count.
+           : Headers are turned off again by init_elm_session().
+   Input   : Serial port number.
+   Output  : Returns the number of ECUs found.
+*/
+int discover_ecu_responses(int serial_port)
+{
+   ELM_Parser elm_reply;
+   char *recv_msg = elm_reply.reply;
+   char query[16];
+   unsigned int base_pid;
+   int ecus;
+
+   init_response_count();
+
+   if (ecu_exchange(serial_port, "ATH1\r", &elm_reply) < 0)
+   {
+      return(0);
+   }
+
+   for (base_pid = 0; base_pid <= 0xE0; base_pid += 0x20)
+   {
+      sprintf(query, "01 %.2X\r", base_pid);
+      if (ecu_exchange(serial_port, query, &elm_reply) < 0)
+         break;
+      print_log_entry(recv_msg);
+      if (parse_discovery_reply(recv_msg, base_pid) == 0)
+         break;
+      if ((base_pid == 0xE0) || (is_pid_supported(base_pid + 0x20) == 0))
+         break; /* Next supported PID list is not supported. */
+   }
+
+   ecus = get_ecu_count();
+   set_response_count_enabled(ecus > 0);
+   printf("discover_ecu_responses(): %i ECUs found.\n", ecus);
+
+   return(ecus);
+}
+
+/*
+   Function: init_elm_session()
+
+   Purpose : Sets up a compact interpreter session, echo, linefeeds,
+           : spaces and headers off. A reply such as "01 0C!41 0C 1A F8"
+           : becomes "410C1AF8", about half the bytes at 9600 baud.
+   Input   : Serial port number.
+*/
+void init_elm_session(int serial_port)
+{
+   ELM_Parser elm_reply;
+   int ii;
+
+   for (ii = 0; elm_session_commands[ii] != NULL; ii++)
+   {
+      ecu_exchange(serial_port, (char *)elm_session_commands[ii], &elm_reply);
+      printf("init_elm_session(): %s", elm_session_commands[ii]);
+   }
 
-   return(msg_idx);
+   return;
 }
 
+/*
+   Function: queue_elm_session()
+
+   Purpose : Queues the session setup commands after the interpreter has
+           : been reset, the replies are logged and not sent to a client.
+   Input   : None.
+*/
+void queue_elm_session()
+{
+   ECU_Request req;
+   int ii;
+
+   for (ii = 0; elm_session_commands[ii] != NULL; ii++)
+   {
+      memset(&req, 0, sizeof(ECU_Request));
+      strcpy(req.ecu_query, elm_session_commands[ii]);
+      req.query_len = strlen(req.ecu_query);
+      enqueue_request(&req);
+   }
+
+   return;
+}
 
 /* TODO: Temp protocol test function, move to functional test module. */
-void interface_check(int serial_port)
+void interface_check(int serial_port, char *interface_name)
 {
-   char recv_msg[MAX_SERIAL_BUF_LEN];
+   ELM_Parser elm_reply;
+   char *recv_msg = elm_reply.reply;
    /* struct timespec reqtime;
    reqtime.tv_sec = 1;
    reqtime.tv_nsec = 0; */
    
-   memset(recv_msg, 0, 256);
-   
-   send_ecu_query(serial_port, "ATZ\r\0"); /* Reset the ELM327 OBD interpreter. */
-   recv_ecu_reply(serial_port, recv_msg);
+   ecu_exchange(serial_port, "ATZ\r\0", &elm_reply); /* Reset the ELM327 OBD interpreter. */
    printf("ATZ: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
 
-   send_ecu_query(serial_port, "ATRV\r\0"); /* Get battery voltage from interface. */
-   recv_ecu_reply(serial_port, recv_msg);
+   negotiate_baud_rate(serial_port, interface_name); /* ATZ sets the default rate, so switch after it. */
+
+   ecu_exchange(serial_port, "ATRV\r\0", &elm_reply); /* Get battery voltage from interface. */
    printf("ATRV: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
    
-   send_ecu_query(serial_port, "ATDP\r\0");  /* Get OBD protocol name from interface. */
-   recv_ecu_reply(serial_port, recv_msg);
+   ecu_exchange(serial_port, "ATDP\r\0", &elm_reply);  /* Get OBD protocol name from interface. */
    printf("ATDP: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
    
-   send_ecu_query(serial_port, "ATI\r\0");  /* Get interpreter version ID. */
-   recv_ecu_reply(serial_port, recv_msg);
+   ecu_exchange(serial_port, "ATDPN\r\0", &elm_reply);  /* Get OBD protocol number, multi-PID requests need CAN. */
+   printf("ATDPN: %s\n", recv_msg);
+   print_log_entry((char *)recv_msg);
+   set_multi_pid_mode(&elm_reply);
+   
+   ecu_exchange(serial_port, "ATI\r\0", &elm_reply);  /* Get interpreter version ID. */
    printf("ATI: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
    
-   send_ecu_query(serial_port, "09 02\r\0"); /* Get vehicle VIN number. */
-   recv_ecu_reply(serial_port, recv_msg);
+   ecu_exchange(serial_port, "09 02\r\0", &elm_reply); /* Get vehicle VIN number. */
    printf("VIN: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
    
-   send_ecu_query(serial_port, "09 0A\r\0"); /* Get ECU name. */
-   recv_ecu_reply(serial_port, recv_msg);
+   ecu_exchange(serial_port, "09 0A\r\0", &elm_reply); /* Get ECU name. */
    printf("ECUName: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
    
-   send_ecu_query(serial_port, "01 01\r\0"); /* Get DTC Count and MIL status. */
-   recv_ecu_reply(serial_port, recv_msg);
+   ecu_exchange(serial_port, "01 01\r\0", &elm_reply); /* Get DTC Count and MIL status. */
    printf("MIL: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
    
-   send_ecu_query(serial_port, "01 00\r\0"); /* Get supported PIDs 1 - 32 for MODE 1. */
-   recv_ecu_reply(serial_port, recv_msg);
+   ecu_exchange(serial_port, "01 00\r\0", &elm_reply); /* Get supported PIDs 1 - 32 for MODE 1. */
    printf("PID01: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
    
-   send_ecu_query(serial_port, "09 00\r\0"); /* Get supported PIDs 1 - 32 for MODE 9. */
-   recv_ecu_reply(serial_port, recv_msg);
+   ecu_exchange(serial_port, "09 00\r\0", &elm_reply); /* Get supported PIDs 1 - 32 for MODE 9. */
    printf("PID09: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
    
-   send_ecu_query(serial_port, "03\r\0");      /* Get DTCs that are set. */
-   recv_ecu_reply(serial_port, recv_msg);
+   ecu_exchange(serial_port, "03\r\0", &elm_reply);      /* Get DTCs that are set. */
    printf("DTC: %s\n", recv_msg);
    print_log_entry((char *)recv_msg);
-   memset(recv_msg, 0, 256);
+
+   discover_ecu_responses(serial_port);
+
+   init_elm_session(serial_port);
 
    /* nanosleep(&reqtime, NULL);  Sleep for 1 Second. */
 
@@ -253,159 +514,1195 @@ void interface_check(int serial_port)
 }
 
 
-int main(int argc, char *argv[])
+/* Decodes a reply once for the UNITS clients and the telemetry segment. */
+int decode_ecu_samples(char *ecu_reply)
+{
+   OBD_Sample *samples;
+   int sample_count;
+
+   decode_ecu_data(ecu_reply, get_monotonic_ms());
+   samples = get_last_decoded_samples(&sample_count);
+
+   return(publish_telemetry_samples(samples, sample_count));
+}
+
+/*
+   Function: send_ecu_data()
+
+   Purpose : Decodes the ECU reply for one PID and sends it to the client,
+           : the PID subscribers and any clients waiting on the same
+           : request.
+   Input   : Request and ECU reply without the echo.
+   Output  : Returns the number of clients the reply was sent to.
+*/
+int send_ecu_data(ECU_Request *req, char *ecu_data)
+{
+   unsigned int pid_mode, pid_num;
+   int n;
+
+   decode_ecu_samples(ecu_data);
+
+   n = publish_ecu_reply(req, ecu_data, strlen(ecu_data));
+   n += complete_cached_response(req, ecu_data, strlen(ecu_data), get_monotonic_ms());
+   if ((req->from_client.transport != CLIENT_NONE) && (get_reply_pid(ecu_data, &pid_mode, &pid_num) == 1))
+      note_pid_sampled(pid_mode, pid_num, get_monotonic_ms()); /* Subscribers are up to date. */
+
+   return(n);
+}
+
+/*
+   Function: note_dropped_reply()
+
+   Purpose : Logs and counts a reply that could not be sent. A stream
+           : client that closed or fell behind, or a full UDP socket
+           : buffer, only loses its own reply, the server carries on.
+   Input   : Request the reply was for.
+*/
+void note_dropped_reply(ECU_Request *req)
 {
-   int sock, length, n, udp_port, serial_port;
-   socklen_t from_len;
-   struct sockaddr_in server;
-   struct sockaddr_in from_client;
-   char in_buf[MAX_BUFFER_LEN];
    char log_buf[MAX_BUFFER_LEN+64];
-   char ecu_msg[MAX_BUFFER_LEN];
-   char *pch;
-   
-   /*
-   struct timespec reqtime;
-   reqtime.tv_sec = 1;
-   reqtime.tv_nsec = 0;
+
+   note_server_error(STATS_DROPPED_REPLY);
+   snprintf(log_buf, sizeof(log_buf), "note_dropped_reply(): Reply to %.*s dropped, client gone or too slow.",
+            (int)strcspn(req->ecu_query, "\r\n"), req->ecu_query);
+   print_log_entry(log_buf);
+
+   return;
+}
+
+/*
+   Function: send_client_reply()
+
+   Purpose : Reformats an interpreter reply and sends it to the client that
+           : made the request.
+   Input   : Client request and the interpreter reply frame.
+   Output  : Returns bytes sent, 0 if the reply was dropped.
+*/
+int send_client_reply(ECU_Request *req, Serial_Frame *frame)
+{
+   char log_buf[MAX_BUFFER_LEN+64];
+   char at_msg[MAX_BUFFER_LEN]; /* AT reply or joined ISO-TP frames. */
+   char *ecu_msg = frame->ecu_reply;
+   char *ecu_data;
+   char *pch = NULL;
+   int n = 0;
+   int len;
+
+   if (frame->reply_len <= 3)
+   {
+      return(0);
+   }
+
+   /* Reformat messages before sending to the GUI. 
+      With echo on the ELM327 returns the request message plus the ECU
+      response, so break off the request header and only send the ECU
+      response to the GUI. 
    */
-    
-   if (argc < 2) 
+   ecu_data = ecu_msg + frame->response_idx;
+
+   if (frame->reply_status & ELM_LINE_ERROR) /* Interpreter sent a data error message, so ignore it. */
    {
-      udp_port = DEFAULT_UDP_PORT;
+      sprintf(log_buf, "send_client_reply(): DATA ERROR - %s\n", ecu_msg);
+      print_log_entry(log_buf);
+   }
+   else if ((req->ecu_query[0] == 'A') || (req->ecu_query[0] == 'a')) /* Interpreter AT response message. */
+   {
+      if (req->from_client.transport == CLIENT_NONE)
+      {
+         /* Session setup after a reset, no client waiting. */
+         sprintf(log_buf, "send_client_reply(): RXD AT MSG: %s", ecu_msg);
+         print_log_entry(log_buf);
+         return(0);
+      }
+
+      /* Clients find the reply type from the AT command in front of it,
+         "ATRV 12.5V", so put it back when echo is off. */
+      if ((frame->reply_status & ELM_LINE_ECHO) == 0)
+      {
+         len = strcspn(req->ecu_query, "\r\n");
+         snprintf(at_msg, MAX_BUFFER_LEN, "%.*s!%.*s", len, req->ecu_query, frame->reply_len, ecu_msg);
+      }
+      else
+      {
+         strncpy(at_msg, ecu_msg, MAX_BUFFER_LEN - 1);
+         at_msg[MAX_BUFFER_LEN - 1] = 0;
+      }
+
+      /* Replace ! with space. */
+      replacechar(at_msg, '!', ' ');
+      sprintf(log_buf, "send_client_reply(): RXD AT MSG: %s", at_msg);
+      print_log_entry(log_buf);
+      decode_ecu_samples(at_msg); /* ATRV battery voltage. */
+      
+      /* Send interpreter reply to GUI. */
+      n = send_client_data(&req->from_client, req->request_id, at_msg, strlen(at_msg));
+      if (n < 0)
+      {
+         note_dropped_reply(req);
+         n = 0;
+      }
+   }
+   else if (isxdigit((unsigned char)req->ecu_query[0])) /* ECU response message, with or without the echo. */
+   {
+      sprintf(log_buf, "send_client_reply(): RXD ECU MSG: %s", ecu_msg);
+      print_log_entry(log_buf);
+      
+      if (join_reply_frames(ecu_data, at_msg, MAX_BUFFER_LEN) > 0)
+      {
+         pch = at_msg; /* Long reply in several CAN frames. */
+      }
+      else if (frame->response_len > 0)
+      {
+         pch = ecu_data; /* First line of the ECU response. */
+         pch[frame->response_len] = 0;
+      }
+      if (pch != NULL)
+      {
+         /* Send ECU reply to the client and every subscriber of the PID. */
+         n = send_ecu_data(req, pch);
+
+         printf("send_client_reply(): Sent ECU msg to %i clients: %s\n", n, pch);
+      }
    }
    else
    {
-      udp_port = atoi(argv[1]);
+      /* Log an error message. */
+      sprintf(log_buf, "send_client_reply(): RXD Unknown ECU Message: %s", ecu_msg);
+      print_log_entry(log_buf);
    }
 
+   return(n);
+}
 
-   
-   open_log_file("./", "obd_server_log.txt");
-   
-   /* TODO: make serial port configurable, ttyUSB0 is an FTDI232 USB-RS232 Converter Module. */
-   serial_port = init_serial_comms("ttyUSB0");
-   
-   interface_check(serial_port);
-   
-   
-   
-   
-#ifdef _WINSOCK
+/*
+   Function: send_client_error()
 
-   WSADATA wsaData;
-   int iResult;
-   unsigned long iMode = 1;
-   iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
-   if (iResult != NO_ERROR)
-      printf("init_server_comms() <ERROR>: WSAStartup() failed with error: %ld\n", iResult);
+   Purpose : Tells the client its request failed, so it does not wait for
+           : a reply that will never arrive.
+   Input   : Client request and error message.
+   Output  : Returns bytes sent, 0 if the reply was dropped.
+*/
+int send_client_error(ECU_Request *req, char *error_msg)
+{
+   int n;
 
-#endif
-   
-   
-   
-   sock = socket(AF_INET, SOCK_DGRAM, 0);
+   if (req->from_client.transport == CLIENT_NONE)
+   {
+      return(0); /* Internal request, no client waiting. */
+   }
 
-   if (sock < 0) 
-      fatal_error("Opening socket");
-   
-   length = sizeof(server);
-   memset(&server, 0, length);
+   if (strcmp(error_msg, "?") == 0)
+      note_server_error(STATS_BAD_REQUEST);
 
-   server.sin_family=AF_INET;
-   server.sin_addr.s_addr=INADDR_ANY;
-   server.sin_port=htons(udp_port);
-   
-   if (bind(sock, (struct sockaddr *)&server, length) < 0) 
-      fatal_error("binding");
+   n = send_client_data(&req->from_client, req->request_id, error_msg, strlen(error_msg));
+   if (n < 0)
+   {
+      note_dropped_reply(req);
+      n = 0;
+   }
 
-   from_len = sizeof(struct sockaddr_in);
-   
-   while (1) 
-   {
-       /* Clear the buffers!!! */
-       memset(in_buf, 0, MAX_BUFFER_LEN);
-       memset(ecu_msg, 0, MAX_BUFFER_LEN);
-       
-       n = recvfrom(sock, in_buf, MAX_BUFFER_LEN, 0, (struct sockaddr *)&from_client, &from_len);
-
-       if (n < 0) 
-          fatal_error("recvfrom");
-
-       /* TODO: do some message vaidation here.
-        printf("RXD ECU Query: %s\n", in_buf); */
-
-       /* Now send the query to the interpreter and get a response. */
-       n = send_ecu_query(serial_port, in_buf);
-       if (n > 0)
-       {
-          sprintf(log_buf, "main(): TXD - %s", in_buf);
-          print_log_entry(log_buf);
-       }
-       
-       /* nanosleep(&reqtime, NULL); */
-       
-       n = recv_ecu_reply(serial_port, ecu_msg);
-       if (n > 3)
-       {
-          /* Reformat messages before sending to the GUI. 
-             ELM327 returns the request message plus the ECU response,
-             so break off the request header and only send the ECU response
-             to the GUI. 
-          */
-          if (strstr(ecu_msg, "ERROR") != 0) /* Interpreter sent a data error message, so ignore it. */
-          {
-             sprintf(log_buf, "main(): DATA ERROR - %s\n", ecu_msg);
-             print_log_entry(log_buf);
-
-          }
-          else if (ecu_msg[0] == 'A') /* TODO: or 'a' Interpreter AT response message. */
-          {
-             /* Replace ! with space. */
-             replacechar((char *)ecu_msg, '!', ' ');
-             sprintf(log_buf, "main(): RXD AT MSG: %s", ecu_msg);
-             print_log_entry(log_buf);
-             
-             /* Send interpreter reply to GUI. */
-             n = sendto(sock, ecu_msg, n, 0, (struct sockaddr *)&from_client, from_len);
-
-             if (n  < 0) 
-                fatal_error("sendto");
-          }
-          else if (ecu_msg[0] == '0') /* ELM327 sends the request header plus the ECU response message. */
-          {
-             /* replacechar((char *)ecu_msg, '!', ' '); */          
-             sprintf(log_buf, "main(): RXD ECU MSG: %s", ecu_msg);
-             print_log_entry(log_buf);
-             
-             pch = strtok((char *)ecu_msg,"!"); /* Cut off the header and delimiters. */
-             pch = strtok(NULL,"!");
-             if (pch != NULL)
-             {
-                
-                /* Send ECU reply to GUI. */
-                n = sendto(sock, pch, strlen(pch), 0, (struct sockaddr *)&from_client, from_len);
-
-                if (n  < 0) 
-                   fatal_error("sendto");
-
-                printf("main(): Sent ECU msg to GUI: %s\n", pch);
-             }
-             
-          }
-          else
-          {
-             /* Log an error message. */
-             sprintf(log_buf, "main(): RXD Unknown ECU Message: %s", ecu_msg);
-             print_log_entry(log_buf);
-          }
-       }
-       
+   return(n);
+}
+
+/*
+   Function: send_batch_reply()
+
+   Purpose : Splits a multi-PID reply and sends each PID reply as if it
+           : had been requested on its own. PIDs the ECU does not support
+           : are left out of the reply, those clients get NO DATA.
+   Input   : Interpreter reply frame.
+   Output  : Returns the number of PID replies.
+*/
+int send_batch_reply(Serial_Frame *frame)
+{
+   char log_buf[MAX_BUFFER_LEN+64];
+   char pid_replies[MAX_BATCH_PIDS][MAX_PID_REPLY_LEN];
+   char pid_header[8];
+   char *ecu_msg = frame->ecu_reply;
+   char *ecu_data;
+   unsigned int pid_mode, pid_num;
+   int ii, jj, count;
 
+   if (frame->reply_status & ELM_LINE_ERROR)
+   {
+      sprintf(log_buf, "send_batch_reply(): DATA ERROR - %s\n", ecu_msg);
+      print_log_entry(log_buf);
+      return(0);
    }
 
-   close_log_file();
-   
-   return(0);
- }
+   sprintf(log_buf, "send_batch_reply(): RXD ECU MSG: %s", ecu_msg);
+   print_log_entry(log_buf);
 
+   ecu_data = ecu_msg + frame->response_idx;
+
+   count = split_mode_01_reply(ecu_data, pid_replies, MAX_BATCH_PIDS);
+
+   for (ii = 0; ii < batch_count; ii++)
+   {
+      get_query_pid(batch_requests[ii].ecu_query, &pid_mode, &pid_num);
+      sprintf(pid_header, "41 %.2X", pid_num);
+
+      for (jj = 0; jj < count; jj++)
+      {
+         if (strncmp(pid_replies[jj], pid_header, 5) == 0)
+            break;
+      }
+
+      if (jj < count)
+      {
+         send_ecu_data(&batch_requests[ii], pid_replies[jj]);
+      }
+      else
+      {
+         note_server_error(STATS_NO_DATA);
+         send_client_error(&batch_requests[ii], ECU_NO_DATA_MSG);
+         fail_cached_response(&batch_requests[ii], ECU_NO_DATA_MSG);
+      }
+   }
+
+   printf("send_batch_reply(): Split reply into %i PID replies for %i requests.\n", count, batch_count);
+
+   return(count);
+}
+
+/*
+   Function: set_reset_query()
+
+   Purpose : ATZ returns the interpreter to its default baud rate, so once
+           : a faster rate is in use resets are sent as a warm start, ATWS,
+           : which keeps the rate.
+   Input   : Request to check.
+   Output  : Returns 1 if the request was changed.
+*/
+int set_reset_query(ECU_Request *req)
+{
+   if ((get_link_baud_rate() == ELM_DEFAULT_BAUD_RATE) || (strncmp(req->ecu_query, "ATZ", 3) != 0))
+   {
+      return(0);
+   }
+
+   strcpy(req->ecu_query, "ATWS\r");
+   req->query_len = 5;
+
+   return(1);
+}
+
+/*
+   Function: send_server_stats()
+
+   Purpose : Sends the stats of the adapter to a client, one line per
+           : message so each fits in a datagram: the counters, the
+           : latency of each exchange stage and the latencies of each PID.
+           : The counter line has the number of PID lines.
+   Input   : STATS request.
+   Output  : Returns the number of messages sent.
+*/
+int send_server_stats(ECU_Request *req)
+{
+   char stats_line[MAX_STATS_LINE_LEN];
+   int queue_depths[NUM_PRIORITY_CLASSES];
+   int ii, len, count = 0;
+
+   if (strncmp(req->ecu_query, "STATS RESET", 11) == 0)
+   {
+      init_server_stats();
+   }
+
+   for (ii = 0; ii < NUM_PRIORITY_CLASSES; ii++)
+      queue_depths[ii] = get_priority_queue_count(ii);
+
+   len = format_stats_summary(stats_line, MAX_STATS_LINE_LEN, queue_depths);
+   if (send_client_data(&req->from_client, req->request_id, stats_line, len) > 0)
+      count++;
+
+   for (ii = 0; ii < NUM_STATS_STAGES; ii++)
+   {
+      len = format_stage_stats(ii, stats_line, MAX_STATS_LINE_LEN);
+      if (send_client_data(&req->from_client, req->request_id, stats_line, len) > 0)
+         count++;
+   }
+
+   for (ii = 0; ii < get_stats_pid_count(); ii++)
+   {
+      len = format_pid_stats(ii, stats_line, MAX_STATS_LINE_LEN);
+      if (send_client_data(&req->from_client, req->request_id, stats_line, len) > 0)
+         count++;
+   }
+
+   return(count);
+}
+
+/*
+   Function: handle_client_request()
+
+   Purpose : Handles one request from a client on any transport. Server
+           : messages are handled here, ECU requests are served from the
+           : cache or queued for the interpreter.
+   Input   : Request with the client address set.
+   Output  : Returns 1 if the request was queued.
+*/
+int handle_client_request(ECU_Request *req)
+{
+   if (req->query_len == 0)
+      return(0);
+
+   note_client_request();
+
+   /* TODO: do some message vaidation here. */
+
+   /* Optional "ID <hex> " prefix, echoed in every reply to the request. */
+   if (set_request_id(req) < 0)
+   {
+      send_client_error(req, "?");
+      return(0);
+   }
+
+   if ((strncmp(req->ecu_query, "POLL", 4) == 0) || (strncmp(req->ecu_query, "UNPOLL", 6) == 0))
+   {
+      /* Server polling schedule request, not sent to the interpreter. */
+      if (parse_poll_request(req) < 0)
+         send_client_error(req, "?");
+      return(0);
+   }
+
+   if ((strncmp(req->ecu_query, "SUB", 3) == 0) || (strncmp(req->ecu_query, "UNSUB", 5) == 0))
+   {
+      if (parse_subscribe_request(req) < 0)
+         send_client_error(req, "?");
+      return(0);
+   }
+
+   if (strncmp(req->ecu_query, "STATS", 5) == 0)
+   {
+      /* Latency and error stats of this adapter, "STATS RESET" clears them. */
+      send_server_stats(req);
+      return(0);
+   }
+
+   if (strncmp(req->ecu_query, "FORMAT", 6) == 0)
+   {
+      /* Reply format for this client, text or binary samples. */
+      if (parse_format_request(req) < 0)
+         send_client_error(req, "?");
+      return(0);
+   }
+
+   /* Optional "PRI <class> " prefix, otherwise the class follows the mode. */
+   if (set_request_priority(req) < 0)
+   {
+      send_client_error(req, "?");
+      return(0);
+   }
+
+   set_reset_query(req);
+
+   /* Identical requests share one exchange with the interpreter. */
+   if (serve_from_cache(req, get_monotonic_ms()) > 0)
+   {
+      note_cache_reply();
+      return(0);
+   }
+
+   if (enqueue_request(req) > 0)
+   {
+      note_queue_depth(req->priority, get_priority_queue_count(req->priority));
+      set_response_pending(req);
+      return(1);
+   }
+
+   note_server_error(STATS_QUEUE_FULL);
+
+   return(0);
+}
+
+/*
+   Function: read_client_requests()
+
+   Purpose : Drains all pending datagrams from a non-blocking UDP or Unix
+           : datagram socket into the request queue.
+   Input   : Datagram socket.
+   Output  : Returns the number of requests queued.
+*/
+int read_client_requests(int sock)
+{
+   ECU_Request *req;
+   long long now_us;
+   int n, ii, count = 0;
+
+   if (recv_batch.buf[0] == NULL)
+   {
+      /* Datagrams are received straight into the request buffers. */
+      for (ii = 0; ii < MAX_UDP_BATCH; ii++)
+         set_batch_buffer(&recv_batch, ii, recv_requests[ii].ecu_query, MAX_SERIAL_BUF_LEN, &recv_requests[ii].from_client.addr);
+   }
+
+   do
+   {
+      n = recv_udp_batch(sock, &recv_batch, 0);
+      if (n < 0)
+         fatal_error("recvmmsg");
+
+      now_us = get_monotonic_us();
+      for (ii = 0; ii < n; ii++)
+      {
+         req = &recv_requests[ii];
+         req->rx_time_us = now_us;
+         req->from_client.transport = CLIENT_DGRAM;
+         req->from_client.sock = sock;
+         req->from_client.conn_id = 0;
+         req->from_client.addr_len = recv_batch.addr_len[ii];
+         req->query_len = recv_batch.msg_len[ii];
+
+         count += handle_client_request(req);
+      }
+   } while (n == MAX_UDP_BATCH);
+
+   return(count);
+}
+
+/*
+   Function: read_stream_requests()
+
+   Purpose : Handles all the whole request frames waiting on a TCP or
+           : Unix stream connection.
+   Input   : Connection socket.
+   Output  : Returns the number of requests queued.
+*/
+int read_stream_requests(int stream_sock)
+{
+   ECU_Request req;
+   int n, count = 0;
+
+   memset(&req, 0, sizeof(req));
+   while ((n = recv_stream_msg(stream_sock, req.ecu_query, MAX_SERIAL_BUF_LEN, &req.from_client)) > 0)
+   {
+      req.query_len = n;
+      req.rx_time_us = get_monotonic_us();
+      count += handle_client_request(&req);
+   }
+
+   return(count);
+}
+
+/*
+   Function: drop_client_requests()
+
+   Purpose : Removes the queued requests of a client that closed and its
+           : place in the waiter lists. A request other clients wait on
+           : is kept without a client, so they still get the reply. The
+           : exchange in flight is finished without a client.
+   Input   : Client address.
+   Output  : Returns the number of queued requests removed.
+*/
+int drop_client_requests(Client_Address *client)
+{
+   ECU_Request *queued;
+   ECU_Request req;
+   int ii, position = 0, count = 0;
+
+   remove_cache_waiters(client);
+
+   while ((queued = get_queued_request(position)) != NULL)
+   {
+      if (same_client(&queued->from_client, client) == 0)
+      {
+         position++;
+      }
+      else if (get_cache_waiter_count(queued) > 0)
+      {
+         memset(&queued->from_client, 0, sizeof(Client_Address));
+         position++;
+      }
+      else
+      {
+         dequeue_request_at(position, &req);
+         fail_cached_response(&req, NULL); /* Identical requests queue again. */
+         count++;
+      }
+   }
+
+   if (same_client(&active_request.from_client, client))
+      memset(&active_request.from_client, 0, sizeof(Client_Address));
+
+   for (ii = 0; ii < batch_count; ii++)
+   {
+      if (same_client(&batch_requests[ii].from_client, client))
+         memset(&batch_requests[ii].from_client, 0, sizeof(Client_Address));
+   }
+
+   return(count);
+}
+
+/*
+   Function: close_stream_clients()
+
+   Purpose : Sends the buffered stream replies and removes the polls,
+           : subscriptions, reply format and requests of the clients
+           : that closed.
+   Input   : None.
+   Output  : Returns the number of clients closed.
+*/
+int close_stream_clients()
+{
+   Client_Address closed[MAX_STREAM_CLIENTS];
+   int ii, count;
+
+   count = flush_stream_clients(closed, MAX_STREAM_CLIENTS);
+   for (ii = 0; ii < count; ii++)
+   {
+      unschedule_client(&closed[ii]);
+      unsubscribe_client(&closed[ii]);
+      remove_binary_client(&closed[ii]);
+      drop_client_requests(&closed[ii]);
+   }
+
+   return(count);
+}
+
+/*
+   Function: drop_failed_dgram_clients()
+
+   Purpose : Removes the polls, subscriptions and reply format of the
+           : datagram clients whose replies the kernel refused, the client
+           : socket is gone.
+   Input   : None.
+   Output  : Returns the number of clients dropped.
+*/
+int drop_failed_dgram_clients()
+{
+   Client_Address client;
+   int count = 0;
+
+   memset(&client, 0, sizeof(Client_Address));
+   client.transport = CLIENT_DGRAM;
+   while (take_failed_udp_dest(&client.sock, &client.addr, &client.addr_len) == 1)
+   {
+      unschedule_client(&client);
+      unsubscribe_client(&client);
+      remove_binary_client(&client);
+      count++;
+   }
+
+   return(count);
+}
+
+/*
+   Function: get_next_request()
+
+   Purpose : Real time client requests are sent first, then the PIDs the
+           : polling scheduler has due, then normal and background client
+           : requests. A class that has waited too long goes first.
+   Input   : Request buffer.
+   Output  : Returns 1 if there is a request to send.
+*/
+int get_next_request(ECU_Request *req)
+{
+   int pri;
+
+   pri = get_next_priority();
+   if ((pri == PRIORITY_REALTIME) || is_priority_starved(pri))
+   {
+      return(dequeue_request(req));
+   }
+
+   if (get_next_scheduled_request(req, get_monotonic_ms()) > 0)
+   {
+      note_priority_served(PRIORITY_REALTIME);
+      return(1);
+   }
+
+   return(dequeue_request(req));
+}
+
+/*
+   Function: release_active_request()
+
+   Purpose : Sends an error to the clients of a failed exchange and
+           : releases the clients waiting on it. With a NULL error the
+           : waiters are only released, for replies that were dropped.
+   Input   : Error message or NULL.
+*/
+void release_active_request(char *error_msg)
+{
+   int ii;
+
+   if (error_msg != NULL)
+      send_client_error(&active_request, error_msg);
+   fail_cached_response(&active_request, error_msg);
+
+   for (ii = 0; ii < batch_count; ii++)
+   {
+      if (error_msg != NULL)
+         send_client_error(&batch_requests[ii], error_msg);
+      fail_cached_response(&batch_requests[ii], error_msg);
+   }
+   batch_count = 0;
+
+   return;
+}
+
+int get_batch_pid(ECU_Request *req, unsigned int *pid_num)
+{
+   unsigned int pid_mode;
+
+   if (get_query_pid(req->ecu_query, &pid_mode, pid_num) == 0)
+      return(0);
+
+   return((pid_mode == 0x01) && (get_mode_01_pid_length(*pid_num) > 0));
+}
+
+int batch_has_pid(unsigned int pid_num)
+{
+   unsigned int batch_pid;
+   int ii;
+
+   for (ii = 0; ii < batch_count; ii++)
+   {
+      if (get_batch_pid(&batch_requests[ii], &batch_pid) && (batch_pid == pid_num))
+         return(1);
+   }
+
+   return(0);
+}
+
+/*
+   Function: build_batch_request()
+
+   Purpose : Packs queued and scheduled Mode 01 requests together with the
+           : next request into one multi-PID request, "01 0C 0D 05\r".
+           : Only used on CAN protocols, up to MAX_BATCH_PIDS PIDs.
+   Input   : Next request, replaced by the multi-PID request.
+   Output  : Returns the number of requests in the batch, 0 if the request
+           : is sent on its own.
+*/
+int build_batch_request(ECU_Request *req)
+{
+   ECU_Request next_req;
+   ECU_Request *queued;
+   unsigned int pid_num, batch_pid;
+   int ii, jj, pid_count, len;
+
+   batch_count = 0;
+
+   if ((multi_pid_enabled == 0) || (get_batch_pid(req, &pid_num) == 0))
+   {
+      return(0);
+   }
+
+   memcpy(&batch_requests[batch_count++], req, sizeof(ECU_Request));
+   pid_count = 1;
+
+   /* Client requests first, then PIDs the scheduler has due. */
+   ii = 0;
+   while ((pid_count < MAX_BATCH_PIDS) && ((queued = get_queued_request(ii)) != NULL))
+   {
+      if (get_batch_pid(queued, &pid_num) == 0)
+      {
+         ii++;
+         continue;
+      }
+      if (batch_has_pid(pid_num) == 0)
+         pid_count++;
+      dequeue_request_at(ii, &batch_requests[batch_count++]);
+      if (batch_count >= MAX_BATCH_PIDS)
+         break;
+   }
+
+   while ((pid_count < MAX_BATCH_PIDS) && (batch_count < MAX_BATCH_PIDS) && (get_next_batch_request(&next_req, get_monotonic_ms()) > 0))
+   {
+      get_batch_pid(&next_req, &pid_num);
+      if (batch_has_pid(pid_num) == 1)
+         continue; /* Already in the batch, the reply is published to the subscribers. */
+      memcpy(&batch_requests[batch_count++], &next_req, sizeof(ECU_Request));
+      pid_count++;
+   }
+
+   if (batch_count == 1)
+   {
+      batch_count = 0;
+      return(0);
+   }
+
+   /* The multi-PID request itself has no client, replies go to each request. */
+   memset(req, 0, sizeof(ECU_Request));
+   len = sprintf(req->ecu_query, "01");
+   for (ii = 0; ii < batch_count; ii++)
+   {
+      get_batch_pid(&batch_requests[ii], &pid_num);
+      for (jj = 0; jj < ii; jj++)
+      {
+         if (get_batch_pid(&batch_requests[jj], &batch_pid) && (batch_pid == pid_num))
+            break;
+      }
+      if (jj == ii) /* Two clients can ask for the same PID. */
+         len += sprintf(req->ecu_query + len, " %.2X", pid_num);
+   }
+   len += sprintf(req->ecu_query + len, "\r");
+   req->query_len = len;
+
+   return(batch_count);
+}
+
+/*
+   Function: start_next_exchange()
+
+   Purpose : Sends the next request to the interpreter if no other
+           : exchange is in flight.
+   Input   : None.
+   Output  : Returns 1 if a request was sent.
+*/
+int start_next_exchange()
+{
+   char log_buf[MAX_BUFFER_LEN+64];
+   int ii;
+
+   while ((serial_busy == 0) && (get_next_request(&active_request) > 0))
+   {
+      build_batch_request(&active_request);
+
+      if (queue_ecu_query(active_request.ecu_query) > 0)
+      {
+         sprintf(log_buf, "start_next_exchange(): TXD - %s", active_request.ecu_query);
+         print_log_entry(log_buf);
+         serial_busy = 1;
+         serial_start_time = get_monotonic_ms();
+         serial_deadline = serial_start_time + get_request_timeout(active_request.ecu_query);
+         set_response_pending(&active_request);
+         for (ii = 0; ii < batch_count; ii++)
+            set_response_pending(&batch_requests[ii]);
+      }
+      else
+      {
+         release_active_request(ECU_TIMEOUT_MSG);
+      }
+   }
+
+   return(serial_busy);
+}
+
+/*
+   Function: check_exchange_timeout()
+
+   Purpose : Abandons the exchange in flight if its deadline has passed and
+           : returns an error to the client. After ELM_WATCHDOG_LIMIT
+           : consecutive timeouts the interpreter is reset with ATZ.
+   Input   : None.
+   Output  : Returns 1 if the exchange timed out.
+*/
+int check_exchange_timeout()
+{
+   char log_buf[MAX_SERIAL_BUF_LEN+64];
+
+   if ((serial_busy == 0) || (get_monotonic_ms() < serial_deadline))
+   {
+      return(0);
+   }
+
+   sprintf(log_buf, "check_exchange_timeout() <ERROR>: No reply to %s", active_request.ecu_query);
+   print_log_entry(log_buf);
+
+   serial_busy = 0;
+   note_server_error(STATS_TIMEOUT);
+   response_count_failed(active_request.ecu_query);
+   release_active_request(ECU_TIMEOUT_MSG);
+   queue_serial_abort(serial_exchange_id); /* The serial thread logs the partial reply and flushes the port. */
+
+   watchdog_count++;
+   if ((watchdog_count >= ELM_WATCHDOG_LIMIT) && (strncmp(active_request.ecu_query, "ATZ", 3) != 0) &&
+       (strncmp(active_request.ecu_query, "ATWS", 4) != 0))
+   {
+      print_log_entry("check_exchange_timeout() <ERROR>: Interpreter not responding, sending reset.");
+      memset(&active_request, 0, sizeof(ECU_Request));
+      strcpy(active_request.ecu_query, "ATZ\r");
+      active_request.query_len = 4;
+      set_reset_query(&active_request);
+      if (queue_ecu_query(active_request.ecu_query) > 0)
+      {
+         serial_busy = 1;
+         serial_start_time = get_monotonic_ms();
+         serial_deadline = serial_start_time + ELM_RESET_TIMEOUT_MS;
+      }
+      watchdog_count = 0;
+   }
+
+   return(1);
+}
+
+/*
+   Function: get_event_loop_timeout()
+
+   Purpose : Time left until the deadline of the exchange in flight, or
+           : until the next scheduled PID is due when the link is idle.
+   Input   : None.
+   Output  : Milliseconds for epoll_wait(), -1 to wait forever when idle.
+*/
+int get_event_loop_timeout()
+{
+   long long remaining;
+
+   if (serial_busy == 0)
+   {
+      return(get_scheduler_timeout(get_monotonic_ms()));
+   }
+
+   remaining = serial_deadline - get_monotonic_ms();
+   if (remaining < 0)
+   {
+      remaining = 0;
+   }
+
+   return((int)remaining);
+}
+
+/*
+   Function: note_reply_timing()
+
+   Purpose : Counts reply errors and holds the timestamps of each request
+           : answered by the reply until the replies are sent.
+   Input   : Reply frame of the active request.
+   Output  : Returns the number of requests answered.
+*/
+int note_reply_timing(Serial_Frame *frame)
+{
+   unsigned int pid_mode, pid_num;
+   int ii;
+
+   if (frame->reply_status & ELM_LINE_ERROR)
+      note_server_error(STATS_DATA_ERROR);
+   else if ((batch_count == 0) && (frame->reply_status & ELM_LINE_NO_DATA))
+      note_server_error(STATS_NO_DATA);
+
+   if (batch_count == 0)
+   {
+      if (get_query_pid(active_request.ecu_query, &pid_mode, &pid_num) == 0)
+         pid_mode = pid_num = 0; /* AT command, only the stage times. */
+      note_exchange_reply(pid_mode, pid_num, active_request.rx_time_us, frame);
+      return(1);
+   }
+
+   for (ii = 0; ii < batch_count; ii++)
+   {
+      get_query_pid(batch_requests[ii].ecu_query, &pid_mode, &pid_num);
+      note_exchange_reply(pid_mode, pid_num, batch_requests[ii].rx_time_us, frame);
+   }
+
+   return(batch_count);
+}
+
+/*
+   Function: read_serial_frames()
+
+   Purpose : Handles the frames from the serial thread. Frames from an
+           : exchange that has timed out are dropped.
+   Input   : None.
+   Output  : Returns the number of replies handled.
+*/
+int read_serial_frames()
+{
+   Serial_Frame *frame;
+   int count = 0;
+
+   clear_serial_event();
+
+   while ((frame = get_serial_frame()) != NULL)
+   {
+      note_serial_frame(frame);
+      if ((serial_busy == 0) || (frame->exchange_id != serial_exchange_id))
+      {
+         note_server_error(STATS_LATE_FRAME);
+         release_serial_frame(); /* Late reply to an abandoned request. */
+         continue;
+      }
+
+      if (frame->frame_type == FRAME_SEARCHING)
+      {
+         /* Automatic protocol search, allow the interpreter more time. */
+         serial_deadline = serial_start_time + ELM_SEARCH_TIMEOUT_MS;
+      }
+      else if (frame->frame_type == FRAME_REPLY)
+      {
+         printf("read_serial_frames(): RXD msg %i bytes: %s\n", frame->reply_len, frame->ecu_reply);
+         serial_busy = 0;
+         watchdog_count = 0;
+         check_response_count(active_request.ecu_query, frame->ecu_reply);
+         note_reply_timing(frame);
+         if (batch_count > 0)
+            send_batch_reply(frame);
+         else
+            send_client_reply(&active_request, frame);
+         release_active_request(NULL); /* Release waiters if the reply was dropped. */
+         if ((strncmp(active_request.ecu_query, "ATZ", 3) == 0) || (strncmp(active_request.ecu_query, "ATWS", 4) == 0) ||
+             (strncmp(active_request.ecu_query, "ATD\r", 4) == 0))
+            queue_elm_session(); /* The reset restored the default session settings. */
+         count++;
+      }
+
+      release_serial_frame();
+   }
+
+   return(count);
+}
+
+/*
+   Function: run_server_event_loop()
+
+   Purpose : Waits on the client transports and the serial thread together
+           : and only wakes when a request or an interpreter reply arrives,
+           : see transport.c. Client
+           : requests are queued while an ELM327 exchange is in flight and
+           : the next one is sent when the serial thread returns the reply.
+   Input   : UDP socket and serial port number.
+   Output  : Returns -1 on an epoll error.
+*/
+int run_server_event_loop(int sock, int serial_port)
+{
+   struct epoll_event ev, events[MAX_EPOLL_EVENTS];
+   int transport_socks[NUM_TRANSPORT_SOCKETS];
+   int epfd, serial_fd, stream_sock, nfds, fd, ii;
+
+   /* The serial thread owns the port from here on. */
+   if (start_serial_thread(serial_port) < 0)
+   {
+      return(-1);
+   }
+   serial_fd = get_serial_event_fd();
+
+   epfd = epoll_create1(0);
+   if (epfd < 0)
+   {
+      perror("run_server_event_loop() <ERROR>: epoll_create1");
+      return(-1);
+   }
+
+   memset(&ev, 0, sizeof(ev));
+   ev.events = EPOLLIN;
+   ev.data.fd = sock;
+   if (epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) < 0)
+   {
+      perror("run_server_event_loop() <ERROR>: epoll_ctl socket");
+      return(-1);
+   }
+
+   ev.data.fd = serial_fd;
+   if (epoll_ctl(epfd, EPOLL_CTL_ADD, serial_fd, &ev) < 0)
+   {
+      perror("run_server_event_loop() <ERROR>: epoll_ctl serial");
+      return(-1);
+   }
+
+   nfds = get_transport_sockets(transport_socks);
+   for (ii = 0; ii < nfds; ii++)
+   {
+      ev.data.fd = transport_socks[ii];
+      if (epoll_ctl(epfd, EPOLL_CTL_ADD, transport_socks[ii], &ev) < 0)
+         perror("run_server_event_loop() <ERROR>: epoll_ctl transport");
+   }
+
+   serial_busy = 0;
+   watchdog_count = 0;
+
+   while (1)
+   {
+      nfds = epoll_wait(epfd, events, MAX_EPOLL_EVENTS, get_event_loop_timeout());
+      if (nfds < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         perror("run_server_event_loop() <ERROR>: epoll_wait");
+         break;
+      }
+
+      for (ii = 0; ii < nfds; ii++)
+      {
+         fd = events[ii].data.fd;
+         if ((fd == sock) || is_dgram_socket(fd))
+         {
+            read_client_requests(fd);
+         }
+         else if (fd == serial_fd)
+         {
+            read_serial_frames();
+         }
+         else if (is_listen_socket(fd))
+         {
+            /* Connections are edge triggered, read until nothing is left. */
+            while ((stream_sock = accept_stream_client(fd)) >= 0)
+            {
+               ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+               ev.data.fd = stream_sock;
+               if (epoll_ctl(epfd, EPOLL_CTL_ADD, stream_sock, &ev) < 0)
+                  perror("run_server_event_loop() <ERROR>: epoll_ctl stream");
+            }
+         }
+         else
+         {
+            read_stream_requests(fd);
+         }
+      }
+
+      check_exchange_timeout();
+      start_next_exchange();
+      flush_binary_clients();     /* One datagram per binary client for this pass. */
+      flush_udp_msgs();           /* All replies for this pass in one sendmmsg(). */
+      drop_failed_dgram_clients();
+      close_stream_clients();     /* Stream replies for this pass. */
+      note_replies_sent(get_monotonic_us());
+   }
+
+   close(epfd);
+
+   return(-1);
+}
+
+
+/*
+   Function: run_adapter()
+
+   Purpose : Network thread of one adapter. Checks the interpreter, binds
+           : the UDP port of the adapter and runs the event loop. All the
+           : request state is thread local, adapters share nothing but the
+           : log file.
+   Input   : Adapter.
+   Output  : Returns NULL when the event loop stops.
+*/
+void *run_adapter(void *arg)
+{
+   OBD_Adapter *adapter = (OBD_Adapter *)arg;
+   struct sockaddr_in server;
+   int sock, length;
+
+   set_log_tag(adapter->interface_name);
+
+   interface_check(adapter->serial_port, adapter->interface_name);
+
+   sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+   if (sock < 0) 
+      fatal_error("Opening socket");
+   
+   length = sizeof(server);
+   memset(&server, 0, length);
+
+   server.sin_family=AF_INET;
+   server.sin_addr.s_addr=INADDR_ANY;
+   server.sin_port=htons(adapter->udp_port);
+   
+   if (bind(sock, (struct sockaddr *)&server, length) < 0) 
+      fatal_error("binding");
+
+   /* The event loop drains the socket until it would block. */
+   if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) < 0)
+      fatal_error("fcntl");
+
+   printf("run_adapter(): %s on UDP port %i.\n", adapter->interface_name, adapter->udp_port);
+
+   init_request_queue();
+   init_pid_scheduler();
+   init_subscriptions();
+   init_binary_clients();
+   init_obd_decoder();
+   init_udp_sends();
+   init_response_cache(adapter->cache_ttl);
+   init_server_stats();
+   init_transports();
+   open_transports(adapter->udp_port);
+   open_telemetry_segment(adapter->udp_port);
+
+   run_server_event_loop(sock, adapter->serial_port);
+
+   close_telemetry_segment();
+   close_transports();
+   close(sock);
+
+   return(NULL);
+}
+
+/*
+   obd_server [udp_port] [cache_ttl] [serial_port ...]
+
+   Each serial port is a separate adapter and vehicle, the first one is
+   served on udp_port, the next on udp_port + 1 and so on.
+*/
+int main(int argc, char *argv[])
+{
+   int udp_port, cache_ttl, ii, interface_count, adapter_count = 0;
+   char *default_interface[] = { "ttyUSB0" };
+   char **interface_list;
+   OBD_Adapter *adapter;
+   
+   if (argc < 2) 
+   {
+      udp_port = DEFAULT_UDP_PORT;
+   }
+   else
+   {
+      udp_port = atoi(argv[1]);
+   }
+
+   /* Optional reply cache time to live in milliseconds, 0 only coalesces requests in flight. */
+   cache_ttl = DEFAULT_CACHE_TTL_MS;
+   if (argc > 2)
+   {
+      cache_ttl = atoi(argv[2]);
+   }
+
+   open_log_file("./", "obd_server_log.txt");
+   
+#ifdef _WINSOCK
+
+   WSADATA wsaData;
+   int iResult;
+   iResult = WSAStartup(MAKEWORD(2,2), &wsaData);
+   if (iResult != NO_ERROR)
+      printf("init_server_comms() <ERROR>: WSAStartup() failed with error: %ld\n", iResult);
+
+#endif
+
+   /* ttyUSB0 is an FTDI232 USB-RS232 Converter Module. */
+   if (argc > 3)
+   {
+      interface_count = argc - 3;
+      interface_list = argv + 3;
+   }
+   else
+   {
+      interface_count = 1;
+      interface_list = default_interface;
+   }
+
+   /* The ports are opened one at a time, the rs232 port settings are not thread safe. */
+   for (ii = 0; (ii < interface_count) && (adapter_count < MAX_OBD_ADAPTERS); ii++)
+   {
+      adapter = &adapter_list[adapter_count];
+      adapter->serial_port = init_serial_comms(interface_list[ii]);
+      if (adapter->serial_port < 0)
+         continue;
+
+      strncpy(adapter->interface_name, interface_list[ii], MAX_INTERFACE_NAME_LEN - 1);
+      adapter->interface_name[MAX_INTERFACE_NAME_LEN - 1] = 0;
+      adapter->udp_port = udp_port + ii;
+      adapter->cache_ttl = cache_ttl;
+      adapter_count++;
+   }
+
+   if (adapter_count == 0)
+   {
+      printf("main() <ERROR>: No serial ports.\n");
+      exit(-1);
+   }
+
+   for (ii = 0; ii < adapter_count; ii++)
+   {
+      if (pthread_create(&adapter_list[ii].thread_id, NULL, run_adapter, &adapter_list[ii]) != 0)
+         fatal_error("pthread_create");
+   }
+
+   for (ii = 0; ii < adapter_count; ii++)
+   {
+      pthread_join(adapter_list[ii].thread_id, NULL);
+   }
+
+   close_log_file();
+   
+   return(0);
+ }
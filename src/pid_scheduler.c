@@ -0,0 +1,393 @@
+/*
+   pid_scheduler.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Server side PID polling scheduler.
+
+                Clients register PIDs with a polling interval instead of
+                sending every request themselves:
+
+                POLL <interval ms> <mode> <pid> [<pid> ...]
+                UNPOLL <mode> <pid> [<pid> ...]
+
+                Example: "POLL 100 01 0C 0D\r" polls engine RPM and vehicle
+                speed every 100 milliseconds, "POLL 0 01 0C\r" polls as
+                fast as the serial link allows.
+
+                When the interpreter is idle the server asks for the next
+                scheduled request. The PID with the earliest due time is
+                sent first, so slow PIDs such as temperatures are still
+                polled at their interval while fast PIDs such as RPM use
+                the rest of the serial link.
+
+                A datagram client can go without a word, so its POLL is a
+                lease of POLL_LEASE_MS that the client renews by sending
+                the same POLL again. A lapsed entry is removed, as is every
+                entry of a client the server could not send to. Stream
+                clients keep their entries until UNPOLL or the connection
+                closes.
+
+                POLL also subscribes the client to the PID, see
+                subscriptions.c. When several clients poll the same PID it
+                is requested once at the shortest interval and the reply is
+                sent to every subscriber.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "obd_monitor.h"
+#include "pid_scheduler.h"
+#include "subscriptions.h"
+#include "pid_table.h"
+
+ADAPTER_LOCAL Scheduled_PID pid_schedule[MAX_SCHEDULED_PIDS];
+ADAPTER_LOCAL int scheduled_pid_count;
+
+void init_pid_scheduler()
+{
+   memset(pid_schedule, 0, sizeof(pid_schedule));
+   scheduled_pid_count = 0;
+
+   return;
+}
+
+Scheduled_PID *find_scheduled_pid(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num)
+{
+   int ii;
+
+   for (ii = 0; ii < MAX_SCHEDULED_PIDS; ii++)
+   {
+      if ((pid_schedule[ii].in_use == 1) && (pid_schedule[ii].pid_mode == pid_mode) &&
+          (pid_schedule[ii].pid_num == pid_num) && same_client(&pid_schedule[ii].client, &client_req->from_client))
+      {
+         return(&pid_schedule[ii]);
+      }
+   }
+
+   return(NULL);
+}
+
+/*
+   Function: schedule_pid()
+
+   Purpose : Adds a PID to the polling schedule for a client, or changes
+           : the interval and renews the lease if the client has already
+           : registered it.
+   Input   : Client request, PID mode and number, interval in milliseconds.
+   Output  : Returns 1 or -1 if the schedule is full.
+*/
+int schedule_pid(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num, int interval_ms)
+{
+   Scheduled_PID *sp;
+   int ii;
+
+   if (interval_ms < MIN_POLL_INTERVAL_MS)
+   {
+      interval_ms = MIN_POLL_INTERVAL_MS;
+   }
+
+   sp = find_scheduled_pid(client_req, pid_mode, pid_num);
+   if (sp == NULL)
+   {
+      for (ii = 0; ii < MAX_SCHEDULED_PIDS; ii++)
+      {
+         if (pid_schedule[ii].in_use == 0)
+         {
+            sp = &pid_schedule[ii];
+            memset(sp, 0, sizeof(Scheduled_PID));
+            sp->in_use = 1;
+            sp->pid_mode = pid_mode;
+            sp->pid_num = pid_num;
+            sp->client = client_req->from_client;
+            scheduled_pid_count++;
+            break;
+         }
+      }
+   }
+
+   if (sp == NULL)
+   {
+      printf("schedule_pid() <ERROR>: Schedule full, cannot add %.2X %.2X\n", pid_mode, pid_num);
+      return(-1);
+   }
+
+   sp->interval_ms = interval_ms;
+   if (sp->client.transport == CLIENT_DGRAM)
+      sp->lease_expiry_ms = get_monotonic_ms() + POLL_LEASE_MS;
+
+   return(1);
+}
+
+int unschedule_pid(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num)
+{
+   Scheduled_PID *sp;
+
+   sp = find_scheduled_pid(client_req, pid_mode, pid_num);
+   if (sp == NULL)
+   {
+      return(0);
+   }
+
+   sp->in_use = 0;
+   scheduled_pid_count--;
+
+   return(1);
+}
+
+/* A stream client has gone or a datagram client cannot be reached, stop polling its PIDs. */
+int unschedule_client(Client_Address *client)
+{
+   int ii, count = 0;
+
+   for (ii = 0; ii < MAX_SCHEDULED_PIDS; ii++)
+   {
+      if ((pid_schedule[ii].in_use == 1) && same_client(&pid_schedule[ii].client, client))
+      {
+         pid_schedule[ii].in_use = 0;
+         scheduled_pid_count--;
+         count++;
+      }
+   }
+
+   return(count);
+}
+
+/* Removes the datagram client entries that were not renewed in time. */
+int expire_poll_leases(long long now_ms)
+{
+   ECU_Request client_req;
+   int ii, count = 0;
+
+   for (ii = 0; ii < MAX_SCHEDULED_PIDS; ii++)
+   {
+      if ((pid_schedule[ii].in_use == 1) && (pid_schedule[ii].lease_expiry_ms > 0) &&
+          (pid_schedule[ii].lease_expiry_ms <= now_ms))
+      {
+         memset(&client_req, 0, sizeof(ECU_Request));
+         client_req.from_client = pid_schedule[ii].client;
+         unsubscribe_pid(&client_req, pid_schedule[ii].pid_mode, pid_schedule[ii].pid_num);
+         pid_schedule[ii].in_use = 0;
+         scheduled_pid_count--;
+         count++;
+      }
+   }
+
+   return(count);
+}
+
+/*
+   Function: parse_poll_request()
+
+   Purpose : Parses a POLL or UNPOLL message from a client and updates
+           : the schedule.
+   Input   : Client request.
+   Output  : Returns the number of PIDs updated or -1 on a bad message.
+*/
+int parse_poll_request(ECU_Request *client_req)
+{
+   char temp_buf[MAX_SERIAL_BUF_LEN];
+   char *token;
+   char *end_ptr;
+   unsigned int pid_mode, pid_num;
+   int interval_ms = 0;
+   int add_pid, count = 0;
+
+   strncpy(temp_buf, client_req->ecu_query, MAX_SERIAL_BUF_LEN - 1);
+   temp_buf[MAX_SERIAL_BUF_LEN - 1] = 0;
+
+   token = strtok(temp_buf, " \r\n");
+   if (token == NULL)
+      return(-1);
+
+   if (strcmp(token, "POLL") == 0)
+   {
+      add_pid = 1;
+      token = strtok(NULL, " \r\n");
+      if (token == NULL)
+         return(-1);
+      interval_ms = strtol(token, &end_ptr, 10);
+      if (*end_ptr != 0)
+         return(-1);
+   }
+   else if (strcmp(token, "UNPOLL") == 0)
+   {
+      add_pid = 0;
+   }
+   else
+   {
+      return(-1);
+   }
+
+   token = strtok(NULL, " \r\n");
+   if (token == NULL)
+      return(-1);
+   pid_mode = strtoul(token, &end_ptr, 16);
+   if ((*end_ptr != 0) || (pid_mode > 0xFF))
+      return(-1);
+
+   while ((token = strtok(NULL, " \r\n")) != NULL)
+   {
+      pid_num = strtoul(token, &end_ptr, 16);
+      if ((*end_ptr != 0) || (pid_num > 0xFF))
+         return(-1);
+
+      if (add_pid == 1)
+      {
+         if (schedule_pid(client_req, pid_mode, pid_num, interval_ms) > 0)
+         {
+            subscribe_pid(client_req, pid_mode, pid_num);
+            count++;
+         }
+      }
+      else
+      {
+         unsubscribe_pid(client_req, pid_mode, pid_num);
+         count += unschedule_pid(client_req, pid_mode, pid_num);
+      }
+   }
+
+   return(count);
+}
+
+/*
+   Function: get_due_scheduled_request()
+
+   Purpose : Selects the due PID with the earliest due time and builds
+           : the ELM327 request for it.
+   Input   : Request buffer, the current monotonic time and 1 to only
+           : select Mode 01 PIDs that can be batched.
+   Output  : Returns 1 if a request is due, otherwise 0.
+*/
+int get_due_scheduled_request(ECU_Request *req, long long now_ms, int batch_only)
+{
+   Scheduled_PID *next = NULL;
+   long long due, min_due = 0;
+   int ii;
+
+   expire_poll_leases(now_ms);
+
+   for (ii = 0; ii < MAX_SCHEDULED_PIDS; ii++)
+   {
+      if (pid_schedule[ii].in_use == 0)
+         continue;
+
+      if ((batch_only == 1) && ((pid_schedule[ii].pid_mode != 0x01) || (get_mode_01_pid_length(pid_schedule[ii].pid_num) == 0)))
+         continue;
+
+      due = pid_schedule[ii].last_poll_ms + pid_schedule[ii].interval_ms;
+      if (due > now_ms)
+         continue;
+
+      if ((next == NULL) || (due < min_due))
+      {
+         next = &pid_schedule[ii];
+         min_due = due;
+      }
+   }
+
+   if (next == NULL)
+   {
+      return(0);
+   }
+
+   /* One request serves every client polling this PID. */
+   for (ii = 0; ii < MAX_SCHEDULED_PIDS; ii++)
+   {
+      if ((pid_schedule[ii].in_use == 1) && (pid_schedule[ii].pid_mode == next->pid_mode) &&
+          (pid_schedule[ii].pid_num == next->pid_num))
+      {
+         pid_schedule[ii].last_poll_ms = now_ms;
+      }
+   }
+   next->poll_count++;
+
+   /* No requesting client, the reply is published to the PID subscribers. */
+   memset(req, 0, sizeof(ECU_Request));
+   req->query_len = sprintf(req->ecu_query, "%.2X %.2X\r", next->pid_mode, next->pid_num);
+
+   return(1);
+}
+
+int get_next_scheduled_request(ECU_Request *req, long long now_ms)
+{
+   return(get_due_scheduled_request(req, now_ms, 0));
+}
+
+/*
+   Function: get_next_batch_request()
+
+   Purpose : Selects the next due Mode 01 PID that can be added to a
+           : multi-PID request.
+   Input   : Request buffer and the current monotonic time.
+   Output  : Returns 1 if a request is due, otherwise 0.
+*/
+int get_next_batch_request(ECU_Request *req, long long now_ms)
+{
+   return(get_due_scheduled_request(req, now_ms, 1));
+}
+
+/*
+   Function: get_scheduler_timeout()
+
+   Purpose : Time until the next scheduled PID is due.
+   Input   : Current monotonic time.
+   Output  : Milliseconds, or -1 if nothing is scheduled.
+*/
+int get_scheduler_timeout(long long now_ms)
+{
+   long long due, min_due = -1;
+   int ii;
+
+   expire_poll_leases(now_ms);
+
+   for (ii = 0; ii < MAX_SCHEDULED_PIDS; ii++)
+   {
+      if (pid_schedule[ii].in_use == 0)
+         continue;
+
+      due = pid_schedule[ii].last_poll_ms + pid_schedule[ii].interval_ms - now_ms;
+      if (due < 0)
+         due = 0;
+      if ((min_due < 0) || (due < min_due))
+         min_due = due;
+   }
+
+   return((int)min_due);
+}
+
+/*
+   Function: note_pid_sampled()
+
+   Purpose : Restarts the polling interval of a PID when a client request
+           : has just read it, the reply was published to the subscribers.
+   Input   : PID mode and number, current monotonic time.
+*/
+void note_pid_sampled(unsigned int pid_mode, unsigned int pid_num, long long now_ms)
+{
+   int ii;
+
+   for (ii = 0; ii < MAX_SCHEDULED_PIDS; ii++)
+   {
+      if ((pid_schedule[ii].in_use == 1) && (pid_schedule[ii].pid_mode == pid_mode) &&
+          (pid_schedule[ii].pid_num == pid_num))
+      {
+         pid_schedule[ii].last_poll_ms = now_ms;
+      }
+   }
+
+   return;
+}
+
+int get_scheduled_pid_count()
+{
+   return(scheduled_pid_count);
+}
+
@@ -0,0 +1,52 @@
+/*
+   pid_scheduler.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Server side PID polling scheduler. Clients register a set of
+                PIDs with a polling interval and the server interleaves the
+                requests on the serial link. Datagram clients renew their
+                POLL within POLL_LEASE_MS or the PIDs are dropped.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_PID_SCHEDULER_INCLUDED
+#define OBD_PID_SCHEDULER_INCLUDED
+
+#include "request_queue.h"
+
+#define MAX_SCHEDULED_PIDS 64
+#define MIN_POLL_INTERVAL_MS 1
+
+struct _Scheduled_PID {
+   int in_use;
+   unsigned int pid_mode;
+   unsigned int pid_num;
+   int interval_ms;
+   long long last_poll_ms;
+   unsigned long poll_count;
+   long long lease_expiry_ms;    /* Datagram clients only, 0 = until UNPOLL or the stream closes. */
+   Client_Address client;
+};
+
+typedef struct _Scheduled_PID Scheduled_PID;
+
+/* pid_scheduler.c */
+void init_pid_scheduler();
+int schedule_pid(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num, int interval_ms);
+int unschedule_pid(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num);
+int unschedule_client(Client_Address *client);
+int expire_poll_leases(long long now_ms);
+int parse_poll_request(ECU_Request *client_req);
+int get_next_scheduled_request(ECU_Request *req, long long now_ms);
+int get_next_batch_request(ECU_Request *req, long long now_ms);
+int get_scheduler_timeout(long long now_ms);
+void note_pid_sampled(unsigned int pid_mode, unsigned int pid_num, long long now_ms);
+int get_scheduled_pid_count();
+
+#endif
+
@@ -0,0 +1,333 @@
+/*
+   pid_table.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Mode 01 PID table and the splitter for multi-PID ECU
+                replies.
+
+                Each Mode 01 PID is a row of the PID table: data length,
+                formula, scale, offset and units. A new PID is a new row,
+                the server decoder and the GUI both scale values from it.
+
+                On CAN protocols (ATSP 6 - 9) the ELM327 accepts up to six
+                Mode 01 PIDs in one request, "01 0C 0D 05\r", and the ECU
+                returns them in one reply with the mode byte once:
+
+                41 0C 1A F8 0D 32 05 7B
+
+                Replies longer than one CAN frame are sent as ISO-TP frames
+                with the byte count first:
+
+                00E
+                0: 41 0C 1A F8 0D 32
+                1: 05 7B 0F 46 11 80
+                2: 0B 65 00 00 00 00 00
+
+                With spaces off (ATS0) the same bytes arrive without spaces,
+                "410C1AF80D32", both formats are accepted.
+
+                The reply can only be split with the data length of each
+                PID, so PIDs missing from the table are never batched.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "hex_decode.h"
+#include "pid_table.h"
+
+/* Mode 01 PID descriptors from SAE J1979, indexed by PID number. PIDs
+   with no formula are bit fields or several values, only their length
+   is used here. */
+static const Mode_01_PID mode_01_pids[] = {
+/* 00 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* PIDs supported 01-20 */
+/* 01 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Monitor status since DTCs cleared */
+/* 02 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Freeze frame DTC */
+/* 03 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Fuel system status */
+/* 04 */ { 1, PID_FORMULA_A, 100.0 / 255.0, 0.0, "%" },       /* Calculated engine load */
+/* 05 */ { 1, PID_FORMULA_A, 1.0, -40.0, "C" },               /* Engine coolant temperature */
+/* 06 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Short term fuel trim bank 1 */
+/* 07 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Long term fuel trim bank 1 */
+/* 08 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Short term fuel trim bank 2 */
+/* 09 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Long term fuel trim bank 2 */
+/* 0A */ { 1, PID_FORMULA_A, 3.0, 0.0, "kPa" },               /* Fuel pressure */
+/* 0B */ { 1, PID_FORMULA_A, 1.0, 0.0, "kPa" },               /* Intake manifold absolute pressure */
+/* 0C */ { 2, PID_FORMULA_AB, 0.25, 0.0, "rpm" },             /* Engine RPM, quarter revolutions */
+/* 0D */ { 1, PID_FORMULA_A, 1.0, 0.0, "km/h" },              /* Vehicle speed */
+/* 0E */ { 1, PID_FORMULA_A, 0.5, -64.0, "deg" },             /* Timing advance */
+/* 0F */ { 1, PID_FORMULA_A, 1.0, -40.0, "C" },               /* Intake air temperature */
+/* 10 */ { 2, PID_FORMULA_AB, 0.01, 0.0, "g/s" },             /* MAF air flow rate */
+/* 11 */ { 1, PID_FORMULA_A, 100.0 / 255.0, 0.0, "%" },       /* Throttle position */
+/* 12 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Commanded secondary air status */
+/* 13 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensors present */
+/* 14 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 1 */
+/* 15 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 2 */
+/* 16 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 3 */
+/* 17 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 4 */
+/* 18 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 5 */
+/* 19 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 6 */
+/* 1A */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 7 */
+/* 1B */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 8 */
+/* 1C */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* OBD standards */
+/* 1D */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensors present, 4 banks */
+/* 1E */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Auxiliary input status */
+/* 1F */ { 2, PID_FORMULA_AB, 1.0, 0.0, "s" },                /* Run time since engine start */
+/* 20 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* PIDs supported 21-40 */
+/* 21 */ { 2, PID_FORMULA_AB, 1.0, 0.0, "km" },               /* Distance with MIL on */
+/* 22 */ { 2, PID_FORMULA_AB, 0.079, 0.0, "kPa" },            /* Fuel rail pressure */
+/* 23 */ { 2, PID_FORMULA_AB, 10.0, 0.0, "kPa" },             /* Fuel rail gauge pressure */
+/* 24 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 1 lambda voltage */
+/* 25 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 2 lambda voltage */
+/* 26 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 3 lambda voltage */
+/* 27 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 4 lambda voltage */
+/* 28 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 5 lambda voltage */
+/* 29 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 6 lambda voltage */
+/* 2A */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 7 lambda voltage */
+/* 2B */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 8 lambda voltage */
+/* 2C */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Commanded EGR */
+/* 2D */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* EGR error */
+/* 2E */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Commanded evaporative purge */
+/* 2F */ { 1, PID_FORMULA_A, 100.0 / 255.0, 0.0, "%" },       /* Fuel tank level */
+/* 30 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Warm-ups since codes cleared */
+/* 31 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Distance since codes cleared */
+/* 32 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Evap system vapour pressure */
+/* 33 */ { 1, PID_FORMULA_A, 1.0, 0.0, "kPa" },               /* Barometric pressure */
+/* 34 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 1 lambda current */
+/* 35 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 2 lambda current */
+/* 36 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 3 lambda current */
+/* 37 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 4 lambda current */
+/* 38 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 5 lambda current */
+/* 39 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 6 lambda current */
+/* 3A */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 7 lambda current */
+/* 3B */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Oxygen sensor 8 lambda current */
+/* 3C */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Catalyst temperature bank 1 sensor 1 */
+/* 3D */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Catalyst temperature bank 2 sensor 1 */
+/* 3E */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Catalyst temperature bank 1 sensor 2 */
+/* 3F */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Catalyst temperature bank 2 sensor 2 */
+/* 40 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* PIDs supported 41-60 */
+/* 41 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Monitor status this drive cycle */
+/* 42 */ { 2, PID_FORMULA_AB, 0.001, 0.0, "V" },              /* Control module voltage */
+/* 43 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Absolute load value */
+/* 44 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Commanded air-fuel equivalence ratio */
+/* 45 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Relative throttle position */
+/* 46 */ { 1, PID_FORMULA_A, 1.0, -40.0, "C" },               /* Ambient air temperature */
+/* 47 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Absolute throttle position B */
+/* 48 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Absolute throttle position C */
+/* 49 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Accelerator pedal position D */
+/* 4A */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Accelerator pedal position E */
+/* 4B */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Accelerator pedal position F */
+/* 4C */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Commanded throttle actuator */
+/* 4D */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Time run with MIL on */
+/* 4E */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Time since codes cleared */
+/* 4F */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Maximum values */
+/* 50 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Maximum MAF air flow rate */
+/* 51 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Fuel type */
+/* 52 */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Ethanol fuel percentage */
+/* 53 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Absolute evap system vapour pressure */
+/* 54 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Evap system vapour pressure */
+/* 55 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Short term secondary O2 trim bank 1 and 3 */
+/* 56 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Long term secondary O2 trim bank 1 and 3 */
+/* 57 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Short term secondary O2 trim bank 2 and 4 */
+/* 58 */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Long term secondary O2 trim bank 2 and 4 */
+/* 59 */ { 2, PID_FORMULA_AB, 10.0, 0.0, "kPa" },             /* Fuel rail absolute pressure */
+/* 5A */ { 1, PID_FORMULA_A, 100.0 / 255.0, 0.0, "%" },       /* Accelerator pedal position */
+/* 5B */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Hybrid battery pack remaining life */
+/* 5C */ { 1, PID_FORMULA_A, 1.0, -40.0, "C" },               /* Engine oil temperature */
+/* 5D */ { 2, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Fuel injection timing */
+/* 5E */ { 2, PID_FORMULA_AB, 0.05, 0.0, "L/h" },             /* Engine fuel rate */
+/* 5F */ { 1, PID_FORMULA_NONE, 0.0, 0.0, "" },               /* Emission requirements */
+/* 60 */ { 4, PID_FORMULA_NONE, 0.0, 0.0, "" }                /* PIDs supported 61-80 */
+};
+
+#define MODE_01_PID_TABLE_LEN (sizeof(mode_01_pids) / sizeof(mode_01_pids[0]))
+
+/*
+   Function: get_mode_01_pid()
+
+   Purpose : Gets the descriptor of a Mode 01 PID.
+   Input   : PID number.
+   Output  : Returns the descriptor, NULL if the PID is not known.
+*/
+const Mode_01_PID *get_mode_01_pid(unsigned int pid_num)
+{
+   if (pid_num >= MODE_01_PID_TABLE_LEN)
+   {
+      return(NULL);
+   }
+
+   return(&mode_01_pids[pid_num]);
+}
+
+int get_mode_01_pid_length(unsigned int pid_num)
+{
+   if (pid_num >= MODE_01_PID_TABLE_LEN)
+   {
+      return(0);
+   }
+
+   return(mode_01_pids[pid_num].data_bytes);
+}
+
+/*
+   Function: get_mode_01_pid_value()
+
+   Purpose : Scales the data bytes of a Mode 01 PID to engineering units
+           : with the formula in the PID table, A is the first data byte.
+   Input   : PID number, data bytes and the scaled value.
+   Output  : Returns 1, 0 if the PID has no formula here.
+*/
+int get_mode_01_pid_value(unsigned int pid_num, unsigned char *data, double *value)
+{
+   const Mode_01_PID *pid;
+   unsigned int raw;
+
+   if (pid_num >= MODE_01_PID_TABLE_LEN)
+   {
+      return(0);
+   }
+
+   pid = &mode_01_pids[pid_num];
+   switch(pid->formula)
+   {
+      case PID_FORMULA_A: raw = data[0]; break;
+      case PID_FORMULA_AB: raw = ((unsigned int)data[0] << 8) | data[1]; break;
+      default : return(0);
+   }
+
+   *value = ((double)raw * pid->scale) + pid->offset;
+
+   return(1);
+}
+
+/*
+   Function: get_mode_01_pid_units()
+
+   Purpose : Gets the units of the value from get_mode_01_pid_value().
+   Input   : PID number.
+   Output  : Returns the units, an empty string if the PID has no formula.
+*/
+const char *get_mode_01_pid_units(unsigned int pid_num)
+{
+   if (pid_num >= MODE_01_PID_TABLE_LEN)
+   {
+      return("");
+   }
+
+   return(mode_01_pids[pid_num].units);
+}
+
+/*
+   Function: get_hex_bytes()
+
+   Purpose : Converts hex digit pairs to bytes in one pass, with or without
+           : spaces, "41 0C 1A F8" or "410C1AF8". Stops at the end of the
+           : line or anything that is not a hex digit pair.
+   Input   : Hex message, byte buffer and buffer length.
+   Output  : Returns the number of bytes.
+*/
+int get_hex_bytes(char *hex_msg, unsigned char *out_bytes, int max_bytes)
+{
+   return(decode_hex_bytes(hex_msg, strlen(hex_msg), out_bytes, max_bytes, NULL));
+}
+
+/*
+   Function: get_reply_bytes()
+
+   Purpose : Converts an ECU reply to bytes. Lines are delimited with
+           : '!' (server) or '\r'. ISO-TP byte counts and frame numbers are
+           : removed and the CAN padding after the last byte is cut off.
+   Input   : ECU reply, byte buffer and buffer length.
+   Output  : Returns the number of bytes.
+*/
+int get_reply_bytes(char *ecu_reply, unsigned char *reply_bytes, int max_bytes)
+{
+   int nbytes, byte_count;
+
+   nbytes = decode_hex_tokens(ecu_reply, strlen(ecu_reply), reply_bytes, max_bytes, &byte_count);
+   if ((byte_count >= 0) && (byte_count < nbytes))
+   {
+      nbytes = byte_count;
+   }
+
+   return(nbytes);
+}
+
+/*
+   Function: join_reply_frames()
+
+   Purpose : Joins the ISO-TP frames of a long reply into one message,
+           : "008!0:410C1AF80D32!1:057B" becomes "41 0C 1A F8 0D 32 05 7B".
+   Input   : ECU reply, output buffer and buffer length.
+   Output  : Returns the message length, 0 if the reply is one frame.
+*/
+int join_reply_frames(char *ecu_reply, char *out_buf, int out_len)
+{
+   unsigned char reply_bytes[MAX_REPLY_BYTES];
+   int nbytes, ii, len = 0;
+
+   /* The byte count is the first line, three hex digits. */
+   if ((strspn(ecu_reply, "0123456789ABCDEFabcdef") != 3) || ((ecu_reply[3] != '!') && (ecu_reply[3] != '\r')))
+   {
+      return(0);
+   }
+
+   nbytes = get_reply_bytes(ecu_reply, reply_bytes, MAX_REPLY_BYTES);
+   for (ii = 0; (ii < nbytes) && (len + 4 < out_len); ii++)
+   {
+      len += sprintf(out_buf + len, (ii == 0) ? "%.2X" : " %.2X", reply_bytes[ii]);
+   }
+   out_buf[len] = 0;
+
+   return(len);
+}
+
+/*
+   Function: split_mode_01_reply()
+
+   Purpose : Splits a multi-PID Mode 01 reply into one reply per PID,
+           : "41 0C 1A F8 0D 32" becomes "41 0C 1A F8" and "41 0D 32".
+   Input   : ECU reply, reply buffers and number of buffers.
+   Output  : Returns the number of PID replies, 0 if the reply is not a
+           : Mode 01 reply or a PID length is not known.
+*/
+int split_mode_01_reply(char *ecu_reply, char pid_replies[][MAX_PID_REPLY_LEN], int max_replies)
+{
+   unsigned char reply_bytes[MAX_REPLY_BYTES];
+   int nbytes, idx, pid_len, ii, len, count = 0;
+
+   nbytes = get_reply_bytes(ecu_reply, reply_bytes, MAX_REPLY_BYTES);
+   if ((nbytes < 3) || (reply_bytes[0] != 0x41))
+   {
+      return(0);
+   }
+
+   idx = 1;
+   while ((idx < nbytes) && (count < max_replies))
+   {
+      pid_len = get_mode_01_pid_length(reply_bytes[idx]);
+      if ((pid_len == 0) || ((idx + 1 + pid_len) > nbytes))
+      {
+         break; /* Unknown PID or truncated reply, the rest cannot be split. */
+      }
+
+      len = sprintf(pid_replies[count], "41 %.2X", reply_bytes[idx]);
+      for (ii = 1; ii <= pid_len; ii++)
+      {
+         len += sprintf(pid_replies[count] + len, " %.2X", reply_bytes[idx + ii]);
+      }
+
+      idx += 1 + pid_len;
+      count++;
+   }
+
+   return(count);
+}
+
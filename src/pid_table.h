@@ -0,0 +1,49 @@
+/*
+   pid_table.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Mode 01 PID table of data lengths, formulas and units and the
+                splitter for multi-PID ECU replies. Used by the server and
+                the GUI.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_PID_TABLE_INCLUDED
+#define OBD_PID_TABLE_INCLUDED
+
+#define MAX_BATCH_PIDS 6        /* ELM327 limit for one Mode 01 request on CAN. */
+#define MAX_PID_REPLY_LEN 64
+#define MAX_REPLY_BYTES 128
+
+/* Mode 01 PID formulas, A and B are the first two data bytes. */
+#define PID_FORMULA_NONE 0      /* Bit fields or several values, decoded by the caller. */
+#define PID_FORMULA_A 1         /* A * scale + offset */
+#define PID_FORMULA_AB 2        /* (256 * A + B) * scale + offset */
+
+struct _Mode_01_PID {
+   unsigned char data_bytes;
+   unsigned char formula;
+   double scale;
+   double offset;
+   const char *units;
+};
+
+typedef struct _Mode_01_PID Mode_01_PID;
+
+/* pid_table.c */
+const Mode_01_PID *get_mode_01_pid(unsigned int pid_num);
+int get_mode_01_pid_length(unsigned int pid_num);
+int get_mode_01_pid_value(unsigned int pid_num, unsigned char *data, double *value);
+const char *get_mode_01_pid_units(unsigned int pid_num);
+int get_hex_bytes(char *hex_msg, unsigned char *out_bytes, int max_bytes);
+int get_reply_bytes(char *ecu_reply, unsigned char *reply_bytes, int max_bytes);
+int join_reply_frames(char *ecu_reply, char *out_buf, int out_len);
+int split_mode_01_reply(char *ecu_reply, char pid_replies[][MAX_PID_REPLY_LEN], int max_replies);
+
+#endif
+
@@ -59,6 +59,8 @@
 
 #include "obd_monitor.h"
 #include "protocols.h"
+#include "pid_table.h"
+#include "wire_protocol.h"
 
 /* OBD Interface Parameters. */
 OBD_Interface obd_interface;
@@ -115,6 +117,25 @@ DTC_Parameters dtc_list[32];
 #define DTC_SECOND_NUM  0b11110000
 #define DTC_THIRD_NUM   0b00001111
 
+/* ECU parameter of each Mode 01 PID, indexed by PID number. The values
+   are scaled with the PID table, see pid_table.c. */
+static double * const mode_01_parameters[] = {
+   [0x05] = &ecup.ecu_coolant_temperature,
+   [0x0A] = &ecup.ecu_fuel_pressure,
+   [0x0B] = &ecup.ecu_manifold_air_pressure,
+   [0x0C] = &ecup.ecu_engine_rpm,
+   [0x0D] = &ecup.ecu_vehicle_speed,
+   [0x0E] = &ecup.ecu_timing_advance,
+   [0x0F] = &ecup.ecu_intake_air_temperature,
+   [0x11] = &ecup.ecu_throttle_position,
+   [0x2F] = &ecup.ecu_fuel_tank_level,
+   [0x5A] = &ecup.ecu_accelerator_position,
+   [0x5C] = &ecup.ecu_oil_temperature,
+   [0x5E] = &ecup.ecu_fuel_flow_rate
+};
+
+#define MODE_01_PARAMETERS_LEN (sizeof(mode_01_parameters) / sizeof(mode_01_parameters[0]))
+
 /*
    DTC Count and MIL Status Message.
    MIL ON/OFF = Bit A7
@@ -174,113 +195,21 @@ void log_ecu_parameters()
    /* TODO: log ecu parameters on a 60 second timer. */
 }
 
-void set_engine_rpm(char *rpm_msg, int quarter)
-{
-   unsigned int pmode, pid, pa, pb;
-   char temp_buf[256];
-   
-   memset(temp_buf, 0, 256);
-   
-   if (sscanf(rpm_msg, "%x %x %x %x", &pmode, &pid, &pa, &pb) == 4)
-   {
-      if (quarter == 1) 
-      {
-         ecup.ecu_engine_rpm = (((256.0 * (double)pa) + (double)pb) / 4.0);
-      }
-      else
-      {
-         /* Isuzu ECU does not send quarter revolutions. */
-         ecup.ecu_engine_rpm = (((256.0 * (double)pa) + (double)pb));
-      }
-      
-      /* ECU rpm parameter is in quarters of a revolution. */
-      sprintf(temp_buf, "Engine RPM: %f", ecup.ecu_engine_rpm);
-      print_log_entry(temp_buf);
-   }
-   else
-   {
-      ecup.ecu_engine_rpm = 0.0;
-   }
-   return;
-}
-
 double get_engine_rpm()
 {
    return(ecup.ecu_engine_rpm);
 }
 
-void set_coolant_temperature(char *ctemp_msg)
-{
-   unsigned int pmode, pid, pa;
-   char temp_buf[256];
-   
-   memset(temp_buf, 0, 256);
-   
-   if (sscanf(ctemp_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   {
-      ecup.ecu_coolant_temperature = ((double)pa - 40.0);
-      sprintf(temp_buf, "ECT: %f", ecup.ecu_coolant_temperature);
-      print_log_entry(temp_buf);
-   }
-   else
-   {
-      ecup.ecu_coolant_temperature = 0.0;
-   }
-   return;
-}
-
 double get_coolant_temperature()
 {
    return(ecup.ecu_coolant_temperature);
 }
 
-void set_manifold_pressure(char *manap_msg)
-{
-   unsigned int pmode, pid, pa;
-   char temp_buf[256];
-   
-   memset(temp_buf, 0, 256);
-   
-   if (sscanf(manap_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   {
-      ecup.ecu_manifold_air_pressure = (double)pa;
-      sprintf(temp_buf, "MAP: %f", ecup.ecu_manifold_air_pressure);
-      print_log_entry(temp_buf);
-   }
-   else
-   {
-      ecup.ecu_manifold_air_pressure = 0.0;
-   }
-   
-   return;
-}
-
 double get_manifold_pressure()
 {
    return(ecup.ecu_manifold_air_pressure);
 }
 
-void set_intake_air_temperature(char *atemp_msg)
-{
-   unsigned int pmode, pid, pa;
-   char temp_buf[256];
-   
-   memset(temp_buf, 0, 256);
-   
-   if (sscanf(atemp_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   {
-      ecup.ecu_intake_air_temperature = ((double)pa - 40.0);
-      sprintf(temp_buf, "IAT: %f", ecup.ecu_intake_air_temperature);
-      print_log_entry(temp_buf);
-   }
-   else
-   {
-      ecup.ecu_intake_air_temperature = 0.0;
-   }
-   
-   return;
-}
-
 double get_intake_air_temperature()
 {
    return(ecup.ecu_intake_air_temperature);
@@ -389,27 +318,6 @@ void get_obd_protocol_name(char *info)
 }
 
 
-void set_vehicle_speed(char *vs_msg)
-{
-   unsigned int pmode, pid, pa;
-   char temp_buf[256];
-   
-   memset(temp_buf, 0, 256);
-   
-   if (sscanf(vs_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   {
-      ecup.ecu_vehicle_speed = (double)pa;
-      sprintf(temp_buf, "Vehicle Speed: %f", ecup.ecu_vehicle_speed);
-      print_log_entry(temp_buf);
-   }
-   else
-   {
-      ecup.ecu_vehicle_speed = 0.0;
-   }
-   
-   return;
-}
-
 double get_vehicle_speed()
 {
    return(ecup.ecu_vehicle_speed);
@@ -425,44 +333,11 @@ double get_egr_pressure()
    return(0);
 }
 
-void set_throttle_position(char *tp_msg)
-{
-   unsigned int pmode, pid, pa;
-
-   if (sscanf(tp_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   {
-      ecup.ecu_throttle_position = 0.392 * (double)pa;
-      print_log_entry(tp_msg);
-   }
-   else
-   {
-      ecup.ecu_throttle_position = 0.0;
-   }
-   
-   return;
-}
-
 double get_throttle_position()
 {
    return(ecup.ecu_throttle_position);
 }
 
-void set_oil_temperature(char *otemp_msg)
-{
-   unsigned int pmode, pid, pa;
-
-   if (sscanf(otemp_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   { 
-      ecup.ecu_oil_temperature = ((double)pa - 40.0);
-      print_log_entry(otemp_msg);
-   }
-   else
-   {
-      ecup.ecu_oil_temperature = 0.0;
-   }
-   return;
-}
-
 double get_oil_temperature()
 {
    return(ecup.ecu_oil_temperature);
@@ -478,160 +353,60 @@ double get_oil_pressure()
    return(0);
 }
 
-void set_timing_advance(char *tadv_msg)
-{
-   unsigned int pmode, pid, pa;
-
-   if (sscanf(tadv_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   {
-      ecup.ecu_timing_advance = ((double)pa / 2.0) - 64.0;
-      print_log_entry(tadv_msg);
-   }
-   else
-   {
-      ecup.ecu_timing_advance = 0.0;
-   }
-   
-   return;
-}
-
 double get_timing_advance()
 {
    return(ecup.ecu_timing_advance);
 }
 
 
-void set_fuel_tank_level(char *ftl_msg)
-{
-   unsigned int pmode, pid, pa;
-
-   if (sscanf(ftl_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   {
-      ecup.ecu_fuel_tank_level = ((float)pa * 0.392);
-      print_log_entry(ftl_msg);
-   }
-   else
-   {
-      ecup.ecu_fuel_tank_level = 0.0;
-   }
-   
-   return;
-}
-
-
 double get_fuel_tank_level()
 {
    return(ecup.ecu_fuel_tank_level);
 }
 
-void set_fuel_flow_rate(char *ffr_msg)
-{
-   unsigned int pmode, pid, pa, pb;
-
-   if (sscanf(ffr_msg, "%x %x %x %x", &pmode, &pid, &pa, &pb) == 4)
-   {
-      ecup.ecu_fuel_flow_rate = ((256.0 * (double)pa) + (double)pb) / 20.0;
-      print_log_entry(ffr_msg);
-   }
-   else
-   {
-      ecup.ecu_fuel_flow_rate = 0.0;
-   }
-   
-   return;
-}
-
 double get_fuel_flow_rate()
 {
    return(ecup.ecu_fuel_flow_rate);
 }
 
 
-void set_fuel_pressure(char *fp_msg)
-{
-   unsigned int pmode, pid, pa;
-
-   if (sscanf(fp_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   { 
-      ecup.ecu_fuel_pressure = (double)pa * 3.0; 
-      print_log_entry(fp_msg);
-   }
-   else
-   {
-      ecup.ecu_fuel_pressure = 0.0;
-   }
-   
-   return;
-}
-
 double get_fuel_pressure()
 {
    return(ecup.ecu_fuel_pressure);
 }
 
 
-void set_accelerator_position(char *ap_msg)
-{
-   unsigned int pmode, pid, pa;
-   char temp_buf[256];
-   
-   memset(temp_buf, 0, 256);
-
-   if (sscanf(ap_msg, "%x %x %x", &pmode, &pid, &pa) == 3)
-   {
-      ecup.ecu_accelerator_position = 0.392 * (double)pa;
-      sprintf(temp_buf, "Accelerator Position: %f", ecup.ecu_accelerator_position);
-      print_log_entry(temp_buf);
-   }
-   else
-   {
-      ecup.ecu_accelerator_position = 0.0;
-   }
-   
-   return;
-}
-
 double get_accelerator_position()
 {
    return(ecup.ecu_accelerator_position);
 }
 
-void set_mode_1_supported_pid_list_1_32(char *pid_msg)
+void set_mode_1_supported_pid_list_1_32(unsigned char *pid_data)
 {
-   unsigned int pmode, pid, pa, pb, pc, pd;
    unsigned int ii;
    unsigned long bit_select = 0x80000000;
    unsigned long bit_list;
    char temp_buf[256];
 
-   if (sscanf(pid_msg, "%x %x %x %x %x %x", &pmode, &pid, &pa, &pb, &pc, &pd) == 6)
+   bit_list = ((unsigned long)pid_data[0] << 24) | (pid_data[1] << 16) | (pid_data[2] << 8) | pid_data[3];
+   printf("set_mode_1_supported_pid_list_1_32(): PID list = %.2x %.2x %.2x %.2x = %lx\n", pid_data[0], pid_data[1], pid_data[2], pid_data[3], bit_list);
+   for (ii = 0; ii < 32; ii++)
    {
-      bit_list = (16777216 * pa) + (65536 * pb) + (256 * pc) + pd;
-      printf("set_mode_1_supported_pid_list_1_32(): PID list = %.2x %.2x %.2x %.2x = %lx\n", pa, pb, pc, pd, bit_list);
-      for (ii = 0; ii < 32; ii++)
+      if (bit_list & bit_select)
       {
-         if (bit_list & bit_select)
-         {
-            /* TODO: add to supported PID list. */
-            sprintf(temp_buf, "set_mode_1_supported_pid_list_1_32(): PID %.2x supported.\n", ii+1);
-            update_comms_log_view(temp_buf);
-            print_log_entry(temp_buf);
-         }
-         else
-         {
-            sprintf(temp_buf, "set_mode_1_supported_pid_list_1_32(): PID %.2x NOT supported.\n", ii+1);
-            update_comms_log_view(temp_buf);
-            print_log_entry(temp_buf);
-         }
-         bit_select = bit_select >> 1;
+         /* TODO: add to supported PID list. */
+         sprintf(temp_buf, "set_mode_1_supported_pid_list_1_32(): PID %.2x supported.\n", ii+1);
+         update_comms_log_view(temp_buf);
+         print_log_entry(temp_buf);
       }
-      print_log_entry(pid_msg);
-   }
-   else
-   {
-      printf("set_mode_1_supported_pid_list_1_32() <ERROR>: Invalid message.\n");
+      else
+      {
+         sprintf(temp_buf, "set_mode_1_supported_pid_list_1_32(): PID %.2x NOT supported.\n", ii+1);
+         update_comms_log_view(temp_buf);
+         print_log_entry(temp_buf);
+      }
+      bit_select = bit_select >> 1;
    }
-   
 
    return;
 }
@@ -645,16 +420,16 @@ double get_mode_1_supported_pid_list_1_32()
 
 void set_mode_9_supported_pid_list_1_32(char *pid_msg)
 {
-   unsigned int pmode, pid, pa, pb, pc, pd;
+   unsigned char msg_bytes[6];
    unsigned int ii;
    unsigned long bit_select = 0x80000000;
    unsigned long bit_list;
    char temp_buf[256];
 
-   if (sscanf(pid_msg, "%x %x %x %x %x %x", &pmode, &pid, &pa, &pb, &pc, &pd) == 6)
+   if (get_hex_bytes(pid_msg, msg_bytes, 6) == 6)
    {
-      bit_list = (16777216 * pa) + (65536 * pb) + (256 * pc) + pd;
-      printf("set_mode_9_supported_pid_list_1_32(): PID list = %.2x %.2x %.2x %.2x = %lx\n", pa, pb, pc, pd, bit_list);
+      bit_list = ((unsigned long)msg_bytes[2] << 24) | (msg_bytes[3] << 16) | (msg_bytes[4] << 8) | msg_bytes[5];
+      printf("set_mode_9_supported_pid_list_1_32(): PID list = %.2x %.2x %.2x %.2x = %lx\n", msg_bytes[2], msg_bytes[3], msg_bytes[4], msg_bytes[5], bit_list);
       for (ii = 0; ii < 32; ii++)
       {
          if (bit_list & bit_select)
@@ -766,40 +541,25 @@ int get_dtc_count()
    return(ecup.ecu_dtc_count);
 }
 
-void set_dtc_count(char *obd_mil_msg)
+void set_dtc_count(unsigned char *mil_data)
 {
-   int len;
-   long mil_code;
    char buf[256];
-   char mil_chars[2];
-   
-   len = strlen(obd_mil_msg);
-   
-   if (len > 8)
+
+   /* Bit 7 of A is the MIL, the rest is the DTC count. */
+   ecup.ecu_dtc_count = mil_data[0] & 0x7F;
+   if (mil_data[0] & 0x80)
    {
-     mil_chars[0] = obd_mil_msg[6];
-     mil_chars[1] = obd_mil_msg[7];
-     mil_code = strtol(mil_chars, 0, 16);
-     if (mil_code >= 128)
-     {
-        /* MIL is on. */
-        ecup.ecu_mil_status = 1;
-        ecup.ecu_dtc_count = mil_code - 128;
-        sprintf(buf, "MIL On: DTC Count = %d", ecup.ecu_dtc_count);
-        
-     }
-     else
-     {
-        /* MIL is off. */
-        ecup.ecu_mil_status = 0;
-        ecup.ecu_dtc_count = mil_code;
-        sprintf(buf, "MIL Off: DTC Count = %d", ecup.ecu_dtc_count);
-        
-     }
-     set_status_bar_msg(buf);
-     print_log_entry(buf);
+      ecup.ecu_mil_status = 1;
+      sprintf(buf, "MIL On: DTC Count = %d", ecup.ecu_dtc_count);
    }
-   
+   else
+   {
+      ecup.ecu_mil_status = 0;
+      sprintf(buf, "MIL Off: DTC Count = %d", ecup.ecu_dtc_count);
+   }
+   set_status_bar_msg(buf);
+   print_log_entry(buf);
+
    return;
 }
 
@@ -817,45 +577,75 @@ void get_last_dtc_code(char *code_buf)
 }
 
 
-void parse_mode_01_msg(char *obd_msg)
+/*
+   Function: set_mode_01_value()
+
+   Purpose : Stores a scaled Mode 01 value in its ECU parameter.
+   Input   : PID number and value.
+   Output  : Returns 1, 0 if the PID has no ECU parameter.
+*/
+int set_mode_01_value(unsigned int pid_num, double value)
 {
-   /* Decode ECU Mode 01 parameter message. */
-   unsigned int pmode, pid;
-   char header[16];
-   
-   memset(header, 0, 16);
-   strncpy(header, obd_msg, 5);
-   
-   if (sscanf(header, "%x %x", &pmode, &pid) == 2)
+   if ((pid_num >= MODE_01_PARAMETERS_LEN) || (mode_01_parameters[pid_num] == NULL))
+   {
+      return(0);
+   }
+
+   *mode_01_parameters[pid_num] = value;
+
+   return(1);
+}
+
+/*
+   Function: parse_mode_01_msg()
+
+   Purpose : Decodes every PID of a Mode 01 message with the PID table, in
+           : one pass over the message bytes. A multi-PID request returns
+           : several PIDs in one message, "41 0C 1A F8 0D 32".
+   Input   : ECU message, with or without spaces.
+   Output  : Returns the number of PIDs decoded.
+*/
+int parse_mode_01_msg(char *obd_msg)
+{
+   unsigned char msg_bytes[MAX_REPLY_BYTES];
+   unsigned char *pid_data;
+   unsigned int pid_num;
+   double value;
+   int nbytes, pid_len, idx, count = 0;
+
+   nbytes = get_hex_bytes(obd_msg, msg_bytes, MAX_REPLY_BYTES);
+   if ((nbytes < 3) || (msg_bytes[0] != 0x41))
+   {
+      printf("parse_mode_01_msg(): Invalid OBD Mode 01 Message: %s\n", obd_msg);
+      return(0);
+   }
+
+   for (idx = 1; idx < nbytes; idx += 1 + pid_len)
    {
-      switch(pid)
+      pid_num = msg_bytes[idx];
+      pid_len = get_mode_01_pid_length(pid_num);
+      if ((pid_len == 0) || ((idx + 1 + pid_len) > nbytes))
       {
-         case 0: set_mode_1_supported_pid_list_1_32(obd_msg); break; /* TODO: Supported PIDs. */
-         case 1: set_dtc_count(obd_msg);
-         case 5: set_coolant_temperature(obd_msg); break;
-         case 10: set_fuel_pressure(obd_msg); break;
-         case 11: set_manifold_pressure(obd_msg); break; 
-         case 12: set_engine_rpm(obd_msg, 0); break; /* TODO: Isuzu ECU does use standard calculation. */
-         case 13: set_vehicle_speed(obd_msg); break;
-         case 14: set_timing_advance(obd_msg); break;
-         case 15: set_intake_air_temperature(obd_msg); break;
-         case 17: set_throttle_position(obd_msg); break;
-         case 47: set_fuel_tank_level(obd_msg); break;
-         case 90: set_accelerator_position(obd_msg); break;
-         case 92: set_oil_temperature(obd_msg); break;
-         case 94: set_fuel_flow_rate(obd_msg); break;
-         default : break; /* TODO: process unknown PID. */
+         break; /* Unknown PID or truncated message, the rest cannot be split. */
       }
 
+      pid_data = &msg_bytes[idx + 1];
+      if (pid_num == 0x00)
+      {
+         set_mode_1_supported_pid_list_1_32(pid_data);
+      }
+      else if (pid_num == 0x01)
+      {
+         set_dtc_count(pid_data);
+      }
+      else if (get_mode_01_pid_value(pid_num, pid_data, &value) == 1)
+      {
+         set_mode_01_value(pid_num, value);
+      }
+      count++;
    }
-   else
-   {
-      /* TODO: log error message. */
-      printf("parse_mode_01_msg(): Invalid OBD Mode 01 Message: %s\n", obd_msg);
-   }   
 
-   
-   return;
+   return(count);
 }
 
 void parse_mode_03_msg(char *obd_dtc_msg)
@@ -912,15 +702,11 @@ void parse_mode_03_msg(char *obd_dtc_msg)
 void parse_mode_09_msg(char *obd_msg)
 {
    /* Decode ECU Mode 09 parameter message. */
-   unsigned int pmode, pid;
-   char header[16];
-   
-   memset(header, 0, 16);
-   strncpy(header, obd_msg, 5);
+   unsigned char header[2];
    
-   if (sscanf(header, "%x %x", &pmode, &pid) == 2)
+   if (get_hex_bytes(obd_msg, header, 2) == 2)
    {
-      switch(pid)
+      switch(header[1])
       {
          case 0: set_mode_9_supported_pid_list_1_32(obd_msg); break; /* TODO: Supported PIDs. */
          case 2: set_vehicle_vin(obd_msg); break;
@@ -931,15 +717,48 @@ void parse_mode_09_msg(char *obd_msg)
 }
 
 
+/*
+   Function: parse_wire_msg()
+
+   Purpose : Reads the scaled samples of a binary datagram from the server,
+           : no text parsing needed.
+   Input   : Datagram and length.
+   Output  : Returns the number of samples or -1 if the datagram is invalid.
+*/
+int parse_wire_msg(unsigned char *wire_msg, int msg_len)
+{
+   Wire_Sample samples[MAX_WIRE_SAMPLES];
+   unsigned int sequence;
+   int count, ii;
+
+   count = decode_wire_datagram(wire_msg, msg_len, &sequence, samples, MAX_WIRE_SAMPLES);
+   for (ii = 0; ii < count; ii++)
+   {
+      if (samples[ii].pid_mode == 0x01)
+         set_mode_01_value(samples[ii].pid_num, samples[ii].value);
+   }
+
+   return(count);
+}
+
 int parse_obd_msg(char *obd_msg)
 {
    int msg_len, result;
    char log_buf[256];
+   char spaced_msg[256];
    
    memset(log_buf, 0, 256);
 
    result = -1;
    
+   /* The server sets the interpreter spaces off (ATS0), so ECU replies
+      can arrive as "410C1AF8", the parsers expect "41 0C 1A F8". */
+   if ((obd_msg[0] == '4') && (strchr(obd_msg, ' ') == NULL))
+   {
+      xhexspace(spaced_msg, obd_msg, 256);
+      obd_msg = spaced_msg;
+   }
+   
    msg_len = strlen(obd_msg);
    
    if (msg_len > 0) 
@@ -125,6 +125,11 @@ struct _PID_Parameters {
    char pid_formula[256];
    char pid_description[256];
    char pid_gauge_label[32];
+   unsigned int pid_mode;
+   char pid_units[16];
+   struct te_expr *pid_expr;  /* Formula compiled once, see custom_pid.c. */
+   struct te_program *pid_program;  /* The formula as bytecode. */
+   double pid_vars[4];        /* Data bytes A, B, C and D bound to the formula. */
    UT_hash_handle hh;
 };
 
@@ -183,6 +188,7 @@ void get_last_dtc_code(char *code_buf);
 
 /* Message Parsers. */
 int parse_obd_msg(char *obd_msg);
+int parse_wire_msg(unsigned char *wire_msg, int msg_len);
 
 
 #endif
@@ -0,0 +1,358 @@
+/*
+   request_queue.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Ring buffers of client requests, one per priority class.
+                The ELM327 can only handle one request at a time, so
+                requests that arrive while an exchange is in flight wait
+                here until the interpreter sends the '>' prompt. No memory
+                is allocated after startup.
+
+                Requests are served real time first, then normal, then
+                background, FIFO within a class. A burst of DTC or VIN
+                reads no longer holds up the gauge PIDs:
+
+                PRI <class> <request>
+
+                Example: "PRI 2 03\r" reads the DTCs in the background.
+                Without the prefix Mode 01 and AT requests are normal and
+                the slow modes (02, 03, 04, 07, 09, 0A) are background.
+
+                A class that has waited while MAX_PRIORITY_SKIPS higher
+                class requests were served gets the next turn, so a busy
+                poll schedule cannot starve the other clients.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "obd_monitor.h"
+#include "request_queue.h"
+
+ADAPTER_LOCAL ECU_Request request_queue[NUM_PRIORITY_CLASSES][MAX_REQUEST_QUEUE];
+ADAPTER_LOCAL int queue_head[NUM_PRIORITY_CLASSES];
+ADAPTER_LOCAL int queue_tail[NUM_PRIORITY_CLASSES];
+ADAPTER_LOCAL int queue_count[NUM_PRIORITY_CLASSES];
+ADAPTER_LOCAL int priority_skips[NUM_PRIORITY_CLASSES];
+
+void init_request_queue()
+{
+   memset(queue_head, 0, sizeof(queue_head));
+   memset(queue_tail, 0, sizeof(queue_tail));
+   memset(queue_count, 0, sizeof(queue_count));
+   memset(priority_skips, 0, sizeof(priority_skips));
+
+   return;
+}
+
+/*
+   Function: enqueue_request()
+
+   Purpose : Copies a request to the tail of the queue for its priority.
+   Input   : Client request.
+   Output  : Returns the queue count or -1 if the queue is full.
+*/
+int enqueue_request(ECU_Request *req)
+{
+   int pri = req->priority;
+
+   if ((pri < 0) || (pri >= NUM_PRIORITY_CLASSES))
+   {
+      pri = PRIORITY_NORMAL;
+      req->priority = pri;
+   }
+
+   if (queue_count[pri] >= MAX_REQUEST_QUEUE)
+   {
+      printf("enqueue_request() <ERROR>: Request queue full, dropping %s\n", req->ecu_query);
+      return(-1);
+   }
+
+   memcpy(&request_queue[pri][queue_tail[pri]], req, sizeof(ECU_Request));
+   queue_tail[pri] = (queue_tail[pri] + 1) % MAX_REQUEST_QUEUE;
+   queue_count[pri]++;
+
+   return(queue_count[pri]);
+}
+
+int is_priority_starved(int priority)
+{
+   return((priority > PRIORITY_REALTIME) && (priority < NUM_PRIORITY_CLASSES) && (queue_count[priority] > 0) &&
+          (priority_skips[priority] >= MAX_PRIORITY_SKIPS));
+}
+
+/*
+   Function: get_next_priority()
+
+   Purpose : Gets the class the next dequeue will serve, the highest class
+           : with requests unless a lower class has waited too long.
+   Input   : None.
+   Output  : Returns the priority class or -1 if the queues are empty.
+*/
+int get_next_priority()
+{
+   int pri;
+
+   for (pri = NUM_PRIORITY_CLASSES - 1; pri > PRIORITY_REALTIME; pri--)
+   {
+      if (is_priority_starved(pri))
+         return(pri);
+   }
+
+   for (pri = 0; pri < NUM_PRIORITY_CLASSES; pri++)
+   {
+      if (queue_count[pri] > 0)
+         return(pri);
+   }
+
+   return(-1);
+}
+
+/*
+   Function: note_priority_served()
+
+   Purpose : Records that a request of a class was sent, the waiting lower
+           : classes move one turn closer to being served.
+   Input   : Priority class served, scheduler polls count as real time.
+   Output  : None.
+*/
+void note_priority_served(int priority)
+{
+   int pri;
+
+   priority_skips[priority] = 0;
+   for (pri = priority + 1; pri < NUM_PRIORITY_CLASSES; pri++)
+   {
+      if (queue_count[pri] > 0)
+         priority_skips[pri]++;
+   }
+
+   return;
+}
+
+/*
+   Function: dequeue_request()
+
+   Purpose : Copies the next request to serve and removes it.
+   Input   : Request buffer.
+   Output  : Returns 1 or 0 if the queues are empty.
+*/
+int dequeue_request(ECU_Request *req)
+{
+   int pri;
+
+   pri = get_next_priority();
+   if (pri < 0)
+   {
+      return(0);
+   }
+
+   memcpy(req, &request_queue[pri][queue_head[pri]], sizeof(ECU_Request));
+   queue_head[pri] = (queue_head[pri] + 1) % MAX_REQUEST_QUEUE;
+   queue_count[pri]--;
+
+   note_priority_served(pri);
+
+   return(1);
+}
+
+/*
+   Function: get_queue_slot()
+
+   Purpose : Maps a position in priority order to a class and queue slot.
+   Input   : Position, 0 is the head of the highest class, class and slot.
+   Output  : Returns 1 or 0 if the position is not queued.
+*/
+int get_queue_slot(int position, int *priority, int *slot)
+{
+   int pri;
+
+   if (position < 0)
+   {
+      return(0);
+   }
+
+   for (pri = 0; pri < NUM_PRIORITY_CLASSES; pri++)
+   {
+      if (position < queue_count[pri])
+      {
+         *priority = pri;
+         *slot = (queue_head[pri] + position) % MAX_REQUEST_QUEUE;
+         return(1);
+      }
+      position -= queue_count[pri];
+   }
+
+   return(0);
+}
+
+/*
+   Function: get_queued_request()
+
+   Purpose : Looks at a queued request without removing it.
+   Input   : Position in priority order, 0 is the head.
+   Output  : Returns the request or NULL if the position is not queued.
+*/
+ECU_Request *get_queued_request(int position)
+{
+   int pri, slot;
+
+   if (get_queue_slot(position, &pri, &slot) == 0)
+   {
+      return(NULL);
+   }
+
+   return(&request_queue[pri][slot]);
+}
+
+/*
+   Function: dequeue_request_at()
+
+   Purpose : Removes a request from the middle of the queues, the requests
+           : in front of it in the same class move back one place.
+   Input   : Position in priority order and request buffer.
+   Output  : Returns 1 or 0 if the position is not queued.
+*/
+int dequeue_request_at(int position, ECU_Request *req)
+{
+   int ii, pri, slot, prev, class_pos;
+
+   if (get_queue_slot(position, &pri, &slot) == 0)
+   {
+      return(0);
+   }
+
+   memcpy(req, &request_queue[pri][slot], sizeof(ECU_Request));
+
+   class_pos = (slot + MAX_REQUEST_QUEUE - queue_head[pri]) % MAX_REQUEST_QUEUE;
+   for (ii = class_pos; ii > 0; ii--)
+   {
+      prev = (slot + MAX_REQUEST_QUEUE - 1) % MAX_REQUEST_QUEUE;
+      memcpy(&request_queue[pri][slot], &request_queue[pri][prev], sizeof(ECU_Request));
+      slot = prev;
+   }
+
+   queue_head[pri] = (queue_head[pri] + 1) % MAX_REQUEST_QUEUE;
+   queue_count[pri]--;
+
+   return(1);
+}
+
+int get_request_queue_count()
+{
+   return(queue_count[PRIORITY_REALTIME] + queue_count[PRIORITY_NORMAL] + queue_count[PRIORITY_BACKGROUND]);
+}
+
+int get_priority_queue_count(int priority)
+{
+   return(queue_count[priority]);
+}
+
+int get_default_priority(char *ecu_query)
+{
+   unsigned int pid_mode;
+
+   if (!isxdigit((unsigned char)ecu_query[0]) || !isxdigit((unsigned char)ecu_query[1]) ||
+       (sscanf(ecu_query, "%2x", &pid_mode) != 1))
+   {
+      return(PRIORITY_NORMAL); /* AT commands. */
+   }
+
+   switch(pid_mode)
+   {
+      case 0x02: /* Freeze frame */
+      case 0x03: /* DTCs */
+      case 0x04: /* Clear DTCs */
+      case 0x07: /* Pending DTCs */
+      case 0x09: /* Vehicle information */
+      case 0x0A: /* Permanent DTCs */
+         return(PRIORITY_BACKGROUND);
+   }
+
+   return(PRIORITY_NORMAL);
+}
+
+/*
+   Function: set_request_priority()
+
+   Purpose : Sets the priority of a client request from the "PRI <class> "
+           : prefix, which is removed, or from the request mode.
+   Input   : Client request.
+   Output  : Returns the priority or -1 if the prefix is invalid.
+*/
+int set_request_priority(ECU_Request *req)
+{
+   char *query;
+   int pri;
+
+   if (strncmp(req->ecu_query, "PRI ", 4) != 0)
+   {
+      req->priority = get_default_priority(req->ecu_query);
+      return(req->priority);
+   }
+
+   query = req->ecu_query + 4;
+   if (!isdigit((unsigned char)query[0]) || (query[1] != ' ') || (query[2] == 0))
+   {
+      return(-1);
+   }
+
+   pri = query[0] - '0';
+   if (pri >= NUM_PRIORITY_CLASSES)
+   {
+      return(-1);
+   }
+
+   req->query_len -= 6;
+   memmove(req->ecu_query, query + 2, req->query_len + 1);
+   req->priority = pri;
+
+   return(pri);
+}
+
+/*
+   Function: set_request_id()
+
+   Purpose : Takes the "ID <hex> " prefix off a client request. The server
+           : puts the same prefix on every reply to the request, so the
+           : client can match replies to requests: "ID 1F 01 0C\r" is
+           : answered with "ID 1F 41 0C 1A F8".
+   Input   : Client request.
+   Output  : Returns 1 if the request has an ID, 0 if not or -1 if the
+           : prefix is invalid.
+*/
+int set_request_id(ECU_Request *req)
+{
+   char *end_ptr;
+   unsigned long request_id;
+   int len;
+
+   req->request_id = 0;
+   if (strncmp(req->ecu_query, "ID ", 3) != 0)
+   {
+      return(0);
+   }
+
+   request_id = strtoul(req->ecu_query + 3, &end_ptr, 16);
+   if ((end_ptr == req->ecu_query + 3) || (end_ptr - req->ecu_query > 11) || (*end_ptr != ' ') ||
+       (request_id == 0) || (request_id > 0xFFFFFFFFUL))
+   {
+      return(-1);
+   }
+
+   len = (end_ptr + 1) - req->ecu_query;
+   req->query_len -= len;
+   memmove(req->ecu_query, end_ptr + 1, req->query_len + 1);
+   req->request_id = (unsigned int)request_id;
+
+   return(1);
+}
+
@@ -0,0 +1,56 @@
+/*
+   request_queue.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Fixed size priority queues of client requests waiting for
+                the ELM327 interpreter. Used by the server event loop.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_REQUEST_QUEUE_INCLUDED
+#define OBD_REQUEST_QUEUE_INCLUDED
+
+#include "transport.h"
+
+#define MAX_REQUEST_QUEUE 64     /* Per priority class. */
+
+/* Request priority classes, the scheduler polls are real time. */
+#define PRIORITY_REALTIME 0
+#define PRIORITY_NORMAL 1
+#define PRIORITY_BACKGROUND 2
+#define NUM_PRIORITY_CLASSES 3
+#define MAX_PRIORITY_SKIPS 8     /* Higher class requests served before a waiting class gets a turn. */
+
+struct _ECU_Request {
+   char ecu_query[MAX_SERIAL_BUF_LEN];
+   int query_len;
+   Client_Address from_client;   /* Transport CLIENT_NONE for server requests. */
+   int priority;
+   unsigned int request_id;      /* Echoed in the reply, 0 if the client sent none. */
+   long long rx_time_us;         /* When the request arrived, 0 for server requests. */
+};
+
+typedef struct _ECU_Request ECU_Request;
+
+/* request_queue.c */
+void init_request_queue();
+int enqueue_request(ECU_Request *req);
+int dequeue_request(ECU_Request *req);
+ECU_Request *get_queued_request(int position);
+int dequeue_request_at(int position, ECU_Request *req);
+int get_request_queue_count();
+int get_priority_queue_count(int priority);
+int get_next_priority();
+int is_priority_starved(int priority);
+void note_priority_served(int priority);
+int get_default_priority(char *ecu_query);
+int set_request_priority(ECU_Request *req);
+int set_request_id(ECU_Request *req);
+
+#endif
+
@@ -0,0 +1,327 @@
+/*
+   response_cache.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: ECU reply cache and in-flight request coalescing.
+
+                Single PID requests for the read only modes 01 (current
+                data) and 09 (vehicle information) are keyed on mode and
+                PID. A request is answered from the cache when the last
+                reply is younger than the cache TTL. Otherwise, if the
+                same request is already queued or in flight, the client
+                is attached to it as a waiter and gets the same reply, so
+                several clients asking for 01 0C at the same moment cost
+                one serial exchange.
+
+                Requests that change ECU state, such as mode 04 (clear
+                DTCs), and AT commands are never cached.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "obd_monitor.h"
+#include "response_cache.h"
+#include "subscriptions.h"
+#include "binary_clients.h"
+
+ADAPTER_LOCAL Cached_Reply *reply_cache = NULL; /* the hash map head record */
+ADAPTER_LOCAL int cache_ttl_ms;
+
+void init_response_cache(int ttl_ms)
+{
+   cache_ttl_ms = ttl_ms;
+
+   return;
+}
+
+int get_cache_ttl()
+{
+   return(cache_ttl_ms);
+}
+
+/*
+   Function: get_query_pid()
+
+   Purpose : Checks if a request can be cached, it must be exactly one
+           : mode 01 or mode 09 PID, e.g. "01 0C\r" or "010C\r".
+   Input   : Request message, mode and PID output.
+   Output  : Returns 1 if the request can be cached, otherwise 0.
+*/
+int get_query_pid(char *ecu_query, unsigned int *pid_mode, unsigned int *pid_num)
+{
+   char hex_chars[5];
+   int ii, nhex = 0;
+   unsigned int query_value;
+
+   for (ii = 0; ecu_query[ii] != 0; ii++)
+   {
+      if (isxdigit((unsigned char)ecu_query[ii]))
+      {
+         if (nhex >= 4)
+            return(0);
+         hex_chars[nhex++] = ecu_query[ii];
+      }
+      else if ((ecu_query[ii] != ' ') && (ecu_query[ii] != '\r') && (ecu_query[ii] != '\n'))
+      {
+         return(0);
+      }
+   }
+
+   if (nhex != 4)
+      return(0);
+
+   hex_chars[4] = 0;
+   query_value = strtoul(hex_chars, NULL, 16);
+   *pid_mode = query_value >> 8;
+   *pid_num = query_value & 0xFF;
+
+   return((*pid_mode == 0x01) || (*pid_mode == 0x09));
+}
+
+int cache_key_of(unsigned int pid_mode, unsigned int pid_num)
+{
+   return((int)((pid_mode << 8) | pid_num));
+}
+
+Cached_Reply *find_cached_reply(ECU_Request *req, int create)
+{
+   Cached_Reply *cr;
+   unsigned int pid_mode, pid_num;
+   int cache_key;
+
+   if (get_query_pid(req->ecu_query, &pid_mode, &pid_num) == 0)
+   {
+      return(NULL);
+   }
+
+   cache_key = cache_key_of(pid_mode, pid_num);
+   HASH_FIND_INT(reply_cache, &cache_key, cr);
+   if ((cr == NULL) && (create == 1))
+   {
+      /* Only allocated the first time a PID is requested. */
+      cr = (Cached_Reply *) xcalloc(sizeof(Cached_Reply));
+      cr->cache_key = cache_key;
+      HASH_ADD_INT(reply_cache, cache_key, cr);
+   }
+
+   return(cr);
+}
+
+int add_waiter(Cached_Reply *cr, ECU_Request *req)
+{
+   int ii;
+
+   if (req->from_client.transport == CLIENT_NONE)
+      return(0);
+
+   for (ii = 0; ii < cr->waiter_count; ii++)
+   {
+      if (same_client(&cr->waiters[ii], &req->from_client) && (cr->waiter_ids[ii] == req->request_id))
+         return(1);
+   }
+
+   if (cr->waiter_count >= MAX_CACHE_WAITERS)
+      return(0);
+
+   cr->waiters[cr->waiter_count] = req->from_client;
+   cr->waiter_ids[cr->waiter_count] = req->request_id;
+   cr->waiter_count++;
+
+   return(1);
+}
+
+/*
+   Function: serve_from_cache()
+
+   Purpose : Answers a client request from the cache if the last reply is
+           : fresh, or attaches the client to a matching request that is
+           : already queued or in flight.
+   Input   : Client request and current monotonic time.
+   Output  : Returns 1 if the request was handled, 0 if it must be sent
+           : to the interpreter.
+*/
+int serve_from_cache(ECU_Request *req, long long now_ms)
+{
+   Cached_Reply *cr;
+
+   cr = find_cached_reply(req, 0);
+   if (cr == NULL)
+   {
+      return(0);
+   }
+
+   if ((cr->reply_len > 0) && ((now_ms - cr->reply_time_ms) < cache_ttl_ms))
+   {
+      send_client_data(&req->from_client, req->request_id, cr->ecu_reply, cr->reply_len);
+      cr->hit_count++;
+      return(1);
+   }
+
+   if ((cr->pending == 1) && (add_waiter(cr, req) == 1))
+   {
+      cr->coalesced_count++;
+      return(1);
+   }
+
+   return(0);
+}
+
+/*
+   Function: set_response_pending()
+
+   Purpose : Marks a request as queued or in flight so that identical
+           : requests attach to it.
+   Input   : Request.
+*/
+void set_response_pending(ECU_Request *req)
+{
+   Cached_Reply *cr;
+
+   cr = find_cached_reply(req, 1);
+   if (cr != NULL)
+   {
+      cr->pending = 1;
+   }
+
+   return;
+}
+
+/*
+   Function: complete_cached_response()
+
+   Purpose : Saves an ECU reply in the cache and sends it to the clients
+           : waiting on the request. Waiters that made the request or are
+           : subscribed to the PID already have the reply.
+   Input   : Request, ECU reply, reply length and current time.
+   Output  : Returns the number of waiters the reply was sent to.
+*/
+int complete_cached_response(ECU_Request *req, char *ecu_reply, int reply_len, long long now_ms)
+{
+   Cached_Reply *cr;
+   unsigned int pid_mode, pid_num;
+   int ii, valid_reply, count = 0;
+
+   cr = find_cached_reply(req, 1);
+   if (cr == NULL)
+   {
+      return(0);
+   }
+
+   /* Only positive replies such as "41 0C 1A F8" are cached, not NO DATA. */
+   valid_reply = (get_reply_pid(ecu_reply, &pid_mode, &pid_num) == 1) && (cache_key_of(pid_mode, pid_num) == cr->cache_key);
+   if ((valid_reply == 1) && (reply_len < MAX_SERIAL_BUF_LEN))
+   {
+      memcpy(cr->ecu_reply, ecu_reply, reply_len);
+      cr->ecu_reply[reply_len] = 0;
+      cr->reply_len = reply_len;
+      cr->reply_time_ms = now_ms;
+   }
+   else
+   {
+      cr->reply_len = 0;
+   }
+
+   for (ii = 0; ii < cr->waiter_count; ii++)
+   {
+      if ((req->from_client.transport != CLIENT_NONE) && same_client(&cr->waiters[ii], &req->from_client) && (cr->waiter_ids[ii] == req->request_id))
+         continue;
+      if ((valid_reply == 1) && (cr->waiter_ids[ii] == 0) && is_subscribed(&cr->waiters[ii], pid_mode, pid_num))
+         continue; /* Already published to the subscriber, a waiter with an ID needs its own reply. */
+
+      if (send_client_data(&cr->waiters[ii], cr->waiter_ids[ii], ecu_reply, reply_len) > 0)
+         count++;
+   }
+
+   cr->waiter_count = 0;
+   cr->pending = 0;
+
+   return(count);
+}
+
+/*
+   Function: fail_cached_response()
+
+   Purpose : Releases the clients waiting on a request that failed.
+   Input   : Request and the error message to send, or NULL
+           : to release the waiters without a reply.
+   Output  : Returns the number of waiters released.
+*/
+int fail_cached_response(ECU_Request *req, char *error_msg)
+{
+   Cached_Reply *cr;
+   int ii, count;
+
+   cr = find_cached_reply(req, 0);
+   if ((cr == NULL) || (cr->pending == 0))
+   {
+      return(0);
+   }
+
+   count = cr->waiter_count;
+   if (error_msg != NULL)
+   {
+      for (ii = 0; ii < cr->waiter_count; ii++)
+      {
+         send_client_data(&cr->waiters[ii], cr->waiter_ids[ii], error_msg, strlen(error_msg));
+      }
+   }
+
+   cr->waiter_count = 0;
+   cr->pending = 0;
+
+   return(count);
+}
+
+/*
+   Function: remove_cache_waiters()
+
+   Purpose : Takes a client that closed off every waiter list.
+   Input   : Client address.
+   Output  : Returns the number of waiters removed.
+*/
+int remove_cache_waiters(Client_Address *client)
+{
+   Cached_Reply *cr;
+   int ii, jj, count = 0;
+
+   for (cr = reply_cache; cr != NULL; cr = (Cached_Reply *)(cr->hh.next))
+   {
+      for (ii = 0, jj = 0; ii < cr->waiter_count; ii++)
+      {
+         if (same_client(&cr->waiters[ii], client))
+         {
+            count++;
+            continue;
+         }
+         cr->waiters[jj] = cr->waiters[ii];
+         cr->waiter_ids[jj] = cr->waiter_ids[ii];
+         jj++;
+      }
+      cr->waiter_count = jj;
+   }
+
+   return(count);
+}
+
+/* Clients waiting on a queued or in flight request. */
+int get_cache_waiter_count(ECU_Request *req)
+{
+   Cached_Reply *cr;
+
+   cr = find_cached_reply(req, 0);
+   if ((cr == NULL) || (cr->pending == 0))
+   {
+      return(0);
+   }
+
+   return(cr->waiter_count);
+}
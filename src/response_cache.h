@@ -0,0 +1,52 @@
+/*
+   response_cache.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: ECU reply cache and in-flight request coalescing for
+                the server.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_RESPONSE_CACHE_INCLUDED
+#define OBD_RESPONSE_CACHE_INCLUDED
+
+#include "uthash.h"
+#include "request_queue.h"
+
+#define DEFAULT_CACHE_TTL_MS 50
+#define MAX_CACHE_WAITERS 16
+
+struct _Cached_Reply {
+   int cache_key;                /* (mode << 8) | PID */
+   int pending;                  /* Request queued or in flight. */
+   long long reply_time_ms;
+   int reply_len;
+   char ecu_reply[MAX_SERIAL_BUF_LEN];
+   int waiter_count;
+   Client_Address waiters[MAX_CACHE_WAITERS];
+   unsigned int waiter_ids[MAX_CACHE_WAITERS];
+   unsigned long hit_count;
+   unsigned long coalesced_count;
+   UT_hash_handle hh;
+};
+
+typedef struct _Cached_Reply Cached_Reply;
+
+/* response_cache.c */
+void init_response_cache(int ttl_ms);
+int get_cache_ttl();
+int get_query_pid(char *ecu_query, unsigned int *pid_mode, unsigned int *pid_num);
+int serve_from_cache(ECU_Request *req, long long now_ms);
+void set_response_pending(ECU_Request *req);
+int complete_cached_response(ECU_Request *req, char *ecu_reply, int reply_len, long long now_ms);
+int fail_cached_response(ECU_Request *req, char *error_msg);
+int remove_cache_waiters(Client_Address *client);
+int get_cache_waiter_count(ECU_Request *req);
+
+#endif
+
@@ -0,0 +1,360 @@
+/*
+   response_count.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Expected response counts for Mode 01 requests.
+
+                The ELM327 does not know how many ECUs will answer a
+                request, so it waits for its response timeout after the
+                last reply before it sends the '>' prompt. A single digit
+                after the request, "01 0C 1\r", tells the interpreter how
+                many replies to expect and it returns as soon as they
+                arrive (ELM327 v1.3 and later).
+
+                At startup the server turns headers on (ATH1) and reads the
+                supported PID bitmaps (01 00, 01 20, ...) of every ECU. The
+                expected count for a request is the number of ECUs that
+                support any of its PIDs. If a request with a count gets
+                fewer replies, NO DATA or '?' the PIDs fall back to
+                requests without a count.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "obd_monitor.h"
+#include "response_count.h"
+#include "pid_table.h"
+
+ADAPTER_LOCAL ECU_Support ecu_support_list[MAX_OBD_ECUS];
+ADAPTER_LOCAL int ecu_count;
+ADAPTER_LOCAL int response_count_enabled;
+ADAPTER_LOCAL unsigned char count_disabled_pids[32]; /* PIDs that fell back, bit 0 is PID 00. */
+
+void init_response_count()
+{
+   memset(ecu_support_list, 0, sizeof(ecu_support_list));
+   memset(count_disabled_pids, 0, sizeof(count_disabled_pids));
+   ecu_count = 0;
+   response_count_enabled = 0;
+
+   return;
+}
+
+void set_response_count_enabled(int enabled)
+{
+   response_count_enabled = enabled;
+
+   return;
+}
+
+int get_ecu_count()
+{
+   return(ecu_count);
+}
+
+int test_pid_bit(unsigned char *pid_bitmap, unsigned int pid_num)
+{
+   return((pid_bitmap[(pid_num >> 3) & 0x1F] >> (pid_num & 7)) & 1);
+}
+
+void set_pid_bit(unsigned char *pid_bitmap, unsigned int pid_num)
+{
+   pid_bitmap[(pid_num >> 3) & 0x1F] |= (1 << (pid_num & 7));
+
+   return;
+}
+
+ECU_Support *find_ecu_support(char *ecu_header)
+{
+   int ii;
+
+   for (ii = 0; ii < ecu_count; ii++)
+   {
+      if (strcmp(ecu_support_list[ii].ecu_header, ecu_header) == 0)
+      {
+         return(&ecu_support_list[ii]);
+      }
+   }
+
+   if (ecu_count >= MAX_OBD_ECUS)
+   {
+      printf("find_ecu_support() <ERROR>: Too many ECUs, ignoring %s\n", ecu_header);
+      return(NULL);
+   }
+
+   strncpy(ecu_support_list[ecu_count].ecu_header, ecu_header, MAX_ECU_HEADER_LEN - 1);
+
+   return(&ecu_support_list[ecu_count++]);
+}
+
+/*
+   Function: parse_discovery_reply()
+
+   Purpose : Records the supported PIDs of each ECU from the reply to a
+           : supported PID request sent with headers on, one line per ECU:
+           : "7E8 06 41 00 BE 3E B8 11!7E9 06 41 00 98 18 00 01"
+   Input   : ECU reply and the base PID of the request, 00, 20, 40...
+   Output  : Returns the number of ECUs that replied.
+*/
+int parse_discovery_reply(char *ecu_reply, unsigned int base_pid)
+{
+   char temp_buf[MAX_BUFFER_LEN];
+   char ecu_header[MAX_ECU_HEADER_LEN];
+   char *tokens[32];
+   char *line, *next_line;
+   ECU_Support *ecu;
+   unsigned int pid_bits;
+   int ntokens, ii, jj, count = 0;
+
+   strncpy(temp_buf, ecu_reply, MAX_BUFFER_LEN - 1);
+   temp_buf[MAX_BUFFER_LEN - 1] = 0;
+
+   for (line = temp_buf; line != NULL; line = next_line)
+   {
+      next_line = strchr(line, '!');
+      if (next_line != NULL)
+         *next_line++ = 0;
+
+      ntokens = 0;
+      tokens[0] = strtok(line, " \r\n");
+      while ((tokens[ntokens] != NULL) && (ntokens < 31))
+         tokens[++ntokens] = strtok(NULL, " \r\n");
+
+      /* Find the "41 <base pid>" reply header, the bytes before it are the ECU header. */
+      for (ii = 0; ii + 5 < ntokens; ii++)
+      {
+         if ((strtoul(tokens[ii], NULL, 16) == 0x41) && (strtoul(tokens[ii + 1], NULL, 16) == base_pid))
+            break;
+      }
+      if (ii + 5 >= ntokens)
+         continue;
+
+      ecu_header[0] = 0;
+      for (jj = 0; jj < ii; jj++)
+      {
+         if (strlen(ecu_header) + strlen(tokens[jj]) + 2 < MAX_ECU_HEADER_LEN)
+         {
+            if (jj > 0)
+               strcat(ecu_header, " ");
+            strcat(ecu_header, tokens[jj]);
+         }
+      }
+
+      ecu = find_ecu_support(ecu_header);
+      if (ecu == NULL)
+         continue;
+
+      pid_bits = (strtoul(tokens[ii + 2], NULL, 16) << 24) | (strtoul(tokens[ii + 3], NULL, 16) << 16) |
+                 (strtoul(tokens[ii + 4], NULL, 16) << 8) | strtoul(tokens[ii + 5], NULL, 16);
+
+      /* The most significant bit is PID base + 1. */
+      set_pid_bit(ecu->mode_01_pids, base_pid);
+      for (jj = 0; (jj < 32) && (base_pid + 1 + jj <= 0xFF); jj++)
+      {
+         if (pid_bits & (0x80000000U >> jj))
+            set_pid_bit(ecu->mode_01_pids, base_pid + 1 + jj);
+      }
+
+      count++;
+   }
+
+   return(count);
+}
+
+/*
+   Function: is_pid_supported()
+
+   Purpose : Checks if any ECU supports a Mode 01 PID, used to decide if
+           : the next supported PID request is needed during discovery.
+   Input   : PID number.
+   Output  : Returns 1 if supported.
+*/
+int is_pid_supported(unsigned int pid_num)
+{
+   int ii;
+
+   for (ii = 0; ii < ecu_count; ii++)
+   {
+      if (test_pid_bit(ecu_support_list[ii].mode_01_pids, pid_num))
+         return(1);
+   }
+
+   return(0);
+}
+
+int has_count_suffix(char *ecu_query)
+{
+   char temp_buf[MAX_SERIAL_BUF_LEN];
+   char *token, *last_token = NULL;
+
+   strncpy(temp_buf, ecu_query, MAX_SERIAL_BUF_LEN - 1);
+   temp_buf[MAX_SERIAL_BUF_LEN - 1] = 0;
+
+   for (token = strtok(temp_buf, " \r\n"); token != NULL; token = strtok(NULL, " \r\n"))
+      last_token = token;
+
+   return((last_token != NULL) && (strlen(last_token) == 1));
+}
+
+/*
+   Function: get_query_response_count()
+
+   Purpose : Gets the number of ECUs expected to answer a Mode 01 request.
+   Input   : Request message, "01 0C\r" or "01 0C 0D\r".
+   Output  : Returns the count, 0 if it is not known or the request must
+           : be sent without a count.
+*/
+int get_query_response_count(char *ecu_query)
+{
+   unsigned char query_bytes[MAX_BATCH_PIDS + 2];
+   int nbytes, ii, jj, count = 0;
+
+   if ((response_count_enabled == 0) || (ecu_count == 0))
+   {
+      return(0);
+   }
+
+   nbytes = get_reply_bytes(ecu_query, query_bytes, MAX_BATCH_PIDS + 2);
+   if ((nbytes < 2) || (query_bytes[0] != 0x01) || has_count_suffix(ecu_query))
+   {
+      return(0);
+   }
+
+   for (jj = 1; jj < nbytes; jj++)
+   {
+      if (test_pid_bit(count_disabled_pids, query_bytes[jj]))
+         return(0);
+   }
+
+   for (ii = 0; ii < ecu_count; ii++)
+   {
+      for (jj = 1; jj < nbytes; jj++)
+      {
+         if (test_pid_bit(ecu_support_list[ii].mode_01_pids, query_bytes[jj]))
+         {
+            count++;
+            break;
+         }
+      }
+   }
+
+   if (count > MAX_RESPONSE_COUNT)
+      count = 0;
+
+   return(count);
+}
+
+/*
+   Function: add_response_count()
+
+   Purpose : Copies a request and appends the expected response count,
+           : "01 0C\r" becomes "01 0C 1\r".
+   Input   : Request message, output buffer and buffer length.
+   Output  : Returns the length of the output request.
+*/
+int add_response_count(char *ecu_query, char *out_query, int out_len)
+{
+   int count, len;
+
+   strncpy(out_query, ecu_query, out_len - 1);
+   out_query[out_len - 1] = 0;
+
+   count = get_query_response_count(ecu_query);
+   if (count == 0)
+   {
+      return(strlen(out_query));
+   }
+
+   len = strlen(out_query);
+   while ((len > 0) && ((out_query[len - 1] == '\r') || (out_query[len - 1] == '\n')))
+      len--;
+
+   if (len + 4 < out_len)
+   {
+      len += sprintf(out_query + len, " %i\r", count);
+   }
+
+   return(len);
+}
+
+int count_reply_messages(char *ecu_reply)
+{
+   char temp_buf[MAX_BUFFER_LEN];
+   char *line, *next_line;
+   int count = 0;
+
+   strncpy(temp_buf, ecu_reply, MAX_BUFFER_LEN - 1);
+   temp_buf[MAX_BUFFER_LEN - 1] = 0;
+
+   for (line = temp_buf; line != NULL; line = next_line)
+   {
+      next_line = strchr(line, '!');
+      if (next_line != NULL)
+         *next_line++ = 0;
+
+      /* One line per ECU, or the first ISO-TP frame of a long reply. */
+      if ((strncmp(line, "41", 2) == 0) || (strncmp(line, "0:", 2) == 0))
+         count++;
+   }
+
+   return(count);
+}
+
+/*
+   Function: check_response_count()
+
+   Purpose : Checks the reply to a request that was sent with a response
+           : count. If replies are missing the PIDs fall back to requests
+           : without a count.
+   Input   : Request message, as queued without the count, and the reply.
+   Output  : Returns 1 if the reply is complete or no count was sent.
+*/
+int check_response_count(char *ecu_query, char *ecu_reply)
+{
+   int count;
+
+   count = get_query_response_count(ecu_query);
+   if (count == 0)
+   {
+      return(1);
+   }
+
+   if (count_reply_messages(ecu_reply) < count)
+   {
+      response_count_failed(ecu_query);
+      return(0);
+   }
+
+   return(1);
+}
+
+void response_count_failed(char *ecu_query)
+{
+   unsigned char query_bytes[MAX_BATCH_PIDS + 2];
+   int nbytes, jj;
+
+   if (get_query_response_count(ecu_query) == 0)
+   {
+      return;
+   }
+
+   nbytes = get_reply_bytes(ecu_query, query_bytes, MAX_BATCH_PIDS + 2);
+   for (jj = 1; jj < nbytes; jj++)
+   {
+      set_pid_bit(count_disabled_pids, query_bytes[jj]);
+   }
+
+   printf("response_count_failed(): Missing replies, sending without a count: %s\n", ecu_query);
+
+   return;
+}
+
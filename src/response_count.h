@@ -0,0 +1,41 @@
+/*
+   response_count.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Expected response counts for Mode 01 requests, learned
+                from the supported PID replies of each ECU.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_RESPONSE_COUNT_INCLUDED
+#define OBD_RESPONSE_COUNT_INCLUDED
+
+#define MAX_OBD_ECUS 8
+#define MAX_ECU_HEADER_LEN 16
+#define MAX_RESPONSE_COUNT 9     /* The ELM327 count suffix is one digit. */
+
+struct _ECU_Support {
+   char ecu_header[MAX_ECU_HEADER_LEN];  /* Header bytes with ATH1, e.g. "7E8 06". */
+   unsigned char mode_01_pids[32];       /* Supported PID bitmap, bit 0 is PID 00. */
+};
+
+typedef struct _ECU_Support ECU_Support;
+
+/* response_count.c */
+void init_response_count();
+int parse_discovery_reply(char *ecu_reply, unsigned int base_pid);
+int is_pid_supported(unsigned int pid_num);
+void set_response_count_enabled(int enabled);
+int get_ecu_count();
+int get_query_response_count(char *ecu_query);
+int add_response_count(char *ecu_query, char *out_query, int out_len);
+int check_response_count(char *ecu_query, char *ecu_reply);
+void response_count_failed(char *ecu_query);
+
+#endif
+
@@ -480,6 +480,77 @@ void RS232_flushRXTX(int comport_number)
 }
 
 
+/* returns the file descriptor of an open comport so it can be used with poll/epoll */
+int RS232_GetFileDescriptor(int comport_number)
+{
+  if((comport_number>=RS232_PORTNR)||(comport_number<0))
+  {
+    return(-1);
+  }
+
+  return(Cport[comport_number]);
+}
+
+
+/* changes the baudrate of an open comport, used after the device has switched rate */
+int RS232_SetBaudrate(int comport_number, int baudrate)
+{
+  int baudr;
+  struct termios port_settings;
+
+  if((comport_number>=RS232_PORTNR)||(comport_number<0))
+  {
+    return(1);
+  }
+
+  switch(baudrate)
+  {
+    case    9600 : baudr = B9600;
+                   break;
+    case   19200 : baudr = B19200;
+                   break;
+    case   38400 : baudr = B38400;
+                   break;
+    case   57600 : baudr = B57600;
+                   break;
+    case  115200 : baudr = B115200;
+                   break;
+    case  230400 : baudr = B230400;
+                   break;
+    case  460800 : baudr = B460800;
+                   break;
+    case  500000 : baudr = B500000;
+                   break;
+    case  921600 : baudr = B921600;
+                   break;
+    case 1000000 : baudr = B1000000;
+                   break;
+    case 2000000 : baudr = B2000000;
+                   break;
+    default      : printf("invalid baudrate\n");
+                   return(1);
+                   break;
+  }
+
+  if(tcgetattr(Cport[comport_number], &port_settings) == -1)
+  {
+    perror("unable to read portsettings ");
+    return(1);
+  }
+
+  cfsetispeed(&port_settings, baudr);
+  cfsetospeed(&port_settings, baudr);
+
+  if(tcsetattr(Cport[comport_number], TCSADRAIN, &port_settings) == -1)
+  {
+    perror("unable to adjust portsettings ");
+    return(1);
+  }
+
+  return(0);
+}
+
+
 #else  /* windows */
 
 #define RS232_PORTNR  16
@@ -773,6 +844,37 @@ void RS232_flushRXTX(int comport_number)
 }
 
 
+/* changes the baudrate of an open comport, used after the device has switched rate */
+int RS232_SetBaudrate(int comport_number, int baudrate)
+{
+  DCB port_settings;
+
+  if((comport_number>=RS232_PORTNR)||(comport_number<0))
+  {
+    return(1);
+  }
+
+  memset(&port_settings, 0, sizeof(port_settings));
+  port_settings.DCBlength = sizeof(port_settings);
+
+  if(!GetCommState(Cport[comport_number], &port_settings))
+  {
+    printf("unable to read comport cfg settings\n");
+    return(1);
+  }
+
+  port_settings.BaudRate = baudrate;
+
+  if(!SetCommState(Cport[comport_number], &port_settings))
+  {
+    printf("unable to set comport cfg settings\n");
+    return(1);
+  }
+
+  return(0);
+}
+
+
 #endif
 
 
@@ -77,6 +77,11 @@ void RS232_flushRX(int);
 void RS232_flushTX(int);
 void RS232_flushRXTX(int);
 int RS232_GetPortnr(const char *);
+int RS232_SetBaudrate(int, int);
+
+#if defined(__linux__) || defined(__FreeBSD__)
+int RS232_GetFileDescriptor(int);
+#endif
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -0,0 +1,364 @@
+/*
+   serial_thread.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Serial I/O thread that owns the ELM327 serial port.
+
+                After the startup checks the serial port is only used by
+                this thread. It sends requests, reads the interpreter and
+                frames each reply at the '>' prompt, so a burst of client
+                datagrams never delays reading the serial line.
+
+                network thread                      serial thread
+
+                queue_serial_request()  -- request ring -->  RS232_SendBuf()
+                get_serial_frame()      <-- frame ring ---   feed_elm_parser()
+
+                Both rings are lock-free single producer, single consumer
+                rings of preallocated slots (spsc_ring.c). An eventfd next
+                to each ring wakes the other thread: the network thread
+                waits for frames in epoll_wait() with the UDP socket, the
+                serial thread waits in poll() on the serial port and its
+                request eventfd.
+
+                With several adapters each adapter network thread owns
+                its own link and serial thread, nothing is shared between
+                adapters.
+
+                Each request has an exchange ID and the frames of its reply
+                carry the same ID, so a late reply to an abandoned request
+                is never taken for the reply to the next one.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "obd_monitor.h"
+#include "rs232.h"
+#include "elm_parser.h"
+#include "serial_thread.h"
+
+/* The link of the adapter, owned by the adapter network thread. */
+ADAPTER_LOCAL Serial_Link serial_link;
+
+void signal_event_fd(int event_fd)
+{
+   uint64_t one = 1;
+
+   if (write(event_fd, &one, sizeof(one)) < 0)
+   {
+      if (errno != EAGAIN)
+         perror("signal_event_fd() <ERROR>: write");
+   }
+
+   return;
+}
+
+void drain_event_fd(int event_fd)
+{
+   uint64_t count;
+
+   while (read(event_fd, &count, sizeof(count)) > 0)
+      ;
+
+   return;
+}
+
+int push_serial_frame(Serial_Link *link, int frame_type, char *ecu_reply, int reply_len)
+{
+   ELM_Line *response;
+   Serial_Frame *frame;
+
+   frame = (Serial_Frame *)get_ring_write_slot(&link->frame_ring);
+   if (frame == NULL)
+   {
+      printf("push_serial_frame() <ERROR>: Frame ring is full, reply dropped.\n");
+      return(-1);
+   }
+
+   frame->frame_type = frame_type;
+   frame->exchange_id = link->exchange_id;
+   frame->rx_time_ms = get_monotonic_ms();
+   frame->tx_time_us = link->tx_time_us;
+   frame->first_rx_time_us = link->first_rx_time_us;
+   frame->prompt_time_us = get_monotonic_us();
+   frame->rx_bytes = link->rx_bytes;
+   link->rx_bytes = 0;
+   frame->reply_len = reply_len;
+   memcpy(frame->ecu_reply, ecu_reply, reply_len + 1);
+   frame->reply_status = link->parser.reply_status;
+   response = get_elm_response(&link->parser);
+   frame->response_idx = (response != NULL) ? response->text_idx : reply_len;
+   frame->response_len = (response != NULL) ? response->text_len : 0;
+   commit_ring_write(&link->frame_ring);
+
+   signal_event_fd(link->frame_event_fd);
+
+   return(0);
+}
+
+/*
+   Function: run_serial_requests()
+
+   Purpose : Runs the requests from the network thread in order.
+   Input   : Serial link.
+   Output  : Returns the number of requests.
+*/
+int run_serial_requests(Serial_Link *link)
+{
+   Serial_Command *cmd;
+   int count = 0;
+
+   while ((cmd = (Serial_Command *)get_ring_read_slot(&link->request_ring)) != NULL)
+   {
+      if (cmd->command == SERIAL_SEND)
+      {
+         link->exchange_id = cmd->exchange_id;
+         init_elm_parser(&link->parser, cmd->ecu_query);
+         link->busy = 1;
+         link->first_rx_time_us = 0;
+         RS232_SendBuf(link->serial_port, (unsigned char *)cmd->ecu_query, cmd->query_len);
+         link->tx_time_us = get_monotonic_us();
+         RS232_flushTX(link->serial_port);
+      }
+      else if ((cmd->command == SERIAL_ABORT) && (cmd->exchange_id == link->exchange_id))
+      {
+         if (link->busy == 1)
+            printf("run_serial_requests() <ERROR>: Exchange %u abandoned, partial reply: %s\n", link->exchange_id, link->parser.reply);
+         link->busy = 0;
+         RS232_flushRX(link->serial_port);
+      }
+
+      commit_ring_read(&link->request_ring);
+      count++;
+   }
+
+   return(count);
+}
+
+/*
+   Function: read_serial_reply()
+
+   Purpose : Reads the bytes waiting on the serial port into the reply of
+           : the exchange in flight and sends the reply to the network
+           : thread when the prompt arrives.
+   Input   : Serial link.
+   Output  : Returns 1 if a reply was framed.
+*/
+int read_serial_reply(Serial_Link *link)
+{
+   unsigned char in_buf[MAX_SERIAL_BUF_LEN];
+   int n, events = 0;
+
+   while ((n = RS232_PollComport(link->serial_port, in_buf, MAX_SERIAL_BUF_LEN)) > 0)
+   {
+      link->rx_bytes += n;
+      if (link->busy == 0)
+         continue; /* Unsolicited bytes from the interpreter, discard. */
+
+      if (link->first_rx_time_us == 0)
+         link->first_rx_time_us = get_monotonic_us();
+
+      events |= feed_elm_parser(&link->parser, in_buf, n);
+      if (events & ELM_REPLY_PROMPT)
+         break;
+   }
+
+   if ((link->busy == 1) && (events & ELM_LINE_SEARCHING))
+   {
+      /* The network thread allows the interpreter more time. */
+      push_serial_frame(link, FRAME_SEARCHING, "", 0);
+   }
+
+   if ((link->busy == 1) && (events & ELM_REPLY_PROMPT))
+   {
+      link->busy = 0;
+      push_serial_frame(link, FRAME_REPLY, link->parser.reply, link->parser.reply_len);
+      RS232_flushRX(link->serial_port);
+      return(1);
+   }
+
+   return(0);
+}
+
+void *serial_thread_main(void *arg)
+{
+   Serial_Link *link = (Serial_Link *)arg;
+   struct pollfd pfds[2];
+
+   pfds[0].fd = RS232_GetFileDescriptor(link->serial_port);
+   pfds[0].events = POLLIN;
+   pfds[1].fd = link->request_event_fd;
+   pfds[1].events = POLLIN;
+
+   while (1)
+   {
+      pfds[0].revents = 0;
+      pfds[1].revents = 0;
+      if (poll(pfds, 2, -1) < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         perror("serial_thread_main() <ERROR>: poll");
+         break;
+      }
+
+      if (pfds[1].revents & POLLIN)
+      {
+         drain_event_fd(link->request_event_fd);
+         run_serial_requests(link);
+      }
+
+      if (pfds[0].revents & POLLIN)
+      {
+         read_serial_reply(link);
+      }
+      else if (pfds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+      {
+         printf("serial_thread_main() <ERROR>: Serial port closed.\n");
+         break;
+      }
+   }
+
+   return(NULL);
+}
+
+/*
+   Function: start_serial_thread()
+
+   Purpose : Hands the serial port of the adapter to a serial thread. The
+           : port must not be used by any other thread after this. Called
+           : by the adapter network thread, which owns the link.
+   Input   : Serial port number.
+   Output  : Returns 0 or -1 on error.
+*/
+int start_serial_thread(int serial_port)
+{
+   Serial_Link *link = &serial_link;
+
+   init_spsc_ring(&link->request_ring, link->request_slots, sizeof(Serial_Command), SERIAL_RING_SLOTS);
+   init_spsc_ring(&link->frame_ring, link->frame_slots, sizeof(Serial_Frame), SERIAL_RING_SLOTS);
+   link->next_exchange_id = 0;
+   link->serial_port = serial_port;
+   link->exchange_id = 0;
+   link->busy = 0;
+   link->rx_bytes = 0;
+
+   link->request_event_fd = eventfd(0, EFD_NONBLOCK);
+   link->frame_event_fd = eventfd(0, EFD_NONBLOCK);
+   if ((link->request_event_fd < 0) || (link->frame_event_fd < 0))
+   {
+      perror("start_serial_thread() <ERROR>: eventfd");
+      return(-1);
+   }
+
+   if (pthread_create(&link->thread_id, NULL, serial_thread_main, link) != 0)
+   {
+      printf("start_serial_thread() <ERROR>: Could not create the serial thread.\n");
+      return(-1);
+   }
+
+   return(0);
+}
+
+/*
+   Function: queue_serial_request()
+
+   Purpose : Passes a request to the serial thread, network thread only.
+   Input   : Request as sent to the interpreter and its length.
+   Output  : Returns the exchange ID of the request, 0 if the request
+           : ring is full.
+*/
+unsigned int queue_serial_request(char *out_query, int query_len)
+{
+   Serial_Command *cmd;
+
+   cmd = (Serial_Command *)get_ring_write_slot(&serial_link.request_ring);
+   if ((cmd == NULL) || (query_len >= MAX_SERIAL_BUF_LEN))
+   {
+      printf("queue_serial_request() <ERROR>: Request not queued: %s\n", out_query);
+      return(0);
+   }
+
+   if (++serial_link.next_exchange_id == 0)
+      serial_link.next_exchange_id = 1;
+
+   cmd->command = SERIAL_SEND;
+   cmd->exchange_id = serial_link.next_exchange_id;
+   cmd->query_len = query_len;
+   memcpy(cmd->ecu_query, out_query, query_len);
+   cmd->ecu_query[query_len] = 0;
+   commit_ring_write(&serial_link.request_ring);
+
+   signal_event_fd(serial_link.request_event_fd);
+
+   return(serial_link.next_exchange_id);
+}
+
+int queue_serial_abort(unsigned int exchange_id)
+{
+   Serial_Command *cmd;
+
+   cmd = (Serial_Command *)get_ring_write_slot(&serial_link.request_ring);
+   if (cmd == NULL)
+   {
+      return(-1);
+   }
+
+   cmd->command = SERIAL_ABORT;
+   cmd->exchange_id = exchange_id;
+   cmd->query_len = 0;
+   cmd->ecu_query[0] = 0;
+   commit_ring_write(&serial_link.request_ring);
+
+   signal_event_fd(serial_link.request_event_fd);
+
+   return(0);
+}
+
+int get_serial_event_fd()
+{
+   return(serial_link.frame_event_fd);
+}
+
+void clear_serial_event()
+{
+   drain_event_fd(serial_link.frame_event_fd);
+
+   return;
+}
+
+/*
+   Function: get_serial_frame()
+
+   Purpose : Gets the oldest frame from the serial thread, network thread
+           : only. The frame can be changed in place until it is released
+           : with release_serial_frame().
+   Input   : None.
+   Output  : Returns the frame or NULL if there is none.
+*/
+Serial_Frame *get_serial_frame()
+{
+   return((Serial_Frame *)get_ring_read_slot(&serial_link.frame_ring));
+}
+
+void release_serial_frame()
+{
+   commit_ring_read(&serial_link.frame_ring);
+
+   return;
+}
+
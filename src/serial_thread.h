@@ -0,0 +1,96 @@
+/*
+   serial_thread.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Serial I/O thread that owns the ELM327 serial port. Used by
+                the server event loop.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_SERIAL_THREAD_INCLUDED
+#define OBD_SERIAL_THREAD_INCLUDED
+
+#include <pthread.h>
+
+#include "spsc_ring.h"
+#include "elm_parser.h"
+
+#define SERIAL_RING_SLOTS 16     /* Power of two, one exchange is in flight at a time. */
+
+/* Requests from the network thread. */
+#define SERIAL_SEND 1            /* Send a request to the interpreter and frame the reply. */
+#define SERIAL_ABORT 2           /* Abandon the exchange after a timeout and flush the port. */
+
+/* Frames from the serial thread. */
+#define FRAME_REPLY 1            /* Complete reply, the '>' prompt arrived. */
+#define FRAME_SEARCHING 2        /* Interpreter started an automatic protocol search. */
+
+struct _Serial_Command {
+   int command;
+   unsigned int exchange_id;
+   int query_len;
+   char ecu_query[MAX_SERIAL_BUF_LEN];
+};
+
+typedef struct _Serial_Command Serial_Command;
+
+struct _Serial_Frame {
+   int frame_type;
+   unsigned int exchange_id;
+   long long rx_time_ms;
+   long long tx_time_us;         /* Request sent to the interpreter. */
+   long long first_rx_time_us;   /* First reply byte, 0 if none arrived. */
+   long long prompt_time_us;     /* The '>' prompt, or when the frame was pushed. */
+   int rx_bytes;                 /* Bytes read from the port since the last frame. */
+   int reply_status;             /* ELM_LINE_ and ELM_REPLY_ bits of the reply. */
+   int response_idx;             /* First line after the echo and search messages. */
+   int response_len;
+   int reply_len;
+   char ecu_reply[MAX_BUFFER_LEN];
+};
+
+typedef struct _Serial_Frame Serial_Frame;
+
+/* One serial port, its thread and the rings to the adapter network thread. */
+struct _Serial_Link {
+   int serial_port;
+   pthread_t thread_id;
+
+   /* Network thread to serial thread. */
+   SPSC_Ring request_ring;
+   Serial_Command request_slots[SERIAL_RING_SLOTS];
+   int request_event_fd;
+   unsigned int next_exchange_id;
+
+   /* Serial thread to network thread. */
+   SPSC_Ring frame_ring;
+   Serial_Frame frame_slots[SERIAL_RING_SLOTS];
+   int frame_event_fd;
+
+   /* Only used by the serial thread. */
+   ELM_Parser parser;
+   unsigned int exchange_id;
+   int busy;
+   long long tx_time_us;
+   long long first_rx_time_us;
+   int rx_bytes;
+};
+
+typedef struct _Serial_Link Serial_Link;
+
+/* serial_thread.c */
+int start_serial_thread(int serial_port);
+unsigned int queue_serial_request(char *out_query, int query_len);
+int queue_serial_abort(unsigned int exchange_id);
+int get_serial_event_fd();
+void clear_serial_event();
+Serial_Frame *get_serial_frame();
+void release_serial_frame();
+
+#endif
+
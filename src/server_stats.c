@@ -0,0 +1,410 @@
+/*
+   server_stats.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Latency histograms and counters of the server hot path.
+
+                Each exchange is timed with the monotonic clock at five
+                points: client request received, request sent to the
+                interpreter, first reply byte, '>' prompt and reply sent.
+                The serial thread stamps the middle three in the frame of
+                the reply. The gaps between them go into one histogram per
+                stage, so the queue wait, the ECU response time and the
+                serial transfer time can be told apart, and the whole
+                request and serial times go into histograms for each PID.
+
+                The histograms are log-linear like HdrHistogram: a bucket
+                for each of 8 steps within each power of two microseconds.
+                Recording is a few shifts and an increment, no allocation,
+                so it stays on in production.
+
+                Replies are queued to the transports and sent at the end of
+                each event loop pass, so they are held as pending until
+                note_replies_sent() is called after the send.
+
+                The stats are per adapter, only the adapter network thread
+                uses them.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "obd_monitor.h"
+#include "server_stats.h"
+
+ADAPTER_LOCAL Server_Stats server_stats;
+ADAPTER_LOCAL Pending_Reply pending_replies[MAX_PENDING_REPLIES];
+ADAPTER_LOCAL int pending_count;
+
+const char *stage_names[NUM_STATS_STAGES] = { "queue", "response", "transfer", "send" };
+const char *error_names[NUM_STATS_ERRORS] = { "timeout", "data_error", "no_data", "bad_request", "queue_full", "late_frame", "dropped_reply" };
+
+void init_server_stats()
+{
+   memset(&server_stats, 0, sizeof(server_stats));
+   server_stats.start_time_us = get_monotonic_us();
+   pending_count = 0;
+
+   return;
+}
+
+int get_latency_bucket(long long latency_us)
+{
+   int exponent;
+
+   if (latency_us < STATS_SUB_BUCKETS)
+   {
+      return(latency_us < 0 ? 0 : (int)latency_us);
+   }
+
+   if (latency_us >= (2LL << STATS_MAX_EXPONENT))
+   {
+      latency_us = (2LL << STATS_MAX_EXPONENT) - 1;
+   }
+
+   exponent = 63 - __builtin_clzll((unsigned long long)latency_us);
+
+   return(((exponent - STATS_SUB_BITS + 1) << STATS_SUB_BITS) +
+          (int)((latency_us >> (exponent - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1)));
+}
+
+/* Highest latency that falls in a bucket. */
+long long get_bucket_latency(int bucket)
+{
+   int exponent, sub_bucket;
+
+   if (bucket < STATS_SUB_BUCKETS)
+   {
+      return(bucket);
+   }
+
+   exponent = (bucket >> STATS_SUB_BITS) + STATS_SUB_BITS - 1;
+   sub_bucket = bucket & (STATS_SUB_BUCKETS - 1);
+
+   return((((long long)(STATS_SUB_BUCKETS + sub_bucket + 1)) << (exponent - STATS_SUB_BITS)) - 1);
+}
+
+void record_latency(Latency_Histogram *hist, long long latency_us)
+{
+   if (latency_us < 0)
+   {
+      latency_us = 0; /* Stage not reached, e.g. no reply bytes before the prompt. */
+   }
+
+   hist->buckets[get_latency_bucket(latency_us)]++;
+   hist->count++;
+   hist->total_us += latency_us;
+   if (latency_us > hist->max_us)
+   {
+      hist->max_us = latency_us;
+   }
+
+   return;
+}
+
+/*
+   Function: get_latency_percentile()
+
+   Purpose : Finds the latency that the given percentage of the recorded
+           : latencies are at or below.
+   Input   : Histogram and percentile, 50.0 for the median.
+   Output  : Returns the top of the bucket holding the percentile, never
+           : more than the largest recorded latency, 0 if nothing is
+           : recorded.
+*/
+long long get_latency_percentile(Latency_Histogram *hist, double percentile)
+{
+   unsigned long long target, total = 0;
+   long long latency_us;
+   int ii;
+
+   if (hist->count == 0)
+   {
+      return(0);
+   }
+
+   target = (unsigned long long)((hist->count * percentile) / 100.0 + 0.5);
+   if (target < 1)
+   {
+      target = 1;
+   }
+
+   for (ii = 0; ii < STATS_HISTOGRAM_BUCKETS; ii++)
+   {
+      total += hist->buckets[ii];
+      if (total >= target)
+         break;
+   }
+
+   latency_us = get_bucket_latency(ii);
+   if (latency_us > hist->max_us)
+   {
+      latency_us = hist->max_us;
+   }
+
+   return(latency_us);
+}
+
+PID_Stats *get_pid_stats(unsigned int pid_mode, unsigned int pid_num)
+{
+   PID_Stats *ps;
+   int ii;
+
+   for (ii = 0; ii < server_stats.pid_count; ii++)
+   {
+      ps = &server_stats.pids[ii];
+      if ((ps->pid_mode == pid_mode) && (ps->pid_num == pid_num))
+         return(ps);
+   }
+
+   if (server_stats.pid_count >= MAX_STATS_PIDS)
+   {
+      return(NULL); /* Only the stage histograms for the rest. */
+   }
+
+   ps = &server_stats.pids[server_stats.pid_count++];
+   memset(ps, 0, sizeof(PID_Stats));
+   ps->pid_mode = pid_mode;
+   ps->pid_num = pid_num;
+
+   return(ps);
+}
+
+void note_client_request()
+{
+   server_stats.requests++;
+
+   return;
+}
+
+void note_cache_reply()
+{
+   server_stats.cache_replies++;
+
+   return;
+}
+
+void note_queue_depth(int priority, int depth)
+{
+   if ((priority >= 0) && (priority < NUM_PRIORITY_CLASSES) && (depth > server_stats.max_queue_depth[priority]))
+   {
+      server_stats.max_queue_depth[priority] = depth;
+   }
+
+   return;
+}
+
+void note_serial_request(int query_len)
+{
+   server_stats.exchanges++;
+   server_stats.serial_tx_bytes += query_len;
+
+   return;
+}
+
+void note_serial_frame(Serial_Frame *frame)
+{
+   server_stats.serial_rx_bytes += frame->rx_bytes;
+
+   return;
+}
+
+void note_server_error(int error_type)
+{
+   if ((error_type >= 0) && (error_type < NUM_STATS_ERRORS))
+   {
+      server_stats.errors[error_type]++;
+   }
+
+   return;
+}
+
+/*
+   Function: note_exchange_reply()
+
+   Purpose : Holds the timestamps of a reply until it has been sent. Called
+           : once for each request answered by an interpreter reply, every
+           : request of a multi-PID batch has the same serial times.
+   Input   : PID of the request, 0 0 for AT commands, time the client
+           : request was received, 0 for scheduler requests, and the
+           : reply frame.
+   Output  : Returns the number of pending replies.
+*/
+int note_exchange_reply(unsigned int pid_mode, unsigned int pid_num, long long rx_time_us, Serial_Frame *frame)
+{
+   Pending_Reply *pr;
+
+   if (pending_count >= MAX_PENDING_REPLIES)
+   {
+      note_replies_sent(get_monotonic_us());
+   }
+
+   pr = &pending_replies[pending_count++];
+   pr->pid_mode = pid_mode;
+   pr->pid_num = pid_num;
+   pr->rx_time_us = rx_time_us;
+   pr->tx_time_us = frame->tx_time_us;
+   pr->first_rx_time_us = frame->first_rx_time_us;
+   pr->prompt_time_us = frame->prompt_time_us;
+
+   return(pending_count);
+}
+
+/*
+   Function: note_replies_sent()
+
+   Purpose : Records the latencies of the pending replies, called after the
+           : replies of the event loop pass have been sent.
+   Input   : Time the replies were sent.
+   Output  : Returns the number of replies recorded.
+*/
+int note_replies_sent(long long now_us)
+{
+   Pending_Reply *pr;
+   PID_Stats *ps;
+   Latency_Histogram *stages = server_stats.stage_latency;
+   long long first_rx_us;
+   int ii, count = pending_count;
+
+   for (ii = 0; ii < count; ii++)
+   {
+      pr = &pending_replies[ii];
+
+      /* No reply bytes before the prompt, all the time is the ECU response. */
+      first_rx_us = (pr->first_rx_time_us != 0) ? pr->first_rx_time_us : pr->prompt_time_us;
+
+      record_latency(&stages[STAGE_RESPONSE], first_rx_us - pr->tx_time_us);
+      record_latency(&stages[STAGE_TRANSFER], pr->prompt_time_us - first_rx_us);
+      record_latency(&stages[STAGE_SEND], now_us - pr->prompt_time_us);
+      if (pr->rx_time_us != 0)
+         record_latency(&stages[STAGE_QUEUE], pr->tx_time_us - pr->rx_time_us);
+
+      ps = (pr->pid_mode != 0) ? get_pid_stats(pr->pid_mode, pr->pid_num) : NULL;
+      if (ps != NULL)
+      {
+         record_latency(&ps->serial_latency, pr->prompt_time_us - pr->tx_time_us);
+         if (pr->rx_time_us != 0)
+            record_latency(&ps->request_latency, now_us - pr->rx_time_us);
+      }
+   }
+
+   server_stats.replies += count;
+   pending_count = 0;
+
+   return(count);
+}
+
+int format_latency(Latency_Histogram *hist, char *out_buf, int out_len)
+{
+   return(snprintf(out_buf, out_len, "n %u p50 %lld p90 %lld p99 %lld max %lld", hist->count,
+                   get_latency_percentile(hist, 50.0), get_latency_percentile(hist, 90.0),
+                   get_latency_percentile(hist, 99.0), hist->max_us));
+}
+
+/*
+   Function: format_stats_summary()
+
+   Purpose : Formats the counters of the adapter on one line.
+           :
+           : STATS uptime_ms 60000 requests 1200 cache 40 replies 1150
+           : exchanges 1100 tx_bytes 6600 rx_bytes 19800 queue 0 0 0
+           : max_queue 3 1 0 pids 4 timeout 2 data_error 0 ...
+   Input   : Output buffer, length and current depth of each queue class.
+   Output  : Returns the text length.
+*/
+int format_stats_summary(char *out_buf, int out_len, int *queue_depths)
+{
+   Server_Stats *ss = &server_stats;
+   int ii, len;
+
+   len = snprintf(out_buf, out_len, "STATS uptime_ms %lld requests %llu cache %llu replies %llu exchanges %llu tx_bytes %llu rx_bytes %llu queue %i %i %i max_queue %i %i %i pids %i",
+                  (get_monotonic_us() - ss->start_time_us) / 1000LL, ss->requests, ss->cache_replies, ss->replies,
+                  ss->exchanges, ss->serial_tx_bytes, ss->serial_rx_bytes,
+                  queue_depths[PRIORITY_REALTIME], queue_depths[PRIORITY_NORMAL], queue_depths[PRIORITY_BACKGROUND],
+                  ss->max_queue_depth[PRIORITY_REALTIME], ss->max_queue_depth[PRIORITY_NORMAL], ss->max_queue_depth[PRIORITY_BACKGROUND], ss->pid_count);
+
+   for (ii = 0; (ii < NUM_STATS_ERRORS) && (len < out_len); ii++)
+      len += snprintf(out_buf + len, out_len - len, " %s %u", error_names[ii], ss->errors[ii]);
+
+   if (len >= out_len)
+   {
+      len = out_len - 1;
+   }
+
+   return(len);
+}
+
+/*
+   Function: format_stage_stats()
+
+   Purpose : Formats the latencies of one exchange stage in microseconds.
+           :
+           : STATS response n 1100 p50 40959 p90 57343 p99 98303 max 101210
+   Input   : Stage, output buffer and length.
+   Output  : Returns the text length.
+*/
+int format_stage_stats(int stage, char *out_buf, int out_len)
+{
+   int len;
+
+   len = snprintf(out_buf, out_len, "STATS %s ", stage_names[stage]);
+   if (len < out_len)
+      len += format_latency(&server_stats.stage_latency[stage], out_buf + len, out_len - len);
+
+   if (len >= out_len)
+   {
+      len = out_len - 1;
+   }
+
+   return(len);
+}
+
+/*
+   Function: format_pid_stats()
+
+   Purpose : Formats the latencies of one PID, the whole request and the
+           : serial exchange, latencies in microseconds.
+           :
+           : STATS 01 0C request n 600 p50 52223 ... serial n 900 p50 ...
+   Input   : PID index, output buffer and length.
+   Output  : Returns the text length, 0 if there is no such PID.
+*/
+int format_pid_stats(int index, char *out_buf, int out_len)
+{
+   PID_Stats *ps;
+   int len;
+
+   if ((index < 0) || (index >= server_stats.pid_count))
+   {
+      return(0);
+   }
+
+   ps = &server_stats.pids[index];
+   len = snprintf(out_buf, out_len, "STATS %.2X %.2X request ", ps->pid_mode, ps->pid_num);
+   if (len < out_len)
+      len += format_latency(&ps->request_latency, out_buf + len, out_len - len);
+   if (len < out_len)
+      len += snprintf(out_buf + len, out_len - len, " serial ");
+   if (len < out_len)
+      len += format_latency(&ps->serial_latency, out_buf + len, out_len - len);
+
+   if (len >= out_len)
+   {
+      len = out_len - 1;
+   }
+
+   return(len);
+}
+
+int get_stats_pid_count()
+{
+   return(server_stats.pid_count);
+}
+
@@ -0,0 +1,114 @@
+/*
+   server_stats.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Latency histograms and counters of the server hot path,
+                returned to clients by the STATS request.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_SERVER_STATS_INCLUDED
+#define OBD_SERVER_STATS_INCLUDED
+
+#include "request_queue.h"
+#include "serial_thread.h"
+
+/* Log-linear histogram buckets, 8 sub-buckets per power of two, so a
+   percentile is within 12.5% of the recorded value. */
+#define STATS_SUB_BITS 3
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXPONENT 26    /* Latencies up to 2^27 - 1 us, about two minutes. */
+#define STATS_HISTOGRAM_BUCKETS ((STATS_MAX_EXPONENT - STATS_SUB_BITS + 2) * STATS_SUB_BUCKETS)
+
+#define MAX_STATS_PIDS 32
+#define MAX_PENDING_REPLIES 16
+#define MAX_STATS_LINE_LEN 400  /* Each line is sent on its own, within MAX_UDP_MSG_LEN. */
+
+/* Stages of an exchange. */
+#define STAGE_QUEUE 0            /* Client request received to request sent to the interpreter. */
+#define STAGE_RESPONSE 1         /* Request sent to the first reply byte. */
+#define STAGE_TRANSFER 2         /* First reply byte to the '>' prompt. */
+#define STAGE_SEND 3             /* Prompt to the reply sent to the client. */
+#define NUM_STATS_STAGES 4
+
+/* Error counts. */
+#define STATS_TIMEOUT 0          /* No reply from the interpreter. */
+#define STATS_DATA_ERROR 1       /* Interpreter reply with ERROR in it. */
+#define STATS_NO_DATA 2          /* PID left out of a multi-PID reply. */
+#define STATS_BAD_REQUEST 3      /* Client request rejected with "?". */
+#define STATS_QUEUE_FULL 4       /* Request queue of the class full. */
+#define STATS_LATE_FRAME 5       /* Reply to an abandoned request. */
+#define STATS_DROPPED_REPLY 6    /* Client gone or too slow, or the UDP socket buffer full. */
+#define NUM_STATS_ERRORS 7
+
+struct _Latency_Histogram {
+   unsigned int count;
+   long long total_us;
+   long long max_us;
+   unsigned int buckets[STATS_HISTOGRAM_BUCKETS];
+};
+
+typedef struct _Latency_Histogram Latency_Histogram;
+
+struct _PID_Stats {
+   unsigned int pid_mode;
+   unsigned int pid_num;
+   Latency_Histogram request_latency;  /* Client request received to reply sent. */
+   Latency_Histogram serial_latency;   /* Request sent to the interpreter to the prompt. */
+};
+
+typedef struct _PID_Stats PID_Stats;
+
+/* A reply handed to the transports, timed when the pass sends it. */
+struct _Pending_Reply {
+   unsigned int pid_mode;        /* 0 for AT commands. */
+   unsigned int pid_num;
+   long long rx_time_us;         /* 0 for scheduler requests. */
+   long long tx_time_us;
+   long long first_rx_time_us;
+   long long prompt_time_us;
+};
+
+typedef struct _Pending_Reply Pending_Reply;
+
+struct _Server_Stats {
+   long long start_time_us;
+   unsigned long long requests;
+   unsigned long long cache_replies;
+   unsigned long long replies;
+   unsigned long long exchanges;
+   unsigned long long serial_tx_bytes;
+   unsigned long long serial_rx_bytes;
+   unsigned int errors[NUM_STATS_ERRORS];
+   int max_queue_depth[NUM_PRIORITY_CLASSES];
+   Latency_Histogram stage_latency[NUM_STATS_STAGES];
+   int pid_count;
+   PID_Stats pids[MAX_STATS_PIDS];
+};
+
+typedef struct _Server_Stats Server_Stats;
+
+/* server_stats.c */
+void init_server_stats();
+void record_latency(Latency_Histogram *hist, long long latency_us);
+long long get_latency_percentile(Latency_Histogram *hist, double percentile);
+void note_client_request();
+void note_cache_reply();
+void note_queue_depth(int priority, int depth);
+void note_serial_request(int query_len);
+void note_serial_frame(Serial_Frame *frame);
+void note_server_error(int error_type);
+int note_exchange_reply(unsigned int pid_mode, unsigned int pid_num, long long rx_time_us, Serial_Frame *frame);
+int note_replies_sent(long long now_us);
+int format_stats_summary(char *out_buf, int out_len, int *queue_depths);
+int format_stage_stats(int stage, char *out_buf, int out_len);
+int format_pid_stats(int index, char *out_buf, int out_len);
+int get_stats_pid_count();
+
+#endif
+
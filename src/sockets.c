@@ -7,6 +7,12 @@
 
    Description: UDP server and client functions. 
 
+                The client can also reach the server over a Unix datagram
+                socket, or a Unix stream or TCP connection with length
+                prefixed messages, see transport.c in the server. The
+                server address is taken from the OBD_SERVER environment
+                variable, see connect_obd_server().
+
 
    Date: 18/12/2017
    
@@ -20,6 +26,7 @@
 
 #include <stdio.h>
 #include <time.h>
+#include <errno.h>
 
 #ifdef _WINSOCK
 
@@ -28,6 +35,7 @@
 #else
 
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netdb.h>
 
@@ -35,13 +43,21 @@
 
 
 #include "obd_monitor.h"
+#include "wire_protocol.h"
 
 int c_sock, s_sock;
 unsigned int length;
 struct sockaddr_in obd_server, from;
+struct sockaddr *server_addr = (struct sockaddr *)&obd_server;
+int client_stream;                 /* 1 on a TCP or Unix stream connection. */
+unsigned char stream_rx_buf[STREAM_FRAME_HEADER_LEN + MAX_STREAM_MSG_LEN];
+int stream_rx_len;
 struct hostent *hp;
 int ecu_connected;
 int ecu_auto_connect;
+Pending_Request pending_requests[MAX_PENDING_REQUESTS];
+unsigned int next_request_id;
+int pending_count;
 
 
 #ifdef _WINSOCK
@@ -102,10 +118,156 @@ int init_client_socket(char *server, char *port)
    memcpy((char *)&obd_server.sin_addr, (char *)hp->h_addr, hp->h_length);
    obd_server.sin_port = htons(atoi(port));
    length = sizeof(struct sockaddr_in);
+   server_addr = (struct sockaddr *)&obd_server;
+   client_stream = 0;
+
+   return(c_sock);
+}
+
+struct sockaddr_un unix_server;
+
+/*
+   Function: init_unix_client_socket()
+
+   Purpose : Opens a Unix datagram socket to a server on the same host,
+           : /tmp/obd_server_<udp port>.sock. The socket is bound to an
+           : abstract address picked by the kernel, so replies can reach it
+           : without a file.
+   Input   : Server socket path.
+   Output  : Returns the socket or -1 on error.
+*/
+int init_unix_client_socket(char *path)
+{
+   struct sockaddr_un client;
+
+   c_sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+   if (c_sock < 0)
+   {
+      printf("init_unix_client_socket() <ERROR>: socket creation failed.\n");
+      return(-1);
+   }
+
+   memset(&client, 0, sizeof(client));
+   client.sun_family = AF_UNIX;
+   if (bind(c_sock, (struct sockaddr *)&client, sizeof(sa_family_t)) < 0)
+   {
+      printf("init_unix_client_socket() <ERROR>: bind failed.\n");
+      close(c_sock);
+      return(-1);
+   }
+
+   memset(&unix_server, 0, sizeof(unix_server));
+   unix_server.sun_family = AF_UNIX;
+   strncpy(unix_server.sun_path, path, sizeof(unix_server.sun_path) - 1);
+   length = sizeof(unix_server);
+   server_addr = (struct sockaddr *)&unix_server;
+   client_stream = 0;
+
+   return(c_sock);
+}
+
+/*
+   Function: init_stream_client_socket()
+
+   Purpose : Connects to the server over TCP, or over a Unix stream
+           : socket if the server is a path.
+   Input   : Server host name or path, TCP port.
+   Output  : Returns the socket or -1 on error.
+*/
+int init_stream_client_socket(char *server, char *port)
+{
+   struct sockaddr_in tcp_server;
+
+   if (server[0] == '/')
+   {
+      c_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+      memset(&unix_server, 0, sizeof(unix_server));
+      unix_server.sun_family = AF_UNIX;
+      strncpy(unix_server.sun_path, server, sizeof(unix_server.sun_path) - 1);
+      server_addr = (struct sockaddr *)&unix_server;
+      length = sizeof(unix_server);
+   }
+   else
+   {
+      c_sock = socket(AF_INET, SOCK_STREAM, 0);
+      hp = gethostbyname(server);
+      if (hp == 0)
+      {
+         printf("init_stream_client_socket() <ERROR>: Unknown host -> %s.\n", server);
+         return(-1);
+      }
+      memset(&tcp_server, 0, sizeof(tcp_server));
+      tcp_server.sin_family = AF_INET;
+      memcpy((char *)&tcp_server.sin_addr, (char *)hp->h_addr, hp->h_length);
+      tcp_server.sin_port = htons(atoi(port));
+      obd_server = tcp_server;
+      server_addr = (struct sockaddr *)&obd_server;
+      length = sizeof(struct sockaddr_in);
+   }
+
+   if ((c_sock < 0) || (connect(c_sock, server_addr, length) < 0))
+   {
+      printf("init_stream_client_socket() <ERROR>: Cannot connect to %s.\n", server);
+      if (c_sock >= 0)
+         close(c_sock);
+      return(-1);
+   }
+
+   client_stream = 1;
+   stream_rx_len = 0;
 
    return(c_sock);
 }
 
+/*
+   Function: connect_obd_server()
+
+   Purpose : Opens the client socket for a server address:
+
+           :   host:port         UDP, the default transport
+           :   unix:path         Unix datagram socket
+           :   stream:path       Unix stream socket
+           :   tcp:host:port     TCP, for reliable capture over a network
+
+   Input   : Server address.
+   Output  : Returns the socket or -1 on error.
+*/
+int connect_obd_server(char *address)
+{
+   char host[256];
+   char *port;
+   int tcp = 0;
+
+   if (strncmp(address, "unix:", 5) == 0)
+      return(init_unix_client_socket(address + 5));
+   if (strncmp(address, "stream:", 7) == 0)
+      return(init_stream_client_socket(address + 7, NULL));
+   if (strncmp(address, "tcp:", 4) == 0)
+   {
+      tcp = 1;
+      address += 4;
+   }
+   else if (strncmp(address, "udp:", 4) == 0)
+   {
+      address += 4;
+   }
+
+   strncpy(host, address, sizeof(host) - 1);
+   host[sizeof(host) - 1] = 0;
+   port = strrchr(host, ':');
+   if (port == NULL)
+   {
+      printf("connect_obd_server() <ERROR>: No port in %s.\n", address);
+      return(-1);
+   }
+   *port++ = 0;
+
+   if (tcp == 1)
+      return(init_stream_client_socket(host, port));
+
+   return(init_client_socket(host, port));
+}
+
 int init_server_socket(char *port)
 {
    struct sockaddr_in server;
@@ -133,11 +295,92 @@ int init_server_socket(char *port)
 #endif
 
 
+/*
+   Function: send_server_msg()
+
+   Purpose : Sends a message on the client transport, one datagram or one
+           : length prefixed frame.
+   Input   : Message and length.
+   Output  : Returns bytes sent or -1 on error.
+*/
+int send_server_msg(char *msg, int msg_len)
+{
+   unsigned char frame[STREAM_FRAME_HEADER_LEN + MAX_STREAM_MSG_LEN];
+   int n, len, sent = 0;
+
+   if (client_stream == 0)
+   {
+      return(sendto(c_sock, msg, msg_len, 0, server_addr, length));
+   }
+
+   len = encode_stream_frame(frame, sizeof(frame), msg, msg_len);
+   if (len == 0)
+   {
+      return(-1);
+   }
+
+   while (sent < len)
+   {
+      n = send(c_sock, frame + sent, len - sent, MSG_NOSIGNAL);
+      if ((n < 0) && (errno == EINTR))
+         continue;
+      if (n < 0)
+         return(-1);
+      sent += n;
+   }
+
+   return(msg_len);
+}
+
+/*
+   Function: recv_server_frame()
+
+   Purpose : Gets the next whole frame from a stream connection without
+           : blocking.
+   Input   : Message buffer and length.
+   Output  : Returns the message length, 0 if no whole frame has arrived
+           : or -1 if the connection closed.
+*/
+int recv_server_frame(char *msg, int max_len)
+{
+   int n, frame_len, msg_len, len;
+
+   while (1)
+   {
+      frame_len = get_stream_frame(stream_rx_buf, stream_rx_len, &msg_len);
+      if (frame_len < 0)
+      {
+         return(-1);
+      }
+
+      if (frame_len > 0)
+      {
+         len = (msg_len < max_len) ? msg_len : max_len - 1;
+         memcpy(msg, stream_rx_buf + STREAM_FRAME_HEADER_LEN, len);
+         stream_rx_len -= frame_len;
+         memmove(stream_rx_buf, stream_rx_buf + frame_len, stream_rx_len);
+         return(len);
+      }
+
+      n = recv(c_sock, stream_rx_buf + stream_rx_len, sizeof(stream_rx_buf) - stream_rx_len, MSG_DONTWAIT);
+      if (n > 0)
+      {
+         stream_rx_len += n;
+         continue;
+      }
+
+      if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+         return(0);
+
+      return(-1);
+   }
+}
+
 int send_ecu_msg(char *query)
 {
    int n;
 
-   n = sendto(c_sock,query,strlen(query),0,(const struct sockaddr *)&obd_server,length);
+   n = send_server_msg(query, strlen(query));
    if (n < 0) 
    {
       printf("send_ecu_msg() <ERROR>: Sendto failed.\n");
@@ -157,7 +400,10 @@ int recv_ecu_msg(char *msg)
 
    memset(msg,0,256);
 
-   n = recvfrom(c_sock,msg,256,MSG_DONTWAIT,(struct sockaddr *)&from,&length);
+   if (client_stream == 1)
+      return(recv_server_frame(msg, 256));
+
+   n = recvfrom(c_sock,msg,256,MSG_DONTWAIT,NULL,NULL);
    /* We are not blocking on recv now. */
    
    /*
@@ -176,7 +422,7 @@ int init_obd_comms(char *obd_msg)
 {
    int n;
 
-   n = sendto(c_sock,obd_msg,strlen(obd_msg),0,(const struct sockaddr *)&obd_server,length);
+   n = send_server_msg(obd_msg, strlen(obd_msg));
 
    if (n <= 0) 
    {
@@ -192,13 +438,214 @@ int init_obd_comms(char *obd_msg)
 }
 
 
+/*
+   Function: send_poll_request()
+
+   Purpose : Registers PIDs with the server polling scheduler, the server
+           : then sends the replies without further requests.
+   Input   : Polling interval in milliseconds (0 = as fast as possible,
+           : -1 = stop polling) and a mode plus PID list, e.g. "01 0C 0D".
+   Output  : Returns bytes sent.
+*/
+int send_poll_request(int interval_ms, char *pid_list)
+{
+   char poll_msg[256];
+
+   if (interval_ms < 0)
+      snprintf(poll_msg, 256, "UNPOLL %s\r", pid_list);
+   else
+      snprintf(poll_msg, 256, "POLL %d %s\r", interval_ms, pid_list);
+
+   return(send_ecu_msg(poll_msg));
+}
+
+/*
+   Function: send_subscribe_request()
+
+   Purpose : Subscribes to or unsubscribes from ECU replies for a list of
+           : PIDs, the server sends every reply for those PIDs to this
+           : client whichever client or poll made the request. Over UDP
+           : the subscription lapses unless it is sent again within
+           : POLL_LEASE_MS.
+   Input   : 1 to subscribe or 0 to unsubscribe, mode plus PID list.
+   Output  : Returns bytes sent.
+*/
+int send_subscribe_request(int subscribe, char *pid_list)
+{
+   char sub_msg[256];
+
+   if (subscribe == 1)
+      snprintf(sub_msg, 256, "SUB %s\r", pid_list);
+   else
+      snprintf(sub_msg, 256, "UNSUB %s\r", pid_list);
+
+   return(send_ecu_msg(sub_msg));
+}
+
+/*
+   Function: send_format_request()
+
+   Purpose : Selects the reply format for this client. Binary replies
+           : carry scaled Mode 01 values, see wire_protocol.c. Units
+           : replies are text decoded by the server, see obd_decoder.c.
+   Input   : 1 for binary samples, 2 for units or 0 for ELM327 text.
+   Output  : Returns bytes sent.
+*/
+int send_format_request(int binary)
+{
+   if (binary == 1)
+      return(send_ecu_msg("FORMAT BIN\r"));
+   if (binary == 2)
+      return(send_ecu_msg("FORMAT UNITS\r"));
+
+   return(send_ecu_msg("FORMAT TEXT\r"));
+}
+
+/*
+   Function: send_ecu_request()
+
+   Purpose : Sends a request with a request ID, "ID 1F 01 0C\r". The
+           : server puts the ID in front of every reply to the request, so
+           : many requests can be outstanding and each reply is matched to
+           : its request by recv_ecu_reply_msg().
+   Input   : Request message.
+   Output  : Returns the request ID, 0 if too many requests are pending or
+           : the send failed.
+*/
+unsigned int send_ecu_request(char *query)
+{
+   char id_msg[256];
+   int ii, slot = -1;
+
+   for (ii = 0; ii < MAX_PENDING_REQUESTS; ii++)
+   {
+      if (pending_requests[ii].request_id == 0)
+      {
+         slot = ii;
+         break;
+      }
+   }
+   if (slot < 0)
+   {
+      printf("send_ecu_request() <ERROR>: Too many pending requests.\n");
+      return(0);
+   }
+
+   if (++next_request_id == 0)
+      next_request_id = 1;
+
+   snprintf(id_msg, 256, "ID %X %s", next_request_id, query);
+   if (send_ecu_msg(id_msg) <= 0)
+   {
+      return(0);
+   }
+
+   pending_requests[slot].request_id = next_request_id;
+   pending_requests[slot].sent_ms = get_monotonic_ms();
+   strncpy(pending_requests[slot].ecu_query, query, MAX_ECU_QUERY_LEN - 1);
+   pending_requests[slot].ecu_query[MAX_ECU_QUERY_LEN - 1] = 0;
+   pending_count++;
+
+   return(next_request_id);
+}
+
+/*
+   Function: recv_ecu_reply_msg()
+
+   Purpose : Receives a server message and takes the request ID off the
+           : front of it. The pending request is freed and the time since
+           : it was sent is returned. Messages without an ID, polled and
+           : subscribed replies or binary datagrams, are returned as they
+           : arrive with an ID of 0.
+   Input   : Message buffer (256 bytes), request ID and latency.
+   Output  : Returns the message length, 0 or less if no message arrived.
+           : The latency is -1 if the request is not pending, a late
+           : reply to an expired request or a duplicate.
+*/
+int recv_ecu_reply_msg(char *msg, unsigned int *request_id, long long *latency_ms)
+{
+   char *end_ptr;
+   unsigned long reply_id;
+   int n, ii, len;
+
+   *request_id = 0;
+   *latency_ms = -1;
+
+   n = recv_ecu_msg(msg);
+   if ((n <= 5) || (strncmp(msg, "ID ", 3) != 0))
+   {
+      return(n);
+   }
+
+   reply_id = strtoul(msg + 3, &end_ptr, 16);
+   if ((end_ptr == msg + 3) || (*end_ptr != ' '))
+   {
+      return(n);
+   }
+
+   len = (end_ptr + 1) - msg;
+   n -= len;
+   memmove(msg, end_ptr + 1, n);
+   memset(msg + n, 0, len);
+   *request_id = (unsigned int)reply_id;
+
+   for (ii = 0; ii < MAX_PENDING_REQUESTS; ii++)
+   {
+      if ((pending_requests[ii].request_id != 0) && (pending_requests[ii].request_id == *request_id))
+      {
+         *latency_ms = get_monotonic_ms() - pending_requests[ii].sent_ms;
+         pending_requests[ii].request_id = 0;
+         pending_count--;
+         break;
+      }
+   }
+
+   return(n);
+}
+
+int get_pending_request_count()
+{
+   return(pending_count);
+}
+
+/*
+   Function: expire_pending_requests()
+
+   Purpose : Frees pending requests with no reply, UDP does not resend
+           : lost datagrams.
+   Input   : Milliseconds to wait for a reply.
+   Output  : Returns the number of requests expired.
+*/
+int expire_pending_requests(int timeout_ms)
+{
+   long long now_ms = get_monotonic_ms();
+   int ii, count = 0;
+
+   for (ii = 0; ii < MAX_PENDING_REQUESTS; ii++)
+   {
+      if ((pending_requests[ii].request_id != 0) && (now_ms - pending_requests[ii].sent_ms > timeout_ms))
+      {
+         printf("expire_pending_requests() <INFO>: No reply to %X %s\n", pending_requests[ii].request_id, pending_requests[ii].ecu_query);
+         pending_requests[ii].request_id = 0;
+         pending_count--;
+         count++;
+      }
+   }
+
+   return(count);
+}
+
 int server_connect()
 {
    int result;
    
    /* First set up UDP communication with the server process
-      and check connection to the OBD interface. */
-   result = init_client_socket("127.0.0.1", "8989");
+      and check connection to the OBD interface. OBD_SERVER picks
+      another server or transport, "tcp:192.168.1.20:8989". */
+   if (getenv("OBD_SERVER") != NULL)
+      result = connect_obd_server(getenv("OBD_SERVER"));
+   else
+      result = init_client_socket("127.0.0.1", "8989");
    
    if (result <= 0)
    {
@@ -0,0 +1,117 @@
+/*
+   spsc_ring.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Lock-free single producer, single consumer ring of fixed
+                size slots.
+
+                The slots are preallocated by the caller. The producer
+                fills the slot from get_ring_write_slot() in place and
+                publishes it with commit_ring_write(), the consumer reads
+                the slot from get_ring_read_slot() in place and frees it
+                with commit_ring_read(). Nothing is allocated or copied by
+                the ring.
+
+                Each index is only written by one thread. The release
+                store of an index after a slot is filled or read, paired
+                with the acquire load of that index by the other thread,
+                orders the slot contents, so no lock is needed. The
+                indexes run freely and wrap, a slot is index & mask.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_ring.h"
+
+int init_spsc_ring(SPSC_Ring *ring, void *slots, int slot_size, unsigned int num_slots)
+{
+   if ((num_slots == 0) || ((num_slots & (num_slots - 1)) != 0))
+   {
+      printf("init_spsc_ring() <ERROR>: Slot count %u is not a power of two.\n", num_slots);
+      return(-1);
+   }
+
+   atomic_init(&ring->head, 0);
+   atomic_init(&ring->tail, 0);
+   ring->num_slots = num_slots;
+   ring->slot_size = slot_size;
+   ring->slots = (unsigned char *)slots;
+
+   return(0);
+}
+
+/*
+   Function: get_ring_write_slot()
+
+   Purpose : Gets the next free slot for the producer to fill.
+   Input   : Ring.
+   Output  : Returns the slot or NULL if the ring is full.
+*/
+void *get_ring_write_slot(SPSC_Ring *ring)
+{
+   unsigned int tail, head;
+
+   tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+   head = atomic_load_explicit(&ring->head, memory_order_acquire);
+   if (tail - head >= ring->num_slots)
+   {
+      return(NULL);
+   }
+
+   return(ring->slots + ((tail & (ring->num_slots - 1)) * ring->slot_size));
+}
+
+void commit_ring_write(SPSC_Ring *ring)
+{
+   unsigned int tail;
+
+   tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+   atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+   return;
+}
+
+/*
+   Function: get_ring_read_slot()
+
+   Purpose : Gets the oldest filled slot for the consumer.
+   Input   : Ring.
+   Output  : Returns the slot or NULL if the ring is empty.
+*/
+void *get_ring_read_slot(SPSC_Ring *ring)
+{
+   unsigned int tail, head;
+
+   head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+   if (tail == head)
+   {
+      return(NULL);
+   }
+
+   return(ring->slots + ((head & (ring->num_slots - 1)) * ring->slot_size));
+}
+
+void commit_ring_read(SPSC_Ring *ring)
+{
+   unsigned int head;
+
+   head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+   return;
+}
+
+int get_ring_count(SPSC_Ring *ring)
+{
+   return((int)(atomic_load_explicit(&ring->tail, memory_order_acquire) - atomic_load_explicit(&ring->head, memory_order_acquire)));
+}
+
@@ -0,0 +1,40 @@
+/*
+   spsc_ring.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Lock-free single producer, single consumer ring of fixed
+                size slots. Used between the server network and serial
+                threads.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_SPSC_RING_INCLUDED
+#define OBD_SPSC_RING_INCLUDED
+
+#include <stdatomic.h>
+
+struct _SPSC_Ring {
+   atomic_uint head;             /* Next slot to read, written by the consumer. */
+   atomic_uint tail;             /* Next slot to write, written by the producer. */
+   unsigned int num_slots;       /* Power of two. */
+   int slot_size;
+   unsigned char *slots;
+};
+
+typedef struct _SPSC_Ring SPSC_Ring;
+
+/* spsc_ring.c */
+int init_spsc_ring(SPSC_Ring *ring, void *slots, int slot_size, unsigned int num_slots);
+void *get_ring_write_slot(SPSC_Ring *ring);
+void commit_ring_write(SPSC_Ring *ring);
+void *get_ring_read_slot(SPSC_Ring *ring);
+void commit_ring_read(SPSC_Ring *ring);
+int get_ring_count(SPSC_Ring *ring);
+
+#endif
+
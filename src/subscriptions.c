@@ -0,0 +1,328 @@
+/*
+   subscriptions.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Client subscriptions to ECU parameters.
+
+                SUB <mode> <pid> [<pid> ...]
+                UNSUB <mode> <pid> [<pid> ...]
+
+                Example: "SUB 01 0C 0D\r" sends every engine RPM and vehicle
+                speed reply to the client, no matter which client or the
+                polling scheduler made the request. A dashboard and a data
+                logger can share one serial transaction per sample instead
+                of each doubling the traffic on the serial link.
+
+                Modes without a PID such as 03 (DTCs) are subscribed with
+                the mode only, e.g. "SUB 03\r".
+
+                A datagram subscription is a lease of POLL_LEASE_MS, the
+                client renews it by sending the same SUB again. Lapsed
+                subscriptions are removed before each reply is published,
+                and the server unsubscribes a client when the kernel
+                refuses a datagram to it, see drop_failed_dgram_clients().
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "obd_monitor.h"
+#include "subscriptions.h"
+#include "binary_clients.h"
+
+ADAPTER_LOCAL Subscription subscription_list[MAX_SUBSCRIPTIONS];
+ADAPTER_LOCAL int subscription_count;
+
+void init_subscriptions()
+{
+   memset(subscription_list, 0, sizeof(subscription_list));
+   subscription_count = 0;
+
+   return;
+}
+
+int mode_has_pid(unsigned int pid_mode)
+{
+   /* DTC modes return a list of trouble codes, not a PID. */
+   return((pid_mode != 0x03) && (pid_mode != 0x04) && (pid_mode != 0x07) && (pid_mode != 0x0A));
+}
+
+Subscription *find_subscription(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num)
+{
+   int ii;
+
+   for (ii = 0; ii < MAX_SUBSCRIPTIONS; ii++)
+   {
+      if ((subscription_list[ii].in_use == 1) && (subscription_list[ii].pid_mode == pid_mode) &&
+          (subscription_list[ii].pid_num == pid_num) && same_client(&subscription_list[ii].client, &client_req->from_client))
+      {
+         return(&subscription_list[ii]);
+      }
+   }
+
+   return(NULL);
+}
+
+/*
+   Function: subscribe_pid()
+
+   Purpose : Adds a client to the subscriber list of a PID, or renews the
+           : lease of a datagram client that is already subscribed.
+   Input   : Client request, PID mode and number.
+   Output  : Returns 1, 0 if already subscribed or -1 if the list is full.
+*/
+int subscribe_pid(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num)
+{
+   Subscription *sub;
+   long long lease_expiry_ms = 0;
+   int ii;
+
+   if (!mode_has_pid(pid_mode))
+      pid_num = 0;
+
+   if (client_req->from_client.transport == CLIENT_DGRAM)
+      lease_expiry_ms = get_monotonic_ms() + POLL_LEASE_MS;
+
+   sub = find_subscription(client_req, pid_mode, pid_num);
+   if (sub != NULL)
+   {
+      sub->lease_expiry_ms = lease_expiry_ms;
+      return(0);
+   }
+
+   for (ii = 0; ii < MAX_SUBSCRIPTIONS; ii++)
+   {
+      if (subscription_list[ii].in_use == 0)
+      {
+         subscription_list[ii].in_use = 1;
+         subscription_list[ii].pid_mode = pid_mode;
+         subscription_list[ii].pid_num = pid_num;
+         subscription_list[ii].lease_expiry_ms = lease_expiry_ms;
+         subscription_list[ii].client = client_req->from_client;
+         subscription_count++;
+         return(1);
+      }
+   }
+
+   printf("subscribe_pid() <ERROR>: Subscription list full, cannot add %.2X %.2X\n", pid_mode, pid_num);
+
+   return(-1);
+}
+
+int unsubscribe_pid(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num)
+{
+   Subscription *sub;
+
+   if (!mode_has_pid(pid_mode))
+      pid_num = 0;
+
+   sub = find_subscription(client_req, pid_mode, pid_num);
+   if (sub == NULL)
+   {
+      return(0);
+   }
+
+   sub->in_use = 0;
+   subscription_count--;
+
+   return(1);
+}
+
+/* A stream client has gone or a datagram client cannot be reached, remove all its subscriptions. */
+int unsubscribe_client(Client_Address *client)
+{
+   int ii, count = 0;
+
+   for (ii = 0; ii < MAX_SUBSCRIPTIONS; ii++)
+   {
+      if ((subscription_list[ii].in_use == 1) && same_client(&subscription_list[ii].client, client))
+      {
+         subscription_list[ii].in_use = 0;
+         subscription_count--;
+         count++;
+      }
+   }
+
+   return(count);
+}
+
+/* Removes the datagram subscriptions that were not renewed in time. */
+int expire_subscription_leases(long long now_ms)
+{
+   int ii, count = 0;
+
+   for (ii = 0; ii < MAX_SUBSCRIPTIONS; ii++)
+   {
+      if ((subscription_list[ii].in_use == 1) && (subscription_list[ii].lease_expiry_ms > 0) &&
+          (subscription_list[ii].lease_expiry_ms <= now_ms))
+      {
+         subscription_list[ii].in_use = 0;
+         subscription_count--;
+         count++;
+      }
+   }
+
+   return(count);
+}
+
+/*
+   Function: parse_subscribe_request()
+
+   Purpose : Parses a SUB or UNSUB message from a client.
+   Input   : Client request.
+   Output  : Returns the number of PIDs updated or -1 on a bad message.
+*/
+int parse_subscribe_request(ECU_Request *client_req)
+{
+   char temp_buf[MAX_SERIAL_BUF_LEN];
+   char *token;
+   char *end_ptr;
+   unsigned int pid_mode, pid_num;
+   int add_sub, count = 0;
+
+   strncpy(temp_buf, client_req->ecu_query, MAX_SERIAL_BUF_LEN - 1);
+   temp_buf[MAX_SERIAL_BUF_LEN - 1] = 0;
+
+   token = strtok(temp_buf, " \r\n");
+   if (token == NULL)
+      return(-1);
+
+   if (strcmp(token, "SUB") == 0)
+      add_sub = 1;
+   else if (strcmp(token, "UNSUB") == 0)
+      add_sub = 0;
+   else
+      return(-1);
+
+   token = strtok(NULL, " \r\n");
+   if (token == NULL)
+      return(-1);
+   pid_mode = strtoul(token, &end_ptr, 16);
+   if ((*end_ptr != 0) || (pid_mode > 0xFF))
+      return(-1);
+
+   if (!mode_has_pid(pid_mode))
+   {
+      if (add_sub == 1)
+         return(subscribe_pid(client_req, pid_mode, 0) >= 0 ? 1 : 0);
+      return(unsubscribe_pid(client_req, pid_mode, 0));
+   }
+
+   while ((token = strtok(NULL, " \r\n")) != NULL)
+   {
+      pid_num = strtoul(token, &end_ptr, 16);
+      if ((*end_ptr != 0) || (pid_num > 0xFF))
+         return(-1);
+
+      if (add_sub == 1)
+      {
+         if (subscribe_pid(client_req, pid_mode, pid_num) >= 0)
+            count++;
+      }
+      else
+      {
+         count += unsubscribe_pid(client_req, pid_mode, pid_num);
+      }
+   }
+
+   return(count);
+}
+
+/*
+   Function: get_reply_pid()
+
+   Purpose : Gets the request mode and PID from an ECU reply, for example
+           : "41 0C 1A F8" is mode 01 PID 0C.
+   Input   : ECU reply message.
+   Output  : Returns 1 or 0 if the message is not an ECU reply.
+*/
+int get_reply_pid(char *ecu_reply, unsigned int *pid_mode, unsigned int *pid_num)
+{
+   unsigned int reply_mode, reply_pid;
+   int n;
+
+   n = sscanf(ecu_reply, "%2x %2x", &reply_mode, &reply_pid);
+   if ((n < 1) || (reply_mode < 0x40))
+   {
+      return(0);
+   }
+
+   *pid_mode = reply_mode - 0x40;
+   if ((n == 2) && mode_has_pid(*pid_mode))
+      *pid_num = reply_pid;
+   else
+      *pid_num = 0;
+
+   return(1);
+}
+
+/*
+   Function: publish_ecu_reply()
+
+   Purpose : Sends an ECU reply to the client that made the request and to
+           : every other subscriber of the PID.
+   Input   : Request, ECU reply and reply length.
+   Output  : Returns the number of clients the reply was sent to.
+*/
+int publish_ecu_reply(ECU_Request *req, char *ecu_reply, int reply_len)
+{
+   unsigned int pid_mode, pid_num;
+   int ii, count = 0;
+
+   if (req->from_client.transport != CLIENT_NONE)
+   {
+      if (send_client_data(&req->from_client, req->request_id, ecu_reply, reply_len) > 0)
+         count++;
+   }
+
+   if ((subscription_count == 0) || (get_reply_pid(ecu_reply, &pid_mode, &pid_num) == 0))
+   {
+      return(count);
+   }
+
+   expire_subscription_leases(get_monotonic_ms());
+
+   for (ii = 0; ii < MAX_SUBSCRIPTIONS; ii++)
+   {
+      if ((subscription_list[ii].in_use == 0) || (subscription_list[ii].pid_mode != pid_mode) ||
+          (subscription_list[ii].pid_num != pid_num))
+         continue;
+
+      if ((req->from_client.transport != CLIENT_NONE) && same_client(&subscription_list[ii].client, &req->from_client))
+         continue; /* Already sent to the client that made the request. */
+
+      if (send_client_data(&subscription_list[ii].client, 0, ecu_reply, reply_len) > 0)
+         count++;
+   }
+
+   return(count);
+}
+
+int is_subscribed(Client_Address *client, unsigned int pid_mode, unsigned int pid_num)
+{
+   int ii;
+
+   for (ii = 0; ii < MAX_SUBSCRIPTIONS; ii++)
+   {
+      if ((subscription_list[ii].in_use == 1) && (subscription_list[ii].pid_mode == pid_mode) &&
+          (subscription_list[ii].pid_num == pid_num) && same_client(&subscription_list[ii].client, client))
+      {
+         return(1);
+      }
+   }
+
+   return(0);
+}
+
+int get_subscription_count()
+{
+   return(subscription_count);
+}
+
@@ -0,0 +1,46 @@
+/*
+   subscriptions.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Client subscriptions to ECU parameters. Each ECU reply is
+                sent to every subscriber of the PID. Datagram clients
+                renew their SUB within POLL_LEASE_MS or it is removed.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_SUBSCRIPTIONS_INCLUDED
+#define OBD_SUBSCRIPTIONS_INCLUDED
+
+#include "request_queue.h"
+
+#define MAX_SUBSCRIPTIONS 256
+
+struct _Subscription {
+   int in_use;
+   unsigned int pid_mode;
+   unsigned int pid_num;
+   long long lease_expiry_ms;    /* Datagram clients only, 0 = until UNSUB or the stream closes. */
+   Client_Address client;
+};
+
+typedef struct _Subscription Subscription;
+
+/* subscriptions.c */
+void init_subscriptions();
+int subscribe_pid(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num);
+int unsubscribe_pid(ECU_Request *client_req, unsigned int pid_mode, unsigned int pid_num);
+int unsubscribe_client(Client_Address *client);
+int expire_subscription_leases(long long now_ms);
+int parse_subscribe_request(ECU_Request *client_req);
+int get_reply_pid(char *ecu_reply, unsigned int *pid_mode, unsigned int *pid_num);
+int publish_ecu_reply(ECU_Request *req, char *ecu_reply, int reply_len);
+int is_subscribed(Client_Address *client, unsigned int pid_mode, unsigned int pid_num);
+int get_subscription_count();
+
+#endif
+
@@ -0,0 +1,448 @@
+/*
+   telemetry.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Shared memory telemetry segment for local clients.
+
+                The server writes each decoded sample to a POSIX shared
+                memory segment, /obd_telemetry_<udp port>, as well as
+                sending it to the UDP clients. The segment holds the
+                latest ECU parameters and a ring of the last
+                TELEMETRY_RING_SLOTS samples for each PID. A GUI, logger or
+                dashboard on the same machine maps the segment read only
+                and reads the current values without a UDP round trip.
+
+                The server never waits for a reader. The parameters and
+                each ring slot have a sequence number that is odd while
+                the server writes them (a seqlock). A reader copies the
+                data and tries again if the sequence was odd or changed
+                during the copy. A slot also holds the index of its
+                sample, a reader that was lapped by the server finds a
+                newer sample in the slot and stops there.
+
+                The server side functions are called by the adapter
+                network thread, each adapter has its own segment. The
+                client side functions map one segment per process.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "obd_monitor.h"
+#include "telemetry.h"
+
+/* Server, the segment of the adapter. */
+ADAPTER_LOCAL Telemetry_Segment *telemetry_segment;
+ADAPTER_LOCAL char telemetry_name[64];
+
+/* Client, the segment mapped read only. */
+const Telemetry_Segment *telemetry_map;
+
+/*
+   Function: open_telemetry_segment()
+
+   Purpose : Creates the telemetry segment of an adapter. An old segment
+           : left by a server that did not exit cleanly is replaced.
+   Input   : UDP port of the adapter.
+   Output  : Returns 0 or -1 on error, the server runs without telemetry.
+*/
+int open_telemetry_segment(int udp_port)
+{
+   int shm_fd;
+
+   snprintf(telemetry_name, sizeof(telemetry_name), TELEMETRY_SHM_NAME, udp_port);
+   shm_unlink(telemetry_name);
+
+   shm_fd = shm_open(telemetry_name, O_CREAT | O_EXCL | O_RDWR, 0644);
+   if (shm_fd < 0)
+   {
+      perror("open_telemetry_segment() <ERROR>: shm_open");
+      return(-1);
+   }
+
+   if (ftruncate(shm_fd, sizeof(Telemetry_Segment)) < 0)
+   {
+      perror("open_telemetry_segment() <ERROR>: ftruncate");
+      close(shm_fd);
+      shm_unlink(telemetry_name);
+      return(-1);
+   }
+
+   telemetry_segment = mmap(NULL, sizeof(Telemetry_Segment), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+   close(shm_fd);
+   if (telemetry_segment == MAP_FAILED)
+   {
+      perror("open_telemetry_segment() <ERROR>: mmap");
+      telemetry_segment = NULL;
+      shm_unlink(telemetry_name);
+      return(-1);
+   }
+
+   /* New pages are zero, the sequences and counts start at 0. */
+   telemetry_segment->version = TELEMETRY_VERSION;
+   atomic_thread_fence(memory_order_release);
+   telemetry_segment->magic = TELEMETRY_MAGIC;
+
+   return(0);
+}
+
+void close_telemetry_segment()
+{
+   if (telemetry_segment != NULL)
+   {
+      munmap(telemetry_segment, sizeof(Telemetry_Segment));
+      shm_unlink(telemetry_name);
+      telemetry_segment = NULL;
+   }
+
+   return;
+}
+
+void copy_telemetry_text(char *dest, const char *src, int dest_len)
+{
+   strncpy(dest, src, dest_len - 1);
+   dest[dest_len - 1] = 0;
+
+   return;
+}
+
+/*
+   Function: set_telemetry_parameter()
+
+   Purpose : Copies a sample to the ECU parameter the GUI shows for it.
+   Input   : ECU parameters and the sample.
+   Output  : Returns 1, 0 if the sample has no ECU parameter.
+*/
+int set_telemetry_parameter(ECU_Parameters *ecup, OBD_Sample *sample)
+{
+   if (sample->pid_mode == OBD_MODE_INTERFACE)
+   {
+      ecup->ecu_battery_voltage = sample->value;
+      snprintf(ecup->battery_voltage, sizeof(ecup->battery_voltage), "%.2f %s", sample->value, sample->units);
+      return(1);
+   }
+   else if (sample->pid_mode == 0x03)
+   {
+      copy_telemetry_text(ecup->ecu_last_dtc_code, sample->text, sizeof(ecup->ecu_last_dtc_code));
+      return(1);
+   }
+   else if (sample->pid_mode == 0x09)
+   {
+      if (sample->pid_num == 0x02)
+         copy_telemetry_text(ecup->ecu_vin, sample->text, sizeof(ecup->ecu_vin));
+      else
+         copy_telemetry_text(ecup->ecu_name, sample->text, sizeof(ecup->ecu_name));
+      return(1);
+   }
+   else if (sample->pid_mode != 0x01)
+   {
+      return(0);
+   }
+
+   switch(sample->pid_num)
+   {
+      case 0x01:
+         ecup->ecu_dtc_count = (int)sample->value;
+         ecup->ecu_mil_status = (strcmp(sample->text, "MIL On") == 0);
+         break;
+      case 0x05: ecup->ecu_coolant_temperature = sample->value; break;
+      case 0x0A: ecup->ecu_fuel_pressure = sample->value; break;
+      case 0x0B: ecup->ecu_manifold_air_pressure = sample->value; break;
+      case 0x0C: ecup->ecu_engine_rpm = sample->value; break;
+      case 0x0D: ecup->ecu_vehicle_speed = sample->value; break;
+      case 0x0E: ecup->ecu_timing_advance = sample->value; break;
+      case 0x0F: ecup->ecu_intake_air_temperature = sample->value; break;
+      case 0x11: ecup->ecu_throttle_position = sample->value; break;
+      case 0x2F: ecup->ecu_fuel_tank_level = sample->value; break;
+      case 0x5A: ecup->ecu_accelerator_position = sample->value; break;
+      case 0x5C: ecup->ecu_oil_temperature = sample->value; break;
+      case 0x5E: ecup->ecu_fuel_flow_rate = sample->value; break;
+      default : return(0);
+   }
+
+   return(1);
+}
+
+Telemetry_Ring *get_telemetry_ring(unsigned int pid_mode, unsigned int pid_num)
+{
+   Telemetry_Ring *ring;
+   unsigned int ii, ring_count;
+
+   ring_count = atomic_load_explicit(&telemetry_segment->ring_count, memory_order_relaxed);
+   for (ii = 0; ii < ring_count; ii++)
+   {
+      ring = &telemetry_segment->rings[ii];
+      if ((ring->pid_mode == pid_mode) && (ring->pid_num == pid_num))
+         return(ring);
+   }
+
+   if (ring_count >= MAX_TELEMETRY_PIDS)
+   {
+      return(NULL);
+   }
+
+   /* Readers only look at rings below the count. */
+   ring = &telemetry_segment->rings[ring_count];
+   ring->pid_mode = pid_mode;
+   ring->pid_num = pid_num;
+   atomic_store_explicit(&telemetry_segment->ring_count, ring_count + 1, memory_order_release);
+
+   return(ring);
+}
+
+void write_telemetry_slot(Telemetry_Ring *ring, OBD_Sample *sample)
+{
+   Telemetry_Slot *slot;
+   unsigned int count, seq;
+
+   count = atomic_load_explicit(&ring->sample_count, memory_order_relaxed);
+   slot = &ring->slots[count & (TELEMETRY_RING_SLOTS - 1)];
+
+   seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+   atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+
+   slot->sample_index = count;
+   slot->sample.pid_mode = sample->pid_mode;
+   slot->sample.pid_num = sample->pid_num;
+   slot->sample.sample_type = sample->sample_type;
+   slot->sample.timestamp_ms = sample->timestamp_ms;
+   slot->sample.value = sample->value;
+   copy_telemetry_text(slot->sample.units, (sample->units != NULL) ? sample->units : "", TELEMETRY_UNITS_LEN);
+   copy_telemetry_text(slot->sample.text, sample->text, OBD_SAMPLE_TEXT_LEN);
+
+   atomic_store_explicit(&slot->seq, seq + 2, memory_order_release);
+   atomic_store_explicit(&ring->sample_count, count + 1, memory_order_release);
+
+   return;
+}
+
+/*
+   Function: publish_telemetry_samples()
+
+   Purpose : Writes the samples of one ECU reply to the telemetry segment,
+           : the ECU parameters under one sequence and each sample to the
+           : ring of its PID.
+   Input   : Samples and the number of samples.
+   Output  : Returns the number of samples written.
+*/
+int publish_telemetry_samples(OBD_Sample *samples, int sample_count)
+{
+   Telemetry_Ring *ring;
+   unsigned int seq;
+   int ii, count = 0;
+
+   if ((telemetry_segment == NULL) || (sample_count <= 0))
+   {
+      return(0);
+   }
+
+   seq = atomic_load_explicit(&telemetry_segment->params_seq, memory_order_relaxed);
+   atomic_store_explicit(&telemetry_segment->params_seq, seq + 1, memory_order_relaxed);
+   atomic_thread_fence(memory_order_release);
+
+   for (ii = 0; ii < sample_count; ii++)
+   {
+      set_telemetry_parameter(&telemetry_segment->params, &samples[ii]);
+   }
+   telemetry_segment->params_time_ms = samples[sample_count - 1].timestamp_ms;
+
+   atomic_store_explicit(&telemetry_segment->params_seq, seq + 2, memory_order_release);
+
+   for (ii = 0; ii < sample_count; ii++)
+   {
+      ring = get_telemetry_ring(samples[ii].pid_mode, samples[ii].pid_num);
+      if (ring == NULL)
+         continue; /* No free ring, the parameters still have the sample. */
+
+      write_telemetry_slot(ring, &samples[ii]);
+      count++;
+   }
+
+   return(count);
+}
+
+/*
+   Function: map_telemetry_segment()
+
+   Purpose : Maps the telemetry segment of a server adapter read only.
+   Input   : UDP port of the adapter.
+   Output  : Returns 0 or -1 if the server has no segment.
+*/
+int map_telemetry_segment(int udp_port)
+{
+   char shm_name[64];
+   const Telemetry_Segment *segment;
+   int shm_fd;
+
+   unmap_telemetry_segment();
+
+   snprintf(shm_name, sizeof(shm_name), TELEMETRY_SHM_NAME, udp_port);
+   shm_fd = shm_open(shm_name, O_RDONLY, 0);
+   if (shm_fd < 0)
+   {
+      return(-1);
+   }
+
+   segment = mmap(NULL, sizeof(Telemetry_Segment), PROT_READ, MAP_SHARED, shm_fd, 0);
+   close(shm_fd);
+   if (segment == MAP_FAILED)
+   {
+      perror("map_telemetry_segment() <ERROR>: mmap");
+      return(-1);
+   }
+
+   if ((segment->magic != TELEMETRY_MAGIC) || (segment->version != TELEMETRY_VERSION))
+   {
+      printf("map_telemetry_segment() <ERROR>: %s is not a version %i telemetry segment.\n", shm_name, TELEMETRY_VERSION);
+      munmap((void *)segment, sizeof(Telemetry_Segment));
+      return(-1);
+   }
+
+   telemetry_map = segment;
+
+   return(0);
+}
+
+void unmap_telemetry_segment()
+{
+   if (telemetry_map != NULL)
+   {
+      munmap((void *)telemetry_map, sizeof(Telemetry_Segment));
+      telemetry_map = NULL;
+   }
+
+   return;
+}
+
+/*
+   Function: read_telemetry_parameters()
+
+   Purpose : Copies the latest ECU parameters from the mapped segment.
+   Input   : ECU parameters.
+   Output  : Returns 1, 0 if no segment is mapped or the server did not
+           : finish a write in TELEMETRY_READ_RETRIES tries.
+*/
+int read_telemetry_parameters(ECU_Parameters *ecup)
+{
+   unsigned int seq1, seq2;
+   int ii;
+
+   if (telemetry_map == NULL)
+   {
+      return(0);
+   }
+
+   for (ii = 0; ii < TELEMETRY_READ_RETRIES; ii++)
+   {
+      seq1 = atomic_load_explicit((atomic_uint *)&telemetry_map->params_seq, memory_order_acquire);
+      if (seq1 & 1)
+         continue;
+
+      memcpy(ecup, &telemetry_map->params, sizeof(ECU_Parameters));
+      atomic_thread_fence(memory_order_acquire);
+
+      seq2 = atomic_load_explicit((atomic_uint *)&telemetry_map->params_seq, memory_order_relaxed);
+      if (seq1 == seq2)
+         return(1);
+   }
+
+   return(0);
+}
+
+/*
+   Function: read_telemetry_slot()
+
+   Purpose : Copies the sample in a ring slot if it is still the sample
+           : with the index asked for.
+   Input   : Slot, sample index and sample buffer.
+   Output  : Returns 1, 0 if the server did not finish a write in
+           : TELEMETRY_READ_RETRIES tries or -1 if the server has written
+           : a newer sample to the slot.
+*/
+int read_telemetry_slot(const Telemetry_Slot *slot, unsigned int sample_index, Telemetry_Sample *sample)
+{
+   unsigned int seq1, seq2, slot_index;
+   int ii;
+
+   for (ii = 0; ii < TELEMETRY_READ_RETRIES; ii++)
+   {
+      seq1 = atomic_load_explicit((atomic_uint *)&slot->seq, memory_order_acquire);
+      if (seq1 & 1)
+         continue;
+
+      slot_index = slot->sample_index;
+      memcpy(sample, &slot->sample, sizeof(Telemetry_Sample));
+      atomic_thread_fence(memory_order_acquire);
+
+      seq2 = atomic_load_explicit((atomic_uint *)&slot->seq, memory_order_relaxed);
+      if (seq1 == seq2)
+         return((slot_index == sample_index) ? 1 : -1);
+   }
+
+   return(0);
+}
+
+/*
+   Function: read_telemetry_samples()
+
+   Purpose : Copies the newest consecutive samples of a PID from the
+           : mapped segment, newest first. DTCs are mode 03 with the
+           : code number as the PID, the battery voltage is mode and
+           : PID 00.
+   Input   : Mode, PID, sample buffer and buffer length.
+   Output  : Returns the number of samples copied.
+*/
+int read_telemetry_samples(unsigned int pid_mode, unsigned int pid_num, Telemetry_Sample *samples, int max_samples)
+{
+   const Telemetry_Ring *ring = NULL;
+   unsigned int ii, ring_count, sample_count;
+   int count = 0;
+
+   if (telemetry_map == NULL)
+   {
+      return(0);
+   }
+
+   ring_count = atomic_load_explicit((atomic_uint *)&telemetry_map->ring_count, memory_order_acquire);
+   for (ii = 0; (ii < ring_count) && (ii < MAX_TELEMETRY_PIDS); ii++)
+   {
+      if ((telemetry_map->rings[ii].pid_mode == pid_mode) && (telemetry_map->rings[ii].pid_num == pid_num))
+      {
+         ring = &telemetry_map->rings[ii];
+         break;
+      }
+   }
+
+   if (ring == NULL)
+   {
+      return(0);
+   }
+
+   /* Slots older than one lap of the ring have been written over. */
+   sample_count = atomic_load_explicit((atomic_uint *)&ring->sample_count, memory_order_acquire);
+   if (max_samples > TELEMETRY_RING_SLOTS)
+      max_samples = TELEMETRY_RING_SLOTS;
+
+   for (ii = sample_count; (ii > 0) && (count < max_samples); ii--)
+   {
+      /* Lapped by the server, the older slots hold newer samples too. */
+      if (read_telemetry_slot(&ring->slots[(ii - 1) & (TELEMETRY_RING_SLOTS - 1)], ii - 1, &samples[count]) != 1)
+         break;
+      count++;
+   }
+
+   return(count);
+}
+
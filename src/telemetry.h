@@ -0,0 +1,84 @@
+/*
+   telemetry.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Shared memory telemetry segment. The server publishes the
+                latest ECU parameters and a ring of samples for each PID,
+                local clients map the segment read only.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_TELEMETRY_INCLUDED
+#define OBD_TELEMETRY_INCLUDED
+
+#include <stdatomic.h>
+
+#include "protocols.h"
+#include "obd_decoder.h"
+
+#define TELEMETRY_SHM_NAME "/obd_telemetry_%i"  /* One segment per adapter UDP port. */
+#define TELEMETRY_MAGIC 0x4F424454              /* "OBDT" */
+#define TELEMETRY_VERSION 2
+#define MAX_TELEMETRY_PIDS 32
+#define TELEMETRY_RING_SLOTS 64                 /* Power of two. */
+#define TELEMETRY_UNITS_LEN 8
+#define TELEMETRY_READ_RETRIES 1000
+
+struct _Telemetry_Sample {
+   unsigned int pid_mode;
+   unsigned int pid_num;
+   int sample_type;
+   long long timestamp_ms;
+   double value;
+   char units[TELEMETRY_UNITS_LEN];
+   char text[OBD_SAMPLE_TEXT_LEN];
+};
+
+typedef struct _Telemetry_Sample Telemetry_Sample;
+
+/* A ring slot, the sequence is odd while the server writes the sample. */
+struct _Telemetry_Slot {
+   atomic_uint seq;
+   unsigned int sample_index;    /* Ring sample count when the sample was written. */
+   Telemetry_Sample sample;
+};
+
+typedef struct _Telemetry_Slot Telemetry_Slot;
+
+struct _Telemetry_Ring {
+   unsigned int pid_mode;
+   unsigned int pid_num;
+   atomic_uint sample_count;     /* Samples written, the newest is in slot (count - 1) & mask. */
+   Telemetry_Slot slots[TELEMETRY_RING_SLOTS];
+};
+
+typedef struct _Telemetry_Ring Telemetry_Ring;
+
+struct _Telemetry_Segment {
+   unsigned int magic;
+   unsigned int version;
+   atomic_uint params_seq;       /* Odd while the server writes the parameters. */
+   long long params_time_ms;
+   ECU_Parameters params;
+   atomic_uint ring_count;       /* Rings in use, a ring is set up before the count is raised. */
+   Telemetry_Ring rings[MAX_TELEMETRY_PIDS];
+};
+
+typedef struct _Telemetry_Segment Telemetry_Segment;
+
+/* telemetry.c */
+int open_telemetry_segment(int udp_port);
+void close_telemetry_segment();
+int publish_telemetry_samples(OBD_Sample *samples, int sample_count);
+int map_telemetry_segment(int udp_port);
+void unmap_telemetry_segment();
+int read_telemetry_parameters(ECU_Parameters *ecup);
+int read_telemetry_samples(unsigned int pid_mode, unsigned int pid_num, Telemetry_Sample *samples, int max_samples);
+
+#endif
+
@@ -11,6 +11,13 @@
                 engine control units via an OBD-II interface to obtain 
                 engine status and fault codes. Can also be used as an ECU
                 communications logging function when the GUI is not required.
+
+                ./server_test -t runs the transport tests instead, no server
+                or ECU is needed. The client functions in sockets.c talk to
+                a peer thread over UDP, a Unix datagram socket, a Unix stream
+                socket and TCP. The server side, transport.c, is checked
+                from client sockets. The exit status is the number of failed
+                checks.
                 
 
    Date: 03/01/2018
@@ -30,6 +37,14 @@
 #include "obd_monitor.h"
 #include "rs232.h"
 
+#ifndef _WINSOCK
+#include <pthread.h>
+#include <sys/un.h>
+#include "wire_protocol.h"
+#include "transport.h"
+#include "udp_batch.h"
+#endif
+
 const char *OBD_Protocol_List[] = {
 "OBD 0 - Automatic OBD-II Protocol Search",
 "OBD 1 - SAE J1850 PWM (41.6 kbaud)(Ford)",
@@ -46,6 +61,475 @@ const char *OBD_Protocol_List[] = {
 "OBD C - USER2 CAN (11 bit ID, 50 kbaud)"
 };
 
+#ifndef _WINSOCK
+
+extern int c_sock;                 /* Client socket, sockets.c */
+
+struct _Test_Peer {
+   int sock;
+   int stream;                     /* 1 for a listening stream socket. */
+};
+
+typedef struct _Test_Peer Test_Peer;
+
+int send_test_bytes(int sock, unsigned char *buf, int len)
+{
+   int n, sent = 0;
+
+   while (sent < len)
+   {
+      n = send(sock, buf + sent, len - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+         return(-1);
+      sent += n;
+   }
+
+   return(sent);
+}
+
+/*
+   Function: run_test_peer()
+
+   Purpose : Answers the client as the server transports do. Datagrams are
+           : echoed until "QUIT". Stream messages are echoed as length
+           : prefixed frames until the client closes, "SPLIT" is answered
+           : in two writes and "BIG" with a frame longer than
+           : MAX_STREAM_MSG_LEN.
+   Input   : Test_Peer.
+   Output  : None.
+*/
+void *run_test_peer(void *arg)
+{
+   Test_Peer *peer = (Test_Peer *)arg;
+   struct sockaddr_storage from;
+   socklen_t from_len;
+   unsigned char rx_buf[STREAM_FRAME_HEADER_LEN + MAX_STREAM_MSG_LEN];
+   unsigned char tx_buf[STREAM_FRAME_HEADER_LEN + MAX_STREAM_MSG_LEN];
+   char reply[300];
+   char *msg;
+   unsigned int big_len;
+   int conn, n, len, msg_len, frame_len, rx_len = 0;
+
+   if (peer->stream == 0)
+   {
+      from_len = sizeof(from);
+      while ((n = recvfrom(peer->sock, rx_buf, 256, 0, (struct sockaddr *)&from, &from_len)) > 0)
+      {
+         if (strncmp((char *)rx_buf, "QUIT", 4) == 0)
+            break;
+         len = snprintf(reply, sizeof(reply), "ECHO %.*s", n, rx_buf);
+         sendto(peer->sock, reply, len, 0, (struct sockaddr *)&from, from_len);
+         from_len = sizeof(from);
+      }
+      return(NULL);
+   }
+
+   conn = accept(peer->sock, NULL, NULL);
+   if (conn < 0)
+      return(NULL);
+
+   while ((n = recv(conn, rx_buf + rx_len, sizeof(rx_buf) - rx_len, 0)) > 0)
+   {
+      rx_len += n;
+      while ((frame_len = get_stream_frame(rx_buf, rx_len, &msg_len)) > 0)
+      {
+         msg = (char *)rx_buf + STREAM_FRAME_HEADER_LEN;
+         len = snprintf(reply, sizeof(reply), "ECHO %.*s", msg_len, msg);
+         len = encode_stream_frame(tx_buf, sizeof(tx_buf), reply, len);
+         if (strncmp(msg, "SPLIT", 5) == 0)
+         {
+            /* The header and two bytes, the rest after the client has polled. */
+            send_test_bytes(conn, tx_buf, STREAM_FRAME_HEADER_LEN + 2);
+            usleep(100000);
+            send_test_bytes(conn, tx_buf + STREAM_FRAME_HEADER_LEN + 2, len - STREAM_FRAME_HEADER_LEN - 2);
+         }
+         else if (strncmp(msg, "BIG", 3) == 0)
+         {
+            big_len = htonl(MAX_STREAM_MSG_LEN + 1);
+            memcpy(tx_buf, &big_len, STREAM_FRAME_HEADER_LEN);
+            send_test_bytes(conn, tx_buf, len);
+         }
+         else
+         {
+            send_test_bytes(conn, tx_buf, len);
+         }
+         rx_len -= frame_len;
+         memmove(rx_buf, rx_buf + frame_len, rx_len);
+      }
+   }
+   close(conn);
+
+   return(NULL);
+}
+
+/*
+   Function: wait_test_reply()
+
+   Purpose : Polls for a reply for up to a second, counting the polls that
+           : found nothing.
+   Input   : Message buffer, 1 on a stream connection, empty poll count.
+   Output  : Returns the reply length, 0 if none arrived or -1 if the
+           : stream closed.
+*/
+int wait_test_reply(char *msg, int stream, int *empty_polls)
+{
+   int ii, n;
+
+   *empty_polls = 0;
+   for (ii = 0; ii < 100; ii++)
+   {
+      n = recv_ecu_msg(msg);
+      if (n > 0)
+         return(n);
+      if ((n < 0) && (stream == 1))
+         return(-1);
+      (*empty_polls)++;
+      usleep(10000);
+   }
+
+   return(0);
+}
+
+int check_test_reply(char *name, char *query, int stream)
+{
+   char expected[300];
+   char msg[256];
+   int n, empty_polls;
+
+   snprintf(expected, sizeof(expected), "ECHO %s", query);
+   n = wait_test_reply(msg, stream, &empty_polls);
+   if ((n == (int)strlen(expected)) && (memcmp(msg, expected, n) == 0))
+   {
+      replacechar(expected, '\r', ' ');
+      printf("%-16s PASS %s\n", name, expected);
+      return(0);
+   }
+
+   replacechar(expected, '\r', ' ');
+   printf("%-16s FAIL %i bytes, expected %s\n", name, n, expected);
+   return(1);
+}
+
+/*
+   Function: test_transport()
+
+   Purpose : Connects to a peer with connect_obd_server() and checks the
+           : round trips. Streams also get a reply split over two reads,
+           : an oversized request and an oversized reply.
+   Input   : Test name, server address and the peer.
+   Output  : Returns the number of failed checks.
+*/
+int test_transport(char *name, char *address, Test_Peer *peer)
+{
+   pthread_t peer_thread;
+   char big_msg[MAX_STREAM_MSG_LEN + 1];
+   char msg[256];
+   int empty_polls, n, failures = 0;
+
+   pthread_create(&peer_thread, NULL, run_test_peer, peer);
+
+   if (connect_obd_server(address) < 0)
+   {
+      printf("%-16s FAIL connect_obd_server(%s)\n", name, address);
+      shutdown(peer->sock, SHUT_RDWR);
+      pthread_join(peer_thread, NULL);
+      return(1);
+   }
+
+   send_ecu_msg("01 0C\r");
+   failures += check_test_reply(name, "01 0C\r", peer->stream);
+
+   send_format_request(1);
+   failures += check_test_reply(name, "FORMAT BIN\r", peer->stream);
+
+   if (peer->stream == 1)
+   {
+      send_ecu_msg("SPLIT\r");
+      failures += check_test_reply(name, "SPLIT\r", peer->stream);
+
+      memset(big_msg, 'A', sizeof(big_msg));
+      n = send_server_msg(big_msg, sizeof(big_msg));
+      printf("%-16s %s send_server_msg() refuses %i bytes\n", name, (n < 0) ? "PASS" : "FAIL", (int)sizeof(big_msg));
+      failures += (n >= 0);
+
+      send_ecu_msg("BIG\r");
+      n = wait_test_reply(msg, 1, &empty_polls);
+      printf("%-16s %s recv_server_frame() closes on a frame over %i bytes\n", name, (n < 0) ? "PASS" : "FAIL", MAX_STREAM_MSG_LEN);
+      failures += (n >= 0);
+   }
+   else
+   {
+      send_ecu_msg("QUIT\r");
+   }
+
+   close(c_sock);
+   pthread_join(peer_thread, NULL);
+   close(peer->sock);
+
+   return(failures);
+}
+
+int connect_test_stream(char *path)
+{
+   struct sockaddr_un addr;
+   int sock;
+
+   sock = socket(AF_UNIX, SOCK_STREAM, 0);
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+   if ((sock >= 0) && (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0))
+   {
+      close(sock);
+      return(-1);
+   }
+
+   return(sock);
+}
+
+/* Accepts as the event loop does, the connection is already queued. */
+int accept_test_stream(int listen_sock)
+{
+   int ii, sock = -1;
+
+   for (ii = 0; (ii < 100) && (sock < 0); ii++)
+   {
+      sock = accept_stream_client(listen_sock);
+      if (sock < 0)
+         usleep(1000);
+   }
+
+   return(sock);
+}
+
+/* Calls recv_stream_msg() until a message arrives or the stream closes. */
+int wait_stream_msg(int sock, char *msg, Client_Address *client)
+{
+   int ii, n = 0;
+
+   for (ii = 0; (ii < 100) && (n == 0); ii++)
+   {
+      n = recv_stream_msg(sock, msg, MAX_STREAM_MSG_LEN, client);
+      if (n == 0)
+         usleep(1000);
+   }
+
+   return(n);
+}
+
+int check_transport(char *name, int passed, char *description)
+{
+   printf("%-16s %s %s\n", name, passed ? "PASS" : "FAIL", description);
+
+   return(passed ? 0 : 1);
+}
+
+/*
+   Function: test_server_transports()
+
+   Purpose : Checks the server side of the stream transports, transport.c,
+           : from a client socket: frames split over several writes, two
+           : frames in one write, a client that closes with a reply
+           : pending, a socket number reused by the next connection, a
+           : client that falls STREAM_TX_BUF_LEN behind and same_client().
+   Input   : None.
+   Output  : Returns the number of failed checks.
+*/
+int test_server_transports()
+{
+   Client_Address first, second, closed[MAX_STREAM_CLIENTS];
+   struct sockaddr_in *in_a, *in_b;
+   struct sockaddr_in port_addr;
+   socklen_t addr_len;
+   unsigned char frames[64];
+   char path[MAX_UNIX_PATH_LEN];
+   char msg[MAX_STREAM_MSG_LEN];
+   char reply[400];
+   char *name = "Server stream";
+   int socks[NUM_TRANSPORT_SOCKETS];
+   int listen_sock = -1, client, server_sock, port, len, n, ii, count, failures = 0;
+
+   /* A free port for the TCP listener, the Unix paths are named after it. */
+   memset(&port_addr, 0, sizeof(port_addr));
+   port_addr.sin_family = AF_INET;
+   port_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr_len = sizeof(port_addr);
+   client = socket(AF_INET, SOCK_STREAM, 0);
+   bind(client, (struct sockaddr *)&port_addr, sizeof(port_addr));
+   getsockname(client, (struct sockaddr *)&port_addr, &addr_len);
+   port = ntohs(port_addr.sin_port);
+   close(client);
+
+   init_transports();
+   init_udp_sends();
+   open_transports(port);
+   count = get_transport_sockets(socks);
+   for (ii = 0; (ii < count) && (listen_sock < 0); ii++)
+   {
+      if (is_listen_socket(socks[ii]))
+         listen_sock = socks[ii]; /* Unix stream, before TCP. */
+   }
+   snprintf(path, sizeof(path), UNIX_STREAM_PATH, port);
+
+   client = connect_test_stream(path);
+   server_sock = accept_test_stream(listen_sock);
+   if ((client < 0) || (server_sock < 0))
+   {
+      printf("%-16s FAIL connect to %s\n", name, path);
+      close_transports();
+      return(1);
+   }
+
+   /* One frame in three writes, the header split in two. */
+   len = encode_stream_frame(frames, sizeof(frames), "01 0C\r", 6);
+   send_test_bytes(client, frames, 2);
+   n = recv_stream_msg(server_sock, msg, MAX_STREAM_MSG_LEN, &first);
+   send_test_bytes(client, frames + 2, 2);
+   n += recv_stream_msg(server_sock, msg, MAX_STREAM_MSG_LEN, &first);
+   send_test_bytes(client, frames + 4, len - 4);
+   if (n == 0)
+      n = wait_stream_msg(server_sock, msg, &first);
+   failures += check_transport(name, (n == 6) && (strcmp(msg, "01 0C\r") == 0), "recv_stream_msg() joins a frame sent in three writes");
+
+   /* Two frames and an empty one in one write. */
+   len = encode_stream_frame(frames, sizeof(frames), "ATRV\r", 5);
+   len += encode_stream_frame(frames + len, sizeof(frames) - len, "", 0);
+   len += encode_stream_frame(frames + len, sizeof(frames) - len, "01 0D\r", 6);
+   send_test_bytes(client, frames, len);
+   n = wait_stream_msg(server_sock, msg, &second);
+   ii = (n == 5) && (strcmp(msg, "ATRV\r") == 0);
+   n = wait_stream_msg(server_sock, msg, &second);
+   ii = ii && (n == 6) && (strcmp(msg, "01 0D\r") == 0) && (recv_stream_msg(server_sock, msg, MAX_STREAM_MSG_LEN, &second) == 0);
+   failures += check_transport(name, ii, "recv_stream_msg() splits two frames and skips an empty one");
+
+   /* The client closes before its reply is sent. */
+   close(client);
+   n = wait_stream_msg(server_sock, msg, &second);
+   ii = (n < 0) && (send_client_msg(&first, "41 0C 1A F8", 11) < 0);
+   count = flush_stream_clients(closed, MAX_STREAM_CLIENTS);
+   ii = ii && (count == 1) && same_client(&closed[0], &first);
+   failures += check_transport(name, ii, "a reply to a client that closed is dropped, the client is closed");
+
+   /* The next connection gets the same socket number and a new ID. */
+   client = connect_test_stream(path);
+   server_sock = accept_test_stream(listen_sock);
+   len = encode_stream_frame(frames, sizeof(frames), "01 0C\r", 6);
+   send_test_bytes(client, frames, len);
+   n = wait_stream_msg(server_sock, msg, &second);
+   ii = (n == 6) && (second.sock == first.sock) && (same_client(&first, &second) == 0) &&
+        (send_client_msg(&first, "41 0C 1A F8", 11) < 0) && (send_client_msg(&second, "41 0C 1A F8", 11) == 11);
+   failures += check_transport(name, ii, "a reused socket number only gets the replies of the new connection");
+
+   /* The client closes with a reply buffered, the flush finds it gone. */
+   close(client);
+   usleep(10000);
+   count = flush_stream_clients(closed, MAX_STREAM_CLIENTS);
+   failures += check_transport(name, (count == 1) && same_client(&closed[0], &second), "a client that closes with a reply buffered is closed on the flush");
+
+   /* A client that does not read is closed once the buffer is full. */
+   client = connect_test_stream(path);
+   server_sock = accept_test_stream(listen_sock);
+   send_test_bytes(client, frames, len);
+   wait_stream_msg(server_sock, msg, &first);
+   memset(reply, 'A', sizeof(reply));
+   for (ii = 0; (ii < 100000) && (send_client_msg(&first, reply, sizeof(reply)) > 0); ii++)
+      ;
+   count = flush_stream_clients(closed, MAX_STREAM_CLIENTS);
+   snprintf(msg, MAX_STREAM_MSG_LEN, "a client %i bytes behind is closed after %i replies", STREAM_TX_BUF_LEN, ii);
+   failures += check_transport(name, (ii > STREAM_TX_BUF_LEN / (int)sizeof(reply)) && (ii < 100000) && (count == 1), msg);
+   close(client);
+
+   close_transports();
+
+   /* Datagram clients are the same client when the address and port are. */
+   memset(&first, 0, sizeof(first));
+   first.transport = CLIENT_DGRAM;
+   first.sock = 3;
+   first.addr_len = sizeof(struct sockaddr_in);
+   in_a = (struct sockaddr_in *)&first.addr;
+   in_a->sin_family = AF_INET;
+   in_a->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   in_a->sin_port = htons(5000);
+   second = first;
+   in_b = (struct sockaddr_in *)&second.addr;
+   ii = same_client(&first, &second);
+   in_b->sin_port = htons(5001);
+   ii = ii && (same_client(&first, &second) == 0);
+   second = first;
+   second.sock = 4;
+   ii = ii && (same_client(&first, &second) == 0);
+   second = first;
+   second.transport = CLIENT_STREAM;
+   ii = ii && (same_client(&first, &second) == 0);
+   failures += check_transport("same_client()", ii, "datagram clients match on socket, address and port");
+
+   return(failures);
+}
+
+int run_transport_tests()
+{
+   struct sockaddr_in tcp_addr;
+   struct sockaddr_un unix_addr;
+   socklen_t addr_len;
+   Test_Peer peer;
+   char address[128];
+   char path[100];
+   int failures = 0;
+
+   /* UDP, the default transport. */
+   memset(&tcp_addr, 0, sizeof(tcp_addr));
+   tcp_addr.sin_family = AF_INET;
+   tcp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   peer.sock = socket(AF_INET, SOCK_DGRAM, 0);
+   peer.stream = 0;
+   addr_len = sizeof(tcp_addr);
+   bind(peer.sock, (struct sockaddr *)&tcp_addr, sizeof(tcp_addr));
+   getsockname(peer.sock, (struct sockaddr *)&tcp_addr, &addr_len);
+   sprintf(address, "127.0.0.1:%i", ntohs(tcp_addr.sin_port));
+   failures += test_transport("UDP", address, &peer);
+
+   /* Unix datagram. */
+   snprintf(path, sizeof(path), "/tmp/obd_server_test_%i.sock", (int)getpid());
+   unlink(path);
+   memset(&unix_addr, 0, sizeof(unix_addr));
+   unix_addr.sun_family = AF_UNIX;
+   strncpy(unix_addr.sun_path, path, sizeof(unix_addr.sun_path) - 1);
+   peer.sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+   peer.stream = 0;
+   bind(peer.sock, (struct sockaddr *)&unix_addr, sizeof(unix_addr));
+   sprintf(address, "unix:%s", path);
+   failures += test_transport("Unix datagram", address, &peer);
+   unlink(path);
+
+   /* Unix stream. */
+   peer.sock = socket(AF_UNIX, SOCK_STREAM, 0);
+   peer.stream = 1;
+   bind(peer.sock, (struct sockaddr *)&unix_addr, sizeof(unix_addr));
+   listen(peer.sock, 1);
+   sprintf(address, "stream:%s", path);
+   failures += test_transport("Unix stream", address, &peer);
+   unlink(path);
+
+   /* TCP. */
+   tcp_addr.sin_port = 0;
+   peer.sock = socket(AF_INET, SOCK_STREAM, 0);
+   peer.stream = 1;
+   addr_len = sizeof(tcp_addr);
+   bind(peer.sock, (struct sockaddr *)&tcp_addr, sizeof(tcp_addr));
+   listen(peer.sock, 1);
+   getsockname(peer.sock, (struct sockaddr *)&tcp_addr, &addr_len);
+   sprintf(address, "tcp:127.0.0.1:%i", ntohs(tcp_addr.sin_port));
+   failures += test_transport("TCP", address, &peer);
+
+   failures += test_server_transports();
+
+   printf("Transport tests: %i failed.\n", failures);
+
+   return(failures);
+}
+
+#endif
+
 int main(int argc, char *argv[])
 {
    struct timespec reqtime;
@@ -59,6 +543,13 @@ int main(int argc, char *argv[])
    reqtime.tv_sec = 1;
    reqtime.tv_nsec = 0;   
 
+#ifndef _WINSOCK
+   if ((argc > 1) && (strcmp(argv[1], "-t") == 0))
+   {
+      exit(run_transport_tests());
+   }
+#endif
+
 
    if (argc < 2) /* Get protocol number from command line. */
    {
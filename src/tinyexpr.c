@@ -22,6 +22,9 @@
  * 3. This notice may not be removed or altered from any source distribution.
  */
 
+/* Altered for OBD Monitor: te_compile_program(), te_eval_program() and
+ * te_free_program() run an expression as flat bytecode. */
+
 /* COMPILE TIME OPTIONS */
 
 /* Exponentiation associativity:
@@ -622,6 +625,255 @@ double te_interp(const char *expression, int *error) {
     return ret;
 }
 
+/* Bytecode for te_eval_program(). The top of the stack is kept in an
+ * accumulator, the _C and _V forms take a constant or a variable as the
+ * right operand so "(256*a+b)/4" needs no stack at all:
+ *
+ *   VAR a, MUL_C 256, ADD_V b, DIV_C 4
+ *
+ * Operands are never reordered except for + and *, so every result is
+ * the same as te_eval(). */
+enum {
+    TE_OP_CONST, TE_OP_VAR,
+    TE_OP_ADD, TE_OP_SUB, TE_OP_MUL, TE_OP_DIV,
+    TE_OP_ADD_C, TE_OP_SUB_C, TE_OP_MUL_C, TE_OP_DIV_C,
+    TE_OP_RSUB_C, TE_OP_RDIV_C,
+    TE_OP_ADD_V, TE_OP_SUB_V, TE_OP_MUL_V, TE_OP_DIV_V,
+    TE_OP_NEG, TE_OP_CALL, TE_OP_CLOSURE
+};
+
+#define TE_PROGRAM_MAX_STACK 32
+
+typedef struct te_instr {
+    int op;
+    int arity;
+    union {double value; const double *bound; const void *function;};
+    void *context;
+} te_instr;
+
+struct te_program {
+    int count;
+    te_instr code[];
+};
+
+typedef struct builder {
+    te_program *program;
+    int depth;
+    int max_depth;
+} builder;
+
+
+static int count_nodes(const te_expr *n) {
+    int i, count = 1;
+    for (i = 0; i < ARITY(n->type); ++i) {
+        count += count_nodes(n->parameters[i]);
+    }
+    return count;
+}
+
+
+/* Constant folding, pure functions of constants are evaluated once. */
+static int is_constant(const te_expr *n) {
+    int i;
+    if (TYPE_MASK(n->type) == TE_CONSTANT) return 1;
+    if (TYPE_MASK(n->type) == TE_VARIABLE || !IS_PURE(n->type)) return 0;
+    for (i = 0; i < ARITY(n->type); ++i) {
+        if (!is_constant(n->parameters[i])) return 0;
+    }
+    return 1;
+}
+
+
+static te_instr *emit_op(builder *b, int op, int stack_change) {
+    te_instr *ins = &b->program->code[b->program->count++];
+    memset(ins, 0, sizeof(te_instr));
+    ins->op = op;
+    b->depth += stack_change;
+    if (b->depth > b->max_depth) b->max_depth = b->depth;
+    return ins;
+}
+
+
+static void emit(builder *b, const te_expr *n) {
+    const te_expr *left, *right;
+    const void *f = n->function;
+    int i, op = -1, arity = ARITY(n->type);
+
+    if (is_constant(n)) {
+        emit_op(b, TE_OP_CONST, 1)->value = te_eval(n);
+        return;
+    }
+
+    switch(TYPE_MASK(n->type)) {
+        case TE_VARIABLE:
+            emit_op(b, TE_OP_VAR, 1)->bound = n->bound;
+            return;
+
+        case TE_FUNCTION1:
+            if (f == negate) {
+                emit(b, n->parameters[0]);
+                emit_op(b, TE_OP_NEG, 0);
+                return;
+            }
+            break;
+
+        case TE_FUNCTION2:
+            if (f == add) op = TE_OP_ADD;
+            else if (f == sub) op = TE_OP_SUB;
+            else if (f == mul) op = TE_OP_MUL;
+            else if (f == divide) op = TE_OP_DIV;
+            break;
+    }
+
+    if (op >= 0) {
+        left = n->parameters[0];
+        right = n->parameters[1];
+        if (is_constant(right)) {
+            emit(b, left);
+            emit_op(b, op + (TE_OP_ADD_C - TE_OP_ADD), 0)->value = te_eval(right);
+        } else if (TYPE_MASK(right->type) == TE_VARIABLE) {
+            emit(b, left);
+            emit_op(b, op + (TE_OP_ADD_V - TE_OP_ADD), 0)->bound = right->bound;
+        } else if (is_constant(left)) {
+            emit(b, right);
+            if (op == TE_OP_SUB) op = TE_OP_RSUB_C;
+            else if (op == TE_OP_DIV) op = TE_OP_RDIV_C;
+            else op += TE_OP_ADD_C - TE_OP_ADD;
+            emit_op(b, op, 0)->value = te_eval(left);
+        } else if (TYPE_MASK(left->type) == TE_VARIABLE && (op == TE_OP_ADD || op == TE_OP_MUL)) {
+            emit(b, right);
+            emit_op(b, op + (TE_OP_ADD_V - TE_OP_ADD), 0)->bound = left->bound;
+        } else {
+            emit(b, left);
+            emit(b, right);
+            emit_op(b, op, -1);
+        }
+        return;
+    }
+
+    /* Any other function or closure, the arguments are on the stack. */
+    for (i = 0; i < arity; ++i) {
+        emit(b, n->parameters[i]);
+    }
+    te_instr *ins = emit_op(b, IS_CLOSURE(n->type) ? TE_OP_CLOSURE : TE_OP_CALL, 1 - arity);
+    ins->arity = arity;
+    ins->function = f;
+    if (IS_CLOSURE(n->type)) ins->context = n->parameters[arity];
+}
+
+
+te_program *te_compile_program(const te_expr *n) {
+    builder b;
+
+    if (!n) return 0;
+
+    b.program = malloc(sizeof(te_program) + sizeof(te_instr) * count_nodes(n));
+    if (!b.program) return 0;
+    b.program->count = 0;
+    b.depth = b.max_depth = 0;
+
+    emit(&b, n);
+
+    if (b.max_depth > TE_PROGRAM_MAX_STACK) {
+        free(b.program);
+        return 0;
+    }
+    return b.program;
+}
+
+
+#define TE_FUN(...) ((double(*)(__VA_ARGS__))ins->function)
+
+static double call(const te_instr *ins, const double *a) {
+    switch(ins->arity) {
+        case 0: return TE_FUN(void)();
+        case 1: return TE_FUN(double)(a[0]);
+        case 2: return TE_FUN(double, double)(a[0], a[1]);
+        case 3: return TE_FUN(double, double, double)(a[0], a[1], a[2]);
+        case 4: return TE_FUN(double, double, double, double)(a[0], a[1], a[2], a[3]);
+        case 5: return TE_FUN(double, double, double, double, double)(a[0], a[1], a[2], a[3], a[4]);
+        case 6: return TE_FUN(double, double, double, double, double, double)(a[0], a[1], a[2], a[3], a[4], a[5]);
+        case 7: return TE_FUN(double, double, double, double, double, double, double)(a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+        default: return NAN;
+    }
+}
+
+static double call_closure(const te_instr *ins, const double *a) {
+    void *c = ins->context;
+    switch(ins->arity) {
+        case 0: return TE_FUN(void*)(c);
+        case 1: return TE_FUN(void*, double)(c, a[0]);
+        case 2: return TE_FUN(void*, double, double)(c, a[0], a[1]);
+        case 3: return TE_FUN(void*, double, double, double)(c, a[0], a[1], a[2]);
+        case 4: return TE_FUN(void*, double, double, double, double)(c, a[0], a[1], a[2], a[3]);
+        case 5: return TE_FUN(void*, double, double, double, double, double)(c, a[0], a[1], a[2], a[3], a[4]);
+        case 6: return TE_FUN(void*, double, double, double, double, double, double)(c, a[0], a[1], a[2], a[3], a[4], a[5]);
+        case 7: return TE_FUN(void*, double, double, double, double, double, double, double)(c, a[0], a[1], a[2], a[3], a[4], a[5], a[6]);
+        default: return NAN;
+    }
+}
+
+#undef TE_FUN
+
+
+double te_eval_program(const te_program *p) {
+    double stack[TE_PROGRAM_MAX_STACK];
+    double args[7];
+    double acc = NAN;
+    const te_instr *ins, *end;
+    int sp = 0, i;
+
+    if (!p) return NAN;
+
+    for (ins = p->code, end = p->code + p->count; ins < end; ++ins) {
+        switch(ins->op) {
+            case TE_OP_CONST: stack[sp++] = acc; acc = ins->value; break;
+            case TE_OP_VAR: stack[sp++] = acc; acc = *ins->bound; break;
+
+            case TE_OP_ADD: acc = stack[--sp] + acc; break;
+            case TE_OP_SUB: acc = stack[--sp] - acc; break;
+            case TE_OP_MUL: acc = stack[--sp] * acc; break;
+            case TE_OP_DIV: acc = stack[--sp] / acc; break;
+
+            case TE_OP_ADD_C: acc = acc + ins->value; break;
+            case TE_OP_SUB_C: acc = acc - ins->value; break;
+            case TE_OP_MUL_C: acc = acc * ins->value; break;
+            case TE_OP_DIV_C: acc = acc / ins->value; break;
+            case TE_OP_RSUB_C: acc = ins->value - acc; break;
+            case TE_OP_RDIV_C: acc = ins->value / acc; break;
+
+            case TE_OP_ADD_V: acc = acc + *ins->bound; break;
+            case TE_OP_SUB_V: acc = acc - *ins->bound; break;
+            case TE_OP_MUL_V: acc = acc * *ins->bound; break;
+            case TE_OP_DIV_V: acc = acc / *ins->bound; break;
+
+            case TE_OP_NEG: acc = -acc; break;
+
+            case TE_OP_CALL: case TE_OP_CLOSURE:
+                /* The last argument is the accumulator, the result replaces the arguments. */
+                if (ins->arity == 0) {
+                    stack[sp++] = acc;
+                } else {
+                    args[ins->arity - 1] = acc;
+                    sp -= ins->arity - 1;
+                    for (i = 0; i < ins->arity - 1; ++i) args[i] = stack[sp + i];
+                }
+                acc = (ins->op == TE_OP_CALL) ? call(ins, args) : call_closure(ins, args);
+                break;
+
+            default: return NAN;
+        }
+    }
+
+    return acc;
+}
+
+
+void te_free_program(te_program *p) {
+    free(p);
+}
+
+
 static void pn (const te_expr *n, int depth) {
     int i, arity;
     printf("%*s", depth, "");
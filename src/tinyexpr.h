@@ -22,6 +22,9 @@
  * 3. This notice may not be removed or altered from any source distribution.
  */
 
+/* Altered for OBD Monitor: te_compile_program(), te_eval_program() and
+ * te_free_program() run an expression as flat bytecode. */
+
 #ifndef __TINYEXPR_H__
 #define __TINYEXPR_H__
 
@@ -71,6 +74,18 @@ te_expr *te_compile(const char *expression, const te_variable *variables, int va
 /* Evaluates the expression. */
 double te_eval(const te_expr *n);
 
+/* Lowers a compiled expression to flat bytecode, see tinyexpr.c. */
+/* The bound variables are read when the program runs. */
+/* Returns NULL if the expression is too deep, use te_eval() then. */
+typedef struct te_program te_program;
+te_program *te_compile_program(const te_expr *n);
+
+/* Runs the bytecode, the result is the same as te_eval(). */
+double te_eval_program(const te_program *p);
+
+/* Frees the program, the expression is not changed. */
+void te_free_program(te_program *p);
+
 /* Prints debugging information on the syntax tree. */
 void te_print(const te_expr *n);
 
@@ -0,0 +1,509 @@
+/*
+   transport.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Client transports of the server.
+
+                Each adapter is served on four sockets, all handled by the
+                same request and reply code in the server:
+
+                UDP                  udp_port, the GUI and remote clients.
+                Unix datagram        /tmp/obd_server_<udp_port>.sock, same
+                                     host clients, no IP stack. The client
+                                     binds its own address to get replies.
+                Unix stream          /tmp/obd_server_<udp_port>.stream
+                TCP                  udp_port, reliable remote capture.
+
+                Datagram clients send one request per datagram and get
+                one reply per datagram. Stream clients send and get the
+                same messages as length prefixed frames, see
+                wire_protocol.c. Nothing is lost on a stream: replies are
+                buffered per connection and sent when the socket is
+                writable, a client that falls STREAM_TX_BUF_LEN bytes
+                behind is closed.
+
+                Every request carries a Client_Address, so subscriptions,
+                polls and cached replies go back over the transport the
+                client used. When a stream closes the server removes the
+                state of that client, the connection ID keeps a reused
+                socket number from getting replies meant for the old one.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/un.h>
+#include <netinet/tcp.h>
+
+#include "obd_monitor.h"
+#include "udp_batch.h"
+#include "transport.h"
+
+ADAPTER_LOCAL int unix_dgram_sock;
+ADAPTER_LOCAL int unix_stream_sock;        /* Listening. */
+ADAPTER_LOCAL int tcp_sock;                /* Listening. */
+ADAPTER_LOCAL char unix_dgram_path[MAX_UNIX_PATH_LEN];
+ADAPTER_LOCAL char unix_stream_path[MAX_UNIX_PATH_LEN];
+ADAPTER_LOCAL Stream_Client stream_clients[MAX_STREAM_CLIENTS];
+ADAPTER_LOCAL unsigned int next_conn_id;
+
+void init_transports()
+{
+   int ii;
+
+   unix_dgram_sock = -1;
+   unix_stream_sock = -1;
+   tcp_sock = -1;
+   unix_dgram_path[0] = 0;
+   unix_stream_path[0] = 0;
+   next_conn_id = 0;
+
+   for (ii = 0; ii < MAX_STREAM_CLIENTS; ii++)
+   {
+      stream_clients[ii].sock = -1;
+   }
+
+   return;
+}
+
+int set_nonblocking(int sock)
+{
+   return(fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK));
+}
+
+int open_unix_socket(char *path, int sock_type)
+{
+   struct sockaddr_un addr;
+   int sock;
+
+   sock = socket(AF_UNIX, sock_type, 0);
+   if (sock < 0)
+   {
+      perror("open_unix_socket() <ERROR>: socket");
+      return(-1);
+   }
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+   unlink(path); /* Left by a server that did not exit cleanly. */
+
+   if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+       ((sock_type == SOCK_STREAM) && (listen(sock, MAX_STREAM_CLIENTS) < 0)) ||
+       (set_nonblocking(sock) < 0))
+   {
+      printf("open_unix_socket() <ERROR>: %s: %s\n", path, strerror(errno));
+      close(sock);
+      return(-1);
+   }
+
+   return(sock);
+}
+
+int open_tcp_socket(int port)
+{
+   struct sockaddr_in addr;
+   int sock, reuse = 1;
+
+   sock = socket(AF_INET, SOCK_STREAM, 0);
+   if (sock < 0)
+   {
+      perror("open_tcp_socket() <ERROR>: socket");
+      return(-1);
+   }
+
+   setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = INADDR_ANY;
+   addr.sin_port = htons(port);
+
+   if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+       (listen(sock, MAX_STREAM_CLIENTS) < 0) || (set_nonblocking(sock) < 0))
+   {
+      printf("open_tcp_socket() <ERROR>: TCP port %i: %s\n", port, strerror(errno));
+      close(sock);
+      return(-1);
+   }
+
+   return(sock);
+}
+
+/*
+   Function: open_transports()
+
+   Purpose : Opens the Unix and TCP sockets of an adapter, the UDP socket
+           : is opened by the server. A transport that fails to open is
+           : left out, the others still run.
+   Input   : UDP port of the adapter, also the TCP port.
+   Output  : Returns the number of transports opened.
+*/
+int open_transports(int port)
+{
+   int count = 0;
+
+   snprintf(unix_dgram_path, MAX_UNIX_PATH_LEN, UNIX_DGRAM_PATH, port);
+   snprintf(unix_stream_path, MAX_UNIX_PATH_LEN, UNIX_STREAM_PATH, port);
+
+   if ((unix_dgram_sock = open_unix_socket(unix_dgram_path, SOCK_DGRAM)) >= 0)
+      count++;
+   if ((unix_stream_sock = open_unix_socket(unix_stream_path, SOCK_STREAM)) >= 0)
+      count++;
+   if ((tcp_sock = open_tcp_socket(port)) >= 0)
+      count++;
+
+   return(count);
+}
+
+void close_transports()
+{
+   int ii;
+
+   for (ii = 0; ii < MAX_STREAM_CLIENTS; ii++)
+   {
+      if (stream_clients[ii].sock >= 0)
+         close(stream_clients[ii].sock);
+      stream_clients[ii].sock = -1;
+   }
+
+   if (unix_dgram_sock >= 0)
+   {
+      close(unix_dgram_sock);
+      unlink(unix_dgram_path);
+   }
+   if (unix_stream_sock >= 0)
+   {
+      close(unix_stream_sock);
+      unlink(unix_stream_path);
+   }
+   if (tcp_sock >= 0)
+      close(tcp_sock);
+
+   init_transports();
+
+   return;
+}
+
+/* Unix datagram, Unix stream and TCP sockets for the event loop to watch. */
+int get_transport_sockets(int *socks)
+{
+   int count = 0;
+
+   if (unix_dgram_sock >= 0)
+      socks[count++] = unix_dgram_sock;
+   if (unix_stream_sock >= 0)
+      socks[count++] = unix_stream_sock;
+   if (tcp_sock >= 0)
+      socks[count++] = tcp_sock;
+
+   return(count);
+}
+
+int is_dgram_socket(int sock)
+{
+   return((sock >= 0) && (sock == unix_dgram_sock));
+}
+
+int is_listen_socket(int sock)
+{
+   return((sock >= 0) && ((sock == unix_stream_sock) || (sock == tcp_sock)));
+}
+
+Stream_Client *find_stream_client(int sock)
+{
+   int ii;
+
+   for (ii = 0; ii < MAX_STREAM_CLIENTS; ii++)
+   {
+      if (stream_clients[ii].sock == sock)
+         return(&stream_clients[ii]);
+   }
+
+   return(NULL);
+}
+
+/*
+   Function: accept_stream_client()
+
+   Purpose : Accepts a connection on a Unix stream or TCP socket.
+   Input   : Listening socket.
+   Output  : Returns the connection socket for the event loop to watch,
+           : -1 if there is none or no free client slot.
+*/
+int accept_stream_client(int listen_sock)
+{
+   Stream_Client *sc;
+   int sock, nodelay = 1;
+
+   sock = accept(listen_sock, NULL, NULL);
+   if (sock < 0)
+   {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+         perror("accept_stream_client() <ERROR>: accept");
+      return(-1);
+   }
+
+   sc = find_stream_client(-1);
+   if ((sc == NULL) || (set_nonblocking(sock) < 0))
+   {
+      printf("accept_stream_client() <ERROR>: No free stream client, connection closed.\n");
+      close(sock);
+      return(-1);
+   }
+
+   if (listen_sock == tcp_sock)
+      setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+   if (++next_conn_id == 0)
+      next_conn_id = 1;
+
+   sc->sock = sock;
+   sc->conn_id = next_conn_id;
+   sc->closing = 0;
+   sc->rx_len = 0;
+   sc->tx_len = 0;
+
+   return(sock);
+}
+
+/*
+   Function: recv_stream_msg()
+
+   Purpose : Gets the next request frame from a stream connection. Call
+           : until it returns 0, the event loop is edge triggered.
+   Input   : Connection socket, message buffer and length, client address
+           : for the replies.
+   Output  : Returns the message length, 0 if no whole frame is waiting or
+           : -1 if the connection closed.
+*/
+int recv_stream_msg(int sock, char *msg, int max_len, Client_Address *client)
+{
+   Stream_Client *sc;
+   int n, frame_len, msg_len, len;
+
+   sc = find_stream_client(sock);
+   if ((sc == NULL) || (sc->closing == 1))
+   {
+      return(-1);
+   }
+
+   while (1)
+   {
+      frame_len = get_stream_frame(sc->rx_buf, sc->rx_len, &msg_len);
+      if (frame_len < 0)
+      {
+         printf("recv_stream_msg() <ERROR>: Bad frame length, connection closed.\n");
+         break;
+      }
+
+      if ((frame_len > 0) && (msg_len == 0))
+      {
+         /* Empty frame, nothing to do. */
+         sc->rx_len -= frame_len;
+         memmove(sc->rx_buf, sc->rx_buf + frame_len, sc->rx_len);
+         continue;
+      }
+
+      if (frame_len > 0)
+      {
+         len = (msg_len < max_len) ? msg_len : max_len - 1;
+         memcpy(msg, sc->rx_buf + STREAM_FRAME_HEADER_LEN, len);
+         msg[len] = 0;
+         sc->rx_len -= frame_len;
+         memmove(sc->rx_buf, sc->rx_buf + frame_len, sc->rx_len);
+
+         memset(client, 0, sizeof(Client_Address));
+         client->transport = CLIENT_STREAM;
+         client->sock = sock;
+         client->conn_id = sc->conn_id;
+
+         return(len);
+      }
+
+      n = read(sock, sc->rx_buf + sc->rx_len, sizeof(sc->rx_buf) - sc->rx_len);
+      if (n > 0)
+      {
+         sc->rx_len += n;
+         continue;
+      }
+
+      if ((n < 0) && (errno == EINTR))
+         continue;
+      if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+         return(0);
+
+      break; /* Closed by the client or failed. */
+   }
+
+   sc->closing = 1;
+
+   return(-1);
+}
+
+int write_stream_client(Stream_Client *sc)
+{
+   int n, sent = 0;
+
+   while (sent < sc->tx_len)
+   {
+      n = send(sc->sock, sc->tx_buf + sent, sc->tx_len - sent, MSG_NOSIGNAL);
+      if (n > 0)
+      {
+         sent += n;
+         continue;
+      }
+
+      if ((n < 0) && (errno == EINTR))
+         continue;
+      if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+         break; /* The rest goes when the socket is writable. */
+
+      sc->closing = 1;
+      sent = sc->tx_len;
+      break;
+   }
+
+   sc->tx_len -= sent;
+   memmove(sc->tx_buf, sc->tx_buf + sent, sc->tx_len);
+
+   return(sent);
+}
+
+/*
+   Function: send_client_msg()
+
+   Purpose : Sends a reply over the transport of the client. Datagrams go
+           : to the UDP send queue, stream frames to the send buffer of
+           : the connection.
+   Input   : Client address, message and length.
+   Output  : Returns the message length, 0 for a server request or -1 if
+           : the reply could not be sent.
+*/
+int send_client_msg(Client_Address *client, void *msg, int msg_len)
+{
+   Stream_Client *sc;
+   int len;
+
+   if (client->transport == CLIENT_DGRAM)
+   {
+      return(queue_udp_msg(client->sock, &client->addr, client->addr_len, msg, msg_len));
+   }
+   else if (client->transport != CLIENT_STREAM)
+   {
+      return(0);
+   }
+
+   sc = find_stream_client(client->sock);
+   if ((sc == NULL) || (sc->conn_id != client->conn_id) || (sc->closing == 1))
+   {
+      return(-1); /* The client has gone. */
+   }
+
+   if (sc->tx_len + STREAM_FRAME_HEADER_LEN + msg_len > STREAM_TX_BUF_LEN)
+   {
+      write_stream_client(sc);
+   }
+
+   len = encode_stream_frame(sc->tx_buf + sc->tx_len, STREAM_TX_BUF_LEN - sc->tx_len, msg, msg_len);
+   if (len == 0)
+   {
+      printf("send_client_msg() <ERROR>: Stream client too slow, connection closed.\n");
+      sc->closing = 1;
+      return(-1);
+   }
+   sc->tx_len += len;
+
+   return(msg_len);
+}
+
+/*
+   Function: flush_stream_clients()
+
+   Purpose : Sends the buffered replies of each stream connection and
+           : closes the connections that ended in this event loop pass.
+   Input   : Buffer for the addresses of the closed clients and length.
+   Output  : Returns the number of closed clients, the server removes
+           : their subscriptions and polls.
+*/
+int flush_stream_clients(Client_Address *closed, int max_closed)
+{
+   Stream_Client *sc;
+   int ii, count = 0;
+
+   for (ii = 0; ii < MAX_STREAM_CLIENTS; ii++)
+   {
+      sc = &stream_clients[ii];
+      if (sc->sock < 0)
+         continue;
+
+      if ((sc->closing == 0) && (sc->tx_len > 0))
+         write_stream_client(sc);
+
+      if ((sc->closing == 1) && (count < max_closed))
+      {
+         memset(&closed[count], 0, sizeof(Client_Address));
+         closed[count].transport = CLIENT_STREAM;
+         closed[count].sock = sc->sock;
+         closed[count].conn_id = sc->conn_id;
+         count++;
+
+         close(sc->sock);
+         sc->sock = -1;
+      }
+   }
+
+   return(count);
+}
+
+int get_stream_client_count()
+{
+   int ii, count = 0;
+
+   for (ii = 0; ii < MAX_STREAM_CLIENTS; ii++)
+   {
+      if (stream_clients[ii].sock >= 0)
+         count++;
+   }
+
+   return(count);
+}
+
+int same_client(Client_Address *a, Client_Address *b)
+{
+   struct sockaddr_in *ina, *inb;
+
+   if ((a->transport != b->transport) || (a->sock != b->sock))
+   {
+      return(0);
+   }
+
+   if (a->transport == CLIENT_STREAM)
+   {
+      return(a->conn_id == b->conn_id);
+   }
+
+   if (a->addr.ss_family != b->addr.ss_family)
+   {
+      return(0);
+   }
+
+   if (a->addr.ss_family == AF_INET)
+   {
+      ina = (struct sockaddr_in *)&a->addr;
+      inb = (struct sockaddr_in *)&b->addr;
+      return((ina->sin_addr.s_addr == inb->sin_addr.s_addr) && (ina->sin_port == inb->sin_port));
+   }
+
+   return((a->addr_len == b->addr_len) && (memcmp(&a->addr, &b->addr, a->addr_len) == 0));
+}
+
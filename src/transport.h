@@ -0,0 +1,76 @@
+/*
+   transport.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Client transports of the server, UDP, Unix domain datagram
+                and stream sockets and TCP. Used by the server event loop.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_TRANSPORT_INCLUDED
+#define OBD_TRANSPORT_INCLUDED
+
+#ifdef _WINSOCK
+#include <winsock.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#include "wire_protocol.h"
+
+#define CLIENT_NONE 0            /* Request made by the server, no reply. */
+#define CLIENT_DGRAM 1           /* UDP or Unix datagram, one reply per datagram. */
+#define CLIENT_STREAM 2          /* TCP or Unix stream connection, one reply per frame. */
+
+#define UNIX_DGRAM_PATH "/tmp/obd_server_%i.sock"
+#define UNIX_STREAM_PATH "/tmp/obd_server_%i.stream"
+#define MAX_UNIX_PATH_LEN 108
+#define MAX_STREAM_CLIENTS 16
+#define STREAM_TX_BUF_LEN 16384  /* A client that falls this far behind is closed. */
+#define NUM_TRANSPORT_SOCKETS 3
+
+/* Where a request came from and where its replies go. */
+struct _Client_Address {
+   int transport;
+   int sock;                     /* Socket the request arrived on, or the connection. */
+   unsigned int conn_id;         /* Stream connection, the socket number is reused. */
+   socklen_t addr_len;
+   struct sockaddr_storage addr;
+};
+
+typedef struct _Client_Address Client_Address;
+
+struct _Stream_Client {
+   int sock;                     /* -1 if the slot is free. */
+   unsigned int conn_id;
+   int closing;                  /* Closed at the end of the event loop pass. */
+   int rx_len;
+   unsigned char rx_buf[STREAM_FRAME_HEADER_LEN + MAX_STREAM_MSG_LEN];
+   int tx_len;
+   unsigned char tx_buf[STREAM_TX_BUF_LEN];
+};
+
+typedef struct _Stream_Client Stream_Client;
+
+/* transport.c */
+void init_transports();
+int open_transports(int port);
+void close_transports();
+int get_transport_sockets(int *socks);
+int is_dgram_socket(int sock);
+int is_listen_socket(int sock);
+int accept_stream_client(int listen_sock);
+int recv_stream_msg(int sock, char *msg, int max_len, Client_Address *client);
+int send_client_msg(Client_Address *client, void *msg, int msg_len);
+int flush_stream_clients(Client_Address *closed, int max_closed);
+int get_stream_client_count();
+int same_client(Client_Address *a, Client_Address *b);
+
+#endif
+
@@ -0,0 +1,347 @@
+/*
+   udp_batch.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Batched UDP receive and send, many datagrams per system
+                call.
+
+                Receive: the caller points each slot of a UDP_Batch at its
+                own buffer and address once, recvmmsg() then fills up to
+                MAX_UDP_BATCH slots per call. The buffers are not cleared,
+                each message is null terminated at its length.
+
+                Send: replies are copied to a preallocated send queue and
+                sent with one sendmmsg() call at the end of each event
+                loop pass, or when the queue is full. A reply published to
+                many subscribers costs one system call.
+
+                A datagram the kernel refuses for its destination, such
+                as a Unix socket path with no reader (ENOENT or
+                ECONNREFUSED), is skipped and the rest of the queue is
+                still sent. The destination is kept until the server takes
+                it with take_failed_udp_dest() and drops that client. A
+                Unix datagram client that is not reading (EAGAIN) only
+                loses that datagram, as a UDP client would. A full send
+                buffer, in a burst of replies, drops the datagrams that do
+                not fit, the server carries on. Only an error of the
+                socket itself fails the send.
+
+                Other platforms fall back to one recvfrom() or sendto()
+                per datagram.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "obd_monitor.h"
+#include "udp_batch.h"
+
+ADAPTER_LOCAL UDP_Batch send_batch;
+ADAPTER_LOCAL char send_bufs[MAX_UDP_BATCH][MAX_UDP_MSG_LEN];
+ADAPTER_LOCAL struct sockaddr_storage send_addrs[MAX_UDP_BATCH];
+ADAPTER_LOCAL int send_sock;                             /* Socket of the queued datagrams. */
+ADAPTER_LOCAL struct sockaddr_storage failed_addrs[MAX_UDP_BATCH];
+ADAPTER_LOCAL socklen_t failed_addr_lens[MAX_UDP_BATCH];
+ADAPTER_LOCAL int failed_socks[MAX_UDP_BATCH];
+ADAPTER_LOCAL int failed_count;                          /* Destinations of refused datagrams. */
+
+/* A Unix datagram client that is not reading has a full queue, only its datagram is lost. */
+static int is_peer_full(int err, struct sockaddr_storage *addr)
+{
+   return(((err == EAGAIN) || (err == EWOULDBLOCK)) && (addr->ss_family == AF_UNIX));
+}
+
+/* The socket send buffer is full, the datagrams that do not fit are lost
+   as they would be on the network. */
+static int is_send_buffer_full(int err)
+{
+   return((err == EAGAIN) || (err == EWOULDBLOCK) || (err == ENOBUFS) || (err == ENOMEM));
+}
+
+/* Errors of the socket itself, nothing can be sent on it. */
+static int is_socket_error(int err)
+{
+   return((err == EBADF) || (err == ENOTSOCK) || (err == EFAULT));
+}
+
+static void note_failed_udp_dest(int sock, struct sockaddr_storage *addr, socklen_t addr_len)
+{
+   int ii;
+
+   for (ii = 0; ii < failed_count; ii++)
+   {
+      if ((failed_socks[ii] == sock) && (failed_addr_lens[ii] == addr_len) && (memcmp(&failed_addrs[ii], addr, addr_len) == 0))
+         return;
+   }
+
+   if (failed_count < MAX_UDP_BATCH)
+   {
+      failed_socks[failed_count] = sock;
+      failed_addrs[failed_count] = *addr;
+      failed_addr_lens[failed_count] = addr_len;
+      failed_count++;
+   }
+
+   return;
+}
+
+/*
+   Function: set_batch_buffer()
+
+   Purpose : Points a batch slot at a caller buffer and address, done once
+           : before the first receive.
+   Input   : Batch, slot index, buffer and length, address buffer.
+   Output  : None.
+*/
+void set_batch_buffer(UDP_Batch *batch, int index, void *buf, int buf_len, struct sockaddr_storage *addr)
+{
+   batch->buf[index] = buf;
+   batch->buf_len[index] = buf_len;
+   batch->addr[index] = addr;
+   batch->msg_len[index] = 0;
+   batch->addr_len[index] = sizeof(struct sockaddr_storage);
+
+#ifdef __linux__
+   memset(&batch->msgs[index], 0, sizeof(struct mmsghdr));
+   batch->iovs[index].iov_base = buf;
+   batch->iovs[index].iov_len = buf_len;
+   batch->msgs[index].msg_hdr.msg_iov = &batch->iovs[index];
+   batch->msgs[index].msg_hdr.msg_iovlen = 1;
+   batch->msgs[index].msg_hdr.msg_name = addr;
+#endif
+
+   return;
+}
+
+/*
+   Function: recv_udp_batch()
+
+   Purpose : Receives the datagrams waiting on a socket into the batch
+           : slots, leaving room to null terminate each one.
+   Input   : Socket, batch with MAX_UDP_BATCH slots set and 1 to block until
+           : the first datagram arrives or 0 to return at once.
+   Output  : Returns the number of datagrams, 0 if none or -1 on error.
+*/
+int recv_udp_batch(int sock, UDP_Batch *batch, int wait)
+{
+   int ii, n;
+
+#ifdef __linux__
+   for (ii = 0; ii < MAX_UDP_BATCH; ii++)
+   {
+      batch->iovs[ii].iov_len = batch->buf_len[ii] - 1;
+      batch->msgs[ii].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+   }
+
+   n = recvmmsg(sock, batch->msgs, MAX_UDP_BATCH, (wait == 1) ? MSG_WAITFORONE : MSG_DONTWAIT, NULL);
+   if (n < 0)
+   {
+      batch->count = 0;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+         return(0);
+      return(-1);
+   }
+
+   for (ii = 0; ii < n; ii++)
+   {
+      batch->msg_len[ii] = batch->msgs[ii].msg_len;
+      batch->addr_len[ii] = batch->msgs[ii].msg_hdr.msg_namelen;
+      ((char *)batch->buf[ii])[batch->msg_len[ii]] = 0;
+   }
+#else
+   batch->addr_len[0] = sizeof(struct sockaddr_storage);
+   n = recvfrom(sock, batch->buf[0], batch->buf_len[0] - 1, 0, (struct sockaddr *)batch->addr[0], &batch->addr_len[0]);
+   if (n < 0)
+   {
+      batch->count = 0;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+         return(0);
+      return(-1);
+   }
+
+   batch->msg_len[0] = n;
+   ((char *)batch->buf[0])[n] = 0;
+   n = 1;
+#endif
+
+   batch->count = n;
+
+   return(n);
+}
+
+void init_udp_sends()
+{
+   int ii;
+
+   for (ii = 0; ii < MAX_UDP_BATCH; ii++)
+   {
+      set_batch_buffer(&send_batch, ii, send_bufs[ii], MAX_UDP_MSG_LEN, &send_addrs[ii]);
+   }
+   send_batch.count = 0;
+   send_sock = -1;
+   failed_count = 0;
+
+   return;
+}
+
+/*
+   Function: queue_udp_msg()
+
+   Purpose : Copies a datagram to the send queue, the queue is sent when it
+           : is full, a datagram for another socket is queued or
+           : flush_udp_msgs() is called.
+   Input   : Socket, destination address, message and length.
+   Output  : Returns the message length, 0 if the socket buffer was full
+           : and it was dropped, or -1 on a send error.
+*/
+int queue_udp_msg(int sock, struct sockaddr_storage *addr, socklen_t addr_len, void *msg, int msg_len)
+{
+   int idx;
+
+   if ((send_batch.count > 0) && (sock != send_sock))
+   {
+      /* One sendmmsg() per socket, keep the order. */
+      flush_udp_msgs();
+   }
+
+   if (msg_len > MAX_UDP_MSG_LEN)
+   {
+      /* Too long for a queue slot, keep the order and send it now. */
+      flush_udp_msgs();
+      idx = sendto(sock, msg, msg_len, 0, (struct sockaddr *)addr, addr_len);
+      if ((idx < 0) && (is_peer_full(errno, addr) || is_send_buffer_full(errno)))
+         return(0);
+      if ((idx < 0) && (is_socket_error(errno) == 0))
+         note_failed_udp_dest(sock, addr, addr_len);
+      return(idx);
+   }
+
+   send_sock = sock;
+
+   idx = send_batch.count;
+   memcpy(send_bufs[idx], msg, msg_len);
+   send_addrs[idx] = *addr;
+   send_batch.msg_len[idx] = msg_len;
+   send_batch.addr_len[idx] = addr_len;
+   send_batch.count++;
+
+   if (send_batch.count == MAX_UDP_BATCH)
+   {
+      if (flush_udp_msgs() < 0)
+         return(-1);
+   }
+
+   return(msg_len);
+}
+
+/*
+   Function: flush_udp_msgs()
+
+   Purpose : Sends the queued datagrams, with sendmmsg() on Linux. A
+           : datagram refused for its destination is skipped and noted,
+           : see take_failed_udp_dest(). When the socket buffer is full
+           : the rest of the queue is dropped.
+   Input   : None.
+   Output  : Returns the number of datagrams sent or -1 if a socket error
+           : dropped the queue.
+*/
+int flush_udp_msgs()
+{
+   int ii, n, sent = 0;
+
+   if (send_batch.count == 0)
+   {
+      return(0);
+   }
+
+#ifdef __linux__
+   for (ii = 0; ii < send_batch.count; ii++)
+   {
+      send_batch.iovs[ii].iov_len = send_batch.msg_len[ii];
+      send_batch.msgs[ii].msg_hdr.msg_namelen = send_batch.addr_len[ii];
+   }
+
+   ii = 0;
+   while (ii < send_batch.count)
+   {
+      n = sendmmsg(send_sock, &send_batch.msgs[ii], send_batch.count - ii, 0);
+      if (n < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         if (is_peer_full(errno, &send_addrs[ii]))
+         {
+            ii++;
+            continue;
+         }
+         if (is_send_buffer_full(errno))
+         {
+            printf("flush_udp_msgs() <ERROR>: Socket buffer full, %i datagrams dropped.\n", send_batch.count - ii);
+            break;
+         }
+         if (is_socket_error(errno))
+         {
+            printf("flush_udp_msgs() <ERROR>: sendmmsg failed, %i datagrams dropped.\n", send_batch.count - ii);
+            send_batch.count = 0;
+            return(-1);
+         }
+         /* sendmmsg() stops at the first refused datagram, skip it. */
+         note_failed_udp_dest(send_sock, &send_addrs[ii], send_batch.addr_len[ii]);
+         ii++;
+         continue;
+      }
+      ii += n;
+      sent += n;
+   }
+#else
+   for (ii = 0; ii < send_batch.count; ii++)
+   {
+      n = sendto(send_sock, send_bufs[ii], send_batch.msg_len[ii], 0, (struct sockaddr *)&send_addrs[ii], send_batch.addr_len[ii]);
+      if (n >= 0)
+         sent++;
+      else if ((is_peer_full(errno, &send_addrs[ii]) == 0) && (is_send_buffer_full(errno) == 0) && (is_socket_error(errno) == 0))
+         note_failed_udp_dest(send_sock, &send_addrs[ii], send_batch.addr_len[ii]);
+   }
+#endif
+
+   send_batch.count = 0;
+
+   return(sent);
+}
+
+/*
+   Function: take_failed_udp_dest()
+
+   Purpose : Takes one destination a datagram was refused for since the
+           : last call, so the caller can drop that client.
+   Input   : Socket, address and address length to set.
+   Output  : Returns 1 if a destination was set, 0 if there are none.
+*/
+int take_failed_udp_dest(int *sock, struct sockaddr_storage *addr, socklen_t *addr_len)
+{
+   if (failed_count == 0)
+   {
+      return(0);
+   }
+
+   failed_count--;
+   *sock = failed_socks[failed_count];
+   *addr = failed_addrs[failed_count];
+   *addr_len = failed_addr_lens[failed_count];
+
+   return(1);
+}
+
+int get_queued_udp_count()
+{
+   return(send_batch.count);
+}
+
@@ -0,0 +1,55 @@
+/*
+   udp_batch.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Batched UDP receive and send, many datagrams per system
+                call. Also used for Unix datagram sockets. Used by the
+                server and the ECU simulator.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_UDP_BATCH_INCLUDED
+#define OBD_UDP_BATCH_INCLUDED
+
+#ifdef _WINSOCK
+#include <winsock.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/uio.h>
+#endif
+
+#define MAX_UDP_BATCH 32
+#define MAX_UDP_MSG_LEN 512
+
+struct _UDP_Batch {
+   int count;
+   void *buf[MAX_UDP_BATCH];
+   int buf_len[MAX_UDP_BATCH];
+   int msg_len[MAX_UDP_BATCH];
+   struct sockaddr_storage *addr[MAX_UDP_BATCH];
+   socklen_t addr_len[MAX_UDP_BATCH];
+#ifdef __linux__
+   struct mmsghdr msgs[MAX_UDP_BATCH];
+   struct iovec iovs[MAX_UDP_BATCH];
+#endif
+};
+
+typedef struct _UDP_Batch UDP_Batch;
+
+/* udp_batch.c */
+void set_batch_buffer(UDP_Batch *batch, int index, void *buf, int buf_len, struct sockaddr_storage *addr);
+int recv_udp_batch(int sock, UDP_Batch *batch, int wait);
+void init_udp_sends();
+int queue_udp_msg(int sock, struct sockaddr_storage *addr, socklen_t addr_len, void *msg, int msg_len);
+int flush_udp_msgs();
+int take_failed_udp_dest(int *sock, struct sockaddr_storage *addr, socklen_t *addr_len);
+int get_queued_udp_count();
+
+#endif
+
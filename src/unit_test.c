@@ -12,10 +12,29 @@
 #include <netdb.h>
 #include <stdio.h>
 #include <time.h>
+#include <math.h>
+#ifndef _WINSOCK
+#include <pthread.h>
+#endif
 
 #include "obd_monitor.h"
 #include "pid_hash_map.h"
 #include "dtc_hash_map.h"
+#include "pid_table.h"
+#include "wire_protocol.h"
+#include "obd_decoder.h"
+#include "server_stats.h"
+#include "elm_parser.h"
+#include "hex_decode.h"
+#include "custom_pid.h"
+#include "tinyexpr.h"
+#include "request_queue.h"
+#include "response_count.h"
+#ifndef _WINSOCK
+#include "telemetry.h"
+#include "response_cache.h"
+#include "udp_batch.h"
+#endif
 
 const char *OBD_Protocol_List[] = {
 "OBD 0 - Automatic OBD-II Protocol Search",
@@ -60,11 +79,164 @@ const char *test_strings[] = {
 "ATZ!ELM327 v2.1!"
 };
 
+/* Multi-PID Mode 01 replies, single CAN frame, ISO-TP frames and no spaces. */
+const char *multi_pid_replies[] = { 
+"41 0C 1A F8 0D 32",
+"00E!0: 41 0C 1A F8 0D 32!1: 05 7B 0F 46 11 80!2: 0B 65 00 00 00 00 00",
+"410C1AF80D32057B"
+};
+
+const char *wire_sample_replies[] = { 
+"41 0C 1A F8",
+"41 05 7B",
+"410D32",
+"41 5E 01 F4"
+};
+
+/* Replies for the server decoder, Mode 01, DTCs non-CAN and CAN, VIN and ATRV. */
+const char *decoder_replies[] = { 
+"41 0C 1A F8 0D 32",
+"41 01 82 07 E5 00",
+"43 01 33 00 00 00 00",
+"43 02 01 33 C1 05",
+"4902013144344750303052353542313233343536",
+"62 11 5C 5B",
+"ATRV 12.5V"
+};
+
+/* Monitor mode lines, spaced and packed, and a CAN frame with its header. */
+const char *hex_decode_lines[] = { 
+"49 02 01 31 44 34 47 50 30 30 52 35 35 42 31 32 33 34 35 36",
+"4902013144344750303052353542313233343536",
+"7E8 10 14 49 02 01 31 44 34!7E8 21 47 50 30 30 52 35 35!7E8 22 42 31 32 33 34 35 36"
+};
+
+/* Interpreter replies with echo on, protocol search, ISO-TP frames and errors. */
+const char *elm_queries[] = { "01 0C\r", "0100\r", "09 02\r", "01 0C\r", "01 0C\r", "ATRV\r" };
+const char *elm_replies[] = { 
+"01 0C\r41 0C 1A F8\r\r>",
+"0100\rSEARCHING...\r41 00 BE 3E B8 11\r\r>",
+"09 02\r014\r0: 49 02 01 31 44 34\r1: 47 50 30 30 52 35 35\r2: 42 31 32 33 34 35 36\r\r>",
+"01 0C\rNO DATA\r\r>",
+"01 0C\rCAN ERROR\r\r>",
+"ATRV\r12.5V\r\r>"
+};
+
+/* Feeds a reply in chunks and prints the lines and bytes found. */
+int get_elm_summary(int reply_num, int chunk_len, char *out_buf)
+{
+   ELM_Parser parser;
+   unsigned char *reply = (unsigned char *)elm_replies[reply_num];
+   int ii, len, reply_len = strlen(elm_replies[reply_num]);
+
+   init_elm_parser(&parser, (char *)elm_queries[reply_num]);
+   for (ii = 0; ii < reply_len; ii += chunk_len)
+   {
+      feed_elm_parser(&parser, reply + ii, (reply_len - ii < chunk_len) ? reply_len - ii : chunk_len);
+   }
+
+   len = sprintf(out_buf, "%.3X", parser.reply_status);
+   for (ii = 0; ii < parser.line_count; ii++)
+   {
+      len += sprintf(out_buf + len, " %s:%i", get_elm_line_type(parser.lines[ii].line_type), parser.lines[ii].data_len);
+   }
+   for (ii = 0; ii < parser.data_len; ii++)
+   {
+      len += sprintf(out_buf + len, (ii == 0) ? " | %.2X" : " %.2X", parser.data[ii]);
+   }
+
+   return(len);
+}
+
 void generate_dtc_lookup_table()
 {
    return;
 }
 
+int test_failures = 0;            /* Checks that failed, the exit status. */
+
+/* Closure for the te_eval_program() tests, multiplies by the context. */
+double scale_closure(void *context, double x)
+{
+   return(x * *(double *)context);
+}
+
+/* A client request as the server reads it, the priority set from the query. */
+int make_test_request(ECU_Request *req, char *ecu_query)
+{
+   memset(req, 0, sizeof(ECU_Request));
+   strcpy(req->ecu_query, ecu_query);
+   req->query_len = strlen(ecu_query);
+
+   return(set_request_priority(req));
+}
+
+/* The queued requests in the order they are served, "01 0C,ATRV". */
+void dequeue_test_requests(char *order)
+{
+   ECU_Request req;
+   int len = 0;
+
+   order[0] = 0;
+   while (dequeue_request(&req) == 1)
+      len += sprintf(order + len, "%s%.*s", (len > 0) ? "," : "", req.query_len - 1, req.ecu_query);
+
+   return;
+}
+
+#ifndef _WINSOCK
+/* A UDP client on the loopback, replies to it are queued and never sent. */
+void make_test_client(Client_Address *client, int port)
+{
+   struct sockaddr_in *addr = (struct sockaddr_in *)&client->addr;
+
+   memset(client, 0, sizeof(Client_Address));
+   client->transport = CLIENT_DGRAM;
+   client->sock = -1;
+   client->addr_len = sizeof(struct sockaddr_in);
+   addr->sin_family = AF_INET;
+   addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+   addr->sin_port = htons(port);
+
+   return;
+}
+
+#define TELEMETRY_TEST_SAMPLES 2000000
+
+atomic_int telemetry_test_state;  /* 1 when the segment is open, 2 when every sample is written. */
+
+/* The server adapter thread, writes RPM samples numbered 0, 1, 2... as fast as it can. */
+void *telemetry_writer(void *arg)
+{
+   OBD_Sample sample;
+   int ii;
+
+   if (open_telemetry_segment(getpid()) < 0)
+   {
+      atomic_store(&telemetry_test_state, 2);
+      return(NULL);
+   }
+   atomic_store(&telemetry_test_state, 1);
+
+   memset(&sample, 0, sizeof(sample));
+   sample.pid_mode = 0x01;
+   sample.pid_num = 0x0C;
+   sample.sample_type = OBD_SAMPLE_VALUE;
+   sample.units = "rpm";
+   for (ii = 0; ii < TELEMETRY_TEST_SAMPLES; ii++)
+   {
+      sample.timestamp_ms = ii;
+      sample.value = ii;
+      publish_telemetry_samples(&sample, 1);
+   }
+
+   atomic_store(&telemetry_test_state, 2);
+   close_telemetry_segment();
+
+   return(NULL);
+}
+#endif
+
 
 int main(int argc, char *argv[])
 {
@@ -152,6 +324,712 @@ int main(int argc, char *argv[])
       printf("replacechar(): %s\n", temp_buf);
    }
          
+/* 
+----------------------------------------------
+         Function tests pid_table.c 
+----------------------------------------------
+*/
+   for (ii = 0; ii < 3; ii++)
+   {
+      char pid_replies[MAX_BATCH_PIDS][MAX_PID_REPLY_LEN];
+      int jj;
+
+      strcpy(obd_msg, multi_pid_replies[ii]);
+
+      len = split_mode_01_reply(obd_msg, pid_replies, MAX_BATCH_PIDS);
+      for (jj = 0; jj < len; jj++)
+      {
+         print_log_entry(pid_replies[jj]);
+         printf("split_mode_01_reply(): %i %s\n", ii, pid_replies[jj]);
+      }
+   }
+
+   for (ii = 0; ii < 4; ii++)
+   {
+      unsigned char pid_bytes[MAX_REPLY_BYTES];
+      double value = 0.0;
+
+      strcpy(obd_msg, wire_sample_replies[ii]);
+
+      len = get_hex_bytes(obd_msg, pid_bytes, MAX_REPLY_BYTES);
+      if ((len > 2) && (get_mode_01_pid_value(pid_bytes[1], &pid_bytes[2], &value) == 1))
+         sprintf(temp_buf, "%i bytes %.2X %.2f %s", len, pid_bytes[1], value, get_mode_01_pid_units(pid_bytes[1]));
+      else
+         sprintf(temp_buf, "%i bytes, no value", len);
+      print_log_entry(temp_buf);
+      printf("get_mode_01_pid_value(): %s\n", temp_buf);
+   }
+
+/* 
+----------------------------------------------
+         Function tests wire_protocol.c 
+----------------------------------------------
+*/
+   {
+      Wire_Sample samples[MAX_WIRE_SAMPLES];
+      unsigned char wire_msg[MAX_WIRE_DATAGRAM_LEN];
+      unsigned int sequence;
+      int count = 0;
+
+      for (ii = 0; ii < 4; ii++)
+      {
+         strcpy(obd_msg, wire_sample_replies[ii]);
+         count += get_wire_sample(obd_msg, 1000 + ii, &samples[count]);
+      }
+
+      len = encode_wire_datagram(wire_msg, MAX_WIRE_DATAGRAM_LEN, 7, samples, count);
+      memset(samples, 0, sizeof(samples));
+      count = decode_wire_datagram(wire_msg, len, &sequence, samples, MAX_WIRE_SAMPLES);
+      for (ii = 0; ii < count; ii++)
+      {
+         sprintf(temp_buf, "%i bytes seq %u: %.2X %.2X %lld %.2f", len, sequence, samples[ii].pid_mode,
+                 samples[ii].pid_num, samples[ii].timestamp_ms, samples[ii].value);
+         print_log_entry(temp_buf);
+         printf("decode_wire_datagram(): %s\n", temp_buf);
+      }
+   }
+
+   {
+      /* Two stream frames received a few bytes at a time. */
+      unsigned char stream_buf[64];
+      int msg_len, frame_len, stream_len, rx_len = 0;
+
+      stream_len = encode_stream_frame(stream_buf, 64, "01 0C", 5);
+      stream_len += encode_stream_frame(stream_buf + stream_len, 64 - stream_len, "410C1AF8", 8);
+      for (ii = 1; ii <= stream_len; ii++)
+      {
+         frame_len = get_stream_frame(stream_buf + rx_len, ii - rx_len, &msg_len);
+         if (frame_len > 0)
+         {
+            sprintf(temp_buf, "%i of %i bytes: %.*s", ii, stream_len, msg_len, stream_buf + rx_len + STREAM_FRAME_HEADER_LEN);
+            print_log_entry(temp_buf);
+            printf("get_stream_frame(): %s\n", temp_buf);
+            rx_len += frame_len;
+         }
+      }
+   }
+
+/* 
+----------------------------------------------
+         Function tests hex_decode.c 
+----------------------------------------------
+*/
+   {
+      unsigned char hex_bytes[MAX_REPLY_BYTES];
+      unsigned char scalar_bytes[3][MAX_REPLY_BYTES];
+      int scalar_len[3];
+      long long start_us, line_ns[3][3];
+      int level, best_level, mismatches = 0;
+
+      /* Every decoder level returns the same bytes, then the time of each
+         level. Only the bytes go in the log, the times change per run. */
+      best_level = get_hex_decode_level();
+      for (level = HEX_DECODE_SCALAR; level <= best_level; level++)
+      {
+         set_hex_decode_level(level);
+         for (ii = 0; ii < 3; ii++)
+         {
+            len = decode_hex_tokens((char *)hex_decode_lines[ii], strlen(hex_decode_lines[ii]), hex_bytes, MAX_REPLY_BYTES, NULL);
+            if (level == HEX_DECODE_SCALAR)
+            {
+               scalar_len[ii] = len;
+               memcpy(scalar_bytes[ii], hex_bytes, len);
+            }
+            else if ((len != scalar_len[ii]) || (memcmp(hex_bytes, scalar_bytes[ii], len) != 0))
+            {
+               printf("decode_hex_tokens() <ERROR>: %s line %i differs from scalar.\n", get_hex_decode_name(level), ii);
+               mismatches++;
+               test_failures++;
+            }
+
+            start_us = get_monotonic_us();
+            for (len = 0; len < 100000; len++)
+               decode_hex_tokens((char *)hex_decode_lines[ii], strlen(hex_decode_lines[ii]), hex_bytes, MAX_REPLY_BYTES, NULL);
+            line_ns[level][ii] = (get_monotonic_us() - start_us) * 1000 / 100000;
+         }
+      }
+      set_hex_decode_level(best_level);
+
+      for (ii = 0; ii < 3; ii++)
+      {
+         sprintf(temp_buf, "%i bytes %.2X..%.2X, %i level mismatches", scalar_len[ii], scalar_bytes[ii][0],
+                 scalar_bytes[ii][scalar_len[ii] - 1], mismatches);
+         print_log_entry(temp_buf);
+         printf("decode_hex_tokens(): %s\n", temp_buf);
+      }
+
+      for (level = HEX_DECODE_SCALAR; level <= best_level; level++)
+      {
+         printf("decode_hex_tokens(): %-6s spaced %3lld ns packed %3lld ns CAN frames %3lld ns per line\n", get_hex_decode_name(level),
+                line_ns[level][0], line_ns[level][1], line_ns[level][2]);
+      }
+   }
+
+/* 
+----------------------------------------------
+         Function tests elm_parser.c 
+----------------------------------------------
+*/
+   for (ii = 0; ii < 6; ii++)
+   {
+      char chunk_summary[256];
+      int chunk_len, reply_len, split_errors = 0;
+
+      /* The same lines and bytes whatever the read sizes. */
+      reply_len = strlen(elm_replies[ii]);
+      get_elm_summary(ii, reply_len, temp_buf);
+      for (chunk_len = 1; chunk_len < reply_len; chunk_len++)
+      {
+         get_elm_summary(ii, chunk_len, chunk_summary);
+         if (strcmp(chunk_summary, temp_buf) != 0)
+            split_errors++;
+      }
+
+      print_log_entry(temp_buf);
+      printf("feed_elm_parser(): %s, %i split errors\n", temp_buf, split_errors);
+   }
+
+/* 
+----------------------------------------------
+         Function tests obd_decoder.c 
+----------------------------------------------
+*/
+   init_obd_decoder();
+   for (ii = 0; ii < 7; ii++)
+   {
+      char units_reply[MAX_UNITS_REPLY_LEN];
+
+      strcpy(obd_msg, decoder_replies[ii]);
+
+      decode_ecu_data(obd_msg, 1000 + ii);
+      len = get_units_reply(obd_msg, units_reply, MAX_UNITS_REPLY_LEN);
+      replacechar(units_reply, '\n', '|');
+      print_log_entry(units_reply);
+      printf("get_units_reply(): %i %s\n", len, units_reply);
+   }
+
+/* 
+----------------------------------------------
+         Function tests custom_pid.c 
+----------------------------------------------
+*/
+   {
+      unsigned char pid_data[2] = { 0x1A, 0xF8 };
+      PID_Parameters *pid;
+      double value = 0.0;
+
+      add_custom_pid("22F40C", 2, "((256*A)+B)/4", "rpm", "Engine RPM");
+      add_custom_pid("22F40D", 1, "A*", "km/h", "Vehicle Speed"); /* Not a formula. */
+      pid = find_custom_pid(0x22, 0xF40C);
+      if (pid != NULL)
+         get_custom_pid_value(pid, pid_data, 2, &value);
+
+      sprintf(temp_buf, "%i PIDs, 22 F40C 1A F8 = %.2f", get_custom_pid_count(), value);
+      print_log_entry(temp_buf);
+      printf("get_custom_pid_value(): %s\n", temp_buf);
+
+      /* The bytecode against the tree for every byte pair. */
+      if (pid != NULL)
+      {
+         long long start_us, tree_ns, program_ns;
+         double tree_value, program_value;
+         int mismatches = 0;
+
+         for (ii = 0; ii < 65536; ii++)
+         {
+            pid_data[0] = ii >> 8;
+            pid_data[1] = ii & 0xFF;
+            get_custom_pid_value(pid, pid_data, 2, &program_value);
+            tree_value = te_eval(pid->pid_expr);
+            if (memcmp(&tree_value, &program_value, sizeof(double)) != 0)
+               mismatches++;
+         }
+         if (mismatches > 0)
+            test_failures++;
+
+         sprintf(temp_buf, "%.64s bytecode, %i mismatches with te_eval()", pid->pid_formula, mismatches);
+         print_log_entry(temp_buf);
+         printf("te_eval_program(): %s\n", temp_buf);
+
+         start_us = get_monotonic_us();
+         for (ii = 0; ii < 1000000; ii++)
+            value += te_eval(pid->pid_expr);
+         tree_ns = (get_monotonic_us() - start_us) * 1000 / 1000000;
+
+         start_us = get_monotonic_us();
+         for (ii = 0; ii < 1000000; ii++)
+            value += te_eval_program(pid->pid_program);
+         program_ns = (get_monotonic_us() - start_us) * 1000 / 1000000;
+
+         printf("te_eval_program(): te_eval %lld ns bytecode %lld ns per sample\n", tree_ns, program_ns);
+      }
+   }
+
+   /* The bytecode against the tree for closures, pow and fmod calls, unary
+      minus and constant left operands (RSUB_C and RDIV_C). */
+   {
+      const char *expressions[] = { "scale(a)+scale(b*c)", "pow(a,2)+b%7", "a^c-(a*b)%(c+1)", "-a+-(b*c)-(-c)",
+                                    "100-(a*b)", "1000/(a+1)", "2^(a/(b+c))" };
+      const double values[] = { -3.5, -1.0, 0.0, 0.5, 2.0, 255.0 };
+      double a, b, c, factor = 0.25, tree_value, program_value;
+      te_variable vars[] = { { "a", &a, TE_VARIABLE, NULL }, { "b", &b, TE_VARIABLE, NULL }, { "c", &c, TE_VARIABLE, NULL },
+                             { "scale", scale_closure, TE_CLOSURE1, &factor } };
+      te_expr *expr;
+      te_program *program;
+      int jj, kk, ll, error, mismatches = 0;
+
+      for (ii = 0; ii < sizeof(expressions) / sizeof(expressions[0]); ii++)
+      {
+         expr = te_compile(expressions[ii], vars, 4, &error);
+         program = te_compile_program(expr);
+         if (program == NULL)
+         {
+            printf("te_compile_program() <ERROR>: %s not compiled.\n", expressions[ii]);
+            test_failures++;
+            te_free(expr);
+            continue;
+         }
+
+         for (jj = 0; jj < 6; jj++)
+         for (kk = 0; kk < 6; kk++)
+         for (ll = 0; ll < 6; ll++)
+         {
+            a = values[jj];
+            b = values[kk];
+            c = values[ll];
+            tree_value = te_eval(expr);
+            program_value = te_eval_program(program);
+            if ((memcmp(&tree_value, &program_value, sizeof(double)) != 0) && !(isnan(tree_value) && isnan(program_value)))
+            {
+               printf("te_eval_program() <ERROR>: %s = %f, te_eval() %f.\n", expressions[ii], program_value, tree_value);
+               mismatches++;
+            }
+         }
+
+         te_free_program(program);
+         te_free(expr);
+      }
+      if (mismatches > 0)
+         test_failures++;
+
+      sprintf(temp_buf, "%i formulas, %i mismatches with te_eval()", ii, mismatches);
+      print_log_entry(temp_buf);
+      printf("te_eval_program(): %s\n", temp_buf);
+   }
+
+   /* 40 nested subtractions need 40 stack slots, more than the bytecode
+      has, so the PID is evaluated with te_eval(). */
+   {
+      unsigned char pid_data[2] = { 7, 3 };
+      char deep_formula[256];
+      PID_Parameters *pid;
+      double value = 0.0, expected = 7.0;
+
+      strcpy(deep_formula, "A");
+      for (ii = 1; ii < 40; ii++)
+      {
+         sprintf(temp_buf, "%c-(%.200s)", (ii % 2) ? 'B' : 'A', deep_formula);
+         strcpy(deep_formula, temp_buf);
+         expected = (double)pid_data[ii % 2] - expected;
+      }
+
+      add_custom_pid("22F40E", 2, deep_formula, "", "Nested Formula");
+      pid = find_custom_pid(0x22, 0xF40E);
+      if (pid != NULL)
+         get_custom_pid_value(pid, pid_data, 2, &value);
+      if ((pid == NULL) || (pid->pid_program != NULL) || (value != expected))
+         test_failures++;
+
+      sprintf(temp_buf, "22 F40E 07 03 = %.2f, %s", value, ((pid != NULL) && (pid->pid_program == NULL)) ? "te_eval()" : "bytecode");
+      print_log_entry(temp_buf);
+      printf("get_custom_pid_value(): %s\n", temp_buf);
+   }
+
+   /* A PID file in the config.c PID_Entry format. */
+   {
+      unsigned char pid_data[1] = { 0x5A };
+      PID_Parameters *pid;
+      FILE *pid_file;
+      double value = 0.0;
+      int count;
+
+      pid_file = fopen("unit_test_pids.txt", "w");
+      if (pid_file != NULL)
+      {
+         fputs("Manufacturer_PID_List {\n\nPID_Entry {\n\n   ID_Number: \"221154\"\n   Name: \"Trans Temp\"\n"
+               "   Description: \"Transmission Fluid Temperature (GM)\"\n   Formula: \"A-40\"\n   Data_Bytes: \"1\"\n"
+               "   Units: \"C\"\n\n}\n\nPID_Entry {\n\n   ID_Number: \"221155\"\n\n}\n\n}\n", pid_file);
+         fclose(pid_file);
+      }
+
+      free_custom_pids();
+      count = load_custom_pid_file("unit_test_pids.txt");
+      pid = find_custom_pid(0x22, 0x1154);
+      if (pid != NULL)
+         get_custom_pid_value(pid, pid_data, 1, &value);
+      if ((count != 1) || (pid == NULL) || (value != 50.0))
+         test_failures++;
+      remove("unit_test_pids.txt");
+
+      sprintf(temp_buf, "%i PIDs from unit_test_pids.txt, 22 1154 5A = %.2f %s", count, value, (pid != NULL) ? pid->pid_units : "");
+      print_log_entry(temp_buf);
+      printf("load_custom_pid_file(): %s\n", temp_buf);
+
+      /* No PID file, the built-in PIDs only. */
+      count = load_custom_pids();
+      pid = find_custom_pid(0x22, 0x115C);
+      if (pid == NULL)
+         test_failures++;
+      sprintf(temp_buf, "%i PIDs, 22 115C %.64s", count, (pid != NULL) ? pid->pid_formula : "missing");
+      print_log_entry(temp_buf);
+      printf("load_custom_pids(): %s\n", temp_buf);
+   }
+
+/* 
+----------------------------------------------
+         Function tests server_stats.c 
+----------------------------------------------
+*/
+   {
+      Latency_Histogram hist;
+
+      /* 1 ms to 100 ms in 1 ms steps, then one 2 second outlier. */
+      memset(&hist, 0, sizeof(hist));
+      for (ii = 1; ii <= 100; ii++)
+         record_latency(&hist, ii * 1000);
+      record_latency(&hist, 2000000);
+
+      sprintf(temp_buf, "n %u p50 %lld p90 %lld p99 %lld p100 %lld", hist.count, get_latency_percentile(&hist, 50.0),
+              get_latency_percentile(&hist, 90.0), get_latency_percentile(&hist, 99.0), get_latency_percentile(&hist, 100.0));
+      print_log_entry(temp_buf);
+      printf("get_latency_percentile(): %s\n", temp_buf);
+   }
+
+/* 
+----------------------------------------------
+         Function tests request_queue.c 
+----------------------------------------------
+*/
+   {
+      ECU_Request req;
+      char order[128];
+      int pri;
+
+      /* Real time, then normal, then background, FIFO within a class. */
+      init_request_queue();
+      make_test_request(&req, "03\r");
+      enqueue_request(&req);
+      make_test_request(&req, "01 0C\r");
+      enqueue_request(&req);
+      make_test_request(&req, "PRI 0 01 0D\r");
+      enqueue_request(&req);
+      make_test_request(&req, "ATRV\r");
+      enqueue_request(&req);
+      make_test_request(&req, "PRI 2 01 05\r");
+      enqueue_request(&req);
+      dequeue_test_requests(order);
+      if (strcmp(order, "01 0D,01 0C,ATRV,03,01 05") != 0)
+         test_failures++;
+
+      sprintf(temp_buf, "served %s", order);
+      print_log_entry(temp_buf);
+      printf("dequeue_request(): %s\n", temp_buf);
+
+      /* A background request waiting behind a burst of real time requests. */
+      init_request_queue();
+      make_test_request(&req, "09 02\r");
+      enqueue_request(&req);
+      for (ii = 0; ii < 20; ii++)
+      {
+         make_test_request(&req, "PRI 0 01 0C\r");
+         enqueue_request(&req);
+      }
+      for (ii = 0; dequeue_request(&req) == 1; ii++)
+      {
+         if (req.priority == PRIORITY_BACKGROUND)
+            break;
+      }
+      if (ii != MAX_PRIORITY_SKIPS)
+         test_failures++;
+      dequeue_test_requests(order);
+
+      sprintf(temp_buf, "09 02 served after %i of 20 real time requests, %i skips allowed", ii, MAX_PRIORITY_SKIPS);
+      print_log_entry(temp_buf);
+      printf("get_next_priority(): %s\n", temp_buf);
+
+      /* The request in front moves back a place, the other classes stay put. */
+      init_request_queue();
+      make_test_request(&req, "01 0C\r");
+      enqueue_request(&req);
+      make_test_request(&req, "01 0D\r");
+      enqueue_request(&req);
+      make_test_request(&req, "01 05\r");
+      enqueue_request(&req);
+      make_test_request(&req, "03\r");
+      enqueue_request(&req);
+      pri = dequeue_request_at(1, &req);
+      sprintf(temp_buf, "removed %.*s, ", req.query_len - 1, req.ecu_query);
+      pri += (get_queued_request(3) == NULL) + dequeue_request_at(3, &req);
+      dequeue_test_requests(order);
+      if ((pri != 2) || (strcmp(temp_buf, "removed 01 0D, ") != 0) || (strcmp(order, "01 0C,01 05,03") != 0))
+         test_failures++;
+
+      strcat(temp_buf, "served ");
+      strcat(temp_buf, order);
+      print_log_entry(temp_buf);
+      printf("dequeue_request_at(): %s\n", temp_buf);
+
+      /* The PRI prefix is removed, a bad prefix is refused. */
+      pri = make_test_request(&req, "PRI 2 01 0C\r");
+      sprintf(temp_buf, "PRI 2 01 0C = %i %.*s, PRI 3, PRI x, PRI 1 and PRI 101 0C refused", pri, req.query_len - 1, req.ecu_query);
+      if ((pri != PRIORITY_BACKGROUND) || (strcmp(req.ecu_query, "01 0C\r") != 0) || (req.query_len != 6) ||
+          (make_test_request(&req, "PRI 3 01 0C\r") != -1) || (make_test_request(&req, "PRI x 01 0C\r") != -1) ||
+          (make_test_request(&req, "PRI 1 ") != -1) || (make_test_request(&req, "PRI 101 0C\r") != -1))
+         test_failures++;
+
+      print_log_entry(temp_buf);
+      printf("set_request_priority(): %s\n", temp_buf);
+
+      /* Without the prefix the slow modes are background. */
+      if ((get_default_priority("01 0C\r") != PRIORITY_NORMAL) || (get_default_priority("ATRV\r") != PRIORITY_NORMAL) ||
+          (get_default_priority("at z\r") != PRIORITY_NORMAL) || (get_default_priority("02 0C 00\r") != PRIORITY_BACKGROUND) ||
+          (get_default_priority("03\r") != PRIORITY_BACKGROUND) || (get_default_priority("09 02\r") != PRIORITY_BACKGROUND) ||
+          (get_default_priority("0A\r") != PRIORITY_BACKGROUND) || (get_default_priority("22 F40C\r") != PRIORITY_NORMAL))
+         test_failures++;
+
+      sprintf(temp_buf, "01 0C %i, ATRV %i, 02 0C 00 %i, 03 %i, 09 02 %i, 0A %i, 22 F40C %i", get_default_priority("01 0C\r"),
+              get_default_priority("ATRV\r"), get_default_priority("02 0C 00\r"), get_default_priority("03\r"),
+              get_default_priority("09 02\r"), get_default_priority("0A\r"), get_default_priority("22 F40C\r"));
+      print_log_entry(temp_buf);
+      printf("get_default_priority(): %s\n", temp_buf);
+   }
+
+/* 
+----------------------------------------------
+         Function tests response_count.c 
+----------------------------------------------
+*/
+   {
+      char out_query[MAX_SERIAL_BUF_LEN];
+      int ecus, count_0c, count_03, count_02, complete, short_reply;
+
+      /* Two CAN ECUs, the engine supports 01 03, both support 01 0C. */
+      init_response_count();
+      ecus = parse_discovery_reply("7E8 06 41 00 BE 3E B8 11!7E9 06 41 00 98 18 00 01", 0x00);
+      set_response_count_enabled(ecus > 0);
+      count_0c = get_query_response_count("01 0C\r");
+      count_03 = get_query_response_count("01 03\r");
+      count_02 = get_query_response_count("01 02\r");
+      add_response_count("01 0C\r", out_query, MAX_SERIAL_BUF_LEN);
+      if ((ecus != 2) || (get_ecu_count() != 2) || (count_0c != 2) || (count_03 != 1) || (count_02 != 0) ||
+          (strcmp(out_query, "01 0C 2\r") != 0) || (is_pid_supported(0x20) != 1) || (is_pid_supported(0x21) != 0))
+         test_failures++;
+
+      sprintf(temp_buf, "%i ECUs, 01 0C count %i, 01 03 count %i, 01 02 count %i, sent as %.*s", ecus, count_0c, count_03,
+              count_02, (int)strlen(out_query) - 1, out_query);
+      print_log_entry(temp_buf);
+      printf("parse_discovery_reply(): %s\n", temp_buf);
+
+      /* A request that already ends in a count is sent as it is and not checked. */
+      count_0c = get_query_response_count("01 0C 1\r");
+      add_response_count("01 0C 1\r", out_query, MAX_SERIAL_BUF_LEN);
+      complete = check_response_count("01 0C 1\r", "410C1AF8");
+      if ((count_0c != 0) || (strcmp(out_query, "01 0C 1\r") != 0) || (complete != 1) || (get_query_response_count("01 0C\r") != 2))
+         test_failures++;
+
+      sprintf(temp_buf, "01 0C 1 count %i, sent as %.*s, one reply %s", count_0c, (int)strlen(out_query) - 1, out_query,
+              complete ? "complete" : "short");
+      print_log_entry(temp_buf);
+      printf("get_query_response_count(): %s\n", temp_buf);
+
+      /* Both replies, then one reply short, 01 0C falls back and 01 0D does not. */
+      complete = check_response_count("01 0C\r", "410C1AF8!410C1B00");
+      short_reply = check_response_count("01 0C\r", "410C1AF8");
+      count_0c = get_query_response_count("01 0C\r");
+      if ((complete != 1) || (short_reply != 0) || (count_0c != 0) || (get_query_response_count("01 0D\r") != 2) ||
+          (get_query_response_count("01 0C 0D\r") != 0))
+         test_failures++;
+
+      sprintf(temp_buf, "two replies %s, one reply %s, 01 0C count %i, 01 0D count %i", complete ? "complete" : "short",
+              short_reply ? "complete" : "short", count_0c, get_query_response_count("01 0D\r"));
+      print_log_entry(temp_buf);
+      printf("check_response_count(): %s\n", temp_buf);
+
+      /* NO DATA or '?' to a request with a count. */
+      response_count_failed("01 03\r");
+      count_03 = get_query_response_count("01 03\r");
+      if (count_03 != 0)
+         test_failures++;
+
+      sprintf(temp_buf, "01 03 count %i after a failed request", count_03);
+      print_log_entry(temp_buf);
+      printf("response_count_failed(): %s\n", temp_buf);
+
+      /* J1850 headers are three bytes and the line ends in a checksum. */
+      init_response_count();
+      ecus = parse_discovery_reply("48 6B 10 41 00 BE 3E B8 11 B9!48 6B 18 41 00 98 18 00 01 9A", 0x00);
+      set_response_count_enabled(ecus > 0);
+      count_0c = get_query_response_count("01 0C\r");
+      count_03 = get_query_response_count("01 03\r");
+      if ((ecus != 2) || (count_0c != 2) || (count_03 != 1))
+         test_failures++;
+
+      sprintf(temp_buf, "J1850 %i ECUs, 01 0C count %i, 01 03 count %i", ecus, count_0c, count_03);
+      print_log_entry(temp_buf);
+      printf("parse_discovery_reply(): %s\n", temp_buf);
+
+      init_response_count();
+   }
+
+#ifndef _WINSOCK
+/* 
+----------------------------------------------
+         Function tests response_cache.c 
+----------------------------------------------
+*/
+   {
+      ECU_Request req, other_req;
+      int hit, late_hit, sent, waiters;
+
+      init_udp_sends();
+
+      /* TTL 0 turns the cache off. */
+      init_response_cache(0);
+      make_test_request(&req, "01 0C\r");
+      make_test_client(&req.from_client, 5000);
+      other_req = req;
+      make_test_client(&other_req.from_client, 5001);
+      set_response_pending(&req);
+      complete_cached_response(&req, "41 0C 1A F8", 11, 1000);
+      hit = serve_from_cache(&other_req, 1000);
+      if (hit != 0)
+         test_failures++;
+
+      sprintf(temp_buf, "TTL 0, 01 0C %s at 0 ms", hit ? "served from the cache" : "sent to the ECU");
+      print_log_entry(temp_buf);
+      printf("serve_from_cache(): %s\n", temp_buf);
+
+      /* A reply exactly TTL old is stale. */
+      init_response_cache(DEFAULT_CACHE_TTL_MS);
+      make_test_request(&req, "01 0D\r");
+      make_test_client(&req.from_client, 5000);
+      other_req = req;
+      make_test_client(&other_req.from_client, 5001);
+      set_response_pending(&req);
+      complete_cached_response(&req, "41 0D 20", 8, 1000);
+      hit = serve_from_cache(&other_req, 1000 + DEFAULT_CACHE_TTL_MS - 1);
+      late_hit = serve_from_cache(&other_req, 1000 + DEFAULT_CACHE_TTL_MS);
+      if ((hit != 1) || (late_hit != 0) || (get_queued_udp_count() != 1))
+         test_failures++;
+
+      sprintf(temp_buf, "TTL %i, 01 0D served at %i ms, %s at %i ms", DEFAULT_CACHE_TTL_MS, DEFAULT_CACHE_TTL_MS - 1,
+              late_hit ? "served" : "stale", DEFAULT_CACHE_TTL_MS);
+      print_log_entry(temp_buf);
+      printf("serve_from_cache(): %s\n", temp_buf);
+
+      /* A second client waits on the request in flight, once. */
+      init_udp_sends();
+      make_test_request(&req, "01 05\r");
+      make_test_client(&req.from_client, 5000);
+      other_req = req;
+      make_test_client(&other_req.from_client, 5001);
+      set_response_pending(&req);
+      hit = serve_from_cache(&other_req, 2000) + serve_from_cache(&other_req, 2000);
+      waiters = get_cache_waiter_count(&req);
+      sent = complete_cached_response(&req, "41 05 7B", 8, 2000);
+      if ((hit != 2) || (waiters != 1) || (sent != 1) || (get_queued_udp_count() != 1) || (get_cache_waiter_count(&req) != 0))
+         test_failures++;
+
+      sprintf(temp_buf, "01 05 in flight, %i waiter, reply sent to %i", waiters, sent);
+      print_log_entry(temp_buf);
+      printf("complete_cached_response(): %s\n", temp_buf);
+
+      /* A failed request releases its waiters with the error. */
+      init_udp_sends();
+      make_test_request(&req, "01 0F\r");
+      make_test_client(&req.from_client, 5000);
+      other_req = req;
+      make_test_client(&other_req.from_client, 5001);
+      set_response_pending(&req);
+      serve_from_cache(&other_req, 3000);
+      sent = fail_cached_response(&req, "NO DATA");
+      hit = serve_from_cache(&other_req, 3000);
+      if ((sent != 1) || (get_queued_udp_count() != 1) || (get_cache_waiter_count(&req) != 0) || (hit != 0))
+         test_failures++;
+
+      sprintf(temp_buf, "01 0F failed, %i waiter released, next request %s", sent, hit ? "waits" : "sent to the ECU");
+      print_log_entry(temp_buf);
+      printf("fail_cached_response(): %s\n", temp_buf);
+
+      /* NO DATA and a reply for another PID are not cached. */
+      init_udp_sends();
+      make_test_request(&req, "01 11\r");
+      make_test_client(&req.from_client, 5000);
+      other_req = req;
+      make_test_client(&other_req.from_client, 5001);
+      set_response_pending(&req);
+      complete_cached_response(&req, "NO DATA", 7, 4000);
+      hit = serve_from_cache(&other_req, 4001);
+      set_response_pending(&req);
+      complete_cached_response(&req, "41 0C 1A F8", 11, 4002);
+      hit += serve_from_cache(&other_req, 4003);
+      if ((hit != 0) || (get_queued_udp_count() != 0))
+         test_failures++;
+
+      sprintf(temp_buf, "01 11 NO DATA and 41 0C %s", hit ? "cached" : "not cached");
+      print_log_entry(temp_buf);
+      printf("complete_cached_response(): %s\n", temp_buf);
+
+      init_udp_sends();
+   }
+
+/* 
+----------------------------------------------
+         Function tests telemetry.c 
+----------------------------------------------
+*/
+   {
+      Telemetry_Sample samples[TELEMETRY_RING_SLOTS];
+      pthread_t writer;
+      long reads = 0, out_of_order = 0;
+      int count;
+
+      /* A reader copies the ring while the writer laps it, every copy
+         must be consecutive samples, newest first. */
+      atomic_store(&telemetry_test_state, 0);
+      pthread_create(&writer, NULL, telemetry_writer, NULL);
+      while (atomic_load(&telemetry_test_state) == 0)
+         usleep(100);
+
+      if (map_telemetry_segment(getpid()) == 0)
+      {
+         while (atomic_load(&telemetry_test_state) == 1)
+         {
+            count = read_telemetry_samples(0x01, 0x0C, samples, TELEMETRY_RING_SLOTS);
+            for (ii = 1; ii < count; ii++)
+            {
+               if ((samples[ii].value != samples[0].value - ii) || (samples[ii].timestamp_ms != (long long)samples[ii].value))
+               {
+                  out_of_order++;
+                  break;
+               }
+            }
+            reads++;
+         }
+         unmap_telemetry_segment();
+      }
+      pthread_join(writer, NULL);
+
+      if ((reads == 0) || (out_of_order > 0))
+         test_failures++;
+
+      /* The number of reads changes per run, only the result is logged. */
+      sprintf(temp_buf, "%i samples, %s", TELEMETRY_TEST_SAMPLES, (reads == 0) ? "no segment" : (out_of_order == 0) ? "all reads in order" : "reads out of order");
+      print_log_entry(temp_buf);
+      printf("read_telemetry_samples(): %s, %ld of %ld reads out of order\n", temp_buf, out_of_order, reads);
+   }
+#endif
+
 /* 
 ----------------------------------------------
          Hashmap tests.
@@ -178,6 +1056,12 @@ int main(int argc, char *argv[])
    
    
    close_log_file();
-   
+
+   if (test_failures > 0)
+   {
+      printf("unit_test <ERROR>: %i checks failed.\n", test_failures);
+      exit(1);
+   }
+
    exit(0);
 }
@@ -22,6 +22,9 @@
 #include <time.h>
 
 #include "obd_monitor.h"
+#include "hex_decode.h"
+
+#define MAX_ASCII_HEX_BYTES 127   /* Two characters each in a 256 byte buffer. */
 
 /* Redefine malloc with a fatal exit. */
 void *xmalloc (size_t size)
@@ -103,35 +106,48 @@ int xstrcpy(char *out_buf, char *in_buf, int start, int end)
 */
 int xhextoascii(char *out_buf, char *in_buf)
 {
-   int ii;
-   long lnum;
-   char temp_buf[256];
-   char *token;
-   char vin_char[1];
+   unsigned char hex_bytes[MAX_ASCII_HEX_BYTES];
+   int ii, nbytes, len = 0;
    
-   ii = 0;
    memset(out_buf, 0, 256);
-   memset(temp_buf, 0, 256);
-   
-   token = strtok(in_buf, " ");
    
-   /* Parse the tokens. */
-   while( token != NULL ) 
+   nbytes = decode_hex_tokens(in_buf, strlen(in_buf), hex_bytes, MAX_ASCII_HEX_BYTES, NULL);
+   for (ii = 0; ii < nbytes; ii++)
    {
-      /* printf("xhextoascii() <DEBUG>: %s\n", token); */
-      lnum = strtol(token, 0, 16);
-      if ((lnum > 31) && (lnum < 124)) /* Only printable characters. */
+      if ((hex_bytes[ii] > 31) && (hex_bytes[ii] < 124)) /* Only printable characters. */
       {
-         vin_char[0] = (char)lnum;
-         strncat(out_buf, vin_char, 1);
-         strcat(out_buf, " ");
+         out_buf[len++] = hex_bytes[ii];
+         out_buf[len++] = ' ';
       }
-
-      token = strtok(NULL, " ");
-      ii++;
    }
    
-   return(ii);
+   return(nbytes);
+}
+
+/*
+   Function: xhexspace()
+
+   Purpose : Puts a space between the bytes of a compact hex message from
+           : an ELM327 with spaces off (ATS0), "410C1AF8" becomes
+           : "41 0C 1A F8".
+   Input   : Output buffer, compact hex message and output buffer length.
+   Output  : Returns the length of the spaced message.
+*/
+int xhexspace(char *out_buf, char *in_buf, int out_len)
+{
+   int ii, len = 0;
+
+   for (ii = 0; (in_buf[ii] != 0) && (len < out_len - 3); ii++)
+   {
+      if ((ii > 0) && ((ii % 2) == 0))
+      {
+         out_buf[len++] = ' ';
+      }
+      out_buf[len++] = in_buf[ii];
+   }
+   out_buf[len] = 0;
+
+   return(len);
 }
 
 /* Bail Out */
@@ -218,6 +234,41 @@ int get_time_string(char *tstr, int slen)
    return(len);
 }
 
+/*
+   Function: get_monotonic_ms()
+
+   Purpose : Gets a monotonic clock value for timeouts and deadlines,
+           : not affected by changes to the system time.
+   Input   : None.
+   Output  : Milliseconds since an unspecified starting point.
+*/
+long long get_monotonic_ms()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return(((long long)ts.tv_sec * 1000LL) + (ts.tv_nsec / 1000000L));
+}
+
+/*
+   Function: get_monotonic_us()
+
+   Purpose : Gets the monotonic clock in microseconds, for latency
+           : measurements.
+   Input   : None.
+   Output  : Microseconds since an unspecified starting point.
+*/
+long long get_monotonic_us()
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+
+   return(((long long)ts.tv_sec * 1000000LL) + (ts.tv_nsec / 1000L));
+}
+
+
 
 int validate_ipv4_address(char *ipv4_addr)
 {
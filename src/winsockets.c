@@ -30,6 +30,9 @@ struct sockaddr_in obd_server, from;
 struct hostent *hp;
 int ecu_connected;
 int ecu_auto_connect;
+Pending_Request pending_requests[MAX_PENDING_REQUESTS];
+unsigned int next_request_id;
+int pending_count;
 WSADATA wsaData;
 int iResult;
 unsigned long iMode = 1;
@@ -127,6 +130,203 @@ int init_obd_comms(char *obd_msg)
 }
 
 
+/*
+   Function: send_poll_request()
+
+   Purpose : Registers PIDs with the server polling scheduler, the server
+           : then sends the replies without further requests.
+   Input   : Polling interval in milliseconds (0 = as fast as possible,
+           : -1 = stop polling) and a mode plus PID list, e.g. "01 0C 0D".
+   Output  : Returns bytes sent.
+*/
+int send_poll_request(int interval_ms, char *pid_list)
+{
+   char poll_msg[256];
+
+   if (interval_ms < 0)
+      snprintf(poll_msg, 256, "UNPOLL %s\r", pid_list);
+   else
+      snprintf(poll_msg, 256, "POLL %d %s\r", interval_ms, pid_list);
+
+   return(send_ecu_msg(poll_msg));
+}
+
+/*
+   Function: send_subscribe_request()
+
+   Purpose : Subscribes to or unsubscribes from ECU replies for a list of
+           : PIDs, the server sends every reply for those PIDs to this
+           : client whichever client or poll made the request. Over UDP
+           : the subscription lapses unless it is sent again within
+           : POLL_LEASE_MS.
+   Input   : 1 to subscribe or 0 to unsubscribe, mode plus PID list.
+   Output  : Returns bytes sent.
+*/
+int send_subscribe_request(int subscribe, char *pid_list)
+{
+   char sub_msg[256];
+
+   if (subscribe == 1)
+      snprintf(sub_msg, 256, "SUB %s\r", pid_list);
+   else
+      snprintf(sub_msg, 256, "UNSUB %s\r", pid_list);
+
+   return(send_ecu_msg(sub_msg));
+}
+
+/*
+   Function: send_format_request()
+
+   Purpose : Selects the reply format for this client. Binary replies
+           : carry scaled Mode 01 values, see wire_protocol.c. Units
+           : replies are text decoded by the server, see obd_decoder.c.
+   Input   : 1 for binary samples, 2 for units or 0 for ELM327 text.
+   Output  : Returns bytes sent.
+*/
+int send_format_request(int binary)
+{
+   if (binary == 1)
+      return(send_ecu_msg("FORMAT BIN\r"));
+   if (binary == 2)
+      return(send_ecu_msg("FORMAT UNITS\r"));
+
+   return(send_ecu_msg("FORMAT TEXT\r"));
+}
+
+/*
+   Function: send_ecu_request()
+
+   Purpose : Sends a request with a request ID, "ID 1F 01 0C\r". The
+           : server puts the ID in front of every reply to the request, so
+           : many requests can be outstanding and each reply is matched to
+           : its request by recv_ecu_reply_msg().
+   Input   : Request message.
+   Output  : Returns the request ID, 0 if too many requests are pending or
+           : the send failed.
+*/
+unsigned int send_ecu_request(char *query)
+{
+   char id_msg[256];
+   int ii, slot = -1;
+
+   for (ii = 0; ii < MAX_PENDING_REQUESTS; ii++)
+   {
+      if (pending_requests[ii].request_id == 0)
+      {
+         slot = ii;
+         break;
+      }
+   }
+   if (slot < 0)
+   {
+      printf("send_ecu_request() <ERROR>: Too many pending requests.\n");
+      return(0);
+   }
+
+   if (++next_request_id == 0)
+      next_request_id = 1;
+
+   snprintf(id_msg, 256, "ID %X %s", next_request_id, query);
+   if (send_ecu_msg(id_msg) <= 0)
+   {
+      return(0);
+   }
+
+   pending_requests[slot].request_id = next_request_id;
+   pending_requests[slot].sent_ms = get_monotonic_ms();
+   strncpy(pending_requests[slot].ecu_query, query, MAX_ECU_QUERY_LEN - 1);
+   pending_requests[slot].ecu_query[MAX_ECU_QUERY_LEN - 1] = 0;
+   pending_count++;
+
+   return(next_request_id);
+}
+
+/*
+   Function: recv_ecu_reply_msg()
+
+   Purpose : Receives a server message and takes the request ID off the
+           : front of it. The pending request is freed and the time since
+           : it was sent is returned. Messages without an ID, polled and
+           : subscribed replies or binary datagrams, are returned as they
+           : arrive with an ID of 0.
+   Input   : Message buffer (256 bytes), request ID and latency.
+   Output  : Returns the message length, 0 or less if no message arrived.
+           : The latency is -1 if the request is not pending, a late
+           : reply to an expired request or a duplicate.
+*/
+int recv_ecu_reply_msg(char *msg, unsigned int *request_id, long long *latency_ms)
+{
+   char *end_ptr;
+   unsigned long reply_id;
+   int n, ii, len;
+
+   *request_id = 0;
+   *latency_ms = -1;
+
+   n = recv_ecu_msg(msg);
+   if ((n <= 5) || (strncmp(msg, "ID ", 3) != 0))
+   {
+      return(n);
+   }
+
+   reply_id = strtoul(msg + 3, &end_ptr, 16);
+   if ((end_ptr == msg + 3) || (*end_ptr != ' '))
+   {
+      return(n);
+   }
+
+   len = (end_ptr + 1) - msg;
+   n -= len;
+   memmove(msg, end_ptr + 1, n);
+   memset(msg + n, 0, len);
+   *request_id = (unsigned int)reply_id;
+
+   for (ii = 0; ii < MAX_PENDING_REQUESTS; ii++)
+   {
+      if ((pending_requests[ii].request_id != 0) && (pending_requests[ii].request_id == *request_id))
+      {
+         *latency_ms = get_monotonic_ms() - pending_requests[ii].sent_ms;
+         pending_requests[ii].request_id = 0;
+         pending_count--;
+         break;
+      }
+   }
+
+   return(n);
+}
+
+int get_pending_request_count()
+{
+   return(pending_count);
+}
+
+/*
+   Function: expire_pending_requests()
+
+   Purpose : Frees pending requests with no reply, UDP does not resend
+           : lost datagrams.
+   Input   : Milliseconds to wait for a reply.
+   Output  : Returns the number of requests expired.
+*/
+int expire_pending_requests(int timeout_ms)
+{
+   long long now_ms = get_monotonic_ms();
+   int ii, count = 0;
+
+   for (ii = 0; ii < MAX_PENDING_REQUESTS; ii++)
+   {
+      if ((pending_requests[ii].request_id != 0) && (now_ms - pending_requests[ii].sent_ms > timeout_ms))
+      {
+         printf("expire_pending_requests() <INFO>: No reply to %X %s\n", pending_requests[ii].request_id, pending_requests[ii].ecu_query);
+         pending_requests[ii].request_id = 0;
+         pending_count--;
+         count++;
+      }
+   }
+
+   return(count);
+}
+
 int server_connect()
 {
    int result;
@@ -0,0 +1,262 @@
+/*
+   wire_protocol.c
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Binary server to client datagrams with scaled PID values.
+
+                Clients that send "FORMAT BIN\r" get Mode 01 replies as
+                already scaled values, several samples per datagram, instead
+                of ELM327 text that every client has to parse again. All
+                fields are in network byte order:
+
+                Header, 16 bytes:
+
+                [0]     0xB0 magic
+                [1]     0xD2 magic
+                [2]     Version, 1
+                [3]     Number of samples
+                [4-7]   Sequence number, one per datagram for each client
+                [8-15]  Monotonic time of the first sample in milliseconds
+
+                Sample, 8 bytes each:
+
+                [0]     Mode
+                [1]     PID
+                [2-3]   Milliseconds after the header time
+                [4-7]   Scaled value, IEEE 754 single precision
+
+                Replies with no formula (AT replies, DTCs, VIN, NO DATA)
+                are still sent as text, so a client checks the magic bytes
+                first with is_wire_datagram().
+
+                On TCP and Unix stream connections every message, text or
+                binary, in both directions is one frame, the message length
+                as a 4 byte network order integer followed by the message.
+                A datagram client and a stream client get the same bytes.
+
+   Date: 16/10/2026
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pid_table.h"
+#include "wire_protocol.h"
+
+void put_wire_u32(unsigned char *out_buf, unsigned int val)
+{
+   out_buf[0] = (val >> 24) & 0xFF;
+   out_buf[1] = (val >> 16) & 0xFF;
+   out_buf[2] = (val >> 8) & 0xFF;
+   out_buf[3] = val & 0xFF;
+
+   return;
+}
+
+unsigned int get_wire_u32(unsigned char *in_buf)
+{
+   return(((unsigned int)in_buf[0] << 24) | ((unsigned int)in_buf[1] << 16) | ((unsigned int)in_buf[2] << 8) | in_buf[3]);
+}
+
+int is_wire_datagram(unsigned char *in_buf, int in_len)
+{
+   return((in_len >= WIRE_HEADER_LEN) && (in_buf[0] == WIRE_MAGIC_0) && (in_buf[1] == WIRE_MAGIC_1));
+}
+
+/*
+   Function: get_wire_sample()
+
+   Purpose : Converts a single PID ECU reply, "41 0C 1A F8" or "410C1AF8",
+           : to a scaled sample.
+   Input   : ECU reply, time the reply arrived and the sample.
+   Output  : Returns 1, 0 if the reply has no scaled value.
+*/
+int get_wire_sample(char *ecu_reply, long long timestamp_ms, Wire_Sample *sample)
+{
+   unsigned char reply_bytes[MAX_REPLY_BYTES];
+   int nbytes, pid_len;
+
+   nbytes = get_reply_bytes(ecu_reply, reply_bytes, MAX_REPLY_BYTES);
+   if ((nbytes < 3) || (reply_bytes[0] != 0x41))
+   {
+      return(0);
+   }
+
+   pid_len = get_mode_01_pid_length(reply_bytes[1]);
+   if ((pid_len == 0) || (nbytes != pid_len + 2))
+   {
+      return(0); /* Unknown PID or a multi-PID reply. */
+   }
+
+   if (get_mode_01_pid_value(reply_bytes[1], &reply_bytes[2], &sample->value) == 0)
+   {
+      return(0);
+   }
+
+   sample->pid_mode = 0x01;
+   sample->pid_num = reply_bytes[1];
+   sample->timestamp_ms = timestamp_ms;
+
+   return(1);
+}
+
+/*
+   Function: encode_wire_datagram()
+
+   Purpose : Packs samples into a binary datagram.
+   Input   : Output buffer and length, sequence number, samples and count.
+   Output  : Returns the datagram length, 0 if the buffer is too small.
+*/
+int encode_wire_datagram(unsigned char *out_buf, int out_len, unsigned int sequence, Wire_Sample *samples, int count)
+{
+   unsigned char *sp;
+   unsigned long long base_ms;
+   long long offset_ms;
+   unsigned int bits;
+   float fval;
+   int ii;
+
+   if ((count < 1) || (count > MAX_WIRE_SAMPLES) || (out_len < WIRE_HEADER_LEN + (count * WIRE_SAMPLE_LEN)))
+   {
+      return(0);
+   }
+
+   base_ms = (unsigned long long)samples[0].timestamp_ms;
+
+   out_buf[0] = WIRE_MAGIC_0;
+   out_buf[1] = WIRE_MAGIC_1;
+   out_buf[2] = WIRE_VERSION;
+   out_buf[3] = (unsigned char)count;
+   put_wire_u32(out_buf + 4, sequence);
+   put_wire_u32(out_buf + 8, (unsigned int)(base_ms >> 32));
+   put_wire_u32(out_buf + 12, (unsigned int)(base_ms & 0xFFFFFFFF));
+
+   for (ii = 0; ii < count; ii++)
+   {
+      sp = out_buf + WIRE_HEADER_LEN + (ii * WIRE_SAMPLE_LEN);
+
+      offset_ms = samples[ii].timestamp_ms - (long long)base_ms;
+      if (offset_ms < 0)
+         offset_ms = 0;
+      else if (offset_ms > 0xFFFF)
+         offset_ms = 0xFFFF;
+
+      fval = (float)samples[ii].value;
+      memcpy(&bits, &fval, sizeof(bits));
+
+      sp[0] = (unsigned char)samples[ii].pid_mode;
+      sp[1] = (unsigned char)samples[ii].pid_num;
+      sp[2] = (offset_ms >> 8) & 0xFF;
+      sp[3] = offset_ms & 0xFF;
+      put_wire_u32(sp + 4, bits);
+   }
+
+   return(WIRE_HEADER_LEN + (count * WIRE_SAMPLE_LEN));
+}
+
+/*
+   Function: decode_wire_datagram()
+
+   Purpose : Unpacks the samples of a binary datagram.
+   Input   : Datagram and length, sequence number, sample buffer and size.
+   Output  : Returns the number of samples, -1 if the datagram is invalid.
+*/
+int decode_wire_datagram(unsigned char *in_buf, int in_len, unsigned int *sequence, Wire_Sample *samples, int max_samples)
+{
+   unsigned char *sp;
+   unsigned long long base_ms;
+   unsigned int bits;
+   float fval;
+   int ii, count;
+
+   if (!is_wire_datagram(in_buf, in_len) || (in_buf[2] != WIRE_VERSION))
+   {
+      return(-1);
+   }
+
+   count = in_buf[3];
+   if (in_len < WIRE_HEADER_LEN + (count * WIRE_SAMPLE_LEN))
+   {
+      return(-1);
+   }
+   if (count > max_samples)
+      count = max_samples;
+
+   *sequence = get_wire_u32(in_buf + 4);
+   base_ms = ((unsigned long long)get_wire_u32(in_buf + 8) << 32) | get_wire_u32(in_buf + 12);
+
+   for (ii = 0; ii < count; ii++)
+   {
+      sp = in_buf + WIRE_HEADER_LEN + (ii * WIRE_SAMPLE_LEN);
+
+      bits = get_wire_u32(sp + 4);
+      memcpy(&fval, &bits, sizeof(fval));
+
+      samples[ii].pid_mode = sp[0];
+      samples[ii].pid_num = sp[1];
+      samples[ii].timestamp_ms = (long long)base_ms + ((sp[2] << 8) | sp[3]);
+      samples[ii].value = fval;
+   }
+
+   return(count);
+}
+
+/*
+   Function: encode_stream_frame()
+
+   Purpose : Writes a message as a stream frame, length then message.
+   Input   : Output buffer and length, message and message length.
+   Output  : Returns the frame length, 0 if it does not fit.
+*/
+int encode_stream_frame(unsigned char *out_buf, int out_len, void *msg, int msg_len)
+{
+   if ((msg_len > MAX_STREAM_MSG_LEN) || (STREAM_FRAME_HEADER_LEN + msg_len > out_len))
+   {
+      return(0);
+   }
+
+   put_wire_u32(out_buf, msg_len);
+   memcpy(out_buf + STREAM_FRAME_HEADER_LEN, msg, msg_len);
+
+   return(STREAM_FRAME_HEADER_LEN + msg_len);
+}
+
+/*
+   Function: get_stream_frame()
+
+   Purpose : Checks for a whole frame at the start of the bytes received
+           : from a stream, the message follows the frame header.
+   Input   : Received bytes and length, message length.
+   Output  : Returns the frame length, 0 if the frame is not complete yet
+           : or -1 if the length is not valid and the stream must close.
+*/
+int get_stream_frame(unsigned char *in_buf, int in_len, int *msg_len)
+{
+   unsigned int len;
+
+   if (in_len < STREAM_FRAME_HEADER_LEN)
+   {
+      return(0);
+   }
+
+   len = get_wire_u32(in_buf);
+   if (len > MAX_STREAM_MSG_LEN)
+   {
+      return(-1);
+   }
+
+   if (in_len < STREAM_FRAME_HEADER_LEN + (int)len)
+   {
+      return(0);
+   }
+
+   *msg_len = len;
+
+   return(STREAM_FRAME_HEADER_LEN + len);
+}
+
@@ -0,0 +1,47 @@
+/*
+   wire_protocol.h
+
+   Project: OBD-II Monitor (On-Board Diagnostics)
+
+   Author: Derek Chadwick
+
+   Description: Binary server to client datagrams with scaled PID values.
+                Length prefixed framing for stream transports. Used by the
+                server and the GUI.
+
+   Date: 16/10/2026
+
+*/
+
+#ifndef OBD_WIRE_PROTOCOL_INCLUDED
+#define OBD_WIRE_PROTOCOL_INCLUDED
+
+#define WIRE_MAGIC_0 0xB0   /* Not ASCII, so text replies are never mistaken for binary. */
+#define WIRE_MAGIC_1 0xD2
+#define WIRE_VERSION 1
+#define WIRE_HEADER_LEN 16
+#define WIRE_SAMPLE_LEN 8
+#define MAX_WIRE_SAMPLES 24 /* Fits the 256 byte client receive buffer. */
+#define MAX_WIRE_DATAGRAM_LEN (WIRE_HEADER_LEN + (MAX_WIRE_SAMPLES * WIRE_SAMPLE_LEN))
+#define STREAM_FRAME_HEADER_LEN 4   /* Message length before each message on a stream transport. */
+#define MAX_STREAM_MSG_LEN 4096
+
+struct _Wire_Sample {
+   unsigned int pid_mode;
+   unsigned int pid_num;
+   long long timestamp_ms;
+   double value;
+};
+
+typedef struct _Wire_Sample Wire_Sample;
+
+/* wire_protocol.c */
+int is_wire_datagram(unsigned char *in_buf, int in_len);
+int get_wire_sample(char *ecu_reply, long long timestamp_ms, Wire_Sample *sample);
+int encode_wire_datagram(unsigned char *out_buf, int out_len, unsigned int sequence, Wire_Sample *samples, int count);
+int decode_wire_datagram(unsigned char *in_buf, int in_len, unsigned int *sequence, Wire_Sample *samples, int max_samples);
+int encode_stream_frame(unsigned char *out_buf, int out_len, void *msg, int msg_len);
+int get_stream_frame(unsigned char *in_buf, int in_len, int *msg_len);
+
+#endif
+